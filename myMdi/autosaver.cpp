@@ -0,0 +1,222 @@
+#include "autosaver.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+#include <QTextDocument>
+
+#include "mdichild.h"
+#include "recoverystore.h"
+
+static const int IdleInterval = 2000;        // 停止输入 2 秒后保存
+static const int MaxDelay = 30000;           // 持续输入时最多 30 秒保存一次
+static const int MinInterval = 5000;         // 两次保存之间至少间隔 5 秒
+static const int MaxPendingJobs = 8;         // 写入线程积压的任务过多时推迟保存
+static const qint64 CompactSlack = 1 << 20;  // 增量记录超过文档大小加 1MB 后改写为完整快照
+
+AutoSaveWriter::AutoSaveWriter(QAtomicInt* pending) : pendingJobs(pending) {}
+
+// 追加一条增量记录，新文件先写入文件头
+void AutoSaveWriter::writeDelta(const QString& fileName, const QByteArray& header, int position, int removed,
+                                const QString& text)
+{
+    QFile file(fileName);
+    if (file.open(QIODevice::WriteOnly | QIODevice::Append))
+    {
+        if (file.size() == 0)
+            file.write(header);
+        QDataStream out(&file);
+        out.setVersion(QDataStream::Qt_5_6);
+        out << RecoveryStore::DeltaRecord << qint32(position) << qint32(removed) << text;
+    }
+    pendingJobs->deref();
+}
+
+// 用完整快照替换整个恢复文件，QSaveFile 保证写入过程中崩溃不会损坏旧文件
+void AutoSaveWriter::writeFull(const QString& fileName, const QByteArray& header, const QString& text)
+{
+    QSaveFile file(fileName);
+    if (file.open(QIODevice::WriteOnly))
+    {
+        file.write(header);
+        QDataStream out(&file);
+        out.setVersion(QDataStream::Qt_5_6);
+        out << RecoveryStore::FullRecord << text;
+        file.commit();
+    }
+    pendingJobs->deref();
+}
+
+// 删除恢复文件
+void AutoSaveWriter::remove(const QString& fileName)
+{
+    QFile::remove(fileName);
+    pendingJobs->deref();
+}
+
+// 在之前提交的写入全部完成后停止写入线程
+void AutoSaveWriter::stop() { thread()->quit(); }
+
+AutoSaver::AutoSaver(QObject* parent) : QObject(parent)
+{
+    // 恢复文件以进程号开头，锁文件表明该进程还在运行
+    RecoveryStore::lock();
+
+    // 写入线程使用最低的优先级，不和界面线程争抢 CPU
+    writer = new AutoSaveWriter(&pendingJobs);
+    writer->moveToThread(&writerThread);
+    writerThread.start(QThread::LowestPriority);
+
+    idleTimer.setSingleShot(true);
+    idleTimer.setInterval(IdleInterval);
+    maxDelayTimer.setSingleShot(true);
+    maxDelayTimer.setInterval(MaxDelay);
+    connect(&idleTimer, SIGNAL(timeout()), this, SLOT(snapshotAll()));
+    connect(&maxDelayTimer, SIGNAL(timeout()), this, SLOT(snapshotAll()));
+}
+
+AutoSaver::~AutoSaver()
+{
+    // 等待已经提交的写入和删除完成，否则正常退出后会留下需要恢复的文件
+    QMetaObject::invokeMethod(writer, "stop", Qt::QueuedConnection);
+    writerThread.wait();
+    delete writer;
+}
+
+// 开始自动保存一个文档
+void AutoSaver::addDocument(MdiChild* child)
+{
+    QTextDocument* doc = child->document();
+    Entry& entry = entries[doc];
+    entry.child = child;
+    entry.fileName = RecoveryStore::path() + "/" + RecoveryStore::fileStem(doc) + ".autosave";
+    entry.header = RecoveryStore::header(QString());
+    entry.writtenBytes = 0;
+    resetEntry(entry);
+    connect(doc, SIGNAL(contentsChange(int, int, int)), this, SLOT(documentChanged(int, int, int)));
+    connect(doc, SIGNAL(destroyed(QObject*)), this, SLOT(documentDestroyed(QObject*)));
+    connect(child, SIGNAL(documentSynced()), this, SLOT(documentSynced()));
+}
+
+// 以当前文档为基准，清空更改区域
+void AutoSaver::resetEntry(Entry& entry)
+{
+    entry.region.clear();
+    entry.length = entry.child ? entry.child->document()->characterCount() - 1 : 0;
+}
+
+// 记录文档的更改区域，只做整数运算，不影响输入
+void AutoSaver::documentChanged(int position, int charsRemoved, int charsAdded)
+{
+    QHash<QTextDocument*, Entry>::iterator it = entries.find(static_cast<QTextDocument*>(sender()));
+    if (it == entries.end())
+        return;
+    it.value().region.merge(position, charsRemoved, charsAdded);
+    idleTimer.start();
+    if (!maxDelayTimer.isActive())
+        maxDelayTimer.start();
+}
+
+// 文档已与硬盘同步，之前的恢复文件不再需要，原文件成为新的基准
+void AutoSaver::documentSynced()
+{
+    MdiChild* child = qobject_cast<MdiChild*>(sender());
+    QHash<QTextDocument*, Entry>::iterator it = entries.find(child->document());
+    if (it == entries.end())
+        return;
+    Entry& entry = it.value();
+    if (entry.writtenBytes > 0)
+    {
+        pendingJobs.ref();
+        QMetaObject::invokeMethod(writer, "remove", Qt::QueuedConnection, Q_ARG(QString, entry.fileName));
+        entry.writtenBytes = 0;
+    }
+    entry.header = RecoveryStore::header(child->isNewFile() ? QString() : child->currentFile());
+    resetEntry(entry);
+}
+
+// 文档被关闭，不论是否保存，恢复文件都不再需要
+void AutoSaver::documentDestroyed(QObject* object)
+{
+    QHash<QTextDocument*, Entry>::iterator it = entries.find(static_cast<QTextDocument*>(object));
+    if (it == entries.end())
+        return;
+    if (it.value().writtenBytes > 0)
+    {
+        pendingJobs.ref();
+        QMetaObject::invokeMethod(writer, "remove", Qt::QueuedConnection, Q_ARG(QString, it.value().fileName));
+    }
+    entries.erase(it);
+}
+
+// 保存所有被更改的文档
+void AutoSaver::snapshotAll()
+{
+    // 限制保存频率，写入线程积压时也推迟保存，期间的更改会继续合并到更改区域中
+    if (lastSnapshot.isValid() && lastSnapshot.elapsed() < MinInterval)
+    {
+        idleTimer.start(MinInterval - lastSnapshot.elapsed());
+        return;
+    }
+    if (pendingJobs.load() > MaxPendingJobs)
+    {
+        idleTimer.start(IdleInterval);
+        return;
+    }
+    idleTimer.stop();
+    maxDelayTimer.stop();
+    for (QHash<QTextDocument*, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+    {
+        if (it.value().region.dirty)
+            snapshot(it.value());
+    }
+    lastSnapshot.start();
+}
+
+// 把一个文档的更改区域写入恢复文件，界面线程只负责取出更改区域的文本
+void AutoSaver::snapshot(Entry& entry)
+{
+    if (!entry.child)
+        return;
+    QTextDocument* doc = entry.child->document();
+    // 更改被撤销回与硬盘一致的状态，删除恢复文件
+    if (!doc->isModified())
+    {
+        if (entry.writtenBytes > 0)
+        {
+            pendingJobs.ref();
+            QMetaObject::invokeMethod(writer, "remove", Qt::QueuedConnection, Q_ARG(QString, entry.fileName));
+            entry.writtenBytes = 0;
+        }
+        resetEntry(entry);
+        return;
+    }
+    int length = doc->characterCount() - 1;
+    // 增量记录累计超过文档本身的大小时，改写为一个完整快照
+    bool full = entry.writtenBytes + qint64(entry.region.newEnd - entry.region.start) * 2
+                > qint64(length) * 2 + CompactSlack;
+    if (full)
+    {
+        entry.region.start = 0;
+        entry.region.newEnd = length;
+    }
+    int position, removed;
+    QString text = RecoveryStore::regionText(doc, entry.region, entry.length, &position, &removed);
+
+    pendingJobs.ref();
+    if (full)
+    {
+        QMetaObject::invokeMethod(writer, "writeFull", Qt::QueuedConnection, Q_ARG(QString, entry.fileName),
+                                  Q_ARG(QByteArray, entry.header), Q_ARG(QString, text));
+        entry.writtenBytes = qint64(text.size()) * 2;
+    }
+    else
+    {
+        QMetaObject::invokeMethod(writer, "writeDelta", Qt::QueuedConnection, Q_ARG(QString, entry.fileName),
+                                  Q_ARG(QByteArray, entry.header), Q_ARG(int, position), Q_ARG(int, removed),
+                                  Q_ARG(QString, text));
+        entry.writtenBytes += qint64(text.size()) * 2 + 16;
+    }
+    entry.region.clear();
+    entry.length = length;
+}
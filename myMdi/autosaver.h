@@ -0,0 +1,76 @@
+#ifndef AUTOSAVER_H
+#define AUTOSAVER_H
+
+class MdiChild;
+class QTextDocument;
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QThread>
+#include <QTimer>
+
+#include "editregion.h"
+
+// 在后台线程中写入恢复文件，所有写操作按提交顺序执行
+class AutoSaveWriter : public QObject
+{
+    Q_OBJECT
+private:
+    QAtomicInt* pendingJobs;  // 尚未完成的写入任务数，由 AutoSaver 用于限速
+
+public:
+    explicit AutoSaveWriter(QAtomicInt* pending);
+
+public slots:
+    void writeDelta(const QString& fileName, const QByteArray& header, int position, int removed,
+                    const QString& text);                                                    // 追加一条增量记录
+    void writeFull(const QString& fileName, const QByteArray& header, const QString& text);  // 重写为完整快照
+    void remove(const QString& fileName);                                                    // 删除恢复文件
+    void stop();                                                                             // 停止写入线程
+};
+
+// 自动保存：空闲时把被更改的文档写入恢复目录，异常退出后可以恢复未保存的内容
+//
+// 恢复文件以硬盘上的原文件为基准，每次快照只追加上次快照之后被更改的区域，
+// 因此在很大的文档中做一次小的更改，自动保存的代价只与更改的大小有关
+class AutoSaver : public QObject
+{
+    Q_OBJECT
+private:
+    struct Entry
+    {
+        QPointer<MdiChild> child;  // 文档所在的窗口
+        QString fileName;          // 恢复文件路径
+        QByteArray header;         // 恢复文件头，记录作为基准的原文件
+        EditRegion region;         // 上次快照之后的更改区域
+        int length;                // 上次快照时的文档长度
+        qint64 writtenBytes;       // 恢复文件已经写入的字节数
+    };
+
+    QHash<QTextDocument*, Entry> entries;  // 每个文档的自动保存状态
+    QThread writerThread;                  // 低优先级的写入线程
+    AutoSaveWriter* writer;                // 写入线程中的写入对象
+    QAtomicInt pendingJobs;                // 尚未完成的写入任务数
+    QTimer idleTimer;                      // 停止输入一段时间后保存
+    QTimer maxDelayTimer;                  // 持续输入时最长的保存间隔
+    QElapsedTimer lastSnapshot;            // 上次保存的时间，用于限速
+
+    void resetEntry(Entry& entry);  // 以当前文档为基准，清空更改区域
+    void snapshot(Entry& entry);    // 把一个文档的更改写入恢复文件
+
+public:
+    explicit AutoSaver(QObject* parent = 0);
+    ~AutoSaver();
+    void addDocument(MdiChild* child);  // 开始自动保存一个文档
+
+private slots:
+    void documentChanged(int position, int charsRemoved, int charsAdded);  // 记录文档的更改区域
+    void documentSynced();                                                 // 文档已与硬盘同步
+    void documentDestroyed(QObject* object);                               // 文档被关闭
+    void snapshotAll();                                                    // 保存所有被更改的文档
+};
+
+#endif  // AUTOSAVER_H
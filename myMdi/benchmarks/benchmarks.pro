@@ -0,0 +1,51 @@
+#-------------------------------------------------
+#
+# 加载、保存和编辑热点路径的基准测试，与编辑器分开构建：
+#   qmake && make && make check
+# 默认同时输出到控制台和 hotpaths.xml，也可以用 -o 指定其他格式，例如
+#   ./tst_hotpaths -o results.csv,csv
+# 默认只测试不超过 64MB 的文件，设置 MYMDI_BENCH_MAX_MB=1024 可以测试到 1GB
+#
+#-------------------------------------------------
+
+QT       += core gui widgets testlib
+
+TARGET = tst_hotpaths
+TEMPLATE = app
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += ..
+
+SOURCES += \
+        tst_hotpaths.cpp \
+    ../mdichild.cpp \
+    ../documentio.cpp \
+    ../encodingdetector.cpp \
+    ../gzipstream.cpp \
+    ../latencyhistogram.cpp \
+    ../lineending.cpp \
+    ../localhistory.cpp \
+    ../recoverystore.cpp \
+    ../textrope.cpp \
+    ../tracer.cpp \
+    ../undomanager.cpp
+
+HEADERS += \
+    ../mdichild.h \
+    ../documentio.h \
+    ../editregion.h \
+    ../encodingdetector.h \
+    ../gzipstream.h \
+    ../latencyhistogram.h \
+    ../lineending.h \
+    ../localhistory.h \
+    ../recoverystore.h \
+    ../textrope.h \
+    ../tracer.h \
+    ../undomanager.h
+
+# gzip 压缩的文件使用 zlib 边读边解压
+include(../zlib.pri)
@@ -0,0 +1,279 @@
+#include <QApplication>
+#include <QClipboard>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTextCursor>
+#include <QtTest>
+
+#include "localhistory.h"
+#include "mdichild.h"
+
+static const int DefaultMaxMegabytes = 64;      // 默认测试的最大文件，更大的文件需要设置 MYMDI_BENCH_MAX_MB
+static const int LongLineLength = 256 * 1024;   // longlines 文件每行的字符数
+static const int PasteLength = 64 * 1024;       // 粘贴测试每次粘贴的字符数
+static const char* const EndMarker = "MYMDI-BENCH-END";  // 文件末尾的标记，查找测试从文档开头查找它
+static const int Sizes[] = { 1, 16, 256, 1024 };         // 测试的文件大小，单位为 MB
+
+// 线性同余随机数，种子固定，每次运行生成的文件都相同
+static quint32 nextRandom(quint32* seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 16;
+}
+
+// 生成一行合成文本：ascii 是长短不一的英文单词，cjk 是中文，longlines 是压缩过的 JSON 那样的长行
+static QByteArray syntheticLine(const QString& kind, quint32* seed)
+{
+    static const char* const words[] = { "the", "editor", "document", "window", "buffer", "line", "quick",
+                                         "brown", "fox", "jumps", "over", "lazy", "dog", "value", "index" };
+    static const int wordCount = sizeof(words) / sizeof(words[0]);
+    QString line;
+    if (kind == "cjk")
+    {
+        int length = 10 + nextRandom(seed) % 60;
+        for (int i = 0; i < length; ++i)
+        {
+            // 常用汉字区间，偶尔插入标点
+            if (i % 12 == 11)
+                line += QChar(0xFF0C);
+            else
+                line += QChar(0x4E00 + nextRandom(seed) % 0x51A6);
+        }
+        line += QChar(0x3002);
+    }
+    else if (kind == "longlines")
+    {
+        while (line.size() < LongLineLength)
+            line += QString("\"%1\":%2,").arg(words[nextRandom(seed) % wordCount]).arg(nextRandom(seed));
+    }
+    else
+    {
+        int length = 20 + nextRandom(seed) % 80;
+        while (line.size() < length)
+        {
+            if (!line.isEmpty())
+                line += ' ';
+            line += words[nextRandom(seed) % wordCount];
+        }
+    }
+    line += '\n';
+    return line.toUtf8();
+}
+
+// 编辑器热点路径的基准测试：加载和保存 1MB 到 1GB 的合成文件（ASCII、中文、长行），
+// 以及在已经加载的文档中输入、粘贴、撤销和查找。文件在第一次用到时生成，之后的测试共用
+class HotPathBenchmark : public QObject
+{
+    Q_OBJECT
+private:
+    QTemporaryDir dir;             // 合成文件所在的临时目录
+    QMap<QString, QString> files;  // 已经生成的文件，按种类和大小索引
+    int maxMegabytes;              // 测试的最大文件
+
+    QString syntheticFile(const QString& kind, int megabytes);  // 生成或者取出合成文件
+    void addRows();                                             // 按种类和大小添加数据行
+    QString rowFile();                                          // 当前数据行的文件，超出上限时返回空
+    void placeCursor(MdiChild* child);                          // 把光标移到文档中间
+
+private slots:
+    void initTestCase();
+    void load_data() { addRows(); }
+    void load();
+    void save_data() { addRows(); }
+    void save();
+    void typing_data() { addRows(); }
+    void typing();
+    void paste_data() { addRows(); }
+    void paste();
+    void undoRedo_data() { addRows(); }
+    void undoRedo();
+    void search_data() { addRows(); }
+    void search();
+};
+
+void HotPathBenchmark::initTestCase()
+{
+    QVERIFY(dir.isValid());
+    // 保存后不在后台记录本地历史，保存的计时只包括编码和写入
+    LocalHistory::setRecording(false);
+    bool ok;
+    maxMegabytes = qEnvironmentVariableIntValue("MYMDI_BENCH_MAX_MB", &ok);
+    if (!ok)
+        maxMegabytes = DefaultMaxMegabytes;
+}
+
+// 按固定的种子生成文件，末尾加上查找测试用的标记。
+// 只在整行之后停止，不会把多字节字符截断，文件会比指定的大小稍大
+QString HotPathBenchmark::syntheticFile(const QString& kind, int megabytes)
+{
+    QString key = QString("%1-%2MB").arg(kind).arg(megabytes);
+    if (files.contains(key))
+        return files.value(key);
+    QString fileName = dir.filePath(key + ".txt");
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return QString();
+    quint32 seed = 12345;
+    qint64 target = qint64(megabytes) << 20;
+    qint64 written = 0;
+    QByteArray block;
+    while (written < target)
+    {
+        block.clear();
+        while (block.size() < (1 << 20))
+            block += syntheticLine(kind, &seed);
+        if (file.write(block) != block.size())
+            return QString();
+        written += block.size();
+    }
+    file.write(EndMarker);
+    file.write("\n");
+    if (!file.flush())
+        return QString();
+    files.insert(key, fileName);
+    return fileName;
+}
+
+void HotPathBenchmark::addRows()
+{
+    QTest::addColumn<QString>("kind");
+    QTest::addColumn<int>("megabytes");
+    QStringList kinds;
+    kinds << "ascii" << "cjk" << "longlines";
+    foreach (const QString& kind, kinds)
+    {
+        for (unsigned i = 0; i < sizeof(Sizes) / sizeof(Sizes[0]); ++i)
+            QTest::newRow(qPrintable(QString("%1-%2MB").arg(kind).arg(Sizes[i]))) << kind << Sizes[i];
+    }
+}
+
+QString HotPathBenchmark::rowFile()
+{
+    QFETCH(QString, kind);
+    QFETCH(int, megabytes);
+    if (megabytes > maxMegabytes)
+        return QString();
+    return syntheticFile(kind, megabytes);
+}
+
+void HotPathBenchmark::placeCursor(MdiChild* child)
+{
+    QTextCursor cursor = child->textCursor();
+    cursor.setPosition(child->document()->characterCount() / 2);
+    child->setTextCursor(cursor);
+}
+
+// 打开文件直到文本放入编辑器，包括读取、检测编码、解码和建立文本绳
+void HotPathBenchmark::load()
+{
+    QString fileName = rowFile();
+    if (fileName.isEmpty())
+        QSKIP("文件超出 MYMDI_BENCH_MAX_MB 的上限");
+    QBENCHMARK
+    {
+        MdiChild child;
+        QVERIFY(child.loadFile(fileName, true));
+    }
+}
+
+// 保存到另一个文件直到写入完成，包括编码、计算签名和替换原文件
+void HotPathBenchmark::save()
+{
+    QString fileName = rowFile();
+    if (fileName.isEmpty())
+        QSKIP("文件超出 MYMDI_BENCH_MAX_MB 的上限");
+    MdiChild child;
+    QVERIFY(child.loadFile(fileName, true));
+    QString target = dir.filePath("saved-" + QFileInfo(fileName).fileName());
+    QBENCHMARK
+    {
+        QVERIFY(child.saveFile(target, true));
+    }
+}
+
+// 在文档中间逐个输入字符，每个按键都经过撤销分组、更改区域和更改标志的处理
+void HotPathBenchmark::typing()
+{
+    QString fileName = rowFile();
+    if (fileName.isEmpty())
+        QSKIP("文件超出 MYMDI_BENCH_MAX_MB 的上限");
+    MdiChild child;
+    QVERIFY(child.loadFile(fileName, true));
+    child.show();
+    placeCursor(&child);
+    QBENCHMARK
+    {
+        QTest::keyClicks(&child, "the quick brown fox ");
+    }
+}
+
+// 在文档中间粘贴 64K 个字符
+void HotPathBenchmark::paste()
+{
+    QString fileName = rowFile();
+    if (fileName.isEmpty())
+        QSKIP("文件超出 MYMDI_BENCH_MAX_MB 的上限");
+    MdiChild child;
+    QVERIFY(child.loadFile(fileName, true));
+    QApplication::clipboard()->setText(child.snapshot().mid(0, PasteLength));
+    placeCursor(&child);
+    QBENCHMARK
+    {
+        child.paste();
+    }
+}
+
+// 撤销并恢复一次粘贴
+void HotPathBenchmark::undoRedo()
+{
+    QString fileName = rowFile();
+    if (fileName.isEmpty())
+        QSKIP("文件超出 MYMDI_BENCH_MAX_MB 的上限");
+    MdiChild child;
+    QVERIFY(child.loadFile(fileName, true));
+    QApplication::clipboard()->setText(child.snapshot().mid(0, PasteLength));
+    placeCursor(&child);
+    child.paste();
+    QVERIFY(child.isUndoAvailable());
+    QBENCHMARK
+    {
+        child.undo();
+        child.redo();
+    }
+}
+
+// 从文档开头查找只在末尾出现的标记，需要扫描整个文档
+void HotPathBenchmark::search()
+{
+    QString fileName = rowFile();
+    if (fileName.isEmpty())
+        QSKIP("文件超出 MYMDI_BENCH_MAX_MB 的上限");
+    MdiChild child;
+    QVERIFY(child.loadFile(fileName, true));
+    QBENCHMARK
+    {
+        child.moveCursor(QTextCursor::Start);
+        QVERIFY(child.find(EndMarker));
+    }
+}
+
+// 没有指定输出时，结果同时输出到控制台和 hotpaths.xml，便于比较前后两次的结果
+int main(int argc, char* argv[])
+{
+    // 没有显示器的构建机上也能运行
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+    // 本地历史和恢复文件写到测试专用的目录，不影响用户的数据
+    QStandardPaths::setTestModeEnabled(true);
+    QStringList arguments = app.arguments();
+    if (!arguments.contains("-o"))
+        arguments << "-o" << "-,txt" << "-o" << "hotpaths.xml,xml";
+    HotPathBenchmark benchmark;
+    return QTest::qExec(&benchmark, arguments);
+}
+
+#include "tst_hotpaths.moc"
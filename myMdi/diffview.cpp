@@ -0,0 +1,526 @@
+#include "diffview.h"
+
+#include <QHash>
+#include <QPainter>
+#include <QScrollBar>
+#include <algorithm>
+#include <string.h>
+
+static const int MaxEditCost = 2048;     // Myers 算法最多查找的编辑步数，超出时整段作为一处差异
+static const int MaxLineChars = 4096;    // 每行最多显示 4096 个字符，超长的行被截断
+
+DiffRequest::DiffRequest(const TextRope& leftSnapshot, const TextRope& rightSnapshot, int priority)
+    : IoRequest(priority), leftText(leftSnapshot), rightText(rightSnapshot)
+{
+}
+
+// 把每一行换成编号，相同的行编号相同。直接在文本绳的 UTF-8 叶子中查找换行符，
+// 只有跨越两个叶子的行和第一次出现的行才复制
+void DiffRequest::intern(const TextRope& text, QHash<QByteArray, int>* table, QVector<int>* lines)
+{
+    lines->reserve(int(text.lineCount()));
+    QByteArray carry;  // 跨越叶子的行已经取出的部分
+    QVector<QByteArray> chunks = text.chunks();
+    for (int i = 0; i <= chunks.size(); i++)
+    {
+        if (isCancelled())
+            return;
+        const char* p = i < chunks.size() ? chunks.at(i).constData() : 0;
+        const char* end = i < chunks.size() ? p + chunks.at(i).size() : 0;
+        while (p != end || i == chunks.size())
+        {
+            const char* newline = p ? static_cast<const char*>(memchr(p, '\n', size_t(end - p))) : 0;
+            if (!newline && i < chunks.size())
+            {
+                carry.append(p, int(end - p));
+                break;
+            }
+            // 最后一行没有换行符也算一行
+            QByteArray line;
+            if (!newline)
+                line = carry;
+            else if (carry.isEmpty())
+                line = QByteArray::fromRawData(p, int(newline - p));
+            else
+                line = carry.append(p, int(newline - p));
+            QHash<QByteArray, int>::const_iterator it = table->constFind(line);
+            if (it == table->constEnd())
+            {
+                int id = table->size();
+                table->insert(QByteArray(line.constData(), line.size()), id);
+                lines->append(id);
+            }
+            else
+            {
+                lines->append(it.value());
+            }
+            carry.clear();
+            if (!newline)
+                break;
+            p = newline + 1;
+        }
+    }
+}
+
+// 添加一处差异，与前一处首尾相连时合并为一处
+void DiffRequest::addHunk(int leftStart, int leftEnd, int rightStart, int rightEnd)
+{
+    if (leftStart == leftEnd && rightStart == rightEnd)
+        return;
+    if (!result.isEmpty())
+    {
+        DiffHunk& last = result.last();
+        if (last.leftStart + last.leftCount == leftStart && last.rightStart + last.rightCount == rightStart)
+        {
+            last.leftCount += leftEnd - leftStart;
+            last.rightCount += rightEnd - rightStart;
+            return;
+        }
+    }
+    DiffHunk hunk;
+    hunk.leftStart = leftStart;
+    hunk.leftCount = leftEnd - leftStart;
+    hunk.rightStart = rightStart;
+    hunk.rightCount = rightEnd - rightStart;
+    result.append(hunk);
+}
+
+// 用 Myers 算法求一段的最短编辑，编辑步数超过 MaxEditCost 时返回 false。
+// 每一步之前保存上一步各对角线走到的位置，找到终点后沿着这些位置倒推出编辑
+bool DiffRequest::myers(int leftStart, int leftEnd, int rightStart, int rightEnd)
+{
+    const int* a = left.constData() + leftStart;
+    const int* b = right.constData() + rightStart;
+    int n = leftEnd - leftStart;
+    int m = rightEnd - rightStart;
+    int max = qMin(n + m, MaxEditCost);
+    int offset = max + 1;
+    QVector<int> v(2 * max + 3, 0);  // v[offset + k] 为对角线 k 上走到的最远的 x
+    QVector<QVector<int> > trace;    // 第 d 项为第 d 步之前对角线 -d 到 d 上的位置
+    int cost = -1;
+    for (int d = 0; d <= max && cost < 0; d++)
+    {
+        if (isCancelled())
+            return true;
+        trace << v.mid(offset - d, 2 * d + 1);
+        for (int k = -d; k <= d; k += 2)
+        {
+            int x;
+            if (k == -d || (k != d && v.at(offset + k - 1) < v.at(offset + k + 1)))
+                x = v.at(offset + k + 1);
+            else
+                x = v.at(offset + k - 1) + 1;
+            int y = x - k;
+            while (x < n && y < m && a[x] == b[y])
+            {
+                x++;
+                y++;
+            }
+            v[offset + k] = x;
+            if (x >= n && y >= m)
+            {
+                cost = d;
+                break;
+            }
+        }
+    }
+    if (cost < 0)
+        return false;
+
+    // 从终点倒推，每一步是删除左边的一行或者插入右边的一行
+    QVector<int> edits;  // 倒序的编辑：删除时为 x，插入时为 -(y + 1)
+    int x = n;
+    int y = m;
+    for (int d = cost; d > 0; d--)
+    {
+        const QVector<int>& previous = trace.at(d);
+        int k = x - y;
+        bool down = (k == -d || (k != d && previous.at(k - 1 + d) < previous.at(k + 1 + d)));
+        int previousK = down ? k + 1 : k - 1;
+        int previousX = previous.at(previousK + d);
+        int previousY = previousX - previousK;
+        edits << (down ? -(previousY + 1) : previousX);
+        x = previousX;
+        y = previousY;
+    }
+    // 按顺序重放编辑，编辑之间是两边相同的行，相连的编辑在 addHunk() 中合并
+    x = 0;
+    y = 0;
+    for (int i = edits.size() - 1; i >= 0; i--)
+    {
+        int edit = edits.at(i);
+        int targetX = edit >= 0 ? edit : x;
+        int targetY = edit >= 0 ? y : -edit - 1;
+        // 编辑之前相同的行
+        int same = edit >= 0 ? targetX - x : targetY - y;
+        x += same;
+        y += same;
+        if (edit >= 0)
+        {
+            addHunk(leftStart + x, leftStart + x + 1, rightStart + y, rightStart + y);
+            x++;
+        }
+        else
+        {
+            addHunk(leftStart + x, leftStart + x, rightStart + y, rightStart + y + 1);
+            y++;
+        }
+    }
+    return true;
+}
+
+// 先把两边的每一行换成编号，再逐段比较。待比较的段放在栈中，按行号从前往后处理，差异按顺序产生
+void DiffRequest::run()
+{
+    QHash<QByteArray, int> table;
+    intern(leftText, &table, &left);
+    setProgress(left.size(), qint64(leftText.lineCount() + rightText.lineCount()) * 2);
+    intern(rightText, &table, &right);
+    if (isCancelled())
+        return;
+    int ids = table.size();
+    table.clear();
+    leftText = TextRope();
+    rightText = TextRope();
+
+    struct Range
+    {
+        int leftStart, leftEnd, rightStart, rightEnd;
+    };
+    qint64 total = qint64(left.size() + right.size());
+    QVector<int> leftCount(ids), rightCount(ids), leftPosition(ids);
+    QVector<Range> stack;
+    Range whole = {0, left.size(), 0, right.size()};
+    stack << whole;
+    while (!stack.isEmpty())
+    {
+        if (isCancelled())
+            return;
+        Range range = stack.last();
+        stack.removeLast();
+        setProgress(total + range.leftStart + range.rightStart, total * 2);
+        // 去掉首尾相同的行
+        while (range.leftStart < range.leftEnd && range.rightStart < range.rightEnd
+               && left.at(range.leftStart) == right.at(range.rightStart))
+        {
+            range.leftStart++;
+            range.rightStart++;
+        }
+        while (range.leftStart < range.leftEnd && range.rightStart < range.rightEnd
+               && left.at(range.leftEnd - 1) == right.at(range.rightEnd - 1))
+        {
+            range.leftEnd--;
+            range.rightEnd--;
+        }
+        if (range.leftStart == range.leftEnd || range.rightStart == range.rightEnd)
+        {
+            addHunk(range.leftStart, range.leftEnd, range.rightStart, range.rightEnd);
+            continue;
+        }
+
+        // 按右边的顺序取出两边都只出现一次的行
+        for (int i = range.leftStart; i < range.leftEnd; i++)
+        {
+            leftCount[left.at(i)]++;
+            leftPosition[left.at(i)] = i;
+        }
+        for (int j = range.rightStart; j < range.rightEnd; j++)
+            rightCount[right.at(j)]++;
+        QVector<int> unique;
+        for (int j = range.rightStart; j < range.rightEnd; j++)
+        {
+            int id = right.at(j);
+            if (leftCount.at(id) == 1 && rightCount.at(id) == 1)
+                unique << j;
+        }
+        for (int i = range.leftStart; i < range.leftEnd; i++)
+            leftCount[left.at(i)] = 0;
+        for (int j = range.rightStart; j < range.rightEnd; j++)
+            rightCount[right.at(j)] = 0;
+
+        // 这些行在左边的位置的最长递增子序列就是两边顺序一致的锚点，用耐心排序求出
+        QVector<int> tails;                      // 长度为 i + 1 的递增子序列的最后一项在 unique 中的下标
+        QVector<int> previous(unique.size());   // 子序列中前一项在 unique 中的下标
+        QVector<int> tailPositions;              // tails 各项在左边的位置，用于二分查找
+        for (int u = 0; u < unique.size(); u++)
+        {
+            int position = leftPosition.at(right.at(unique.at(u)));
+            int length = int(std::lower_bound(tailPositions.begin(), tailPositions.end(), position) - tailPositions.begin());
+            previous[u] = length > 0 ? tails.at(length - 1) : -1;
+            if (length == tails.size())
+            {
+                tails << u;
+                tailPositions << position;
+            }
+            else
+            {
+                tails[length] = u;
+                tailPositions[length] = position;
+            }
+        }
+        if (tails.isEmpty())
+        {
+            // 没有锚点时用 Myers 算法，编辑太多时整段作为一处差异
+            if (!myers(range.leftStart, range.leftEnd, range.rightStart, range.rightEnd))
+                addHunk(range.leftStart, range.leftEnd, range.rightStart, range.rightEnd);
+            continue;
+        }
+        // 锚点之间的各段倒序压入栈中，最前面的一段最先处理
+        int leftEnd = range.leftEnd;
+        int rightEnd = range.rightEnd;
+        for (int u = tails.last(); u >= 0; u = previous.at(u))
+        {
+            int j = unique.at(u);
+            int i = leftPosition.at(right.at(j));
+            Range gap = {i + 1, leftEnd, j + 1, rightEnd};
+            stack << gap;
+            leftEnd = i;
+            rightEnd = j;
+        }
+        Range first = {range.leftStart, leftEnd, range.rightStart, rightEnd};
+        stack << first;
+    }
+}
+
+DiffView::DiffView(QWidget* parent) : QAbstractScrollArea(parent)
+{
+    setAttribute(Qt::WA_DeleteOnClose);
+    rowCount = 0;
+    currentHunk = -1;
+    widest = 0;
+    // 等宽字体，两边的行对齐
+    QFont font("Courier New");
+    font.setStyleHint(QFont::TypeWriter);
+    setFont(font);
+    viewport()->setBackgroundRole(QPalette::Base);
+    setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
+}
+
+DiffView::~DiffView()
+{
+    if (request)
+        request->cancel();
+}
+
+// 在后台比较两个文档，文本是调用时的快照，之后的编辑不影响比较的结果
+void DiffView::compare(const QString& leftFile, const TextRope& leftSnapshot, const QString& rightFile,
+                       const TextRope& rightSnapshot)
+{
+    if (request)
+        request->cancel();
+    leftName = leftFile;
+    rightName = rightFile;
+    leftText = leftSnapshot;
+    rightText = rightSnapshot;
+    hunks.clear();
+    hunkRows.clear();
+    rowCount = 0;
+    currentHunk = -1;
+    DiffRequest* diff = new DiffRequest(leftSnapshot, rightSnapshot, DocumentIo::Active);
+    request = diff;
+    connect(diff, SIGNAL(progress(qint64, qint64)), this, SLOT(compareProgress(qint64, qint64)));
+    connect(diff, SIGNAL(finished()), this, SLOT(requestFinished()));
+    DocumentIo::instance()->submit(diff);
+    updateTitle(0);
+    updateScrollBars();
+    viewport()->update();
+}
+
+// 显示的行对应两边的行号，这一边没有对应的行时为 -1。
+// 二分查找这一行之前的最后一处差异，差异之内是更改的行，之后是两边相同的行
+void DiffView::rowLines(int row, int* leftLine, int* rightLine, bool* changed) const
+{
+    int index = int(std::upper_bound(hunkRows.constBegin(), hunkRows.constEnd(), row) - hunkRows.constBegin()) - 1;
+    *changed = false;
+    if (index < 0)
+    {
+        *leftLine = row;
+        *rightLine = row;
+        return;
+    }
+    const DiffHunk& hunk = hunks.at(index);
+    int offset = row - hunkRows.at(index);
+    int size = qMax(hunk.leftCount, hunk.rightCount);
+    if (offset < size)
+    {
+        *leftLine = offset < hunk.leftCount ? hunk.leftStart + offset : -1;
+        *rightLine = offset < hunk.rightCount ? hunk.rightStart + offset : -1;
+        *changed = true;
+        return;
+    }
+    offset -= size;
+    *leftLine = hunk.leftStart + hunk.leftCount + offset;
+    *rightLine = hunk.rightStart + hunk.rightCount + offset;
+}
+
+// 从文本绳中取出一行的文本，O(log n)
+QString DiffView::lineText(const TextRope& text, int line) const
+{
+    qint64 start = text.lineStart(line);
+    qint64 end = text.lineStart(line + 1);
+    QString result = text.mid(start, qMin(end - start, qint64(MaxLineChars)));
+    if (result.endsWith(QLatin1Char('\n')))
+        result.chop(1);
+    else if (end - start > MaxLineChars)
+        result += QChar(0x2026);
+    result.replace(QLatin1Char('\t'), QLatin1String("    "));
+    return result;
+}
+
+// 可以显示的行数
+int DiffView::visibleRowCount() const { return qMax(1, viewport()->height() / fontMetrics().lineSpacing()); }
+
+// 垂直滚动条按行滚动，水平滚动条按像素滚动，范围是显示过的最宽的行
+void DiffView::updateScrollBars()
+{
+    int rows = visibleRowCount();
+    verticalScrollBar()->setRange(0, qMax(0, rowCount - rows));
+    verticalScrollBar()->setPageStep(rows);
+    int half = viewport()->width() / 2;
+    horizontalScrollBar()->setRange(0, qMax(0, widest - half));
+    horizontalScrollBar()->setPageStep(half);
+    horizontalScrollBar()->setSingleStep(fontMetrics().width(QLatin1Char(' ')) * 4);
+}
+
+// 左右两栏分别显示两边的行。更改的行左边用红色、右边用绿色作为背景，没有对应的行用灰色填充，
+// 当前定位到的差异颜色更深
+void DiffView::paintEvent(QPaintEvent*)
+{
+    QPainter painter(viewport());
+    QFontMetrics metrics = fontMetrics();
+    int lineHeight = metrics.lineSpacing();
+    int half = viewport()->width() / 2;
+    int space = metrics.width(QLatin1Char(' '));
+    int gutter = metrics.width(QString::number(qMax(leftText.lineCount(), rightText.lineCount()))) + space * 2;
+    int top = verticalScrollBar()->value();
+    int dx = horizontalScrollBar()->value();
+    int current = currentHunk >= 0 ? hunkRows.at(currentHunk) : -1;
+    int currentEnd = currentHunk >= 0 ? current + qMax(hunks.at(currentHunk).leftCount, hunks.at(currentHunk).rightCount) : -1;
+    int oldWidest = widest;
+    for (int i = 0; i <= visibleRowCount() && top + i < rowCount; i++)
+    {
+        int row = top + i;
+        int y = i * lineHeight;
+        int lines[2];
+        bool changed;
+        rowLines(row, &lines[0], &lines[1], &changed);
+        bool isCurrent = row >= current && row < currentEnd;
+        for (int side = 0; side < 2; side++)
+        {
+            QRect area(side * half, y, half, lineHeight);
+            painter.setClipRect(area);
+            if (changed)
+            {
+                QColor color = lines[side] < 0 ? palette().color(QPalette::Window)
+                                               : (side == 0 ? QColor(255, 224, 224) : QColor(224, 255, 224));
+                painter.fillRect(area, isCurrent ? color.darker(115) : color);
+            }
+            if (lines[side] < 0)
+                continue;
+            QString text = lineText(side == 0 ? leftText : rightText, lines[side]);
+            widest = qMax(widest, gutter + metrics.width(text));
+            painter.setPen(palette().color(QPalette::Dark));
+            painter.drawText(area.left(), y, gutter - space * 2, lineHeight, Qt::AlignRight | Qt::AlignVCenter,
+                             QString::number(lines[side] + 1));
+            painter.setClipRect(area.adjusted(gutter, 0, 0, 0));
+            painter.setPen(palette().color(QPalette::Text));
+            painter.drawText(area.left() + gutter - dx, y, widest, lineHeight, Qt::AlignLeft | Qt::AlignVCenter, text);
+        }
+    }
+    painter.setClipping(false);
+    painter.setPen(palette().color(QPalette::Mid));
+    painter.drawLine(half, 0, half, viewport()->height());
+    // 出现了更宽的行时扩大水平滚动的范围
+    if (widest != oldWidest)
+        updateScrollBars();
+}
+
+void DiffView::resizeEvent(QResizeEvent* event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    updateScrollBars();
+}
+
+// 两边只有一组滚动条，滚动时整体重绘
+void DiffView::scrollContentsBy(int, int) { viewport()->update(); }
+
+// 定位到一处差异，显示在窗口上部三分之一处
+void DiffView::showHunk(int index)
+{
+    if (index < 0 || index >= hunks.size())
+        return;
+    currentHunk = index;
+    verticalScrollBar()->setValue(hunkRows.at(index) - visibleRowCount() / 3);
+    viewport()->update();
+}
+
+// 定位到下一处差异：当前的差异不在窗口中时，从窗口的第一行开始找
+void DiffView::nextHunk()
+{
+    int top = verticalScrollBar()->value();
+    bool visible = currentHunk >= 0 && hunkRows.at(currentHunk) >= top && hunkRows.at(currentHunk) < top + visibleRowCount();
+    if (visible)
+        showHunk(currentHunk + 1);
+    else
+        showHunk(int(std::lower_bound(hunkRows.constBegin(), hunkRows.constEnd(), top) - hunkRows.constBegin()));
+}
+
+// 定位到上一处差异
+void DiffView::previousHunk()
+{
+    int top = verticalScrollBar()->value();
+    bool visible = currentHunk >= 0 && hunkRows.at(currentHunk) >= top && hunkRows.at(currentHunk) < top + visibleRowCount();
+    if (visible)
+        showHunk(currentHunk - 1);
+    else
+        showHunk(int(std::lower_bound(hunkRows.constBegin(), hunkRows.constEnd(), top) - hunkRows.constBegin()) - 1);
+}
+
+// 在标题中显示比较的进度，比较结束后显示差异的数量
+void DiffView::updateTitle(int percent)
+{
+    QString title = tr("比较 %1 与 %2").arg(leftName).arg(rightName);
+    if (percent >= 0)
+        title += tr(" (比较中 %1%)").arg(percent);
+    else
+        title += tr(" (%1 处差异)").arg(hunks.size());
+    setWindowTitle(title);
+}
+
+// 比较的进度
+void DiffView::compareProgress(qint64 processed, qint64 total)
+{
+    if (sender() == request.data())
+        updateTitle(total > 0 ? int(processed * 100 / total) : 100);
+}
+
+// 比较结束，计算每处差异在显示中的位置
+void DiffView::requestFinished()
+{
+    DiffRequest* diff = qobject_cast<DiffRequest*>(sender());
+    if (!diff || diff != request)
+        return;
+    request = 0;
+    if (diff->wasCancelled() || !diff->errorString().isEmpty())
+    {
+        emit compareFinished(false);
+        return;
+    }
+    hunks = diff->hunks();
+    hunkRows.clear();
+    hunkRows.reserve(hunks.size());
+    int row = 0;
+    int leftLine = 0;
+    foreach (const DiffHunk& hunk, hunks)
+    {
+        row += hunk.leftStart - leftLine;
+        hunkRows << row;
+        row += qMax(hunk.leftCount, hunk.rightCount);
+        leftLine = hunk.leftStart + hunk.leftCount;
+    }
+    rowCount = row + int(leftText.lineCount()) - leftLine;
+    updateTitle(-1);
+    updateScrollBars();
+    viewport()->update();
+    emit compareFinished(true);
+}
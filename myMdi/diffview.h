@@ -0,0 +1,94 @@
+#ifndef DIFFVIEW_H
+#define DIFFVIEW_H
+
+#include <QAbstractScrollArea>
+#include <QPointer>
+#include <QVector>
+
+#include "documentio.h"
+#include "textrope.h"
+
+// 一处差异：左边从 leftStart 开始的 leftCount 行被替换为右边从 rightStart 开始的 rightCount 行，行号从 0 开始
+struct DiffHunk
+{
+    int leftStart;   // 左边的第一行
+    int leftCount;   // 左边的行数，为 0 时是右边插入的行
+    int rightStart;  // 右边的第一行
+    int rightCount;  // 右边的行数，为 0 时是左边删除的行
+};
+
+// 在 I/O 线程中逐行比较两段文本。每一行先换成整数编号，相同的行编号相同，之后只比较整数。
+// 先去掉首尾相同的行，再用两边都只出现一次的行作为锚点（patience diff），锚点之间的小段用 Myers 算法，
+// 大量重复的行不会让 Myers 算法退化到平方级
+class DiffRequest : public IoRequest
+{
+    Q_OBJECT
+private:
+    TextRope leftText;          // 左边文本的快照
+    TextRope rightText;         // 右边文本的快照
+    QVector<int> left;          // 左边每一行的编号
+    QVector<int> right;         // 右边每一行的编号
+    QVector<DiffHunk> result;   // 按行号排列的差异
+
+    void intern(const TextRope& text, QHash<QByteArray, int>* table, QVector<int>* lines);  // 把每一行换成编号
+    void addHunk(int leftStart, int leftEnd, int rightStart, int rightEnd);  // 添加一处差异，与前一处相连时合并
+    bool myers(int leftStart, int leftEnd, int rightStart, int rightEnd);    // 用 Myers 算法比较一段
+
+protected:
+    void run();
+
+public:
+    DiffRequest(const TextRope& leftSnapshot, const TextRope& rightSnapshot, int priority);
+    QVector<DiffHunk> hunks() const { return result; }  // 按行号排列的差异
+};
+
+// 并排显示两个文档的差异：两边按行对齐，一边多出的行在另一边留空，只有一个滚动条，两边同步滚动。
+// 显示的行按差异的位置二分查找对应到两边的行号，只取出可见的行，文档很大时也不占用额外的内存
+class DiffView : public QAbstractScrollArea
+{
+    Q_OBJECT
+private:
+    TextRope leftText;                 // 左边文本的快照
+    TextRope rightText;                // 右边文本的快照
+    QString leftName;                  // 左边的文件名
+    QString rightName;                 // 右边的文件名
+    QVector<DiffHunk> hunks;           // 按行号排列的差异
+    QVector<int> hunkRows;             // 每处差异在显示中的第一行
+    int rowCount;                      // 显示的总行数
+    int currentHunk;                   // 当前定位到的差异，没有时为 -1
+    int widest;                        // 显示过的最宽的行，用于设置水平滚动条
+    QPointer<DiffRequest> request;     // 正在进行的比较
+
+    void rowLines(int row, int* leftLine, int* rightLine, bool* changed) const;  // 显示的行对应两边的行号
+    QString lineText(const TextRope& text, int line) const;  // 取出一行的文本
+    int visibleRowCount() const;                             // 可以显示的行数
+    void updateScrollBars();                                 // 根据总行数设置滚动条
+    void showHunk(int index);                                // 定位到一处差异
+    void updateTitle(int percent);                           // 在标题中显示比较的进度
+
+protected:
+    void paintEvent(QPaintEvent* event);
+    void resizeEvent(QResizeEvent* event);
+    void scrollContentsBy(int dx, int dy);
+
+public:
+    explicit DiffView(QWidget* parent = 0);
+    ~DiffView();
+    void compare(const QString& leftFile, const TextRope& leftSnapshot, const QString& rightFile,
+                 const TextRope& rightSnapshot);  // 在后台比较两个文档
+    int hunkCount() const { return hunks.size(); }  // 差异的数量
+    bool isComparing() const { return !request.isNull(); }  // 是否正在比较
+
+public slots:
+    void nextHunk();      // 定位到下一处差异
+    void previousHunk();  // 定位到上一处差异
+
+signals:
+    void compareFinished(bool ok);  // 比较结束
+
+private slots:
+    void compareProgress(qint64 processed, qint64 total);  // 比较的进度
+    void requestFinished();                                // 比较结束
+};
+
+#endif  // DIFFVIEW_H
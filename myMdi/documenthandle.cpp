@@ -0,0 +1,13 @@
+#include "documenthandle.h"
+
+#include <QFileInfo>
+
+// 路径和标题与加载后的编辑器相同，窗口菜单和查找已打开的文件不需要区分两者
+DocumentHandle::DocumentHandle(const QString& fileName, int cursorPosition, QWidget* parent)
+    : QWidget(parent), cursor(cursorPosition)
+{
+    setAttribute(Qt::WA_DeleteOnClose);
+    path = QFileInfo(fileName).canonicalFilePath();
+    setWindowFilePath(path);
+    setWindowTitle(QFileInfo(path).fileName() + "[*]");
+}
@@ -0,0 +1,22 @@
+#ifndef DOCUMENTHANDLE_H
+#define DOCUMENTHANDLE_H
+
+#include <QWidget>
+
+// 标签页模式下还没有编辑器的文档：只记录文件路径和光标位置，没有 QTextDocument、撤销记录，
+// 也不参与自动保存和编辑日志。标签页被激活时才换成 MdiChild，较久未使用的编辑器再换回句柄，
+// 一次打开上千个文件时，编辑器的数量只取决于最近使用的标签页
+class DocumentHandle : public QWidget
+{
+    Q_OBJECT
+private:
+    QString path;  // 文件路径
+    int cursor;    // 换成编辑器后恢复的光标位置
+
+public:
+    explicit DocumentHandle(const QString& fileName, int cursorPosition = 0, QWidget* parent = 0);
+    QString fileName() const { return path; }        // 文件路径
+    int cursorPosition() const { return cursor; }    // 换成编辑器后恢复的光标位置
+};
+
+#endif  // DOCUMENTHANDLE_H
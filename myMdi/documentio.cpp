@@ -0,0 +1,898 @@
+#include "documentio.h"
+
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QScopedPointer>
+#include <QTextCodec>
+
+#include <string.h>
+
+#include "encodingdetector.h"
+#include "gzipstream.h"
+#include "localhistory.h"
+#include "tracer.h"
+
+static const qint64 ChunkSize = 1 << 20;  // 每次读写 1MB，之间检查是否被取消并报告进度
+static const int TailHeadSize = 64;       // 跟踪文件时比较开头的字节数，用于发现日志轮转
+static const int InflateChunkSize = 4 << 20;  // 压缩文件每解压 4MB 解码并显示一次
+static const qint64 BinarySample = 64 << 10;  // 判断是否为二进制文件时检查开头的 64KB
+
+// 块的 64 位哈希值：每次混入 8 个字节，比逐字节计算快得多。只用来比较同一个文件的前后两个版本，不需要抗碰撞
+static quint64 blockHash(const char* data, int size)
+{
+    quint64 hash = Q_UINT64_C(0x9e3779b97f4a7c15) ^ quint64(size);
+    int i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        quint64 word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * Q_UINT64_C(0xff51afd7ed558ccd);
+        hash ^= hash >> 32;
+    }
+    quint64 tail = 0;
+    memcpy(&tail, data + i, size - i);
+    hash = (hash ^ tail) * Q_UINT64_C(0xc4ceb9fe1a85ec53);
+    return hash ^ (hash >> 29);
+}
+
+// 一段字节中 \n 的个数
+static qint64 countNewlines(const char* data, qint64 size)
+{
+    qint64 count = 0;
+    const char* end = data + size;
+    while ((data = static_cast<const char*>(memchr(data, '\n', end - data))))
+    {
+        count++;
+        data++;
+    }
+    return count;
+}
+
+// 检测编码并解码整个文件，BOM 由这里跳过，检测结果记录到 format。
+// 解码后先释放 data 再转换换行符，编辑器中统一使用 \n
+static QString decodeText(QByteArray* data, TextFormat* format)
+{
+    EncodingDetector::Result detected = EncodingDetector::detect(data->constData(), data->size());
+    QTextCodec* codec = QTextCodec::codecForName(detected.codecName);
+    if (!codec)
+    {
+        codec = QTextCodec::codecForLocale();
+        detected.bomLength = 0;
+    }
+    format->encoding = codec->name();
+    format->bom = detected.bomLength > 0;
+    QTextCodec::ConverterState state(QTextCodec::IgnoreHeader);
+    QString text = codec->toUnicode(data->constData() + detected.bomLength, data->size() - detected.bomLength, &state);
+    data->clear();
+    format->lineEnding = LineEnding::normalize(&text, &format->mixedLineEndings);
+    return text;
+}
+
+// 只有大小和修改时间的签名
+FileSignature FileSignature::stat(const QFileInfo& info)
+{
+    FileSignature signature;
+    if (info.exists())
+    {
+        signature.size = info.size();
+        signature.modified = info.lastModified();
+    }
+    return signature;
+}
+
+// 大小和修改时间是否与文件现在的相同
+bool FileSignature::matches(const QFileInfo& info) const
+{
+    return isValid() && info.exists() && size == info.size() && modified == info.lastModified();
+}
+
+// 各块是否都相同，没有记录哈希值时无法判断
+bool FileSignature::sameBlocks(const FileSignature& other) const
+{
+    return hashed && other.hashed && lengths == other.lengths && hashes == other.hashes;
+}
+
+// 开头和末尾相同的块的字节数，两部分不会重叠
+void FileSignature::commonBlocks(const FileSignature& other, qint64* prefix, qint64* suffix) const
+{
+    *prefix = 0;
+    *suffix = 0;
+    if (!hashed || !other.hashed)
+        return;
+    int count = qMin(lengths.size(), other.lengths.size());
+    int head = 0;
+    while (head < count && lengths.at(head) == other.lengths.at(head) && hashes.at(head) == other.hashes.at(head))
+        *prefix += lengths.at(head++);
+    int tail = 0;
+    while (head + tail < count)
+    {
+        int i = lengths.size() - 1 - tail;
+        int j = other.lengths.size() - 1 - tail;
+        if (lengths.at(i) != other.lengths.at(j) || hashes.at(i) != other.hashes.at(j))
+            break;
+        *suffix += lengths.at(i);
+        tail++;
+    }
+}
+
+// 按内容切分 pending 并计算各块的哈希值，块的边界与本地历史的相同。
+// last 为 false 时末尾没有找到边界的部分留给下一次
+int SignatureBuilder::hashBlocks(bool last)
+{
+    int start = 0;
+    while (start < pending.size())
+    {
+        int length = LocalHistory::findBoundary(pending.constData() + start, pending.size() - start);
+        if (length < 0)
+        {
+            if (!last)
+                break;
+            length = pending.size() - start;
+        }
+        signature.lengths.append(length);
+        signature.hashes.append(blockHash(pending.constData() + start, length));
+        start += length;
+    }
+    return start;
+}
+
+// 输入一段内容。只复制末尾不完整的一块，整个文件一次输入时不会再复制一份
+void SignatureBuilder::addData(const QByteArray& data)
+{
+    pending += data;
+    pending = pending.mid(hashBlocks(false));
+}
+
+// 输入结束。大小和修改时间在读取之前取得，读取期间文件又被修改时，下一次检查会发现修改时间不同
+FileSignature SignatureBuilder::finish(const FileSignature& fileStat)
+{
+    hashBlocks(true);
+    pending.clear();
+    FileSignature result = signature;
+    result.size = fileStat.size;
+    result.modified = fileStat.modified;
+    result.hashed = true;
+    return result;
+}
+
+// I/O 线程，不断从服务中取出请求执行，服务停止时退出
+class IoThread : public QThread
+{
+private:
+    DocumentIo* service;
+
+protected:
+    void run()
+    {
+        while (IoRequest* request = service->takeRequest())
+        {
+            if (!request->isCancelled())
+            {
+                // 事件名称是请求的类名，以后新增的搜索、高亮等后台请求也会出现在跟踪中
+                TraceScope trace(request->metaObject()->className());
+                request->run();
+            }
+            service->release(request);
+            request->finish();
+        }
+    }
+
+public:
+    explicit IoThread(DocumentIo* io) : service(io) {}
+};
+
+IoRequest::IoRequest(int priority)
+{
+    requestPriority = priority;
+    sequence = 0;
+    done = false;
+    lastReported = -1;
+}
+
+// 在 I/O 线程中标记完成，唤醒等待的线程，并在界面线程中发射 finished()
+void IoRequest::finish()
+{
+    QMetaObject::invokeMethod(this, "complete", Qt::QueuedConnection);
+    QMutexLocker locker(&doneMutex);
+    done = true;
+    doneCondition.wakeAll();
+}
+
+// 是否已被取消
+bool IoRequest::isCancelled() const { return cancelled.load() != 0; }
+
+// 报告进度，每处理 1MB 最多报告一次
+void IoRequest::setProgress(qint64 processed, qint64 total)
+{
+    if (lastReported >= 0 && processed - lastReported < ChunkSize && processed != total)
+        return;
+    lastReported = processed;
+    QMetaObject::invokeMethod(this, "reportProgress", Qt::QueuedConnection, Q_ARG(qint64, processed),
+                              Q_ARG(qint64, total));
+}
+
+// 文件超过编辑器能打开的大小时的出错信息
+static QString tooLargeError()
+{
+    return IoRequest::tr("文件超过 %1 MB，无法在编辑器中打开，请用只读的大文件查看器查看").arg(DocumentIo::MaxEditorFileSize >> 20);
+}
+
+// 分块读取整个文件，之间检查是否被取消并报告进度。
+// QByteArray 的大小是 int，太大的文件直接报错，不分配缓冲区
+bool IoRequest::readAll(QFile& file, QByteArray* data)
+{
+    qint64 total = file.size();
+    if (total > DocumentIo::MaxEditorFileSize)
+    {
+        error = tooLargeError();
+        return false;
+    }
+    data->resize(int(total));
+    qint64 offset = 0;
+    while (offset < total)
+    {
+        if (isCancelled())
+            return false;
+        qint64 count = file.read(data->data() + offset, qMin(ChunkSize, total - offset));
+        if (count <= 0)
+            break;
+        offset += count;
+        setProgress(offset, total);
+    }
+    if (file.error() != QFile::NoError)
+    {
+        error = file.errorString();
+        return false;
+    }
+    data->resize(int(offset));
+    // 读取期间文件变长，或者文件大小未知时，读出剩余的内容
+    if (!file.atEnd())
+        data->append(file.read(DocumentIo::MaxEditorFileSize - offset + 1));
+    if (data->size() > DocumentIo::MaxEditorFileSize)
+    {
+        data->clear();
+        error = tooLargeError();
+        return false;
+    }
+    return true;
+}
+
+// 调整尚未开始执行的请求的优先级
+void IoRequest::setPriority(int priority) { DocumentIo::instance()->reprioritize(this, priority); }
+
+// 取消请求：还在队列中的请求直接结束，正在执行的请求在下一次检查时结束
+void IoRequest::cancel()
+{
+    cancelled.store(1);
+    if (DocumentIo::instance()->dequeue(this))
+        finish();
+}
+
+// 阻塞等待 run() 结束，用于必须立即得到结果的场合，例如关闭窗口前保存
+void IoRequest::waitForFinished()
+{
+    QMutexLocker locker(&doneMutex);
+    while (!done)
+        doneCondition.wait(&doneMutex);
+}
+
+// 在界面线程中发射 progress()
+void IoRequest::reportProgress(qint64 processed, qint64 total) { emit progress(processed, total); }
+
+// 在界面线程中发射 finished() 并删除自己
+void IoRequest::complete()
+{
+    emit finished();
+    deleteLater();
+}
+
+FileReadRequest::FileReadRequest(const QString& fileName, int priority, bool streamText)
+    : IoRequest(priority), path(fileName), streaming(streamText)
+{
+    detectedFormat.bom = false;
+    detectedFormat.lineEnding = LineEnding::platformDefault();
+    detectedFormat.mixedLineEndings = false;
+    detectedFormat.compressed = false;
+    bytesRead = 0;
+    binary = false;
+}
+
+// 取出已经解码、尚未被取走的文本，避免再复制一份
+QString FileReadRequest::takeText()
+{
+    QMutexLocker locker(&mutex);
+    QString text = content;
+    content.clear();
+    return text;
+}
+
+// 取出与全部文本对应的文本绳
+TextRope FileReadRequest::takeRope()
+{
+    TextRope result = rope;
+    rope = TextRope();
+    return result;
+}
+
+// 在 I/O 线程中添加解码后的一块文本，之前的文本都已被取走时通知界面线程
+void FileReadRequest::appendText(const QString& text)
+{
+    if (text.isEmpty())
+        return;
+    QMutexLocker locker(&mutex);
+    bool notify = content.isEmpty();
+    content.append(text);
+    if (notify)
+        QMetaObject::invokeMethod(this, "reportText", Qt::QueuedConnection);
+}
+
+// 在界面线程中发射 textAvailable()
+void FileReadRequest::reportText() { emit textAvailable(); }
+
+// 分块读取文件，计算签名，然后解码为文本
+void FileReadRequest::run()
+{
+    FileSignature stat = FileSignature::stat(QFileInfo(path));
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        error = file.errorString();
+        return;
+    }
+    if (GzipReader::isGzip(file.peek(2)))
+    {
+        fileSignature = stat;
+        readCompressed(file);
+        return;
+    }
+    // 二进制文件只检查开头的样本，不读入整个文件
+    QByteArray sample = file.peek(BinarySample);
+    if (EncodingDetector::isBinary(sample.constData(), sample.size()))
+    {
+        binary = true;
+        return;
+    }
+    QByteArray data;
+    if (!readAll(file, &data))
+        return;
+    bytesRead = data.size();
+    // 文件被其他程序修改后，根据签名只需要重新解码变化的部分
+    SignatureBuilder builder;
+    builder.addData(data);
+    fileSignature = builder.finish(stat);
+    content = decodeText(&data, &detectedFormat);
+    rope = TextRope(content);
+}
+
+// 边解压边解码 gzip 文件：每解压出一块就解码、转换换行符并交给界面线程，
+// 内存中只有一块解压后的数据。编码根据解压出的第一块检测。
+// 等待读取完成（不边加载边显示）时每一块同时追加到文本绳，界面线程直接使用它；
+// 边加载边显示时界面线程根据显示的文本建立文本绳，这里不再多保存一份
+void FileReadRequest::readCompressed(QFile& file)
+{
+    detectedFormat.compressed = true;
+    GzipReader reader(&file);
+    qint64 total = file.size();
+    QScopedPointer<QTextDecoder> decoder;
+    LineEnding::Counts counts = {0, 0, 0};
+    QString carry;  // 上一块末尾的 \r，可能与下一块开头的 \n 组成 \r\n
+    qint64 inflated = 0;  // 已经解压的字节数
+    forever
+    {
+        if (isCancelled())
+            return;
+        QByteArray data = reader.read(InflateChunkSize);
+        if (data.isEmpty())
+            break;
+        inflated += data.size();
+        if (inflated > DocumentIo::MaxEditorFileSize)
+        {
+            error = tooLargeError();
+            return;
+        }
+        if (!decoder)
+        {
+            // 在最后一个换行处截断样本，被截断的多字节字符不会影响检测
+            int sampleSize = data.lastIndexOf('\n') + 1;
+            EncodingDetector::Result detected =
+                EncodingDetector::detect(data.constData(), sampleSize > 0 ? sampleSize : data.size());
+            QTextCodec* codec = QTextCodec::codecForName(detected.codecName);
+            if (!codec)
+            {
+                codec = QTextCodec::codecForLocale();
+                detected.bomLength = 0;
+            }
+            detectedFormat.encoding = codec->name();
+            detectedFormat.bom = detected.bomLength > 0;
+            decoder.reset(codec->makeDecoder(QTextCodec::IgnoreHeader));
+            data.remove(0, detected.bomLength);
+        }
+        QString text = carry + decoder->toUnicode(data);
+        data.clear();
+        carry.clear();
+        if (text.endsWith(QLatin1Char('\r')))
+        {
+            text.chop(1);
+            carry = QLatin1String("\r");
+        }
+        LineEnding::normalize(&text, &counts);
+        if (!streaming)
+            rope.insert(rope.length(), text);
+        appendText(text);
+        setProgress(file.pos(), total);
+    }
+    if (!reader.errorString().isEmpty())
+    {
+        error = reader.errorString();
+        return;
+    }
+    LineEnding::normalize(&carry, &counts);
+    if (!streaming)
+        rope.insert(rope.length(), carry);
+    appendText(carry);
+    // 空文件与没有压缩的空文件一样按 UTF-8 处理
+    if (!decoder)
+        detectedFormat.encoding = "UTF-8";
+    bytesRead = file.pos();
+    detectedFormat.lineEnding = LineEnding::dominant(counts, &detectedFormat.mixedLineEndings);
+}
+
+FileWriteRequest::FileWriteRequest(const QString& fileName, const TextRope& text, const TextFormat& textFormat,
+                                   int priority)
+    : IoRequest(priority), path(fileName), content(text), format(textFormat)
+{
+    bytesWritten = 0;
+}
+
+// 把文本绳的叶子凑成大约 1MB 的块，分块转换换行符、编码并写入文件，每次只有一块文本的副本。
+// QSaveFile 先写入临时文件，成功后才替换原文件，所以写入失败或被取消时原文件保持不变。
+// gzip 压缩的文件边编码边压缩
+void FileWriteRequest::run()
+{
+    TextRope text = content;
+    content = TextRope();
+    // 使用加载时检测到的编码写回，BOM 由这里单独写入
+    QTextCodec* codec = QTextCodec::codecForName(format.encoding);
+    if (!codec)
+        codec = QTextCodec::codecForLocale();
+
+    QSaveFile file(path);
+    // 目录不可写但文件可写时直接写入原文件
+    file.setDirectWriteFallback(true);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        error = file.errorString();
+        return;
+    }
+    QScopedPointer<GzipWriter> gzip(format.compressed ? new GzipWriter(&file) : 0);
+    QByteArray bom = format.bom ? EncodingDetector::bom(codec->name()) : QByteArray();
+    if (!writeBlock(&file, gzip.data(), bom))
+        return;
+    QTextCodec::ConverterState state(QTextCodec::IgnoreHeader);
+    // 文本绳的叶子已经是 UTF-8，写回 LF 换行的 UTF-8 文件时直接写入，不需要转换
+    bool direct = codec->name() == "UTF-8" && format.lineEnding == LineEnding::Lf;
+    QVector<QByteArray> chunks = text.chunks();
+    qint64 total = text.byteCount();
+    qint64 offset = 0;
+    QByteArray block;
+    QString expanded;
+    for (int i = 0; i < chunks.size(); i++)
+    {
+        block += chunks.at(i);
+        if (block.size() < ChunkSize && i < chunks.size() - 1)
+            continue;
+        if (isCancelled())
+        {
+            file.cancelWriting();
+            return;
+        }
+        // 叶子不会把一个字符拆开，每一块都可以单独转换
+        QByteArray data = block;
+        if (!direct)
+        {
+            QString decoded = QString::fromUtf8(block);
+            if (format.lineEnding == LineEnding::Lf)
+            {
+                data = codec->fromUnicode(decoded.constData(), decoded.size(), &state);
+            }
+            else
+            {
+                LineEnding::expand(decoded.constData(), decoded.size(), format.lineEnding, &expanded);
+                data = codec->fromUnicode(expanded.constData(), expanded.size(), &state);
+            }
+        }
+        if (!writeBlock(&file, gzip.data(), data))
+            return;
+        offset += block.size();
+        setProgress(offset, total);
+        block.clear();
+    }
+    if (gzip && !gzip->finish())
+    {
+        error = gzip->errorString();
+        file.cancelWriting();
+        return;
+    }
+    bytesWritten = file.pos();
+    if (!file.commit())
+    {
+        error = file.errorString();
+        return;
+    }
+    // 写入的就是文件现在的内容，压缩文件只记录大小和修改时间
+    FileSignature stat = FileSignature::stat(QFileInfo(path));
+    fileSignature = format.compressed ? stat : builder.finish(stat);
+}
+
+// 写入一块编码后的数据，需要时先压缩。失败时放弃写入，原文件保持不变
+bool FileWriteRequest::writeBlock(QSaveFile* file, GzipWriter* gzip, const QByteArray& data)
+{
+    bool ok = gzip ? gzip->write(data) : file->write(data) == data.size();
+    if (!ok)
+    {
+        error = gzip ? gzip->errorString() : file->errorString();
+        file->cancelWriting();
+    }
+    else if (!gzip)
+    {
+        builder.addData(data);
+    }
+    return ok;
+}
+
+FileTailRequest::FileTailRequest(const QString& fileName, qint64 start, const QByteArray& fileHead,
+                                 const TextFormat& textFormat, QTextDecoder* textDecoder, qint64 limit, int priority)
+    : IoRequest(priority), path(fileName), offset(start), head(fileHead), format(textFormat), decoder(textDecoder),
+      maxBytes(limit)
+{
+    restarted = false;
+    more = false;
+}
+
+FileTailRequest::~FileTailRequest() { delete decoder; }
+
+// 取出新增内容的文本
+QString FileTailRequest::takeText()
+{
+    QString text = content;
+    content.clear();
+    return text;
+}
+
+// 取回解码器，下一次读取时继续使用
+QTextDecoder* FileTailRequest::takeDecoder()
+{
+    QTextDecoder* result = decoder;
+    decoder = 0;
+    return result;
+}
+
+// 从上次的位置读取新增的内容，每次最多读取 maxBytes 个字节。
+// 文件比上次读取到的位置短，或者开头的内容变了，说明文件被截断或者日志轮转为新文件，这时从头读取
+void FileTailRequest::run()
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        error = file.errorString();
+        return;
+    }
+    QTextCodec* codec = QTextCodec::codecForName(format.encoding);
+    if (!codec)
+        codec = QTextCodec::codecForLocale();
+    qint64 size = file.size();
+    QByteArray current = file.read(TailHeadSize);
+    if (size < offset || current.left(head.size()) != head)
+    {
+        restarted = true;
+        offset = 0;
+        delete decoder;
+        decoder = 0;
+    }
+    if (!decoder)
+        decoder = codec->makeDecoder(QTextCodec::IgnoreHeader);
+    head = current;
+    // 从头读取时跳过 BOM
+    QByteArray bom = EncodingDetector::bom(codec->name());
+    if (offset == 0 && !bom.isEmpty() && current.startsWith(bom))
+        offset = bom.size();
+
+    if (!file.seek(offset))
+    {
+        error = file.errorString();
+        return;
+    }
+    // 超过 maxBytes 时只读取一部分，其余的由下一次读取
+    more = size - offset > maxBytes;
+    QByteArray data = file.read(qMin(size - offset, maxBytes));
+    // \r\n 可能被拆在两次读取之间，末尾的 \r 留到文件再有变化时再读
+    if (data.endsWith('\r') && !codec->name().startsWith("UTF-16") && !codec->name().startsWith("UTF-32"))
+        data.chop(1);
+    offset += data.size();
+    content = decoder->toUnicode(data);
+    bool mixed;
+    LineEnding::normalize(&content, &mixed);
+}
+
+FileReloadRequest::FileReloadRequest(const QString& fileName, const TextRope& snapshot, const TextFormat& textFormat,
+                                     const FileSignature& signature, bool documentClean, int priority)
+    : IoRequest(priority), path(fileName), original(snapshot), fileFormat(textFormat), oldSignature(signature),
+      clean(documentClean)
+{
+    unchanged = false;
+    start = 0;
+    removed = 0;
+}
+
+// 取出替换成的文本
+QString FileReloadRequest::takeText()
+{
+    QString text = replacement;
+    replacement.clear();
+    return text;
+}
+
+// 读取整个文件并计算签名。文档与上次读写的文件一致，而各块又都没有变化时，说明只是修改时间变了，文档不需要更改
+void FileReloadRequest::run()
+{
+    FileSignature stat = FileSignature::stat(QFileInfo(path));
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        error = file.errorString();
+        return;
+    }
+    QByteArray data;
+    if (!readAll(file, &data))
+        return;
+    fileFormat.compressed = GzipReader::isGzip(data.left(2));
+    if (fileFormat.compressed)
+    {
+        newSignature = stat;
+    }
+    else
+    {
+        SignatureBuilder builder;
+        builder.addData(data);
+        newSignature = builder.finish(stat);
+    }
+    if (clean && oldSignature.sameBlocks(newSignature))
+    {
+        unchanged = true;
+        return;
+    }
+    if (!clean || !reloadLines(data))
+        reloadAll(&data);
+    unchanged = error.isEmpty() && removed == 0 && replacement.isEmpty();
+}
+
+// 文档与上次读写的文件一致时，签名中开头和末尾相同的块在文档中也没有变化。把中间变化的字节扩展到整行，
+// 按前后的换行符个数找到文档中对应的行，只解码这几行。只适用于换行符是单独的 \n 字节、
+// 多字节字符中不会出现 \n 的编码，换行符混用时行数也对应不上
+bool FileReloadRequest::reloadLines(const QByteArray& data)
+{
+    if (fileFormat.compressed || !oldSignature.hashed || fileFormat.mixedLineEndings
+        || fileFormat.lineEnding == LineEnding::Cr)
+        return false;
+    QTextCodec* codec = QTextCodec::codecForName(fileFormat.encoding);
+    if (!codec || (codec->name() != "UTF-8" && codec->name() != "GB18030"))
+        return false;
+    // BOM 与上次相同时才能跳过
+    QByteArray bom = EncodingDetector::bom(codec->name());
+    if (fileFormat.bom != (!bom.isEmpty() && data.startsWith(bom)))
+        return false;
+    qint64 bomLength = fileFormat.bom ? bom.size() : 0;
+
+    qint64 prefix, suffix;
+    oldSignature.commonBlocks(newSignature, &prefix, &suffix);
+    const char* bytes = data.constData();
+    qint64 size = data.size();
+    // 起点退到行首，终点进到下一个换行之后
+    qint64 begin = qMax(prefix, bomLength);
+    while (begin > bomLength && bytes[begin - 1] != '\n')
+        begin--;
+    qint64 end = qMax(size - suffix, begin);
+    while (end > bomLength && end < size && bytes[end - 1] != '\n')
+        end++;
+    qint64 firstLine = countNewlines(bytes, begin);
+    qint64 lastLine = original.lineCount() - 1;
+    if (end < size)
+        lastLine -= countNewlines(bytes + end, size - end);
+    if (firstLine >= original.lineCount() || lastLine < firstLine)
+        return false;
+
+    // 变化的几行不是合法的原编码时，文件的编码可能也变了，重新检测
+    QTextCodec::ConverterState state(QTextCodec::IgnoreHeader);
+    QString text = codec->toUnicode(bytes + begin, int(end - begin), &state);
+    if (state.invalidChars > 0 || state.remainingChars > 0)
+        return false;
+    LineEnding::Counts counts = {0, 0, 0};
+    LineEnding::normalize(&text, &counts);
+    // 变化的几行用了其他的换行符，保存时统一为原来的换行符
+    qint64 same = fileFormat.lineEnding == LineEnding::Lf ? counts.lf : counts.crlf;
+    fileFormat.mixedLineEndings = counts.lf + counts.crlf + counts.cr > same;
+
+    start = original.lineStart(firstLine);
+    removed = (end == size ? original.length() : original.lineStart(lastLine)) - start;
+    replacement = text;
+    return true;
+}
+
+// 解码整个文件，逐个叶子与文档的快照比较，找出开头和末尾相同的部分。
+// 文档有没有保存的更改或者文件的编码不适合只解码几行时使用
+void FileReloadRequest::reloadAll(QByteArray* data)
+{
+    if (fileFormat.compressed)
+    {
+        QBuffer buffer(data);
+        buffer.open(QIODevice::ReadOnly);
+        GzipReader reader(&buffer);
+        QByteArray inflated;
+        forever
+        {
+            if (isCancelled())
+                return;
+            QByteArray block = reader.read(InflateChunkSize);
+            if (block.isEmpty())
+                break;
+            if (inflated.size() + qint64(block.size()) > DocumentIo::MaxEditorFileSize)
+            {
+                error = tooLargeError();
+                return;
+            }
+            inflated += block;
+        }
+        if (!reader.errorString().isEmpty())
+        {
+            error = reader.errorString();
+            return;
+        }
+        buffer.close();
+        *data = inflated;
+    }
+    QString text = decodeText(data, &fileFormat);
+    int size = text.size();
+    qint64 length = original.length();
+    QVector<QByteArray> chunks = original.chunks();
+
+    qint64 prefix = 0;
+    for (int i = 0; i < chunks.size(); i++)
+    {
+        if (isCancelled())
+            return;
+        QString leaf = QString::fromUtf8(chunks.at(i));
+        int limit = int(qMin<qint64>(leaf.size(), size - prefix));
+        int same = 0;
+        while (same < limit && leaf.at(same) == text.at(int(prefix) + same))
+            same++;
+        prefix += same;
+        if (same < leaf.size())
+            break;
+    }
+    qint64 suffix = 0;
+    qint64 maxSuffix = qMin<qint64>(length, size) - prefix;
+    for (int i = chunks.size() - 1; i >= 0 && suffix < maxSuffix; i--)
+    {
+        if (isCancelled())
+            return;
+        QString leaf = QString::fromUtf8(chunks.at(i));
+        int limit = int(qMin<qint64>(leaf.size(), maxSuffix - suffix));
+        int same = 0;
+        while (same < limit && leaf.at(leaf.size() - 1 - same) == text.at(size - 1 - int(suffix) - same))
+            same++;
+        suffix += same;
+        if (same < leaf.size())
+            break;
+    }
+    // 不把代理对拆开
+    if (prefix > 0 && text.at(int(prefix) - 1).isHighSurrogate())
+        prefix--;
+    if (suffix > 0 && text.at(size - int(suffix)).isLowSurrogate())
+        suffix--;
+
+    start = prefix;
+    removed = length - prefix - suffix;
+    replacement = text.mid(int(prefix), size - int(prefix) - int(suffix));
+}
+
+DocumentIo::DocumentIo(QObject* parent) : QObject(parent)
+{
+    nextSequence = 0;
+    stopping = false;
+    // I/O 线程的数量有上限，大量请求只会排队，不会创建大量线程
+    int count = qBound(2, QThread::idealThreadCount(), 4);
+    for (int i = 0; i < count; i++)
+    {
+        QThread* thread = new IoThread(this);
+        thread->setObjectName(QString("I/O %1").arg(i + 1));
+        threads << thread;
+        thread->start();
+    }
+}
+
+DocumentIo::~DocumentIo()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        // 正在执行的请求尽快结束
+        foreach (IoRequest* request, running)
+            request->cancelled.store(1);
+        available.wakeAll();
+    }
+    foreach (QThread* thread, threads)
+    {
+        thread->wait();
+        delete thread;
+    }
+    qDeleteAll(queue);
+}
+
+// 全局的 I/O 服务，随应用程序对象一起销毁
+DocumentIo* DocumentIo::instance()
+{
+    static DocumentIo* io = 0;
+    if (!io)
+        io = new DocumentIo(QCoreApplication::instance());
+    return io;
+}
+
+// 提交请求，请求执行完后在界面线程中发射 finished()
+void DocumentIo::submit(IoRequest* request)
+{
+    QMutexLocker locker(&mutex);
+    request->sequence = nextSequence++;
+    enqueue(request);
+    available.wakeOne();
+}
+
+// 按优先级插入队列，同一优先级按提交顺序排列，调用前需要加锁
+void DocumentIo::enqueue(IoRequest* request)
+{
+    int i = 0;
+    while (i < queue.size()
+           && (queue.at(i)->requestPriority > request->requestPriority
+               || (queue.at(i)->requestPriority == request->requestPriority
+                   && queue.at(i)->sequence < request->sequence)))
+        i++;
+    queue.insert(i, request);
+}
+
+// 从队列中移除尚未执行的请求
+bool DocumentIo::dequeue(IoRequest* request)
+{
+    QMutexLocker locker(&mutex);
+    return queue.removeOne(request);
+}
+
+// 调整请求的优先级，还在队列中的请求重新排队
+void DocumentIo::reprioritize(IoRequest* request, int priority)
+{
+    QMutexLocker locker(&mutex);
+    request->requestPriority = priority;
+    if (queue.removeOne(request))
+        enqueue(request);
+}
+
+// I/O 线程取出下一个请求，服务停止时返回 0
+IoRequest* DocumentIo::takeRequest()
+{
+    QMutexLocker locker(&mutex);
+    while (queue.isEmpty() && !stopping)
+        available.wait(&mutex);
+    if (stopping)
+        return 0;
+    IoRequest* request = queue.takeFirst();
+    running << request;
+    return request;
+}
+
+// 请求执行完毕，不再属于正在执行的请求
+void DocumentIo::release(IoRequest* request)
+{
+    QMutexLocker locker(&mutex);
+    running.removeOne(request);
+}
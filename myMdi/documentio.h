@@ -0,0 +1,278 @@
+#ifndef DOCUMENTIO_H
+#define DOCUMENTIO_H
+
+class GzipWriter;
+class QFile;
+class QFileInfo;
+class QSaveFile;
+
+#include <QAtomicInt>
+#include <QDateTime>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QTextCodec>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+#include "lineending.h"
+#include "textrope.h"
+
+// 文件的文本格式，加载时检测，保存时写回
+struct TextFormat
+{
+    QByteArray encoding;           // 编码
+    bool bom;                      // 文件开头是否有 BOM
+    LineEnding::Style lineEnding;  // 换行符
+    bool mixedLineEndings;         // 是否混用了多种换行符，保存时统一为 lineEnding
+    bool compressed;               // 文件是否用 gzip 压缩，保存时重新压缩
+};
+
+// 文件在硬盘上的签名，用于发现其他程序对文件的修改：先比较大小和修改时间，不同时再比较各块的哈希值。
+// 块的边界由内容决定，插入或删除几行只影响所在的一两块，开头和末尾相同的块就是没有变化的部分
+struct FileSignature
+{
+    qint64 size;              // 文件的字节数，-1 表示没有签名
+    QDateTime modified;       // 修改时间
+    bool hashed;              // 是否记录了各块的哈希值，压缩文件只记录大小和修改时间
+    QVector<qint32> lengths;  // 各块的字节数
+    QVector<quint64> hashes;  // 各块的哈希值
+
+    FileSignature() : size(-1), hashed(false) {}
+    static FileSignature stat(const QFileInfo& info);       // 只有大小和修改时间的签名
+    bool isValid() const { return size >= 0; }              // 是否有签名
+    bool matches(const QFileInfo& info) const;              // 大小和修改时间是否相同
+    bool sameBlocks(const FileSignature& other) const;      // 各块是否都相同
+    void commonBlocks(const FileSignature& other, qint64* prefix, qint64* suffix) const;  // 开头和末尾相同的块的字节数
+};
+
+// 依次输入文件的内容，计算签名。末尾还没有找到边界的部分留到下一次输入
+class SignatureBuilder
+{
+private:
+    FileSignature signature;  // 已经计算出的块
+    QByteArray pending;       // 还没有找到边界的部分
+
+    int hashBlocks(bool last);  // 切分 pending 并计算各块的哈希值，返回切分掉的字节数
+
+public:
+    void addData(const QByteArray& data);           // 输入一段内容
+    FileSignature finish(const FileSignature& fileStat);  // 输入结束，大小和修改时间取自 fileStat
+};
+
+// 文档 I/O 请求，在 I/O 线程中执行 run()，完成后在界面线程中发射 finished() 并删除自己
+class IoRequest : public QObject
+{
+    Q_OBJECT
+    friend class DocumentIo;
+    friend class IoThread;
+
+private:
+    QAtomicInt cancelled;          // 是否已被取消
+    int requestPriority;           // 优先级，由 DocumentIo 的互斥锁保护
+    quint64 sequence;              // 提交顺序，同一优先级按先后执行
+    bool done;                     // run() 是否已经结束
+    QMutex doneMutex;              // 保护 done
+    QWaitCondition doneCondition;  // 等待 run() 结束
+    qint64 lastReported;           // 上次报告进度时的字节数
+
+    void finish();  // 在 I/O 线程中标记完成，并通知界面线程
+
+protected:
+    QString error;  // 出错信息，为空表示成功
+
+    virtual void run() = 0;                      // 在 I/O 线程中执行的操作
+    bool isCancelled() const;                    // 是否已被取消，长时间的操作应定期检查
+    void setProgress(qint64 processed, qint64 total);  // 报告进度，自动限制报告频率
+    bool readAll(QFile& file, QByteArray* data);  // 分块读取整个文件，出错或被取消时返回 false
+
+public:
+    explicit IoRequest(int priority);
+    int priority() const { return requestPriority; }  // 当前优先级
+    void setPriority(int priority);                  // 调整尚未开始执行的请求的优先级
+    void cancel();                                   // 取消请求
+    bool wasCancelled() const { return isCancelled(); }  // 是否被取消
+    QString errorString() const { return error; }       // 出错信息
+    void waitForFinished();                              // 阻塞等待 run() 结束
+
+signals:
+    void progress(qint64 processed, qint64 total);  // 进度
+    void finished();                           // 请求结束（成功、失败或被取消）
+
+private slots:
+    void reportProgress(qint64 processed, qint64 total);  // 在界面线程中发射 progress()
+    void complete();                                 // 在界面线程中发射 finished() 并删除自己
+};
+
+// 读取文件并解码为文本。gzip 压缩的文件边解压边解码，每解码一块就发射 textAvailable()，
+// 界面不需要等整个文件解压完就可以显示开头的内容
+class FileReadRequest : public IoRequest
+{
+    Q_OBJECT
+private:
+    QString path;               // 文件路径
+    QMutex mutex;               // 保护 content
+    QString content;            // 解码后、尚未被取走的文本
+    TextRope rope;              // 在 I/O 线程中建立的文本绳，界面线程不需要再复制整个文档
+    TextFormat detectedFormat;  // 检测到的编码和换行符
+    qint64 bytesRead;           // 读取的字节数
+    FileSignature fileSignature;  // 读取时文件的签名
+    bool binary;                // 是否为二进制文件，二进制文件不读入
+    bool streaming;             // 调用者边加载边显示，自己建立文本绳，压缩文件不再在 I/O 线程中建立
+
+    void readCompressed(QFile& file);  // 边解压边解码 gzip 文件
+    void appendText(const QString& text);  // 在 I/O 线程中添加解码后的一块文本
+
+protected:
+    void run();
+
+public:
+    FileReadRequest(const QString& fileName, int priority, bool streamText = false);
+    QString fileName() const { return path; }             // 文件路径
+    QString takeText();                                   // 取出已经解码、尚未被取走的文本
+    TextRope takeRope();                                  // 取出与全部文本对应的文本绳，边加载边显示的压缩文件没有
+    TextFormat format() const { return detectedFormat; }  // 检测到的编码和换行符
+    qint64 size() const { return bytesRead; }             // 读取的字节数
+    FileSignature signature() const { return fileSignature; }  // 读取时文件的签名
+    bool isBinary() const { return binary; }              // 是否为二进制文件，这时没有读入任何文本
+
+signals:
+    void textAvailable();  // 有新解码的文本可以取走
+
+private slots:
+    void reportText();  // 在界面线程中发射 textAvailable()
+};
+
+// 把文本编码后写入文件。文本是文本绳的快照，界面线程不需要复制整个文档
+class FileWriteRequest : public IoRequest
+{
+    Q_OBJECT
+private:
+    QString path;         // 文件路径
+    TextRope content;     // 要写入的文本的快照
+    TextFormat format;    // 写入的编码和换行符
+    qint64 bytesWritten;  // 写入的字节数
+    SignatureBuilder builder;     // 根据写入的数据计算签名
+    FileSignature fileSignature;  // 写入后文件的签名
+
+    bool writeBlock(QSaveFile* file, GzipWriter* gzip, const QByteArray& data);  // 写入一块数据，需要时先压缩
+
+protected:
+    void run();
+
+public:
+    FileWriteRequest(const QString& fileName, const TextRope& text, const TextFormat& textFormat, int priority);
+    QString fileName() const { return path; }     // 文件路径
+    qint64 size() const { return bytesWritten; }  // 写入的字节数
+    FileSignature signature() const { return fileSignature; }  // 写入后文件的签名
+};
+
+// 读取文件在 offset 之后新增的内容，用于跟踪不断增长的日志文件。
+// 解码器在多次读取之间传递，被截断在两次读取之间的多字节字符不会出错
+class FileTailRequest : public IoRequest
+{
+    Q_OBJECT
+private:
+    QString path;           // 文件路径
+    qint64 offset;          // 已经读取到的位置，读取后更新
+    QByteArray head;        // 文件开头的字节，用于发现日志轮转
+    TextFormat format;      // 文件的编码
+    QTextDecoder* decoder;  // 解码器，请求持有期间归请求所有
+    qint64 maxBytes;        // 一次最多读取的字节数
+    QString content;        // 新增内容解码后的文本
+    bool restarted;         // 文件被截断或轮转，已经从头读取
+    bool more;              // 文件中还有没读取的内容
+
+protected:
+    void run();
+
+public:
+    FileTailRequest(const QString& fileName, qint64 start, const QByteArray& fileHead, const TextFormat& textFormat,
+                    QTextDecoder* textDecoder, qint64 limit, int priority);
+    ~FileTailRequest();
+    qint64 position() const { return offset; }       // 已经读取到的位置
+    QByteArray fileHead() const { return head; }     // 文件开头的字节
+    QString takeText();                              // 取出新增内容的文本
+    QTextDecoder* takeDecoder();                     // 取回解码器
+    bool wasRestarted() const { return restarted; }  // 文件是否被截断或轮转
+    bool hasMore() const { return more; }            // 文件中是否还有没读取的内容
+};
+
+// 文件被其他程序修改后重新读取，只找出变化的部分，由界面线程作为一步编辑替换到文档中，
+// 不需要重新布局整个文档，也保留了撤销记录。文档与上次读写的文件一致时，用签名找出开头和末尾相同的块，
+// 扩展到整行后只解码中间变化的几行；否则解码整个文件，与文档的快照比较找出开头和末尾相同的部分
+class FileReloadRequest : public IoRequest
+{
+    Q_OBJECT
+private:
+    QString path;                // 文件路径
+    TextRope original;           // 文档内容的快照
+    TextFormat fileFormat;       // 文件的编码和换行符，读取后更新
+    FileSignature oldSignature;  // 上次读写时文件的签名
+    FileSignature newSignature;  // 重新读取时文件的签名
+    bool clean;                  // 文档是否与上次读写的文件一致
+    bool unchanged;              // 文件与文档的内容相同
+    qint64 start;                // 变化的部分在文档中的起点
+    qint64 removed;              // 文档中被替换的字符数
+    QString replacement;         // 替换成的文本
+
+    bool reloadLines(const QByteArray& data);  // 只解码变化的几行，不能这样做时返回 false
+    void reloadAll(QByteArray* data);          // 解码整个文件，与快照比较
+
+protected:
+    void run();
+
+public:
+    FileReloadRequest(const QString& fileName, const TextRope& snapshot, const TextFormat& textFormat,
+                      const FileSignature& signature, bool documentClean, int priority);
+    QString fileName() const { return path; }                 // 文件路径
+    bool wasUnchanged() const { return unchanged; }           // 文件与文档的内容是否相同
+    qint64 position() const { return start; }                 // 变化的部分在文档中的起点
+    qint64 removedLength() const { return removed; }          // 文档中被替换的字符数
+    QString takeText();                                       // 取出替换成的文本
+    TextFormat format() const { return fileFormat; }          // 文件的编码和换行符
+    FileSignature signature() const { return newSignature; }  // 重新读取时文件的签名
+};
+
+// 文档 I/O 服务：固定数量的 I/O 线程按优先级执行所有文档的读写请求，
+// 活动窗口的请求最先执行，然后是可见窗口，最后是预读和后台任务
+class DocumentIo : public QObject
+{
+    Q_OBJECT
+    friend class IoRequest;
+    friend class IoThread;
+
+private:
+    QMutex mutex;                // 保护请求队列
+    QWaitCondition available;    // 有新的请求或者服务将要停止
+    QList<IoRequest*> queue;     // 等待执行的请求，按优先级从高到低排列
+    QList<IoRequest*> running;   // 正在执行的请求
+    QList<QThread*> threads;     // I/O 线程
+    quint64 nextSequence;        // 下一个请求的提交顺序
+    bool stopping;               // 服务将要停止
+
+    explicit DocumentIo(QObject* parent = 0);
+    void enqueue(IoRequest* request);     // 按优先级插入队列，调用前需要加锁
+    bool dequeue(IoRequest* request);     // 从队列中移除尚未执行的请求
+    void reprioritize(IoRequest* request, int priority);  // 调整请求的优先级
+    IoRequest* takeRequest();             // I/O 线程取出下一个请求，服务停止时返回 0
+    void release(IoRequest* request);     // 请求执行完毕
+
+public:
+    enum Priority
+    {
+        Background = 0,  // 后台任务
+        Prefetch = 1,    // 预读不可见的文档
+        Visible = 2,     // 可见窗口
+        Active = 3       // 活动窗口
+    };
+    // 编辑器能打开的最大文件（压缩文件按解压后计算），解码后的 QString 不超过 1GB，更大的文件只能用只读的查看器
+    static const qint64 MaxEditorFileSize = qint64(512) << 20;
+
+    ~DocumentIo();
+    static DocumentIo* instance();     // 全局的 I/O 服务
+    void submit(IoRequest* request);   // 提交请求
+};
+
+#endif  // DOCUMENTIO_H
@@ -0,0 +1,252 @@
+#include "editjournal.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QTextDocument>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "mdichild.h"
+#include "recoverystore.h"
+
+static const int FlushInterval = 100;           // 每 100 毫秒把缓冲区交给写入线程
+static const int SyncInterval = 1000;           // 每秒最多同步一次硬盘
+static const int MaxBufferBytes = 64 * 1024;    // 缓冲区超过 64KB 时立即交给写入线程
+
+// 把文件内容从系统缓存同步到硬盘
+static void syncFile(QFile* file)
+{
+    file->flush();
+    int fd = file->handle();
+    if (fd == -1)
+        return;
+#ifdef Q_OS_WIN
+    _commit(fd);
+#else
+    fsync(fd);
+#endif
+}
+
+JournalWriter::JournalWriter() { syncTimer = 0; }
+
+JournalWriter::~JournalWriter() { qDeleteAll(files); }
+
+// 追加记录，新文件先写入文件头。写入系统缓存后即使进程崩溃记录也不会丢失，
+// 同步到硬盘则批量进行，防止系统崩溃或断电
+void JournalWriter::append(const QString& fileName, const QByteArray& header, const QByteArray& data)
+{
+    QFile* file = files.value(fileName);
+    if (!file)
+    {
+        file = new QFile(fileName);
+        if (!file->open(QIODevice::WriteOnly | QIODevice::Append))
+        {
+            delete file;
+            return;
+        }
+        files.insert(fileName, file);
+        if (file->size() == 0)
+            file->write(header);
+    }
+    file->write(data);
+    file->flush();
+    unsynced.insert(fileName);
+    // 定时器在写入线程中创建，才会在写入线程中触发
+    if (!syncTimer)
+    {
+        syncTimer = new QTimer(this);
+        syncTimer->setSingleShot(true);
+        connect(syncTimer, SIGNAL(timeout()), this, SLOT(sync()));
+    }
+    if (!syncTimer->isActive())
+        syncTimer->start(SyncInterval);
+}
+
+// 删除日志
+void JournalWriter::remove(const QString& fileName)
+{
+    delete files.take(fileName);
+    unsynced.remove(fileName);
+    QFile::remove(fileName);
+}
+
+// 把写入后还没有同步的日志同步到硬盘
+void JournalWriter::sync()
+{
+    foreach (const QString& fileName, unsynced)
+    {
+        if (QFile* file = files.value(fileName))
+            syncFile(file);
+    }
+    unsynced.clear();
+}
+
+// 同步并关闭所有日志，然后停止写入线程
+void JournalWriter::stop()
+{
+    if (syncTimer)
+        syncTimer->stop();
+    sync();
+    qDeleteAll(files);
+    files.clear();
+    thread()->quit();
+}
+
+EditJournal::EditJournal(QObject* parent) : QObject(parent)
+{
+    // 日志文件以进程号开头，锁文件表明该进程还在运行
+    RecoveryStore::lock();
+
+    writer = new JournalWriter;
+    writer->moveToThread(&writerThread);
+    writerThread.start(QThread::LowPriority);
+
+    // 间隔为 0 的定时器在当前事件处理完之后触发，同一批事件中的编辑合并为一条记录
+    recordTimer.setSingleShot(true);
+    recordTimer.setInterval(0);
+    flushTimer.setSingleShot(true);
+    flushTimer.setInterval(FlushInterval);
+    connect(&recordTimer, SIGNAL(timeout()), this, SLOT(recordAll()));
+    connect(&flushTimer, SIGNAL(timeout()), this, SLOT(flush()));
+}
+
+EditJournal::~EditJournal()
+{
+    recordAll();
+    flush();
+    // 等待已经提交的写入和删除完成
+    QMetaObject::invokeMethod(writer, "stop", Qt::QueuedConnection);
+    writerThread.wait();
+    delete writer;
+}
+
+// 开始记录一个文档的编辑
+void EditJournal::addDocument(MdiChild* child)
+{
+    QTextDocument* doc = child->document();
+    Entry& entry = entries[doc];
+    entry.child = child;
+    entry.fileName = RecoveryStore::path() + "/" + RecoveryStore::fileStem(doc) + ".journal";
+    entry.header = RecoveryStore::header(QString());
+    entry.hasFile = false;
+    resetEntry(entry);
+    connect(doc, SIGNAL(contentsChange(int, int, int)), this, SLOT(documentChanged(int, int, int)));
+    connect(doc, SIGNAL(destroyed(QObject*)), this, SLOT(documentDestroyed(QObject*)));
+    connect(child, SIGNAL(documentSynced()), this, SLOT(documentSynced()));
+}
+
+// 以当前文档为基准，清空更改区域和缓冲区
+void EditJournal::resetEntry(Entry& entry)
+{
+    entry.region.clear();
+    entry.buffer.clear();
+    entry.length = entry.child ? entry.child->document()->characterCount() - 1 : 0;
+}
+
+// 记录文档的更改区域，在当前事件处理完之后再取出文本
+void EditJournal::documentChanged(int position, int charsRemoved, int charsAdded)
+{
+    QTextDocument* doc = static_cast<QTextDocument*>(sender());
+    QHash<QTextDocument*, Entry>::iterator it = entries.find(doc);
+    if (it == entries.end())
+        return;
+    Entry& entry = it.value();
+    if (!entry.region.dirty && entry.buffer.isEmpty())
+        pending.append(doc);
+    entry.region.merge(position, charsRemoved, charsAdded);
+    recordTimer.start();
+}
+
+// 文档已与硬盘同步，删除日志，原文件成为新的基准。
+// 加载文件时 setPlainText() 产生的更改区域也在这里丢弃，不会复制整个文档
+void EditJournal::documentSynced()
+{
+    MdiChild* child = qobject_cast<MdiChild*>(sender());
+    QHash<QTextDocument*, Entry>::iterator it = entries.find(child->document());
+    if (it == entries.end())
+        return;
+    Entry& entry = it.value();
+    if (entry.hasFile)
+    {
+        QMetaObject::invokeMethod(writer, "remove", Qt::QueuedConnection, Q_ARG(QString, entry.fileName));
+        entry.hasFile = false;
+    }
+    entry.header = RecoveryStore::header(child->isNewFile() ? QString() : child->currentFile());
+    resetEntry(entry);
+}
+
+// 文档被关闭，不论是否保存，日志都不再需要
+void EditJournal::documentDestroyed(QObject* object)
+{
+    QTextDocument* doc = static_cast<QTextDocument*>(object);
+    QHash<QTextDocument*, Entry>::iterator it = entries.find(doc);
+    if (it == entries.end())
+        return;
+    if (it.value().hasFile)
+        QMetaObject::invokeMethod(writer, "remove", Qt::QueuedConnection, Q_ARG(QString, it.value().fileName));
+    entries.erase(it);
+    pending.removeAll(doc);
+}
+
+// 把所有更改区域编码到缓冲区
+void EditJournal::recordAll()
+{
+    bool full = false;
+    foreach (QTextDocument* doc, pending)
+    {
+        QHash<QTextDocument*, Entry>::iterator it = entries.find(doc);
+        if (it == entries.end())
+            continue;
+        if (it.value().region.dirty)
+            record(it.value());
+        full = full || it.value().buffer.size() >= MaxBufferBytes;
+    }
+    if (full)
+        flush();
+    else if (!pending.isEmpty() && !flushTimer.isActive())
+        flushTimer.start();
+}
+
+// 把更改区域编码为一条增量记录，取出的文本只有更改区域那么大
+void EditJournal::record(Entry& entry)
+{
+    if (!entry.child)
+        return;
+    QTextDocument* doc = entry.child->document();
+    int position, removed;
+    QString text = RecoveryStore::regionText(doc, entry.region, entry.length, &position, &removed);
+    entry.region.clear();
+    entry.length = doc->characterCount() - 1;
+    if (removed == 0 && text.isEmpty())
+        return;
+    QDataStream out(&entry.buffer, QIODevice::WriteOnly | QIODevice::Append);
+    out.setVersion(QDataStream::Qt_5_6);
+    out << RecoveryStore::DeltaRecord << qint32(position) << qint32(removed) << text;
+}
+
+// 把缓冲区交给写入线程，QByteArray 是隐式共享的，不会复制数据
+void EditJournal::flush()
+{
+    QList<QTextDocument*> stillDirty;
+    foreach (QTextDocument* doc, pending)
+    {
+        QHash<QTextDocument*, Entry>::iterator it = entries.find(doc);
+        if (it == entries.end())
+            continue;
+        Entry& entry = it.value();
+        if (!entry.buffer.isEmpty())
+        {
+            QMetaObject::invokeMethod(writer, "append", Qt::QueuedConnection, Q_ARG(QString, entry.fileName),
+                                      Q_ARG(QByteArray, entry.header), Q_ARG(QByteArray, entry.buffer));
+            entry.buffer.clear();
+            entry.hasFile = true;
+        }
+        if (entry.region.dirty)
+            stillDirty << doc;
+    }
+    pending = stillDirty;
+}
@@ -0,0 +1,80 @@
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+
+class MdiChild;
+class QFile;
+class QTextDocument;
+
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QThread>
+#include <QTimer>
+
+#include "editregion.h"
+
+// 在后台线程中追加编辑日志，并定期把日志同步到硬盘
+class JournalWriter : public QObject
+{
+    Q_OBJECT
+private:
+    QHash<QString, QFile*> files;  // 打开的日志文件
+    QSet<QString> unsynced;        // 写入后还没有同步到硬盘的日志
+    QTimer* syncTimer;             // 批量同步的定时器
+
+public:
+    JournalWriter();
+    ~JournalWriter();
+
+public slots:
+    void append(const QString& fileName, const QByteArray& header, const QByteArray& data);  // 追加记录
+    void remove(const QString& fileName);                                                    // 删除日志
+    void sync();                                                                             // 同步到硬盘
+    void stop();                                                                             // 停止写入线程
+};
+
+// 编辑日志（预写日志）：把每次编辑的位置、删除的长度和插入的文本追加到日志文件中，
+// 异常退出后可以在原文件上重放日志，精确地恢复未保存的内容
+//
+// 编辑先合并到内存中的更改区域，在事件循环空闲时编码到缓冲区，缓冲区定期交给写入线程，
+// 写入线程每秒最多同步一次硬盘，所以每次按键只增加很少的开销
+class EditJournal : public QObject
+{
+    Q_OBJECT
+private:
+    struct Entry
+    {
+        QPointer<MdiChild> child;  // 文档所在的窗口
+        QString fileName;          // 日志文件路径
+        QByteArray header;         // 日志文件头，记录作为基准的原文件
+        EditRegion region;         // 还没有编码的更改区域
+        int length;                // 上次编码时的文档长度
+        QByteArray buffer;         // 还没有交给写入线程的记录
+        bool hasFile;              // 日志文件是否已经创建
+    };
+
+    QHash<QTextDocument*, Entry> entries;  // 每个文档的日志状态
+    QList<QTextDocument*> pending;         // 有更改区域或缓冲区的文档
+    QThread writerThread;                  // 写入线程
+    JournalWriter* writer;                 // 写入线程中的写入对象
+    QTimer recordTimer;                    // 事件循环空闲时编码更改区域
+    QTimer flushTimer;                     // 定期把缓冲区交给写入线程
+
+    void resetEntry(Entry& entry);  // 以当前文档为基准，清空更改区域
+    void record(Entry& entry);      // 把更改区域编码到缓冲区
+
+public:
+    explicit EditJournal(QObject* parent = 0);
+    ~EditJournal();
+    void addDocument(MdiChild* child);  // 开始记录一个文档的编辑
+
+private slots:
+    void documentChanged(int position, int charsRemoved, int charsAdded);  // 记录文档的更改区域
+    void documentSynced();                                                 // 文档已与硬盘同步
+    void documentDestroyed(QObject* object);                               // 文档被关闭
+    void recordAll();                                                      // 编码所有更改区域
+    void flush();                                                          // 把缓冲区交给写入线程
+};
+
+#endif  // EDITJOURNAL_H
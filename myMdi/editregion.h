@@ -0,0 +1,44 @@
+#ifndef EDITREGION_H
+#define EDITREGION_H
+
+#include <QtGlobal>
+
+// 合并后的更改区域：把多次 contentsChange() 报告的更改合并为一次替换，
+// 即上一个版本中 [start, oldEnd) 的文本被替换为当前文档中 [start, newEnd) 的文本
+struct EditRegion
+{
+    bool dirty;  // 是否有尚未处理的更改
+    int start;   // 更改区域的起点
+    int oldEnd;  // 更改区域在上一个版本中的终点
+    int newEnd;  // 更改区域在当前文档中的终点
+
+    EditRegion() : dirty(false), start(0), oldEnd(0), newEnd(0) {}
+
+    // 清空更改区域
+    void clear()
+    {
+        dirty = false;
+        start = oldEnd = newEnd = 0;
+    }
+
+    // 合并一次更改，只做整数运算
+    void merge(int position, int charsRemoved, int charsAdded)
+    {
+        int removedEnd = position + charsRemoved;
+        if (!dirty)
+        {
+            start = position;
+            oldEnd = removedEnd;
+            newEnd = position + charsAdded;
+            dirty = true;
+            return;
+        }
+        // 区域之前的文本在两个版本中位置相同，区域之后的文本位置相差 newEnd - oldEnd
+        int end = qMax(newEnd, removedEnd);
+        oldEnd += end - newEnd;
+        start = qMin(start, position);
+        newEnd = end + charsAdded - charsRemoved;
+    }
+};
+
+#endif  // EDITREGION_H
@@ -0,0 +1,281 @@
+#include "encodingdetector.h"
+
+#include <QTextCodec>
+#include <QtAlgorithms>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const qint64 SampleSize = 1 << 20;  // 统计特征只检查文件开头的 1MB
+
+// 识别 BOM，没有 BOM 时返回空
+static EncodingDetector::Result detectBom(const uchar* p, qint64 size)
+{
+    EncodingDetector::Result result;
+    result.bomLength = 0;
+    // UTF-32 的 BOM 以 UTF-16 的 BOM 开头，要先判断
+    if (size >= 4 && p[0] == 0x00 && p[1] == 0x00 && p[2] == 0xFE && p[3] == 0xFF)
+        result.codecName = "UTF-32BE";
+    else if (size >= 4 && p[0] == 0xFF && p[1] == 0xFE && p[2] == 0x00 && p[3] == 0x00)
+        result.codecName = "UTF-32LE";
+    else if (size >= 4 && p[0] == 0x84 && p[1] == 0x31 && p[2] == 0x95 && p[3] == 0x33)
+        result.codecName = "GB18030";
+    else if (size >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF)
+        result.codecName = "UTF-8";
+    else if (size >= 2 && p[0] == 0xFE && p[1] == 0xFF)
+        result.codecName = "UTF-16BE";
+    else if (size >= 2 && p[0] == 0xFF && p[1] == 0xFE)
+        result.codecName = "UTF-16LE";
+    if (!result.codecName.isEmpty())
+        result.bomLength = EncodingDetector::bom(result.codecName).size();
+    return result;
+}
+
+// 检测文本的编码
+EncodingDetector::Result EncodingDetector::detect(const char* data, qint64 size)
+{
+    Result result = detectBom(reinterpret_cast<const uchar*>(data), size);
+    if (result.bomLength > 0)
+        return result;
+    qint64 sample = qMin(size, SampleSize);
+    // 文本文件中不会出现 0 字节，出现时很可能是没有 BOM 的 UTF-16，
+    // 这样的 ASCII 文本也是合法的 UTF-8，所以要在校验 UTF-8 之前判断
+    if (memchr(data, 0, size_t(sample)))
+        result.codecName = guessUtf16(data, sample);
+    if (result.codecName.isEmpty() && isUtf8(data, size))
+        result.codecName = "UTF-8";
+    if (result.codecName.isEmpty())
+        result.codecName = guessUtf16(data, sample);
+    if (result.codecName.isEmpty() && isGb18030(data, sample))
+        result.codecName = "GB18030";
+    // 都不像时使用本地编码，与之前的行为一致
+    if (result.codecName.isEmpty())
+        result.codecName = QTextCodec::codecForLocale()->name();
+    return result;
+}
+
+#ifdef __SSE2__
+// 一组 16 个字节的特征位：第 i 位对应第 i 个字节
+static inline void classify16(const uchar* p, int shift, quint64* cont, quint64* lead2, quint64* lead3,
+                              quint64* lead4, quint64* special)
+{
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    quint64 high = quint64(_mm_movemask_epi8(b));
+    if (high == 0)
+        return;
+    // 按有符号数比较：0x80-0xBF 为 -128 到 -65
+    quint64 c = quint64(_mm_movemask_epi8(_mm_cmplt_epi8(b, _mm_set1_epi8(-64))));
+    quint64 l3 = quint64(_mm_movemask_epi8(_mm_cmpgt_epi8(b, _mm_set1_epi8(char(0xDF))))) & high;
+    quint64 l4 = quint64(_mm_movemask_epi8(_mm_cmpgt_epi8(b, _mm_set1_epi8(char(0xEF))))) & high;
+    __m128i odd = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8(char(0xC0))),
+                                            _mm_cmpeq_epi8(b, _mm_set1_epi8(char(0xC1)))),
+                               _mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8(char(0xE0))),
+                                            _mm_cmpeq_epi8(b, _mm_set1_epi8(char(0xED)))));
+    *cont |= c << shift;
+    *lead2 |= (high & ~c) << shift;
+    *lead3 |= l3 << shift;
+    *lead4 |= l4 << shift;
+    *special |= (quint64(_mm_movemask_epi8(odd)) | l4) << shift;
+}
+#endif
+
+// 检查需要特别处理的首字节：0xC0、0xC1 和 0xF5 以上不会出现，
+// 0xE0、0xF0 之后不能是过长编码，0xED 之后不能是代理项，0xF4 之后不能超出 U+10FFFF
+static inline bool checkLead(const uchar* p, const uchar* end)
+{
+    uchar c = p[0];
+    if (c < 0xC2 || c > 0xF4 || end - p < 2)
+        return false;
+    if (c == 0xE0)
+        return p[1] >= 0xA0;
+    if (c == 0xED)
+        return p[1] <= 0x9F;
+    if (c == 0xF0)
+        return p[1] >= 0x90;
+    if (c == 0xF4)
+        return p[1] <= 0x8F;
+    return true;
+}
+
+// 校验整个文件是否为合法的 UTF-8：拒绝过长编码、代理项和超出 U+10FFFF 的码点。
+//
+// 用 SSE2 每次处理 64 个字节，得到每个字节是否为后续字节、多字节字符首字节的位掩码。
+// 首字节之后应有的后续字节可以由首字节的掩码移位得到，与实际的后续字节掩码相同时结构正确；
+// 少数需要检查第二个字节取值范围的首字节再逐个检查。汉字等连续的多字节字符也不需要逐字节分支
+bool EncodingDetector::isUtf8(const char* data, qint64 size)
+{
+    const uchar* p = reinterpret_cast<const uchar*>(data);
+    const uchar* end = p + size;
+#ifdef __SSE2__
+    quint64 carry = 0;  // 上一块末尾的首字节要求本块开头是后续字节
+    uchar tail[64];
+    while (p < end)
+    {
+        const uchar* block = p;
+        // 最后不足 64 字节时复制到补 0 的缓冲区，被截断的字符会因为缺少后续字节而失败
+        if (end - p < 64)
+        {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, p, size_t(end - p));
+            block = tail;
+        }
+        quint64 cont = 0, lead2 = 0, lead3 = 0, lead4 = 0, special = 0;
+        for (int i = 0; i < 4; i++)
+            classify16(block + 16 * i, 16 * i, &cont, &lead2, &lead3, &lead4, &special);
+        quint64 required = (lead2 << 1) | (lead3 << 2) | (lead4 << 3) | carry;
+        if (required != cont)
+            return false;
+        carry = (lead2 >> 63) | (lead3 >> 62) | (lead4 >> 61);
+        while (special)
+        {
+            if (!checkLead(p + qCountTrailingZeroBits(special), end))
+                return false;
+            special &= special - 1;
+        }
+        p += 64;
+    }
+    return carry == 0;
+#else
+    while (p < end)
+    {
+        uchar c = *p;
+        if (c < 0x80)
+        {
+            p++;
+            continue;
+        }
+        int trail = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : 1;
+        if (!checkLead(p, end) || end - p <= trail)
+            return false;
+        for (int i = 1; i <= trail; i++)
+        {
+            if ((p[i] & 0xC0) != 0x80)
+                return false;
+        }
+        p += trail + 1;
+    }
+    return true;
+#endif
+}
+
+// 没有 BOM 的 UTF-16：ASCII 字符的高字节为 0，常用汉字的高字节在 0x4E 到 0x9F 之间，
+// 所以高字节一侧大多落在这些范围内。低字节几乎不会是 0，也不会集中在汉字的范围内
+QByteArray EncodingDetector::guessUtf16(const char* data, qint64 size)
+{
+    const uchar* p = reinterpret_cast<const uchar*>(data);
+    qint64 pairs = size / 2;
+    if (pairs < 2)
+        return QByteArray();
+    qint64 zeros[2] = {0, 0};  // 偶数、奇数位置上 0 字节的个数
+    qint64 cjk[2] = {0, 0};    // 偶数、奇数位置上 0x4E 到 0x9F 的字节个数
+    for (qint64 i = 0; i < pairs * 2; i++)
+    {
+        uchar c = p[i];
+        if (c == 0)
+            zeros[i & 1]++;
+        else if (c >= 0x4E && c <= 0x9F)
+            cjk[i & 1]++;
+    }
+    for (int high = 0; high < 2; high++)
+    {
+        int low = 1 - high;
+        // 高字节大多是 0 或汉字的范围，低字节很少是 0 且不集中在汉字的范围内
+        if ((zeros[high] + cjk[high]) * 10 >= pairs * 7 && zeros[low] * 20 < pairs
+            && (zeros[high] * 10 >= pairs * 3 || cjk[low] * 2 < pairs))
+            return high ? "UTF-16LE" : "UTF-16BE";
+    }
+    return QByteArray();
+}
+
+// 是否像 GB18030 文本：双字节字符的首字节为 0x81 到 0xFE，尾字节为 0x40 到 0xFE（除 0x7F），
+// 四字节字符的第二、四字节为数字。允许很少的错误，例如文件中夹杂的少量其他编码
+bool EncodingDetector::isGb18030(const char* data, qint64 size)
+{
+    const uchar* p = reinterpret_cast<const uchar*>(data);
+    qint64 valid = 0, invalid = 0;
+    qint64 i = 0;
+    while (i < size)
+    {
+        uchar c = p[i];
+        if (c < 0x80)
+        {
+            i++;
+            continue;
+        }
+        // 样本末尾被截断的字符不计入
+        if (i + 1 >= size)
+            break;
+        uchar c2 = p[i + 1];
+        if (c == 0x80 || c == 0xFF)
+        {
+            invalid++;
+            i++;
+        }
+        else if (c2 >= 0x40 && c2 <= 0xFE && c2 != 0x7F)
+        {
+            valid++;
+            i += 2;
+        }
+        else if (c2 >= 0x30 && c2 <= 0x39)
+        {
+            if (i + 3 >= size)
+                break;
+            if (p[i + 2] >= 0x81 && p[i + 2] <= 0xFE && p[i + 3] >= 0x30 && p[i + 3] <= 0x39)
+            {
+                valid++;
+                i += 4;
+            }
+            else
+            {
+                invalid++;
+                i++;
+            }
+        }
+        else
+        {
+            invalid++;
+            i++;
+        }
+    }
+    return valid > 0 && invalid * 100 <= valid;
+}
+
+// 是否为二进制文件：有 BOM 或者像 UTF-16 的都是文本。其余的文件含有 0 字节，
+// 或者换行、制表、换页和 ESC（终端颜色）以外的控制字符超过 5% 时，解码为文本没有意义
+bool EncodingDetector::isBinary(const char* data, qint64 size)
+{
+    const uchar* p = reinterpret_cast<const uchar*>(data);
+    qint64 sample = qMin(size, SampleSize);
+    if (detectBom(p, sample).bomLength > 0)
+        return false;
+    if (memchr(data, 0, size_t(sample)))
+        return guessUtf16(data, sample).isEmpty();
+    qint64 controls = 0;
+    for (qint64 i = 0; i < sample; i++)
+    {
+        uchar c = p[i];
+        if ((c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != 0x1B) || c == 0x7F)
+            controls++;
+    }
+    return controls * 20 > sample;
+}
+
+// 指定编码的 BOM，保存时写回文件开头
+QByteArray EncodingDetector::bom(const QByteArray& codecName)
+{
+    if (codecName == "UTF-8")
+        return QByteArray("\xEF\xBB\xBF", 3);
+    if (codecName == "UTF-16BE")
+        return QByteArray("\xFE\xFF", 2);
+    if (codecName == "UTF-16LE")
+        return QByteArray("\xFF\xFE", 2);
+    if (codecName == "UTF-32BE")
+        return QByteArray("\x00\x00\xFE\xFF", 4);
+    if (codecName == "UTF-32LE")
+        return QByteArray("\xFF\xFE\x00\x00", 4);
+    if (codecName == "GB18030")
+        return QByteArray("\x84\x31\x95\x33", 4);
+    return QByteArray();
+}
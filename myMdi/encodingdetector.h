@@ -0,0 +1,27 @@
+#ifndef ENCODINGDETECTOR_H
+#define ENCODINGDETECTOR_H
+
+#include <QByteArray>
+
+// 文本编码检测：依次识别 BOM、校验整个文件是否为合法的 UTF-8，
+// 不是时再根据字节的统计特征判断 UTF-16 或 GB18030（兼容 GBK 和 GB2312）
+class EncodingDetector
+{
+public:
+    struct Result
+    {
+        QByteArray codecName;  // QTextCodec 的编码名称
+        int bomLength;         // 文件开头 BOM 的字节数，没有 BOM 时为 0
+    };
+
+    static Result detect(const char* data, qint64 size);  // 检测文本的编码
+    static bool isUtf8(const char* data, qint64 size);   // 是否为合法的 UTF-8
+    static bool isBinary(const char* data, qint64 size);  // 是否为二进制文件，只检查开头的样本
+    static QByteArray bom(const QByteArray& codecName);  // 指定编码的 BOM，保存时写回文件开头
+
+private:
+    static QByteArray guessUtf16(const char* data, qint64 size);  // 没有 BOM 的 UTF-16，不是时返回空
+    static bool isGb18030(const char* data, qint64 size);         // 是否像 GB18030 文本
+};
+
+#endif  // ENCODINGDETECTOR_H
@@ -0,0 +1,57 @@
+#include "filewindow.h"
+
+#include <QFileInfo>
+
+static const qint64 MapWindow = 32 << 20;     // 每次映射 32MB，32 位程序也不会耗尽地址空间
+static const qint64 MapAlignment = 64 << 10;  // 映射的起点按 64KB 对齐，满足 Windows 的要求
+
+FileWindow::FileWindow()
+{
+    fileSize = 0;
+    mapped = 0;
+    windowStart = 0;
+    windowLength = 0;
+}
+
+// 以只读方式打开文件，路径统一为规范路径
+bool FileWindow::open(const QString& fileName)
+{
+    file.setFileName(QFileInfo(fileName).canonicalFilePath());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    fileSize = file.size();
+    return true;
+}
+
+// 取得从 offset 开始的连续字节。需要的范围不在当前窗口中时重新映射，
+// length 输入需要的长度，输出实际可用的长度，不会超过窗口的剩余部分
+const uchar* FileWindow::bytes(qint64 offset, qint64* length)
+{
+    if (offset < windowStart || offset + *length > windowStart + windowLength)
+    {
+        reset();
+        windowStart = offset & ~(MapAlignment - 1);
+        windowLength = qMin(MapWindow, fileSize - windowStart);
+        mapped = file.map(windowStart, windowLength);
+        if (!mapped)
+        {
+            if (file.seek(windowStart))
+                buffer = file.read(windowLength);
+            windowLength = buffer.size();
+        }
+    }
+    *length = qMax(qint64(0), qMin(*length, windowStart + windowLength - offset));
+    const uchar* base = mapped ? mapped : reinterpret_cast<const uchar*>(buffer.constData());
+    return base + (offset - windowStart);
+}
+
+// 丢弃当前窗口，下次访问时重新映射或读取。映射的内容与文件同步，读入的窗口则需要重新读取
+void FileWindow::reset()
+{
+    if (mapped)
+        file.unmap(mapped);
+    mapped = 0;
+    buffer.clear();
+    windowStart = 0;
+    windowLength = 0;
+}
@@ -0,0 +1,30 @@
+#ifndef FILEWINDOW_H
+#define FILEWINDOW_H
+
+#include <QByteArray>
+#include <QFile>
+
+// 按窗口访问文件：每次只映射需要访问的一段，占用的地址空间与文件大小无关，
+// 32 位程序也能查看任意大小的文件。无法映射时（例如网络文件）用读取代替
+class FileWindow
+{
+    Q_DISABLE_COPY(FileWindow)
+
+private:
+    QFile file;           // 被访问的文件
+    qint64 fileSize;      // 打开时的文件大小
+    uchar* mapped;        // 当前映射的窗口，无法映射时为 0
+    QByteArray buffer;    // 无法映射时读入的窗口
+    qint64 windowStart;   // 当前窗口在文件中的起点
+    qint64 windowLength;  // 当前窗口的长度
+
+public:
+    FileWindow();
+    bool open(const QString& fileName);                 // 以只读方式打开文件
+    QString fileName() const { return file.fileName(); }  // 文件路径
+    qint64 size() const { return fileSize; }            // 打开时的文件大小
+    const uchar* bytes(qint64 offset, qint64* length);  // 取得从 offset 开始的连续字节
+    void reset();                                       // 丢弃当前窗口，文件被修改后调用
+};
+
+#endif  // FILEWINDOW_H
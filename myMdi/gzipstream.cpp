@@ -0,0 +1,159 @@
+#include "gzipstream.h"
+
+#include <QIODevice>
+
+// Windows 上使用 Qt 自带的 zlib，见 zlib.pri
+#ifdef MYMDI_QT_ZLIB
+#include <QtZlib/zlib.h>
+#else
+#include <zlib.h>
+#endif
+
+static const int InputSize = 256 << 10;   // 每次读入 256KB 压缩数据
+static const int OutputSize = 256 << 10;  // 每次写出 256KB 压缩数据
+static const int GzipWindowBits = 16 + MAX_WBITS;  // 加上 16 表示 gzip 格式而不是 zlib 格式
+
+GzipReader::GzipReader(QIODevice* source) : device(source)
+{
+    stream = new z_stream;
+    stream->zalloc = Z_NULL;
+    stream->zfree = Z_NULL;
+    stream->opaque = Z_NULL;
+    stream->next_in = Z_NULL;
+    stream->avail_in = 0;
+    memberEnded = false;
+    finished = false;
+    if (inflateInit2(stream, GzipWindowBits) != Z_OK)
+    {
+        error = tr("无法初始化解压");
+        finished = true;
+    }
+}
+
+GzipReader::~GzipReader()
+{
+    inflateEnd(stream);
+    delete stream;
+}
+
+// gzip 文件以 0x1F 0x8B 开头
+bool GzipReader::isGzip(const QByteArray& head)
+{
+    return head.size() >= 2 && uchar(head.at(0)) == 0x1F && uchar(head.at(1)) == 0x8B;
+}
+
+// 解压出最多 maxSize 个字节，需要时从设备读入更多压缩数据
+QByteArray GzipReader::read(int maxSize)
+{
+    QByteArray out;
+    if (finished)
+        return out;
+    out.resize(maxSize);
+    stream->next_out = reinterpret_cast<Bytef*>(out.data());
+    stream->avail_out = uInt(maxSize);
+    while (stream->avail_out > 0)
+    {
+        if (stream->avail_in == 0)
+        {
+            input.resize(InputSize);
+            qint64 count = device->read(input.data(), InputSize);
+            if (count < 0)
+            {
+                error = device->errorString();
+                finished = true;
+                break;
+            }
+            if (count == 0)
+            {
+                // 压缩数据在一个成员的中间结束，文件被截断了
+                if (!memberEnded)
+                    error = tr("压缩数据不完整");
+                finished = true;
+                break;
+            }
+            stream->next_in = reinterpret_cast<Bytef*>(input.data());
+            stream->avail_in = uInt(count);
+        }
+        int result = inflate(stream, Z_NO_FLUSH);
+        if (result == Z_STREAM_END)
+        {
+            // 一个成员结束，后面可能还有连接在一起的成员
+            memberEnded = true;
+            inflateReset(stream);
+            continue;
+        }
+        if (result != Z_OK)
+        {
+            // 完整的成员之后的多余数据（例如补齐用的 0）与 gzip 命令一样忽略
+            if (!memberEnded)
+                error = stream->msg ? QString::fromLatin1(stream->msg) : tr("压缩数据有错误");
+            finished = true;
+            break;
+        }
+        memberEnded = false;
+    }
+    out.resize(maxSize - int(stream->avail_out));
+    return out;
+}
+
+GzipWriter::GzipWriter(QIODevice* target) : device(target)
+{
+    stream = new z_stream;
+    stream->zalloc = Z_NULL;
+    stream->zfree = Z_NULL;
+    stream->opaque = Z_NULL;
+    output.resize(OutputSize);
+    if (deflateInit2(stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, GzipWindowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        error = tr("无法初始化压缩");
+}
+
+GzipWriter::~GzipWriter()
+{
+    deflateEnd(stream);
+    delete stream;
+}
+
+// 压缩已经提供给 zlib 的数据，每填满一次缓冲区就写入设备
+bool GzipWriter::deflateInput(int flush)
+{
+    int result;
+    do
+    {
+        stream->next_out = reinterpret_cast<Bytef*>(output.data());
+        stream->avail_out = uInt(output.size());
+        result = deflate(stream, flush);
+        if (result == Z_STREAM_ERROR)
+        {
+            error = tr("压缩出错");
+            return false;
+        }
+        qint64 count = output.size() - int(stream->avail_out);
+        if (count > 0 && device->write(output.constData(), count) != count)
+        {
+            error = device->errorString();
+            return false;
+        }
+        // 缓冲区被填满时 zlib 可能还有没输出的数据
+    } while (stream->avail_out == 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+    return true;
+}
+
+// 压缩并写入一块数据
+bool GzipWriter::write(const QByteArray& data)
+{
+    if (!error.isEmpty())
+        return false;
+    stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+    stream->avail_in = uInt(data.size());
+    return deflateInput(Z_NO_FLUSH);
+}
+
+// 写入剩余的压缩数据和 gzip 文件尾，之后不能再写入
+bool GzipWriter::finish()
+{
+    if (!error.isEmpty())
+        return false;
+    stream->next_in = Z_NULL;
+    stream->avail_in = 0;
+    return deflateInput(Z_FINISH);
+}
@@ -0,0 +1,54 @@
+#ifndef GZIPSTREAM_H
+#define GZIPSTREAM_H
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QString>
+
+class QIODevice;
+struct z_stream_s;
+
+// 边读边解压 gzip 文件，任何时候只有一小块压缩数据和解压结果在内存中。
+// 支持多个 gzip 成员连接而成的文件
+class GzipReader
+{
+    Q_DECLARE_TR_FUNCTIONS(GzipReader)
+
+private:
+    QIODevice* device;   // 压缩数据的来源
+    z_stream_s* stream;  // zlib 的解压状态
+    QByteArray input;    // 读入的压缩数据
+    bool memberEnded;    // 刚好解压完一个完整的 gzip 成员
+    bool finished;       // 已经解压到文件末尾或者出错
+    QString error;       // 出错信息，为空表示成功
+
+public:
+    explicit GzipReader(QIODevice* source);
+    ~GzipReader();
+    static bool isGzip(const QByteArray& head);  // 是否以 gzip 的魔数开头
+    QByteArray read(int maxSize);                // 解压出最多 maxSize 个字节，结束或出错时返回空
+    QString errorString() const { return error; }  // 出错信息
+};
+
+// 边压缩边写入 gzip 文件
+class GzipWriter
+{
+    Q_DECLARE_TR_FUNCTIONS(GzipWriter)
+
+private:
+    QIODevice* device;   // 压缩数据的去向
+    z_stream_s* stream;  // zlib 的压缩状态
+    QByteArray output;   // 压缩结果的缓冲区
+    QString error;       // 出错信息，为空表示成功
+
+    bool deflateInput(int flush);  // 压缩已经提供的数据并写入
+
+public:
+    explicit GzipWriter(QIODevice* target);
+    ~GzipWriter();
+    bool write(const QByteArray& data);  // 压缩并写入一块数据
+    bool finish();                       // 写入剩余的压缩数据和 gzip 文件尾
+    QString errorString() const { return error; }  // 出错信息
+};
+
+#endif  // GZIPSTREAM_H
@@ -0,0 +1,544 @@
+#include "hexview.h"
+
+#include <QCloseEvent>
+#include <QFileInfo>
+#include <QKeyEvent>
+#include <QMessageBox>
+#include <QPainter>
+#include <QPushButton>
+#include <QScrollBar>
+#include <string.h>
+
+#include "largefileview.h"
+
+static const qint64 MaxScrollSteps = 1 << 30;  // 滚动条最多的格数，不超出 int 的范围
+
+FilePatchRequest::FilePatchRequest(const QString& fileName, const QMap<qint64, char>& bytes, int priority)
+    : IoRequest(priority), path(fileName), patches(bytes)
+{
+}
+
+// 以读写方式打开文件，把连续的修改合并为一次写入。这里直接修改原文件而不是写入临时文件再替换，
+// 否则保存几个字节也要复制整个文件；开始写入后不再检查是否被取消，避免只写入一部分修改
+void FilePatchRequest::run()
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadWrite))
+    {
+        error = file.errorString();
+        return;
+    }
+    qint64 total = patches.size();
+    qint64 written = 0;
+    QMap<qint64, char>::const_iterator it = patches.constBegin();
+    while (it != patches.constEnd())
+    {
+        qint64 start = it.key();
+        QByteArray bytes;
+        do
+        {
+            bytes.append(it.value());
+            ++it;
+        } while (it != patches.constEnd() && it.key() == start + bytes.size());
+        // 文件在打开后被其他程序截短时不能写入，否则会在末尾之后补 0
+        if (start + bytes.size() > file.size())
+        {
+            error = tr("文件已被其他程序改变");
+            return;
+        }
+        if (!file.seek(start) || file.write(bytes) != bytes.size())
+        {
+            error = file.errorString();
+            return;
+        }
+        written += bytes.size();
+        setProgress(written, total);
+    }
+    if (!file.flush())
+        error = file.errorString();
+}
+
+HexView::HexView(QWidget* parent) : QAbstractScrollArea(parent)
+{
+    setAttribute(Qt::WA_DeleteOnClose);
+    fileSize = 0;
+    writable = false;
+    topRow = 0;
+    cursorOffset = 0;
+    lowNibble = false;
+    textSide = false;
+    rowsPerStep = 1;
+    searchPercent = -1;
+    matchOffset = -1;
+    matchLength = 0;
+    isUpdatingScrollBar = false;
+    // 等宽字体，各列对齐
+    QFont font("Courier New");
+    font.setStyleHint(QFont::TypeWriter);
+    setFont(font);
+    viewport()->setBackgroundRole(QPalette::Base);
+    viewport()->setCursor(Qt::IBeamCursor);
+    setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
+}
+
+HexView::~HexView()
+{
+    if (searchRequest)
+        searchRequest->cancel();
+}
+
+// 搜索内容：由空格分隔的十六进制数字（例如 DE AD BE EF）按字节搜索，
+// 加上双引号或者不是十六进制数字时按 UTF-8 编码的文本搜索
+QByteArray HexView::patternFromText(const QString& text)
+{
+    if (text.size() >= 2 && text.startsWith(QLatin1Char('"')) && text.endsWith(QLatin1Char('"')))
+        return text.mid(1, text.size() - 2).toUtf8();
+    QString digits = text;
+    digits.remove(QLatin1Char(' '));
+    bool isHex = !digits.isEmpty() && digits.size() % 2 == 0;
+    for (int i = 0; isHex && i < digits.size(); i++)
+    {
+        QChar c = digits.at(i).toLower();
+        isHex = (c >= QLatin1Char('0') && c <= QLatin1Char('9')) || (c >= QLatin1Char('a') && c <= QLatin1Char('f'));
+    }
+    return isHex ? QByteArray::fromHex(digits.toLatin1()) : text.toUtf8();
+}
+
+// 打开文件，只有可写的文件才能修改
+bool HexView::openFile(const QString& fileName)
+{
+    if (!file.open(fileName))
+        return false;
+    fileSize = file.size();
+    writable = QFileInfo(file.fileName()).isWritable();
+    setWindowFilePath(file.fileName());
+    updateScrollBar();
+    updateTitle();
+    return true;
+}
+
+// 文件路径
+QString HexView::currentFile() const { return file.fileName(); }
+
+// 文件名
+QString HexView::userFriendlyCurrentFile() const { return QFileInfo(file.fileName()).fileName(); }
+
+// 取得一行的字节，再覆盖上这一行中未保存的修改
+int HexView::rowBytes(qint64 row, uchar* data)
+{
+    qint64 start = row * BytesPerRow;
+    qint64 length = qMax(qint64(0), qMin(qint64(BytesPerRow), fileSize - start));
+    const uchar* p = file.bytes(start, &length);
+    memcpy(data, p, size_t(length));
+    QMap<qint64, char>::const_iterator it = edits.lowerBound(start);
+    for (; it != edits.constEnd() && it.key() < start + length; ++it)
+        data[it.key() - start] = uchar(it.value());
+    return int(length);
+}
+
+// 总行数
+qint64 HexView::rowCount() const { return (fileSize + BytesPerRow - 1) / BytesPerRow; }
+
+// 可以显示的行数
+int HexView::visibleRowCount() const { return qMax(1, viewport()->height() / fontMetrics().lineSpacing()); }
+
+// 偏移栏的十六进制位数，超过 4GB 的文件需要更多位
+int HexView::offsetDigits() const { return fileSize > 0xFFFFFFFFLL ? 12 : 8; }
+
+// 一个字符的宽度
+int HexView::charWidth() const { return fontMetrics().width(QLatin1Char('0')); }
+
+// 第 column 个字节的十六进制的横坐标：偏移栏之后，每个字节占 3 个字符，前后两半之间多空一格
+int HexView::hexX(int column) const
+{
+    return (offsetDigits() + 2 + column * 3 + (column >= BytesPerRow / 2 ? 1 : 0)) * charWidth();
+}
+
+// 第 column 个字节的字符的横坐标：十六进制栏之后
+int HexView::textX(int column) const { return hexX(0) + (BytesPerRow * 3 + 2 + column) * charWidth(); }
+
+// 设置第一行，不超出文件末尾
+void HexView::setTop(qint64 row)
+{
+    topRow = qBound(qint64(0), row, qMax(qint64(0), rowCount() - visibleRowCount()));
+    updateScrollBar();
+    viewport()->update();
+}
+
+// 移动光标，光标不可见时滚动到光标所在的行
+void HexView::moveCursorTo(qint64 offset)
+{
+    cursorOffset = qBound(qint64(0), offset, qMax(qint64(0), fileSize - 1));
+    lowNibble = false;
+    qint64 row = cursorOffset / BytesPerRow;
+    if (row < topRow)
+        setTop(row);
+    else if (row >= topRow + visibleRowCount())
+        setTop(row - visibleRowCount() + 1);
+    viewport()->update();
+    emit cursorOffsetChanged(cursorOffset);
+}
+
+// 修改光标处的字节。改回原来的值时去掉这项修改，全部改回时文档恢复为未修改
+void HexView::overwrite(uchar value)
+{
+    if (!writable || cursorOffset >= fileSize)
+        return;
+    qint64 length = 1;
+    const uchar* original = file.bytes(cursorOffset, &length);
+    if (length == 1 && *original == value)
+        edits.remove(cursorOffset);
+    else
+        edits.insert(cursorOffset, char(value));
+    setWindowModified(isModified());
+    viewport()->update();
+}
+
+// 根据第一行设置滚动条。行数超过 int 的范围时每一格对应多行，不触发 scrollContentsBy() 中的定位
+void HexView::updateScrollBar()
+{
+    qint64 maxTop = qMax(qint64(0), rowCount() - visibleRowCount());
+    rowsPerStep = maxTop / MaxScrollSteps + 1;
+    isUpdatingScrollBar = true;
+    verticalScrollBar()->setRange(0, int(maxTop / rowsPerStep));
+    verticalScrollBar()->setPageStep(int(qMax(qint64(1), visibleRowCount() / rowsPerStep)));
+    verticalScrollBar()->setValue(int(topRow / rowsPerStep));
+    isUpdatingScrollBar = false;
+}
+
+// 在标题中显示只读状态和搜索进度
+void HexView::updateTitle()
+{
+    QString title = userFriendlyCurrentFile() + "[*]" + tr(" [十六进制]");
+    if (!writable)
+        title += tr(" [只读]");
+    if (searchPercent >= 0)
+        title += tr(" (搜索中 %1%)").arg(searchPercent);
+    setWindowTitle(title);
+}
+
+// 关闭前询问是否保存修改
+bool HexView::maybeSave()
+{
+    if (!isModified())
+        return true;
+    QMessageBox box;
+    box.setWindowTitle(tr("多文档编辑器"));
+    box.setText(tr("是否保存对“%1”的更改？").arg(userFriendlyCurrentFile()));
+    box.setIcon(QMessageBox::Warning);
+    QPushButton* yesBtn = box.addButton(tr("是(&Y)"), QMessageBox::YesRole);
+    box.addButton(tr("否(&N)"), QMessageBox::NoRole);
+    QPushButton* cancelBtn = box.addButton(tr("取消"), QMessageBox::RejectRole);
+    box.exec();
+    if (box.clickedButton() == yesBtn)
+        return save(true);
+    return box.clickedButton() != cancelBtn;
+}
+
+// 把修改写回文件。写入在 I/O 线程中进行，期间仍然可以继续修改
+bool HexView::save(bool wait)
+{
+    if (saveRequest)
+        return false;
+    if (!isModified())
+        return true;
+    FilePatchRequest* request = new FilePatchRequest(file.fileName(), edits, DocumentIo::Active);
+    saveRequest = request;
+    if (wait)
+    {
+        DocumentIo::instance()->submit(request);
+        request->waitForFinished();
+        return finishSave(request);
+    }
+    connect(request, SIGNAL(finished()), this, SLOT(saveRequestFinished()));
+    DocumentIo::instance()->submit(request);
+    return true;
+}
+
+// 保存完成：去掉已经写入的修改，写入期间又改过的字节保留
+bool HexView::finishSave(FilePatchRequest* request)
+{
+    saveRequest = 0;
+    ioError = request->wasCancelled() ? tr("保存被取消") : request->errorString();
+    bool ok = ioError.isEmpty();
+    if (ok)
+    {
+        QMap<qint64, char> written = request->bytes();
+        for (QMap<qint64, char>::const_iterator it = written.constBegin(); it != written.constEnd(); ++it)
+        {
+            if (edits.value(it.key()) == it.value())
+                edits.remove(it.key());
+        }
+        // 映射的窗口会看到新的内容，读入的窗口需要重新读取
+        file.reset();
+        setWindowModified(isModified());
+        viewport()->update();
+    }
+    else
+    {
+        QMessageBox::warning(this, tr("多文档编辑器"), tr("无法写入文件 %1:\n%2.").arg(file.fileName()).arg(ioError));
+    }
+    emit saveFinished(ok);
+    return ok;
+}
+
+// 跳转到指定的字节，所在的行显示在上部
+void HexView::gotoOffset(qint64 offset)
+{
+    offset = qBound(qint64(0), offset, qMax(qint64(0), fileSize - 1));
+    setTop(offset / BytesPerRow - visibleRowCount() / 3);
+    moveCursorTo(offset);
+}
+
+// 从光标处（光标在上一个搜索结果上时从下一个字节）开始在后台搜索，结果通过 searchFinished() 通知。
+// 搜索的是硬盘上的文件，不包括未保存的修改
+void HexView::find(const QByteArray& pattern)
+{
+    if (pattern.isEmpty())
+        return;
+    if (searchRequest)
+        searchRequest->cancel();
+    qint64 start = cursorOffset + (matchOffset == cursorOffset ? 1 : 0);
+    FileSearchRequest* request = new FileSearchRequest(file.fileName(), pattern, start, DocumentIo::Active);
+    searchRequest = request;
+    matchLength = pattern.size();
+    searchPercent = 0;
+    connect(request, SIGNAL(progress(qint64, qint64)), this, SLOT(searchProgress(qint64, qint64)));
+    connect(request, SIGNAL(finished()), this, SLOT(searchRequestFinished()));
+    DocumentIo::instance()->submit(request);
+    updateTitle();
+}
+
+// 绘制可见的行：左侧为偏移，中间为十六进制，右侧为可打印的 ASCII 字符。
+// 修改过的字节用红色显示，光标所在的一栏用选中颜色，另一栏用较浅的颜色
+void HexView::paintEvent(QPaintEvent*)
+{
+    QPainter painter(viewport());
+    int lineHeight = fontMetrics().lineSpacing();
+    int cw = charWidth();
+    int digits = offsetDigits();
+    int rows = visibleRowCount() + 1;
+    painter.fillRect(0, 0, hexX(0) - cw, viewport()->height(), palette().window());
+    uchar data[BytesPerRow];
+    for (int r = 0; r < rows; r++)
+    {
+        qint64 start = (topRow + r) * BytesPerRow;
+        if (start >= fileSize)
+            break;
+        int count = rowBytes(topRow + r, data);
+        int y = r * lineHeight;
+        painter.setPen(palette().color(QPalette::Dark));
+        painter.drawText(cw / 2, y, digits * cw, lineHeight, Qt::AlignLeft | Qt::AlignVCenter,
+                         QString("%1").arg(start, digits, 16, QLatin1Char('0')).toUpper());
+        for (int i = 0; i < count; i++)
+        {
+            qint64 offset = start + i;
+            QRect hexRect(hexX(i), y, cw * 2, lineHeight);
+            QRect textRect(textX(i), y, cw, lineHeight);
+            bool matched = matchOffset >= 0 && offset >= matchOffset && offset < matchOffset + matchLength;
+            if (matched)
+            {
+                painter.fillRect(hexRect, palette().highlight());
+                painter.fillRect(textRect, palette().highlight());
+            }
+            if (offset == cursorOffset)
+            {
+                // 已经输入了高 4 位时只标出低 4 位
+                QRect cursorRect = lowNibble ? hexRect.adjusted(cw, 0, 0, 0) : hexRect;
+                painter.fillRect(textSide ? cursorRect : textRect, palette().midlight());
+                painter.fillRect(textSide ? textRect : cursorRect, palette().highlight());
+            }
+            if (edits.contains(offset))
+                painter.setPen(Qt::red);
+            else if (matched || offset == cursorOffset)
+                painter.setPen(palette().color(QPalette::HighlightedText));
+            else
+                painter.setPen(palette().color(QPalette::Text));
+            painter.drawText(hexRect, Qt::AlignLeft | Qt::AlignVCenter,
+                             QString("%1").arg(uint(data[i]), 2, 16, QLatin1Char('0')).toUpper());
+            painter.drawText(textRect, Qt::AlignLeft | Qt::AlignVCenter,
+                             QString(QChar(data[i] >= 0x20 && data[i] < 0x7F ? data[i] : '.')));
+        }
+    }
+}
+
+// 方向键和翻页键移动光标，Tab 在十六进制栏和字符栏之间切换。
+// 在十六进制栏中输入十六进制数字、在字符栏中输入可打印字符，覆盖光标处的字节
+void HexView::keyPressEvent(QKeyEvent* event)
+{
+    qint64 page = qint64(qMax(1, visibleRowCount() - 1)) * BytesPerRow;
+    qint64 column = cursorOffset % BytesPerRow;
+    bool control = event->modifiers() & Qt::ControlModifier;
+    switch (event->key())
+    {
+    case Qt::Key_Left:
+        moveCursorTo(cursorOffset - 1);
+        return;
+    case Qt::Key_Right:
+        moveCursorTo(cursorOffset + 1);
+        return;
+    case Qt::Key_Up:
+        if (cursorOffset >= BytesPerRow)
+            moveCursorTo(cursorOffset - BytesPerRow);
+        return;
+    case Qt::Key_Down:
+        if (cursorOffset + BytesPerRow < fileSize)
+            moveCursorTo(cursorOffset + BytesPerRow);
+        return;
+    case Qt::Key_PageUp:
+        moveCursorTo(cursorOffset >= page ? cursorOffset - page : column);
+        return;
+    case Qt::Key_PageDown:
+        moveCursorTo(cursorOffset + page < fileSize ? cursorOffset + page : fileSize - 1);
+        return;
+    case Qt::Key_Home:
+        moveCursorTo(control ? 0 : cursorOffset - column);
+        return;
+    case Qt::Key_End:
+        moveCursorTo(control ? fileSize - 1 : cursorOffset - column + BytesPerRow - 1);
+        return;
+    case Qt::Key_Tab:
+    case Qt::Key_Backtab:
+        textSide = !textSide;
+        lowNibble = false;
+        viewport()->update();
+        return;
+    }
+    QString text = event->text();
+    if (text.size() != 1 || control || (event->modifiers() & Qt::AltModifier) || fileSize == 0)
+    {
+        QAbstractScrollArea::keyPressEvent(event);
+        return;
+    }
+    ushort c = text.at(0).unicode();
+    if (textSide)
+    {
+        if (c < 0x20 || c >= 0x7F)
+            return;
+        overwrite(uchar(c));
+        moveCursorTo(cursorOffset + 1);
+        return;
+    }
+    bool isDigit;
+    int digit = QString(QChar(c)).toInt(&isDigit, 16);
+    if (!isDigit)
+        return;
+    uchar row[BytesPerRow];
+    rowBytes(cursorOffset / BytesPerRow, row);
+    uchar current = row[column];
+    overwrite(lowNibble ? uchar((current & 0xF0) | digit) : uchar((digit << 4) | (current & 0x0F)));
+    if (lowNibble)
+    {
+        moveCursorTo(cursorOffset + 1);
+    }
+    else
+    {
+        lowNibble = true;
+        viewport()->update();
+    }
+}
+
+// 点击十六进制栏或字符栏时把光标移到对应的字节
+void HexView::mousePressEvent(QMouseEvent* event)
+{
+    int x = event->pos().x();
+    int column = -1;
+    bool text = x >= textX(0);
+    if (text)
+    {
+        column = (x - textX(0)) / charWidth();
+    }
+    else
+    {
+        for (int i = BytesPerRow - 1; i >= 0 && column < 0; i--)
+        {
+            if (x >= hexX(i))
+                column = i;
+        }
+    }
+    if (column < 0 || column >= BytesPerRow)
+        return;
+    qint64 offset = (topRow + event->pos().y() / fontMetrics().lineSpacing()) * BytesPerRow + column;
+    if (offset >= fileSize)
+        return;
+    textSide = text;
+    moveCursorTo(offset);
+}
+
+// 滚轮每一格滚动 3 行
+void HexView::wheelEvent(QWheelEvent* event)
+{
+    setTop(topRow - event->angleDelta().y() / 120 * 3);
+    event->accept();
+}
+
+// 窗口大小改变后可显示的行数变了，重新计算滚动范围
+void HexView::resizeEvent(QResizeEvent* event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    setTop(topRow);
+}
+
+// 拖动滚动条时定位到对应的行
+void HexView::scrollContentsBy(int, int)
+{
+    if (isUpdatingScrollBar)
+        return;
+    topRow = qMin(qint64(verticalScrollBar()->value()) * rowsPerStep,
+                  qMax(qint64(0), rowCount() - visibleRowCount()));
+    viewport()->update();
+}
+
+// 关闭事件：正在保存时先等待保存完成，然后询问是否保存剩余的修改
+void HexView::closeEvent(QCloseEvent* event)
+{
+    if (FilePatchRequest* request = saveRequest)
+    {
+        request->waitForFinished();
+        finishSave(request);
+    }
+    if (maybeSave())
+        event->accept();
+    else
+        event->ignore();
+}
+
+// Tab 键用于切换栏，不移动焦点
+bool HexView::focusNextPrevChild(bool) { return false; }
+
+// 搜索进度
+void HexView::searchProgress(qint64 processed, qint64 total)
+{
+    if (!searchRequest || sender() != searchRequest.data())
+        return;
+    searchPercent = total > 0 ? int(processed * 100 / total) : 100;
+    updateTitle();
+}
+
+// 搜索结束，找到时把光标移到结果处
+void HexView::searchRequestFinished()
+{
+    FileSearchRequest* request = qobject_cast<FileSearchRequest*>(sender());
+    if (!request || request != searchRequest)
+        return;
+    searchRequest = 0;
+    searchPercent = -1;
+    updateTitle();
+    if (request->wasCancelled())
+        return;
+    bool found = request->position() >= 0;
+    if (found)
+    {
+        matchOffset = request->position();
+        gotoOffset(matchOffset);
+    }
+    emit searchFinished(found);
+}
+
+// 保存请求结束，忽略已经在关闭窗口时处理过的请求
+void HexView::saveRequestFinished()
+{
+    FilePatchRequest* request = qobject_cast<FilePatchRequest*>(sender());
+    if (request && request == saveRequest)
+        finishSave(request);
+}
@@ -0,0 +1,106 @@
+#ifndef HEXVIEW_H
+#define HEXVIEW_H
+
+#include <QAbstractScrollArea>
+#include <QMap>
+#include <QPointer>
+
+#include "documentio.h"
+#include "filewindow.h"
+
+class FileSearchRequest;
+
+// 把修改过的字节写回文件的原位置。文件大小不变，只写入修改过的部分，
+// 几 GB 的文件也不需要重写整个文件
+class FilePatchRequest : public IoRequest
+{
+    Q_OBJECT
+private:
+    QString path;                // 文件路径
+    QMap<qint64, char> patches;  // 修改过的位置和新的字节值
+
+protected:
+    void run();
+
+public:
+    FilePatchRequest(const QString& fileName, const QMap<qint64, char>& bytes, int priority);
+    QMap<qint64, char> bytes() const { return patches; }  // 写入的修改
+};
+
+// 二进制文件的十六进制查看器：按窗口映射文件，只绘制可见的行，可以查看任意大小的文件。
+// 支持按偏移跳转、搜索字节序列，以及不改变文件大小的覆盖修改
+class HexView : public QAbstractScrollArea
+{
+    Q_OBJECT
+public:
+    static const int BytesPerRow = 16;  // 每行显示的字节数
+
+private:
+    FileWindow file;                            // 被查看的文件
+    qint64 fileSize;                            // 文件大小
+    bool writable;                              // 文件是否可以修改
+    QMap<qint64, char> edits;                   // 尚未保存的修改，按位置记录新的字节值
+    qint64 topRow;                              // 第一行的行号
+    qint64 cursorOffset;                        // 光标所在的字节
+    bool lowNibble;                             // 下一个输入的十六进制数字是光标处字节的低 4 位
+    bool textSide;                              // 光标在右侧的字符栏中
+    qint64 rowsPerStep;                         // 滚动条每一格对应的行数，行数超过 int 的范围时大于 1
+    QPointer<FileSearchRequest> searchRequest;  // 正在进行的搜索
+    QPointer<FilePatchRequest> saveRequest;     // 正在进行的保存
+    int searchPercent;                          // 搜索的进度，没有搜索时为 -1
+    qint64 matchOffset;                         // 搜索结果的位置，没有时为 -1
+    qint64 matchLength;                         // 搜索结果的字节数
+    bool isUpdatingScrollBar;                   // 正在根据位置设置滚动条
+    QString ioError;                            // 最近一次保存的出错信息
+
+    int rowBytes(qint64 row, uchar* data);      // 取得一行的字节（包括未保存的修改），返回字节数
+    qint64 rowCount() const;                    // 总行数
+    int visibleRowCount() const;                // 可以显示的行数
+    int offsetDigits() const;                   // 偏移栏的十六进制位数
+    int charWidth() const;                      // 一个字符的宽度
+    int hexX(int column) const;                 // 第 column 个字节的十六进制在行中的横坐标
+    int textX(int column) const;                // 第 column 个字节的字符在行中的横坐标
+    void setTop(qint64 row);                    // 设置第一行
+    void moveCursorTo(qint64 offset);           // 移动光标，并保证光标可见
+    void overwrite(uchar value);                // 修改光标处的字节
+    void updateScrollBar();                     // 根据第一行设置滚动条
+    void updateTitle();                         // 在标题中显示状态和进度
+    bool maybeSave();                           // 是否需要保存
+    bool finishSave(FilePatchRequest* request); // 保存完成
+
+protected:
+    void paintEvent(QPaintEvent* event);
+    void keyPressEvent(QKeyEvent* event);
+    void mousePressEvent(QMouseEvent* event);
+    void wheelEvent(QWheelEvent* event);
+    void resizeEvent(QResizeEvent* event);
+    void scrollContentsBy(int dx, int dy);
+    void closeEvent(QCloseEvent* event);
+    bool focusNextPrevChild(bool next);
+
+public:
+    explicit HexView(QWidget* parent = 0);
+    ~HexView();
+    static QByteArray patternFromText(const QString& text);  // 搜索内容：十六进制字节，或者按 UTF-8 编码的文本
+    bool openFile(const QString& fileName);        // 打开文件
+    QString currentFile() const;                   // 文件路径
+    QString userFriendlyCurrentFile() const;       // 文件名
+    qint64 size() const { return fileSize; }       // 文件大小
+    bool isModified() const { return !edits.isEmpty(); }  // 是否有未保存的修改
+    bool save(bool wait = false);                  // 把修改写回文件，wait 为 true 时等待写入完成
+    QString errorString() const { return ioError; }  // 最近一次保存的出错信息
+    void gotoOffset(qint64 offset);                // 跳转到指定的字节
+    void find(const QByteArray& pattern);          // 从光标之后搜索字节序列
+
+signals:
+    void searchFinished(bool found);           // 搜索结束
+    void saveFinished(bool ok);                // 保存结束
+    void cursorOffsetChanged(qint64 offset);   // 光标移动
+
+private slots:
+    void searchProgress(qint64 processed, qint64 total);  // 搜索进度
+    void searchRequestFinished();                         // 搜索结束
+    void saveRequestFinished();                           // 保存请求结束
+};
+
+#endif  // HEXVIEW_H
@@ -0,0 +1,632 @@
+#include "largefileview.h"
+
+#include <QFileInfo>
+#include <QKeyEvent>
+#include <QPainter>
+#include <QScrollBar>
+#include <QTextCodec>
+#include <QtAlgorithms>
+#include <algorithm>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "encodingdetector.h"
+
+static const qint64 ScanChunk = 4 << 20;        // 后台扫描和搜索每次读取 4MB
+static const qint64 LineChunk = 1 << 20;        // 查找行首行尾时每次检查 1MB
+static const qint64 MaxLineBytes = 16 << 10;    // 超长的行按 16KB 分段显示，界面线程每次最多检查两段
+static const int ScrollRange = 1000000;         // 滚动条按文件的百万分比定位
+
+LineIndexRequest::LineIndexRequest(const QString& fileName, int priority) : IoRequest(priority), path(fileName)
+{
+    lines = 0;
+}
+
+// 取走新找到的行首位置
+QVector<qint64> LineIndexRequest::takeCheckpoints()
+{
+    QMutexLocker locker(&mutex);
+    QVector<qint64> result = found;
+    found.clear();
+    return result;
+}
+
+// 已经扫描过的行数
+qint64 LineIndexRequest::lineCount()
+{
+    QMutexLocker locker(&mutex);
+    return lines;
+}
+
+// 分块读取整个文件统计换行符，每隔 IndexStep 行记录一次行首位置
+void LineIndexRequest::run()
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        error = file.errorString();
+        return;
+    }
+    qint64 total = file.size();
+    QByteArray chunk;
+    chunk.resize(int(ScanChunk));
+    qint64 offset = 0;
+    qint64 count = 0;
+    QVector<qint64> batch;
+    batch << 0;
+    while (offset < total)
+    {
+        if (isCancelled())
+            return;
+        qint64 length = file.read(chunk.data(), qMin(ScanChunk, total - offset));
+        if (length <= 0)
+        {
+            error = file.errorString();
+            return;
+        }
+        const char* begin = chunk.constData();
+        const char* end = begin + length;
+        const char* p = begin;
+        while ((p = static_cast<const char*>(memchr(p, '\n', size_t(end - p)))) != 0)
+        {
+            p++;
+            if (++count % LargeFileView::IndexStep == 0)
+                batch << offset + (p - begin);
+        }
+        offset += length;
+        {
+            QMutexLocker locker(&mutex);
+            found += batch;
+            lines = count;
+        }
+        batch.clear();
+        setProgress(offset, total);
+    }
+    // 最后一行没有换行符也算一行
+    QMutexLocker locker(&mutex);
+    lines = count + 1;
+}
+
+// 在 data 的前 size 个字节中查找 pattern，返回第一次出现的位置，没有找到时返回 -1。
+// 用 SSE2 同时检查 16 个起点：第一个和最后一个字节都相同的起点才逐字节比较，
+// 二进制文件中大量重复的字节（例如成片的 0）只会让第一个字节相同，不会频繁地逐字节比较
+static qint64 indexOf(const char* data, qint64 size, const QByteArray& pattern)
+{
+    int n = pattern.size();
+    const char* p = pattern.constData();
+    qint64 last = size - n;  // 最后一个可能的起点
+    qint64 i = 0;
+    if (n == 0 || last < 0)
+        return -1;
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(p[0]);
+    const __m128i final = _mm_set1_epi8(p[n - 1]);
+    for (; i + 15 <= last; i += 16)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + n - 1));
+        uint mask = uint(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, final))));
+        while (mask)
+        {
+            qint64 k = i + qCountTrailingZeroBits(mask);
+            if (n <= 2 || memcmp(data + k + 1, p + 1, size_t(n - 2)) == 0)
+                return k;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    // 剩余的起点用 memchr 找第一个字节
+    while (i <= last)
+    {
+        const char* hit = static_cast<const char*>(memchr(data + i, p[0], size_t(last - i + 1)));
+        if (!hit)
+            return -1;
+        i = hit - data;
+        if (memcmp(hit, p, size_t(n)) == 0)
+            return i;
+        i++;
+    }
+    return -1;
+}
+
+FileSearchRequest::FileSearchRequest(const QString& fileName, const QByteArray& bytes, qint64 start, int priority)
+    : IoRequest(priority), path(fileName), pattern(bytes), from(start)
+{
+    result = -1;
+}
+
+// 在起点位于 [begin, end) 之内的位置中搜索，相邻的两块重叠 pattern 长度减 1 个字节
+qint64 FileSearchRequest::search(QFile& file, qint64 begin, qint64 end, qint64* processed)
+{
+    qint64 total = file.size();
+    qint64 position = begin;
+    while (position < end)
+    {
+        if (isCancelled())
+            return -1;
+        qint64 length = qMin(ScanChunk, end - position);
+        if (!file.seek(position))
+            return -1;
+        QByteArray chunk = file.read(qMin(length + pattern.size() - 1, total - position));
+        if (chunk.isEmpty())
+            return -1;
+        qint64 index = indexOf(chunk.constData(), chunk.size(), pattern);
+        if (index >= 0 && index < length)
+            return position + index;
+        position += length;
+        *processed += length;
+        setProgress(*processed, total);
+    }
+    return -1;
+}
+
+// 从起点向后搜索，到文件末尾后再从头搜索到起点
+void FileSearchRequest::run()
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        error = file.errorString();
+        return;
+    }
+    qint64 processed = 0;
+    qint64 start = qBound(qint64(0), from, file.size());
+    result = search(file, start, file.size(), &processed);
+    if (result < 0 && !isCancelled())
+        result = search(file, 0, start, &processed);
+}
+
+LargeFileView::LargeFileView(QWidget* parent) : QAbstractScrollArea(parent)
+{
+    setAttribute(Qt::WA_DeleteOnClose);
+    fileSize = 0;
+    codec = QTextCodec::codecForLocale();
+    totalLines = -1;
+    indexPercent = 0;
+    searchPercent = -1;
+    topOffset = 0;
+    topLine = 0;
+    matchOffset = -1;
+    matchLength = 0;
+    isUpdatingScrollBar = false;
+    // 等宽字体，行号和内容对齐
+    QFont font("Courier New");
+    font.setStyleHint(QFont::TypeWriter);
+    setFont(font);
+    viewport()->setBackgroundRole(QPalette::Base);
+    setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
+}
+
+LargeFileView::~LargeFileView()
+{
+    if (indexRequest)
+        indexRequest->cancel();
+    if (searchRequest)
+        searchRequest->cancel();
+}
+
+// 打开文件，根据开头的内容选择编码，然后在后台建立行索引
+bool LargeFileView::openFile(const QString& fileName)
+{
+    if (!file.open(fileName))
+        return false;
+    fileSize = file.size();
+    setWindowFilePath(file.fileName());
+
+    // 按行查看时只支持换行符为单字节的编码，UTF-16 和 UTF-32 按 UTF-8 显示
+    qint64 length = qMin(fileSize, LineChunk);
+    const uchar* head = file.bytes(0, &length);
+    EncodingDetector::Result detected = EncodingDetector::detect(reinterpret_cast<const char*>(head), length);
+    if (!detected.codecName.startsWith("UTF-16") && !detected.codecName.startsWith("UTF-32"))
+        codec = QTextCodec::codecForName(detected.codecName);
+    if (!codec)
+        codec = QTextCodec::codecForName("UTF-8");
+
+    verticalScrollBar()->setRange(0, int(qMin(fileSize, qint64(ScrollRange))));
+    verticalScrollBar()->setPageStep(qMax(1, verticalScrollBar()->maximum() / 100));
+
+    LineIndexRequest* request = new LineIndexRequest(file.fileName(), DocumentIo::Background);
+    indexRequest = request;
+    connect(request, SIGNAL(progress(qint64, qint64)), this, SLOT(indexProgress(qint64, qint64)));
+    connect(request, SIGNAL(finished()), this, SLOT(indexFinished()));
+    DocumentIo::instance()->submit(request);
+    updateTitle();
+    return true;
+}
+
+// 文件路径
+QString LargeFileView::currentFile() const { return file.fileName(); }
+
+// 文件名
+QString LargeFileView::userFriendlyCurrentFile() const { return QFileInfo(file.fileName()).fileName(); }
+
+// offset 是否为一行的行首，而不是超长的行中间的一段
+bool LargeFileView::isLineStart(qint64 offset)
+{
+    if (offset <= 0)
+        return true;
+    qint64 length = 1;
+    const uchar* p = file.bytes(offset - 1, &length);
+    return length == 1 && *p == '\n';
+}
+
+// offset 之后下一个显示行的起点，没有下一行时返回文件大小。超长的行在文件中 MaxLineBytes 的整数倍处分段，
+// 离行首不到 MaxLineBytes 的位置不分段，所以最多检查 2 * MaxLineBytes 个字节，
+// 绘制、滚动和拖动滚动条的开销与行的长度无关
+qint64 LargeFileView::nextLine(qint64 offset)
+{
+    qint64 limit = qMin(fileSize, (offset + 2 * MaxLineBytes - 1) / MaxLineBytes * MaxLineBytes);
+    qint64 length = limit - offset;
+    if (length <= 0)
+        return fileSize;
+    const uchar* p = file.bytes(offset, &length);
+    if (length <= 0)
+        return fileSize;
+    const void* hit = memchr(p, '\n', size_t(length));
+    if (hit)
+        return offset + (static_cast<const uchar*>(hit) - p) + 1;
+    return offset + length;
+}
+
+// offset 所在的显示行的起点：向前查找换行符，最多检查 2 * MaxLineBytes 个字节，
+// 没有找到时 offset 一定在超长的行中间，所在的一段从前一个分段位置开始
+qint64 LargeFileView::lineStart(qint64 offset)
+{
+    if (offset <= 0)
+        return 0;
+    qint64 boundary = offset / MaxLineBytes * MaxLineBytes;  // offset 之前最近的分段位置
+    qint64 start = qMax(qint64(0), offset - 2 * MaxLineBytes);
+    qint64 length = offset - start;
+    const uchar* p = file.bytes(start, &length);
+    if (length < offset - start)
+        return boundary;
+    qint64 begin = 0;  // 所在行的行首
+    for (qint64 i = length - 1; i >= 0; i--)
+    {
+        if (p[i] == '\n')
+        {
+            begin = start + i + 1;
+            break;
+        }
+    }
+    if (begin == 0 && start > 0)
+        return boundary;
+    return boundary >= begin + MaxLineBytes ? boundary : begin;
+}
+
+// 在 UTF-8 多字节字符中间的分段位置向后移到字符的边界，这个字符归到前一段
+qint64 LargeFileView::segmentBoundary(qint64 offset)
+{
+    if (codec->mibEnum() != 106 || isLineStart(offset))
+        return offset;
+    qint64 length = qMin(qint64(3), fileSize - offset);
+    const uchar* p = file.bytes(offset, &length);
+    qint64 i = 0;
+    while (i < length && (p[i] & 0xC0) == 0x80)
+        i++;
+    return offset + i;
+}
+
+// offset 所在行的行号：从前一个索引点开始数换行符，最多检查 LineChunk 个字节。
+// 超过时返回 -1，等索引建立到附近再补上，避免在界面线程中扫描大量数据
+qint64 LargeFileView::lineNumberAt(qint64 offset)
+{
+    QVector<qint64>::const_iterator it = std::upper_bound(lineIndex.constBegin(), lineIndex.constEnd(), offset);
+    int k = int(it - lineIndex.constBegin()) - 1;
+    if (k < 0)
+        return -1;
+    qint64 position = lineIndex.at(k);
+    qint64 length = offset - position;
+    if (length > LineChunk)
+        return -1;
+    const uchar* p = file.bytes(position, &length);
+    if (length < offset - position)
+        return -1;
+    qint64 line = qint64(k) * IndexStep;
+    const uchar* end = p + length;
+    while ((p = static_cast<const uchar*>(memchr(p, '\n', size_t(end - p)))) != 0)
+    {
+        p++;
+        line++;
+    }
+    return line;
+}
+
+// 可以显示的行数
+int LargeFileView::visibleLineCount() const
+{
+    return qMax(1, viewport()->height() / fontMetrics().lineSpacing());
+}
+
+// 向下（负数时向上）滚动若干个显示行，不会越过文件的首尾
+void LargeFileView::scrollLines(qint64 count)
+{
+    qint64 offset = topOffset;
+    qint64 line = topLine;
+    for (; count > 0; count--)
+    {
+        qint64 next = nextLine(offset);
+        if (next >= fileSize)
+            break;
+        offset = next;
+        if (line >= 0 && isLineStart(offset))
+            line++;
+    }
+    for (; count < 0 && offset > 0; count++)
+    {
+        if (line > 0 && isLineStart(offset))
+            line--;
+        offset = lineStart(offset - 1);
+    }
+    setTop(offset, line);
+}
+
+// 设置第一行，更新滚动条和显示
+void LargeFileView::setTop(qint64 offset, qint64 line)
+{
+    topOffset = offset;
+    topLine = line;
+    updateScrollBar();
+    viewport()->update();
+}
+
+// 根据第一行的位置设置滚动条，不触发 scrollContentsBy() 中的定位
+void LargeFileView::updateScrollBar()
+{
+    if (fileSize <= 0)
+        return;
+    isUpdatingScrollBar = true;
+    verticalScrollBar()->setValue(int(double(topOffset) / fileSize * verticalScrollBar()->maximum()));
+    isUpdatingScrollBar = false;
+}
+
+// 在标题中显示建立索引和搜索的进度
+void LargeFileView::updateTitle()
+{
+    QString title = userFriendlyCurrentFile() + tr(" [只读]");
+    if (searchPercent >= 0)
+        title += tr(" (搜索中 %1%)").arg(searchPercent);
+    else if (totalLines < 0)
+        title += tr(" (建立索引 %1%)").arg(indexPercent);
+    setWindowTitle(title);
+}
+
+// 跳转到第 line 行（从 1 开始），索引还没有建立到该行时返回 false
+bool LargeFileView::gotoLine(qint64 line)
+{
+    line = qMax(qint64(0), line - 1);
+    if (totalLines >= 0)
+        line = qMin(line, totalLines - 1);
+    qint64 k = line / IndexStep;
+    if (k >= lineIndex.size())
+        return false;
+    // 从索引点开始数换行符，最多经过 IndexStep 行，只在跳转时执行一次
+    qint64 offset = lineIndex.at(int(k));
+    for (qint64 i = k * IndexStep; i < line && offset < fileSize;)
+    {
+        qint64 length = qMin(LineChunk, fileSize - offset);
+        const uchar* p = file.bytes(offset, &length);
+        if (length <= 0)
+            break;
+        const void* hit = memchr(p, '\n', size_t(length));
+        if (!hit)
+        {
+            offset += length;
+            continue;
+        }
+        offset += (static_cast<const uchar*>(hit) - p) + 1;
+        i++;
+    }
+    // 索引还在建立中，该行可能不存在
+    if (offset >= fileSize && line > 0)
+        return false;
+    setTop(offset, line);
+    return true;
+}
+
+// 跳转到文件的百分比位置，不需要等待行索引
+void LargeFileView::gotoPercent(double percent)
+{
+    qint64 offset = lineStart(qint64(qBound(0.0, percent, 100.0) / 100 * fileSize));
+    if (offset >= fileSize && fileSize > 0)
+        offset = lineStart(fileSize - 1);
+    setTop(offset, lineNumberAt(offset));
+}
+
+// 从当前搜索结果之后（没有时从第一行）开始在后台搜索，结果通过 searchFinished() 通知
+void LargeFileView::find(const QString& text)
+{
+    if (searchRequest)
+        searchRequest->cancel();
+    QTextCodec::ConverterState state(QTextCodec::IgnoreHeader);
+    QByteArray pattern = codec->fromUnicode(text.constData(), text.size(), &state);
+    if (pattern.isEmpty())
+        return;
+    qint64 start = matchOffset >= topOffset ? matchOffset + 1 : topOffset;
+    FileSearchRequest* request = new FileSearchRequest(file.fileName(), pattern, start, DocumentIo::Active);
+    searchRequest = request;
+    matchLength = pattern.size();
+    searchPercent = 0;
+    connect(request, SIGNAL(progress(qint64, qint64)), this, SLOT(searchProgress(qint64, qint64)));
+    connect(request, SIGNAL(finished()), this, SLOT(searchRequestFinished()));
+    DocumentIo::instance()->submit(request);
+    updateTitle();
+}
+
+// 绘制可见的行：每次只解码这些行，超长的行分段显示，每段最多解码 2 * MaxLineBytes 个字节。
+// 行号只显示在行首所在的一段
+void LargeFileView::paintEvent(QPaintEvent*)
+{
+    QPainter painter(viewport());
+    QFontMetrics metrics = fontMetrics();
+    int lineHeight = metrics.lineSpacing();
+    int rows = visibleLineCount() + 1;
+    // 行号未知时不显示行号栏
+    int gutter = 0;
+    if (topLine >= 0)
+        gutter = metrics.width(QString::number(topLine + rows)) + metrics.width(' ') * 2;
+    if (gutter > 0)
+        painter.fillRect(0, 0, gutter - metrics.width(' '), viewport()->height(), palette().window());
+
+    qint64 offset = topOffset;
+    qint64 line = topLine;
+    for (int row = 0; row < rows && offset < fileSize; row++)
+    {
+        qint64 next = nextLine(offset);
+        bool first = isLineStart(offset);
+        if (row > 0 && first && line >= 0)
+            line++;
+        qint64 begin = segmentBoundary(offset);
+        qint64 length = (next < fileSize ? segmentBoundary(next) : next) - begin;
+        const char* p = reinterpret_cast<const char*>(file.bytes(begin, &length));
+        QString text = codec->toUnicode(p, int(length));
+        while (text.endsWith(QLatin1Char('\n')) || text.endsWith(QLatin1Char('\r')))
+            text.chop(1);
+        text.replace(QLatin1Char('\t'), QLatin1String("    "));
+        int y = row * lineHeight;
+        if (gutter > 0 && first)
+        {
+            painter.setPen(palette().color(QPalette::Dark));
+            painter.drawText(0, y, gutter - metrics.width(' ') * 2, lineHeight, Qt::AlignRight | Qt::AlignVCenter,
+                             QString::number(line + 1));
+        }
+        // 高亮当前搜索结果
+        if (matchOffset >= begin && matchOffset < begin + length)
+        {
+            QString before = codec->toUnicode(p, int(matchOffset - begin));
+            QString match = codec->toUnicode(p + (matchOffset - begin),
+                                             int(qMin(matchLength, begin + length - matchOffset)));
+            before.replace(QLatin1Char('\t'), QLatin1String("    "));
+            painter.fillRect(gutter + metrics.width(before), y, metrics.width(match), lineHeight,
+                             palette().highlight());
+        }
+        painter.setPen(palette().color(QPalette::Text));
+        painter.drawText(gutter, y, viewport()->width() - gutter, lineHeight, Qt::AlignLeft | Qt::AlignVCenter,
+                         text);
+        offset = next;
+    }
+}
+
+// 方向键和翻页键按行滚动，Ctrl+Home、Ctrl+End 跳到文件首尾
+void LargeFileView::keyPressEvent(QKeyEvent* event)
+{
+    int page = qMax(1, visibleLineCount() - 1);
+    switch (event->key())
+    {
+    case Qt::Key_Up:
+        scrollLines(-1);
+        break;
+    case Qt::Key_Down:
+        scrollLines(1);
+        break;
+    case Qt::Key_PageUp:
+        scrollLines(-page);
+        break;
+    case Qt::Key_PageDown:
+        scrollLines(page);
+        break;
+    case Qt::Key_Home:
+        if (event->modifiers() & Qt::ControlModifier)
+            setTop(0, 0);
+        break;
+    case Qt::Key_End:
+        if (event->modifiers() & Qt::ControlModifier)
+        {
+            setTop(lineStart(qMax(qint64(0), fileSize - 1)), totalLines >= 0 ? totalLines - 1 : -1);
+            scrollLines(-page);
+        }
+        break;
+    default:
+        QAbstractScrollArea::keyPressEvent(event);
+    }
+}
+
+// 滚轮每一格滚动 3 行
+void LargeFileView::wheelEvent(QWheelEvent* event)
+{
+    scrollLines(-qint64(event->angleDelta().y()) / 120 * 3);
+    event->accept();
+}
+
+// 拖动滚动条时按百分比定位到对应位置所在的行
+void LargeFileView::scrollContentsBy(int, int)
+{
+    if (isUpdatingScrollBar || fileSize <= 0)
+        return;
+    int maximum = verticalScrollBar()->maximum();
+    qint64 offset = lineStart(qint64(double(verticalScrollBar()->value()) / qMax(1, maximum) * fileSize));
+    if (offset >= fileSize)
+        offset = lineStart(fileSize - 1);
+    topOffset = offset;
+    topLine = lineNumberAt(offset);
+    viewport()->update();
+}
+
+// 取走后台找到的行首位置，更新进度
+void LargeFileView::indexProgress(qint64 processed, qint64 total)
+{
+    if (!indexRequest || sender() != indexRequest.data())
+        return;
+    lineIndex += indexRequest->takeCheckpoints();
+    indexPercent = total > 0 ? int(processed * 100 / total) : 100;
+    // 第一行的行号之前未知，现在索引已经覆盖时补上
+    if (topLine < 0)
+    {
+        topLine = lineNumberAt(topOffset);
+        if (topLine >= 0)
+            viewport()->update();
+    }
+    updateTitle();
+}
+
+// 行索引建立完成
+void LargeFileView::indexFinished()
+{
+    LineIndexRequest* request = qobject_cast<LineIndexRequest*>(sender());
+    if (!request || request != indexRequest)
+        return;
+    indexRequest = 0;
+    if (request->wasCancelled() || !request->errorString().isEmpty())
+        return;
+    lineIndex += request->takeCheckpoints();
+    totalLines = request->lineCount();
+    if (topLine < 0)
+        topLine = lineNumberAt(topOffset);
+    updateTitle();
+    viewport()->update();
+}
+
+// 搜索进度
+void LargeFileView::searchProgress(qint64 processed, qint64 total)
+{
+    if (!searchRequest || sender() != searchRequest.data())
+        return;
+    searchPercent = total > 0 ? int(processed * 100 / total) : 100;
+    updateTitle();
+}
+
+// 搜索结束，找到时把结果所在的行显示在上部
+void LargeFileView::searchRequestFinished()
+{
+    FileSearchRequest* request = qobject_cast<FileSearchRequest*>(sender());
+    if (!request || request != searchRequest)
+        return;
+    searchRequest = 0;
+    searchPercent = -1;
+    updateTitle();
+    if (request->wasCancelled())
+        return;
+    bool found = request->position() >= 0;
+    if (found)
+    {
+        matchOffset = request->position();
+        qint64 offset = lineStart(matchOffset);
+        setTop(offset, lineNumberAt(offset));
+        scrollLines(-visibleLineCount() / 3);
+    }
+    emit searchFinished(found);
+}
@@ -0,0 +1,116 @@
+#ifndef LARGEFILEVIEW_H
+#define LARGEFILEVIEW_H
+
+class QTextCodec;
+
+#include <QAbstractScrollArea>
+#include <QFile>
+#include <QMutex>
+#include <QPointer>
+#include <QVector>
+
+#include "documentio.h"
+#include "filewindow.h"
+
+// 在后台扫描整个文件，每隔 LargeFileView::IndexStep 行记录一次行首位置
+class LineIndexRequest : public IoRequest
+{
+    Q_OBJECT
+private:
+    QString path;             // 文件路径
+    QMutex mutex;             // 保护 found 和 lines
+    QVector<qint64> found;    // 新找到、尚未被取走的行首位置
+    qint64 lines;             // 已经扫描过的行数
+
+protected:
+    void run();
+
+public:
+    LineIndexRequest(const QString& fileName, int priority);
+    QVector<qint64> takeCheckpoints();  // 取走新找到的行首位置
+    qint64 lineCount();                 // 已经扫描过的行数，扫描结束后为文件的总行数
+};
+
+// 从指定位置开始向后搜索一段字节，到文件末尾后再从头搜索到起点
+class FileSearchRequest : public IoRequest
+{
+    Q_OBJECT
+private:
+    QString path;        // 文件路径
+    QByteArray pattern;  // 按文件编码编码后的搜索内容
+    qint64 from;         // 搜索的起点
+    qint64 result;       // 找到的位置，没有找到时为 -1
+
+    qint64 search(QFile& file, qint64 begin, qint64 end, qint64* processed);  // 在 [begin, end) 中搜索
+
+protected:
+    void run();
+
+public:
+    FileSearchRequest(const QString& fileName, const QByteArray& bytes, qint64 start, int priority);
+    qint64 position() const { return result; }  // 找到的位置，没有找到时为 -1
+};
+
+// 超大文件的只读查看器：按窗口映射文件，只解码可见的行，占用的内存与文件大小无关。
+// 超长的行分段显示。后台建立稀疏的行索引，可以立即跳转到任意百分比，索引建立到的部分也可以按行号跳转
+class LargeFileView : public QAbstractScrollArea
+{
+    Q_OBJECT
+public:
+    static const int IndexStep = 1024;  // 行索引的间隔行数
+
+private:
+    FileWindow file;                           // 被查看的文件
+    qint64 fileSize;                           // 打开时的文件大小
+    QTextCodec* codec;                         // 显示时使用的编码
+    QVector<qint64> lineIndex;                 // 第 i 项为第 i * IndexStep 行的行首位置
+    qint64 totalLines;                         // 总行数，索引建立完之前为 -1
+    QPointer<LineIndexRequest> indexRequest;   // 正在建立的行索引
+    QPointer<FileSearchRequest> searchRequest; // 正在进行的搜索
+    int indexPercent;                          // 行索引建立的进度
+    int searchPercent;                         // 搜索的进度，没有搜索时为 -1
+    qint64 topOffset;                          // 第一行的行首位置
+    qint64 topLine;                            // 第一行的行号（从 0 开始），未知时为 -1
+    qint64 matchOffset;                        // 搜索结果的位置，没有时为 -1
+    qint64 matchLength;                        // 搜索结果的字节数
+    bool isUpdatingScrollBar;                  // 正在根据位置设置滚动条
+
+    bool isLineStart(qint64 offset);                    // offset 是否为一行的行首
+    qint64 nextLine(qint64 offset);                     // offset 之后下一个显示行的起点
+    qint64 lineStart(qint64 offset);                    // offset 所在的显示行的起点
+    qint64 segmentBoundary(qint64 offset);              // 分段位置移到字符的边界
+    qint64 lineNumberAt(qint64 offset);                 // offset 所在行的行号，未知时为 -1
+    int visibleLineCount() const;                       // 可以显示的行数
+    void scrollLines(qint64 count);                     // 向下（负数时向上）滚动若干个显示行
+    void setTop(qint64 offset, qint64 line);            // 设置第一行
+    void updateScrollBar();                             // 根据第一行的位置设置滚动条
+    void updateTitle();                                 // 在标题中显示进度
+
+protected:
+    void paintEvent(QPaintEvent* event);
+    void keyPressEvent(QKeyEvent* event);
+    void wheelEvent(QWheelEvent* event);
+    void scrollContentsBy(int dx, int dy);
+
+public:
+    explicit LargeFileView(QWidget* parent = 0);
+    ~LargeFileView();
+    bool openFile(const QString& fileName);       // 打开文件并开始建立行索引
+    QString currentFile() const;                  // 文件路径
+    QString userFriendlyCurrentFile() const;      // 文件名
+    qint64 lineCount() const { return totalLines; }  // 总行数，索引建立完之前为 -1
+    bool gotoLine(qint64 line);                   // 跳转到第 line 行（从 1 开始）
+    void gotoPercent(double percent);             // 跳转到文件的百分比位置
+    void find(const QString& text);               // 从当前位置向后搜索
+
+signals:
+    void searchFinished(bool found);  // 搜索结束
+
+private slots:
+    void indexProgress(qint64 processed, qint64 total);   // 取走新的行索引
+    void indexFinished();                                 // 行索引建立完成
+    void searchProgress(qint64 processed, qint64 total);  // 搜索进度
+    void searchRequestFinished();                         // 搜索结束
+};
+
+#endif  // LARGEFILEVIEW_H
@@ -0,0 +1,137 @@
+#include "latencydialog.h"
+
+#include <QDateTime>
+#include <QDialogButtonBox>
+#include <QFile>
+#include <QFileDialog>
+#include <QHeaderView>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLabel>
+#include <QMdiArea>
+#include <QMdiSubWindow>
+#include <QMessageBox>
+#include <QPushButton>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+
+#include "mdichild.h"
+
+static const int RefreshInterval = 1000;  // 刷新间隔（毫秒）
+
+// 微秒显示为毫秒
+static QString milliseconds(qint64 micros)
+{
+    return QString::number(micros / 1000.0, 'f', 1);
+}
+
+LatencyDialog::LatencyDialog(QMdiArea* mdiArea, QWidget* parent) : QDialog(parent), area(mdiArea)
+{
+    setWindowTitle(tr("按键延迟"));
+    table = new QTreeWidget(this);
+    table->setRootIsDecorated(false);
+    table->setHeaderLabels(QStringList() << tr("文档") << tr("按键次数") << tr("P50 (ms)") << tr("P95 (ms)")
+                                         << tr("P99 (ms)") << tr("最大 (ms)"));
+    table->header()->setSectionResizeMode(0, QHeaderView::Stretch);
+    table->header()->setStretchLastSection(false);
+    QDialogButtonBox* buttons = new QDialogButtonBox(QDialogButtonBox::Close, this);
+    QPushButton* resetButton = buttons->addButton(tr("清空(&R)"), QDialogButtonBox::ResetRole);
+    QPushButton* exportButton = buttons->addButton(tr("导出(&E)..."), QDialogButtonBox::ActionRole);
+    connect(buttons, SIGNAL(rejected()), this, SLOT(reject()));
+    connect(resetButton, SIGNAL(clicked()), this, SLOT(resetAll()));
+    connect(exportButton, SIGNAL(clicked()), this, SLOT(exportResults()));
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->addWidget(new QLabel(tr("从按键进入编辑器到编辑器完成下一次绘制的时间，窗口打开期间每秒刷新"), this));
+    layout->addWidget(table);
+    layout->addWidget(buttons);
+    resize(640, 320);
+    refreshTimer.setInterval(RefreshInterval);
+    connect(&refreshTimer, SIGNAL(timeout()), this, SLOT(refresh()));
+    refreshTimer.start();
+    refresh();
+}
+
+// 同一个文档的多个视图记录在文档所属的窗口中，只取这些窗口
+QList<MdiChild*> LatencyDialog::documents() const
+{
+    QList<MdiChild*> children;
+    foreach (QMdiSubWindow* window, area->subWindowList())
+    {
+        MdiChild* child = qobject_cast<MdiChild*>(window->widget());
+        if (child && !child->isView())
+            children.append(child);
+    }
+    return children;
+}
+
+void LatencyDialog::refresh()
+{
+    QList<MdiChild*> children = documents();
+    // 文档数量不变时只更新文字，不重建条目，保留选中的行
+    while (table->topLevelItemCount() > children.size())
+        delete table->takeTopLevelItem(table->topLevelItemCount() - 1);
+    while (table->topLevelItemCount() < children.size())
+        table->addTopLevelItem(new QTreeWidgetItem);
+    for (int i = 0; i < children.size(); i++)
+    {
+        MdiChild* child = children.at(i);
+        const LatencyHistogram& latency = child->keyLatency();
+        QTreeWidgetItem* item = table->topLevelItem(i);
+        item->setText(0, child->userFriendlyCurrentFile());
+        item->setToolTip(0, child->currentFile());
+        item->setText(1, QString::number(latency.count()));
+        bool empty = latency.count() == 0;
+        item->setText(2, empty ? QString("-") : milliseconds(latency.percentile(0.50)));
+        item->setText(3, empty ? QString("-") : milliseconds(latency.percentile(0.95)));
+        item->setText(4, empty ? QString("-") : milliseconds(latency.percentile(0.99)));
+        item->setText(5, empty ? QString("-") : milliseconds(latency.maximum()));
+        for (int column = 1; column < table->columnCount(); column++)
+            item->setTextAlignment(column, Qt::AlignRight | Qt::AlignVCenter);
+    }
+}
+
+void LatencyDialog::resetAll()
+{
+    foreach (MdiChild* child, documents())
+        child->resetKeyLatency();
+    refresh();
+}
+
+// 每个文档导出分位数和非空的桶，单位为微秒，桶以下界和次数表示
+void LatencyDialog::exportResults()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, tr("导出按键延迟"), "latency.json", tr("JSON 文件 (*.json)"));
+    if (fileName.isEmpty())
+        return;
+    QJsonArray items;
+    foreach (MdiChild* child, documents())
+    {
+        const LatencyHistogram& latency = child->keyLatency();
+        QJsonObject item;
+        item.insert("document", child->isNewFile() ? child->userFriendlyCurrentFile() : child->currentFile());
+        item.insert("samples", double(latency.count()));
+        item.insert("p50_us", double(latency.percentile(0.50)));
+        item.insert("p95_us", double(latency.percentile(0.95)));
+        item.insert("p99_us", double(latency.percentile(0.99)));
+        item.insert("max_us", double(latency.maximum()));
+        QJsonArray buckets;
+        for (int i = 0; i < latency.bucketCount(); i++)
+        {
+            if (latency.bucketValue(i) == 0)
+                continue;
+            QJsonArray bucket;
+            bucket.append(double(LatencyHistogram::bucketStart(i)));
+            bucket.append(double(latency.bucketValue(i)));
+            buckets.append(bucket);
+        }
+        item.insert("buckets", buckets);
+        items.append(item);
+    }
+    QJsonObject root;
+    root.insert("generated", QDateTime::currentDateTime().toString(Qt::ISODate));
+    root.insert("documents", items);
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(root).toJson()) < 0)
+        QMessageBox::warning(this, tr("多文档编辑器"), tr("无法写入文件 %1：\n%2").arg(fileName).arg(file.errorString()));
+}
@@ -0,0 +1,32 @@
+#ifndef LATENCYDIALOG_H
+#define LATENCYDIALOG_H
+
+class MdiChild;
+class QMdiArea;
+class QTreeWidget;
+
+#include <QDialog>
+#include <QTimer>
+
+// 按键延迟诊断：列出每个打开的文档从按键到完成绘制的延迟分布（P50、P95、P99 和最大值），
+// 对话框打开期间每秒刷新，可以清空记录或者把各文档的分位数和直方图导出为 JSON
+class LatencyDialog : public QDialog
+{
+    Q_OBJECT
+private:
+    QMdiArea* area;         // 文档所在的多文档区域
+    QTreeWidget* table;     // 各文档的延迟
+    QTimer refreshTimer;    // 定时刷新
+
+    QList<MdiChild*> documents() const;  // 所有文档所属的窗口，不包括视图
+
+public:
+    explicit LatencyDialog(QMdiArea* mdiArea, QWidget* parent = 0);
+
+private slots:
+    void refresh();        // 刷新各文档的延迟
+    void resetAll();       // 清空所有文档的记录
+    void exportResults();  // 导出为 JSON 文件
+};
+
+#endif  // LATENCYDIALOG_H
@@ -0,0 +1,57 @@
+#include "latencyhistogram.h"
+
+#include <QtAlgorithms>
+#include <qmath.h>
+
+LatencyHistogram::LatencyHistogram() : counts(bucketOf(MaxMicros) + 1, 0), total(0), largest(0)
+{
+}
+
+// 最高位之后保留 5 位：小于 64 时就是数值本身，之后每个 2 的幂区间 32 个桶
+int LatencyHistogram::bucketOf(qint64 micros)
+{
+    quint64 value = quint64(qBound<qint64>(0, micros, MaxMicros));
+    int shift = qMax(0, 63 - int(qCountLeadingZeroBits(value)) - 5);
+    return shift * SubBuckets + int(value >> shift);
+}
+
+qint64 LatencyHistogram::bucketStart(int bucket)
+{
+    if (bucket < 2 * SubBuckets)
+        return bucket;
+    int shift = bucket / SubBuckets - 1;
+    return qint64(bucket - shift * SubBuckets) << shift;
+}
+
+void LatencyHistogram::add(qint64 micros)
+{
+    counts[bucketOf(micros)]++;
+    total++;
+    largest = qMax(largest, micros);
+}
+
+void LatencyHistogram::reset()
+{
+    counts.fill(0);
+    total = 0;
+    largest = 0;
+}
+
+// 从小到大累加各桶的次数，第一个达到 fraction 的桶的上界，不超过记录到的最大值
+qint64 LatencyHistogram::percentile(double fraction) const
+{
+    if (total == 0)
+        return 0;
+    qint64 rank = qMax<qint64>(1, qint64(qCeil(fraction * total)));
+    qint64 seen = 0;
+    for (int i = 0; i < counts.size(); i++)
+    {
+        seen += counts.at(i);
+        if (seen >= rank)
+        {
+            qint64 end = i + 1 < counts.size() ? bucketStart(i + 1) - 1 : largest;
+            return qMin(end, largest);
+        }
+    }
+    return largest;
+}
@@ -0,0 +1,34 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QVector>
+
+// 延迟的直方图，单位为微秒，范围 0 到 1 分钟，超出的记入最后一个桶。
+// 64 微秒以下每微秒一个桶，之后每个 2 的幂区间分成 32 个桶，分位数的相对误差不超过 1/32。
+// 桶的数量固定，记录一次只是一次加法，可以在每次按键时调用
+class LatencyHistogram
+{
+public:
+    static const int SubBuckets = 32;           // 每个 2 的幂区间的桶数
+    static const qint64 MaxMicros = 60000000;   // 记录的最大延迟
+
+private:
+    QVector<quint32> counts;  // 各桶的次数
+    qint64 total;             // 记录的次数
+    qint64 largest;           // 最大的延迟
+
+    static int bucketOf(qint64 micros);  // 延迟所在的桶
+
+public:
+    LatencyHistogram();
+    void add(qint64 micros);                                  // 记录一次延迟
+    void reset();                                             // 清空记录
+    qint64 count() const { return total; }                    // 记录的次数
+    qint64 maximum() const { return largest; }                // 最大的延迟
+    qint64 percentile(double fraction) const;                 // 分位数，fraction 在 0 到 1 之间，取所在桶的上界
+    int bucketCount() const { return counts.size(); }         // 桶的数量
+    quint32 bucketValue(int bucket) const { return counts.at(bucket); }  // 一个桶的次数
+    static qint64 bucketStart(int bucket);                    // 桶的下界
+};
+
+#endif  // LATENCYHISTOGRAM_H
@@ -0,0 +1,140 @@
+#include "lineending.h"
+
+#include <QtAlgorithms>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// 新建文档使用的换行符
+LineEnding::Style LineEnding::platformDefault()
+{
+#ifdef Q_OS_WIN
+    return CrLf;
+#else
+    return Lf;
+#endif
+}
+
+// 统计三种换行符的数量，同时把它们都转换为 \n，返回最多的一种。没有换行符时返回新建文档的默认值
+LineEnding::Style LineEnding::normalize(QString* text, bool* mixed)
+{
+    Counts counts = {0, 0, 0};
+    normalize(text, &counts);
+    return dominant(counts, mixed);
+}
+
+// 就地把三种换行符都转换为 \n，同时把数量累加到 counts，只需要遍历一遍文本。
+// 用 SSE2 每次检查 8 个字符：不含 \r 的块只统计 \n 的个数，转换前的位置没有变化时也不需要移动；
+// 含有 \r 的块逐个字符处理。分块处理时调用者需要保证 \r\n 不被拆到两块中
+void LineEnding::normalize(QString* text, Counts* counts)
+{
+    int size = text->size();
+    ushort* d = reinterpret_cast<ushort*>(text->data());
+    int r = 0, w = 0;  // 读、写的位置，删除 \r 后写的位置落后于读的位置
+    qint64 lf = 0, crlf = 0, cr = 0;
+#ifdef __SSE2__
+    const __m128i crVector = _mm_set1_epi16('\r');
+    const __m128i lfVector = _mm_set1_epi16('\n');
+    while (r + 8 <= size)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + r));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(block, crVector)) == 0)
+        {
+            // 每个字符对应掩码中的两位
+            lf += qPopulationCount(uint(_mm_movemask_epi8(_mm_cmpeq_epi16(block, lfVector)))) / 2;
+            if (w != r)
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(d + w), block);
+            r += 8;
+            w += 8;
+            continue;
+        }
+        int stop = r + 8;
+        while (r < stop)
+        {
+            ushort c = d[r++];
+            if (c == '\r')
+            {
+                if (r < size && d[r] == '\n')
+                {
+                    crlf++;
+                    r++;
+                }
+                else
+                {
+                    cr++;
+                }
+                c = '\n';
+            }
+            else if (c == '\n')
+            {
+                lf++;
+            }
+            d[w++] = c;
+        }
+    }
+#endif
+    while (r < size)
+    {
+        ushort c = d[r++];
+        if (c == '\r')
+        {
+            if (r < size && d[r] == '\n')
+            {
+                crlf++;
+                r++;
+            }
+            else
+            {
+                cr++;
+            }
+            c = '\n';
+        }
+        else if (c == '\n')
+        {
+            lf++;
+        }
+        d[w++] = c;
+    }
+    if (w != size)
+        text->resize(w);
+    counts->lf += lf;
+    counts->crlf += crlf;
+    counts->cr += cr;
+}
+
+// 最多的一种换行符，同时判断是否混用了多种换行符。没有换行符时返回新建文档的默认值
+LineEnding::Style LineEnding::dominant(const Counts& counts, bool* mixed)
+{
+    *mixed = (counts.lf > 0) + (counts.crlf > 0) + (counts.cr > 0) > 1;
+    if (counts.lf == 0 && counts.crlf == 0 && counts.cr == 0)
+        return platformDefault();
+    if (counts.crlf >= counts.lf && counts.crlf >= counts.cr)
+        return CrLf;
+    return counts.cr > counts.lf ? Cr : Lf;
+}
+
+// 把一段文本中的 \n 转换为指定的换行符，保存时对每一块文本调用，不需要复制整个文档
+void LineEnding::expand(const QChar* text, int length, Style style, QString* out)
+{
+    out->clear();
+    out->reserve(length + length / 8);
+    const QChar* end = text + length;
+    const QChar* start = text;
+    for (const QChar* p = text; p != end; ++p)
+    {
+        if (*p != QLatin1Char('\n'))
+            continue;
+        out->append(start, int(p - start));
+        out->append(style == Cr ? QLatin1String("\r") : QLatin1String("\r\n"));
+        start = p + 1;
+    }
+    out->append(start, int(end - start));
+}
+
+// 状态栏显示的名称，混用多种换行符时加上标记
+QString LineEnding::name(Style style, bool mixed)
+{
+    QString text = style == CrLf ? QString("CRLF") : style == Cr ? QString("CR") : QString("LF");
+    return mixed ? tr("%1（混合）").arg(text) : text;
+}
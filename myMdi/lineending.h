@@ -0,0 +1,36 @@
+#ifndef LINEENDING_H
+#define LINEENDING_H
+
+#include <QCoreApplication>
+#include <QString>
+
+// 换行符：加载时识别文件使用的换行符并统一转换为 \n，保存时再转换回去
+class LineEnding
+{
+    Q_DECLARE_TR_FUNCTIONS(LineEnding)
+
+public:
+    enum Style
+    {
+        Lf = 0,    // Unix 的 \n
+        CrLf = 1,  // Windows 的 \r\n
+        Cr = 2     // 旧的 Mac 的 \r
+    };
+
+    // 三种换行符各自的数量
+    struct Counts
+    {
+        qint64 lf;
+        qint64 crlf;
+        qint64 cr;
+    };
+
+    static Style platformDefault();                      // 新建文档使用的换行符
+    static Style normalize(QString* text, bool* mixed);  // 统计并把所有换行符转换为 \n，返回最多的一种
+    static void normalize(QString* text, Counts* counts);     // 同上，把数量累加到 counts，用于分块处理的文本
+    static Style dominant(const Counts& counts, bool* mixed);  // 最多的一种换行符
+    static void expand(const QChar* text, int length, Style style, QString* out);  // 把 \n 转换为指定的换行符
+    static QString name(Style style, bool mixed = false);  // 状态栏显示的名称
+};
+
+#endif  // LINEENDING_H
@@ -0,0 +1,466 @@
+#include "localhistory.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QLockFile>
+#include <QMutex>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+static const quint32 HistoryMagic = 0x4d44484c;  // "MDHL"
+static const quint16 HistoryFormat = 1;
+
+static const int MinChunk = 2 << 10;                            // 块最小 2KB
+static const int MaxChunk = 64 << 10;                           // 块最大 64KB
+static const quint64 BoundaryMask = Q_UINT64_C(0x1fff) << 51;   // 哈希值最高的 13 位全为 0 时切分，平均 8KB 一块
+static const int GearWindow = 64;                               // 齿轮哈希只与最近的 64 个字节有关
+static const int ReadBlock = 1 << 20;                           // 记录时每次读入 1MB
+static const int HashSize = 20;                                 // SHA-1 的字节数
+static const int IndexRecordSize = HashSize + 8 + 4;            // 索引文件中每条记录的字节数
+
+// 齿轮哈希的随机表，用固定的种子生成，不同的进程在相同的内容上切分出相同的块
+struct GearTable
+{
+    quint64 values[256];
+
+    GearTable()
+    {
+        quint64 seed = Q_UINT64_C(0x6d794d6469484c31);
+        for (int i = 0; i < 256; i++)
+        {
+            // splitmix64
+            quint64 z = (seed += Q_UINT64_C(0x9e3779b97f4a7c15));
+            z = (z ^ (z >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+            z = (z ^ (z >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+            values[i] = z ^ (z >> 31);
+        }
+    }
+};
+
+static const GearTable gear;
+
+// 块在块存储文件中的位置
+struct ChunkLocation
+{
+    qint64 offset;  // 压缩后的数据在块存储文件中的起点
+    qint32 size;    // 压缩后的字节数
+};
+
+static bool recording = true;                        // 保存时是否记录新版本，只在界面线程中访问
+static QMutex indexMutex;                            // 保护块索引，多个 I/O 线程可能同时读写本地历史
+static QHash<QByteArray, ChunkLocation> chunkIndex;  // 块哈希值到块位置的索引
+static qint64 indexLoaded = 0;                       // 已经读入的索引文件字节数
+
+// 锁定块存储以便写入：同一进程的多个 I/O 线程用互斥锁，多个进程之间用锁文件
+class StoreLocker
+{
+private:
+    QMutexLocker locker;
+    QLockFile lockFile;
+
+public:
+    StoreLocker() : locker(&indexMutex), lockFile(LocalHistory::path() + "/store.lock") { lockFile.lock(); }
+    bool isLocked() const { return lockFile.isLocked(); }
+};
+
+// 创建本地历史目录
+static QString createHistoryPath()
+{
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/history";
+    QDir().mkpath(dir);
+    return dir;
+}
+
+// 本地历史目录，I/O 线程也会调用，局部静态变量的初始化是线程安全的
+QString LocalHistory::path()
+{
+    static const QString dir = createHistoryPath();
+    return dir;
+}
+
+// 保存时是否记录新版本，可以在设置中用 localHistory 关闭，基准测试也关闭它以免后台记录影响计时
+bool LocalHistory::isRecording() { return recording; }
+
+// 设置保存时是否记录新版本
+void LocalHistory::setRecording(bool enabled) { recording = enabled; }
+
+// 在 data 开头找块的边界，返回第一块的长度。size 不到最大块又没有找到边界时返回 -1。
+// 齿轮哈希每个字节左移一位，64 个字节之前的内容已经移出，所以从最小块之前 64 个字节开始计算即可
+int LocalHistory::findBoundary(const char* data, int size)
+{
+    const uchar* bytes = reinterpret_cast<const uchar*>(data);
+    int limit = qMin(size, MaxChunk);
+    quint64 hash = 0;
+    for (int i = MinChunk - GearWindow; i < limit; i++)
+    {
+        hash = (hash << 1) + gear.values[bytes[i]];
+        if (i + 1 >= MinChunk && !(hash & BoundaryMask))
+            return i + 1;
+    }
+    return limit == MaxChunk ? MaxChunk : -1;
+}
+
+// 把 data 按内容切分成块。last 为 false 时末尾没有找到边界的部分留给下一次，返回切分掉的字节数
+static int splitChunks(const QByteArray& data, bool last, QList<QByteArray>* chunks)
+{
+    int start = 0;
+    while (start < data.size())
+    {
+        int length = LocalHistory::findBoundary(data.constData() + start, data.size() - start);
+        if (length < 0)
+        {
+            if (!last)
+                break;
+            length = data.size() - start;
+        }
+        chunks->append(data.mid(start, length));
+        start += length;
+    }
+    return start;
+}
+
+// 读入索引文件中新追加的记录，其他线程和进程写入的块也能找到。
+// 异常退出时最后一条记录可能只写了一部分，只读入完整的记录。调用前需要锁定 indexMutex
+static void loadIndex()
+{
+    QFile file(LocalHistory::path() + "/chunks.idx");
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    qint64 complete = file.size() / IndexRecordSize * IndexRecordSize;
+    // 索引文件被删除后重新建立，之前读入的索引已经无效
+    if (complete < indexLoaded)
+    {
+        chunkIndex.clear();
+        indexLoaded = 0;
+    }
+    if (!file.seek(indexLoaded))
+        return;
+    QDataStream in(&file);
+    while (indexLoaded < complete)
+    {
+        QByteArray hash(HashSize, 0);
+        ChunkLocation location;
+        in.readRawData(hash.data(), HashSize);
+        in >> location.offset >> location.size;
+        if (in.status() != QDataStream::Ok)
+            break;
+        chunkIndex.insert(hash, location);
+        indexLoaded += IndexRecordSize;
+    }
+}
+
+// 查找块的位置，location 可以为 0。调用前需要锁定 indexMutex
+static bool findChunk(const QByteArray& hash, ChunkLocation* location)
+{
+    QHash<QByteArray, ChunkLocation>::const_iterator it = chunkIndex.constFind(hash);
+    if (it == chunkIndex.constEnd())
+    {
+        loadIndex();
+        it = chunkIndex.constFind(hash);
+        if (it == chunkIndex.constEnd())
+            return false;
+    }
+    if (location)
+        *location = it.value();
+    return true;
+}
+
+// 把一批块写入块存储，哈希值依次追加到 hashes，已经存在的块只引用不再写入。
+// 先写块数据再写索引，中途崩溃只会在块存储文件末尾留下没有索引的数据，不会有指向不存在数据的索引
+static bool storeChunks(const QList<QByteArray>& chunks, QByteArray* hashes, qint64* newBytes, QString* error)
+{
+    if (chunks.isEmpty())
+        return true;
+    // 在锁定之前计算哈希值，其他线程不用等待
+    QList<QByteArray> keys;
+    foreach (const QByteArray& chunk, chunks)
+        keys << QCryptographicHash::hash(chunk, QCryptographicHash::Sha1);
+
+    StoreLocker locker;
+    if (!locker.isLocked())
+    {
+        *error = LocalHistory::tr("无法锁定本地历史 %1").arg(LocalHistory::path());
+        return false;
+    }
+    loadIndex();
+    QFile pack(LocalHistory::path() + "/chunks.pack");
+    QFile index(LocalHistory::path() + "/chunks.idx");
+    QHash<QByteArray, ChunkLocation> added;
+    QByteArray records;
+    QDataStream out(&records, QIODevice::WriteOnly);
+    qint64 offset = -1;
+    for (int i = 0; i < chunks.size(); i++)
+    {
+        const QByteArray& key = keys.at(i);
+        hashes->append(key);
+        if (added.contains(key) || findChunk(key, 0))
+            continue;
+        if (offset < 0)
+        {
+            if (!pack.open(QIODevice::WriteOnly | QIODevice::Append))
+            {
+                *error = pack.errorString();
+                return false;
+            }
+            offset = pack.size();
+        }
+        QByteArray compressed = qCompress(chunks.at(i));
+        if (pack.write(compressed) != compressed.size())
+        {
+            *error = pack.errorString();
+            return false;
+        }
+        ChunkLocation location;
+        location.offset = offset;
+        location.size = compressed.size();
+        offset += compressed.size();
+        added.insert(key, location);
+        out.writeRawData(key.constData(), HashSize);
+        out << location.offset << location.size;
+        *newBytes += chunks.at(i).size();
+    }
+    if (added.isEmpty())
+        return true;
+    if (!pack.flush())
+    {
+        *error = pack.errorString();
+        return false;
+    }
+    // 去掉异常退出时写了一部分的记录，再追加新的记录
+    if (!index.open(QIODevice::ReadWrite) || !index.resize(indexLoaded) || !index.seek(indexLoaded)
+        || index.write(records) != records.size() || !index.flush())
+    {
+        *error = index.errorString();
+        return false;
+    }
+    for (QHash<QByteArray, ChunkLocation>::const_iterator it = added.constBegin(); it != added.constEnd(); ++it)
+        chunkIndex.insert(it.key(), it.value());
+    indexLoaded += records.size();
+    return true;
+}
+
+// 从块存储中取出一块，并检查内容与哈希值一致
+static bool readChunk(QFile& pack, const QByteArray& hash, QByteArray* data, QString* error)
+{
+    ChunkLocation location;
+    {
+        QMutexLocker locker(&indexMutex);
+        if (!findChunk(hash, &location))
+        {
+            *error = LocalHistory::tr("本地历史中缺少数据块 %1").arg(QString::fromLatin1(hash.toHex()));
+            return false;
+        }
+    }
+    if (!pack.seek(location.offset))
+    {
+        *error = pack.errorString();
+        return false;
+    }
+    *data = qUncompress(pack.read(location.size));
+    if (QCryptographicHash::hash(*data, QCryptographicHash::Sha1) != hash)
+    {
+        *error = LocalHistory::tr("本地历史中的数据块 %1 已损坏").arg(QString::fromLatin1(hash.toHex()));
+        return false;
+    }
+    return true;
+}
+
+// 文件的版本文件，以规范路径的哈希值命名
+static QString versionsFile(const QString& fileName)
+{
+    QFileInfo info(fileName);
+    QString canonical = info.canonicalFilePath();
+    if (canonical.isEmpty())
+        canonical = info.absoluteFilePath();
+    QByteArray hash = QCryptographicHash::hash(canonical.toUtf8(), QCryptographicHash::Sha1);
+    return LocalHistory::path() + "/" + QString::fromLatin1(hash.toHex()) + ".versions";
+}
+
+// 读出版本文件中的所有版本，end 返回最后一条完整记录的结尾。
+// 异常退出时最后一条记录可能只写了一部分，忽略它
+static bool readVersions(QFile& file, QList<LocalHistory::Version>* versions, qint64* end)
+{
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_6);
+    quint32 magic;
+    quint16 format;
+    QString basePath;
+    in >> magic >> format >> basePath;
+    if (in.status() != QDataStream::Ok || magic != HistoryMagic || format != HistoryFormat)
+        return false;
+    *end = file.pos();
+    while (!in.atEnd())
+    {
+        qint64 time, size, newBytes;
+        QByteArray manifest;
+        in >> time >> size >> newBytes >> manifest;
+        if (in.status() != QDataStream::Ok || manifest.size() % HashSize != 0)
+            break;
+        LocalHistory::Version version;
+        version.time = QDateTime::fromMSecsSinceEpoch(time);
+        version.size = size;
+        version.newBytes = newBytes;
+        version.manifest = manifest;
+        versions->append(version);
+        *end = file.pos();
+    }
+    return true;
+}
+
+// 文件的所有历史版本，按保存的先后排列
+QList<LocalHistory::Version> LocalHistory::versions(const QString& fileName)
+{
+    QList<Version> result;
+    QFile file(versionsFile(fileName));
+    qint64 end;
+    if (file.open(QIODevice::ReadOnly))
+        readVersions(file, &result, &end);
+    return result;
+}
+
+HistoryRecordRequest::HistoryRecordRequest(const QString& fileName)
+    : IoRequest(DocumentIo::Background), path(fileName)
+{
+    newBytes = 0;
+    unchanged = false;
+}
+
+// 逐段读入文件并按内容切分，每段切分出的块一起写入块存储，最后写入块清单和版本记录
+void HistoryRecordRequest::run()
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        error = file.errorString();
+        return;
+    }
+    qint64 total = file.size();
+    qint64 size = 0;
+    QByteArray buffer;
+    QByteArray hashes;
+    bool last = false;
+    while (!last)
+    {
+        if (isCancelled())
+            return;
+        QByteArray block = file.read(ReadBlock);
+        if (block.isEmpty() && !file.atEnd())
+        {
+            error = file.errorString();
+            return;
+        }
+        size += block.size();
+        buffer += block;
+        last = file.atEnd();
+        QList<QByteArray> chunks;
+        buffer.remove(0, splitChunks(buffer, last, &chunks));
+        if (!storeChunks(chunks, &hashes, &newBytes, &error))
+            return;
+        setProgress(size, total);
+    }
+
+    // 块清单也按内容切分，相邻版本的块清单大部分相同，同样只存一次
+    QList<QByteArray> manifestChunks;
+    splitChunks(hashes, true, &manifestChunks);
+    LocalHistory::Version version;
+    version.time = QDateTime::currentDateTime();
+    version.size = size;
+    if (!storeChunks(manifestChunks, &version.manifest, &newBytes, &error))
+        return;
+    version.newBytes = newBytes;
+
+    StoreLocker locker;
+    if (!locker.isLocked())
+    {
+        error = tr("无法锁定本地历史 %1").arg(LocalHistory::path());
+        return;
+    }
+    QFile versions(versionsFile(path));
+    if (!versions.open(QIODevice::ReadWrite))
+    {
+        error = versions.errorString();
+        return;
+    }
+    QList<LocalHistory::Version> previous;
+    qint64 end = 0;
+    if (versions.size() > 0 && !readVersions(versions, &previous, &end))
+    {
+        error = tr("版本文件 %1 已损坏").arg(versions.fileName());
+        return;
+    }
+    if (!previous.isEmpty() && previous.last().manifest == version.manifest)
+    {
+        unchanged = true;
+        return;
+    }
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_6);
+    if (end == 0)
+        out << HistoryMagic << HistoryFormat << QFileInfo(path).absoluteFilePath();
+    out << version.time.toMSecsSinceEpoch() << version.size << version.newBytes << version.manifest;
+    // 去掉异常退出时写了一部分的记录，再追加新的记录
+    if (!versions.resize(end) || !versions.seek(end) || versions.write(data) != data.size())
+        error = versions.errorString();
+}
+
+HistoryRestoreRequest::HistoryRestoreRequest(const LocalHistory::Version& historyVersion, const QString& fileName)
+    : IoRequest(DocumentIo::Active), version(historyVersion), path(fileName)
+{
+}
+
+// 先取出块清单，再依次写出其中的每一块。QSaveFile 保证失败或被取消时不留下不完整的文件
+void HistoryRestoreRequest::run()
+{
+    QFile pack(LocalHistory::path() + "/chunks.pack");
+    if (!version.manifest.isEmpty() && !pack.open(QIODevice::ReadOnly))
+    {
+        error = pack.errorString();
+        return;
+    }
+    QByteArray hashes, chunk;
+    for (int i = 0; i < version.manifest.size(); i += HashSize)
+    {
+        if (!readChunk(pack, version.manifest.mid(i, HashSize), &chunk, &error))
+            return;
+        hashes += chunk;
+    }
+    if (hashes.size() % HashSize != 0)
+    {
+        error = tr("历史版本的块清单已损坏");
+        return;
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        error = file.errorString();
+        return;
+    }
+    qint64 written = 0;
+    for (int i = 0; i < hashes.size(); i += HashSize)
+    {
+        if (isCancelled())
+            return;
+        if (!readChunk(pack, hashes.mid(i, HashSize), &chunk, &error))
+            return;
+        if (file.write(chunk) != chunk.size())
+        {
+            error = file.errorString();
+            return;
+        }
+        written += chunk.size();
+        setProgress(written, version.size);
+    }
+    if (written != version.size)
+    {
+        error = tr("历史版本的大小与记录不一致");
+        return;
+    }
+    if (!file.commit())
+        error = file.errorString();
+}
@@ -0,0 +1,72 @@
+#ifndef LOCALHISTORY_H
+#define LOCALHISTORY_H
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QList>
+
+#include "documentio.h"
+
+// 本地历史：每次保存之后把文件内容记录到按内容寻址的块存储中，保存过的任意一个版本都可以取出
+//
+// 文件按内容切分成平均 8KB 的块，块的边界由附近的内容决定，插入或删除几个字节只影响所在的一两块，
+// 其余的块和以前的版本相同。每一块以 SHA-1 为名，压缩后只存一次，所有文档共用一个块存储。
+// 一个版本的块清单（依次排列的块哈希值）本身也按内容切分后存入块存储，
+// 所以对很大的文件做一次小的更改，保存新版本只增加几 KB
+class LocalHistory
+{
+    Q_DECLARE_TR_FUNCTIONS(LocalHistory)
+
+public:
+    // 一个历史版本
+    struct Version
+    {
+        QDateTime time;       // 保存的时间
+        qint64 size;          // 文件的字节数
+        qint64 newBytes;      // 这个版本新增到块存储中的字节数（压缩前）
+        QByteArray manifest;  // 块清单各块的哈希值，依次连接
+    };
+
+    static QString path();                                    // 本地历史目录
+    static bool isRecording();                                // 保存时是否记录新版本
+    static void setRecording(bool enabled);                   // 设置保存时是否记录新版本
+    static QList<Version> versions(const QString& fileName);  // 文件的所有历史版本，按保存的先后排列
+    static int findBoundary(const char* data, int size);      // 按内容找块的边界，返回第一块的长度，没有找到时返回 -1
+};
+
+// 把硬盘上的文件记录为本地历史的一个新版本，与上一个版本相同时不记录
+class HistoryRecordRequest : public IoRequest
+{
+    Q_OBJECT
+private:
+    QString path;      // 文件路径
+    qint64 newBytes;   // 新增到块存储中的字节数
+    bool unchanged;    // 与上一个版本相同，没有记录
+
+protected:
+    void run();
+
+public:
+    explicit HistoryRecordRequest(const QString& fileName);
+    QString fileName() const { return path; }              // 文件路径
+    qint64 addedBytes() const { return newBytes; }         // 新增到块存储中的字节数
+    bool wasUnchanged() const { return unchanged; }        // 是否与上一个版本相同
+};
+
+// 把本地历史的一个版本取出到文件
+class HistoryRestoreRequest : public IoRequest
+{
+    Q_OBJECT
+private:
+    LocalHistory::Version version;  // 要取出的版本
+    QString path;                   // 写入的文件
+
+protected:
+    void run();
+
+public:
+    HistoryRestoreRequest(const LocalHistory::Version& historyVersion, const QString& fileName);
+    QString fileName() const { return path; }  // 写入的文件
+};
+
+#endif  // LOCALHISTORY_H
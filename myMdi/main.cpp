@@ -2,6 +2,7 @@
 #include <QTextCodec>
 
 #include "mainwindow.h"
+#include "tracer.h"
 
 int main(int argc, char* argv[])
 {
@@ -9,6 +10,9 @@ int main(int argc, char* argv[])
     // 解决 Qt 中文乱码问题
     // QTextCodec::setCodecForLocale(QTextCodec::codecForLocale());
     QTextCodec::setCodecForLocale(QTextCodec::codecForName("utf-8"));
+    // 设置了 MYMDI_TRACE 时从启动开始记录性能跟踪，也可以在帮助菜单中随时打开
+    if (qEnvironmentVariableIsSet("MYMDI_TRACE"))
+        Tracer::setEnabled(true);
     MainWindow w;
     w.show();
 
@@ -1,16 +1,52 @@
 #include "mainwindow.h"
 
+#include <QActionGroup>
 #include <QCloseEvent>
+#include <QDir>
+#include <QFile>
 #include <QFileDialog>
+#include <QInputDialog>
 #include <QLabel>
 #include <QMdiSubWindow>
 #include <QMessageBox>
+#include <QPushButton>
 #include <QSettings>
 #include <QSignalMapper>
+#include <QSlider>
+#include <QTextBlock>
+#include <QTimer>
 
+#include "autosaver.h"
+#include "diffview.h"
+#include "documenthandle.h"
+#include "documentio.h"
+#include "editjournal.h"
+#include "gzipstream.h"
+#include "hexview.h"
+#include "largefileview.h"
+#include "latencydialog.h"
+#include "localhistory.h"
 #include "mdichild.h"
+#include "memorydialog.h"
+#include "recoverystore.h"
+#include "stallwatchdog.h"
+#include "tracer.h"
 #include "ui_mainwindow.h"
 
+// 标签页模式下最多保留编辑器的窗口数，其余窗口只有记录文件路径的文档句柄
+static const int MaxLoadedChildren = 8;
+// 界面线程停顿超过这个时间（毫秒）时记录调用栈，可以在设置中用 stallThreshold 修改
+static const int DefaultStallThreshold = 500;
+// 超过这个大小的文件打开时询问是否改用只读的大文件查看器，QTextEdit 编辑这样的文件很慢
+static const qint64 LargeFileThreshold = 64 << 20;
+
+// 文件是否用 gzip 压缩
+static bool isGzipFile(const QString& fileName)
+{
+    QFile file(fileName);
+    return file.open(QIODevice::ReadOnly) && GzipReader::isGzip(file.read(2));
+}
+
 // 活动窗口
 MdiChild* MainWindow::activeMdiChild()
 {
@@ -21,20 +57,156 @@ MdiChild* MainWindow::activeMdiChild()
     return 0;
 }
 
-// 查找子窗口
+// 活动的大文件查看窗口
+LargeFileView* MainWindow::activeLargeFileView()
+{
+    if (QMdiSubWindow* activeSubWindow = ui->mdiArea->activeSubWindow())
+        return qobject_cast<LargeFileView*>(activeSubWindow->widget());
+    return 0;
+}
+
+// 活动的十六进制查看窗口
+HexView* MainWindow::activeHexView()
+{
+    if (QMdiSubWindow* activeSubWindow = ui->mdiArea->activeSubWindow())
+        return qobject_cast<HexView*>(activeSubWindow->widget());
+    return 0;
+}
+
+// 活动的比较窗口
+DiffView* MainWindow::activeDiffView()
+{
+    if (QMdiSubWindow* activeSubWindow = ui->mdiArea->activeSubWindow())
+        return qobject_cast<DiffView*>(activeSubWindow->widget());
+    return 0;
+}
+
+// 查找子窗口：按路径在索引中查找，一次打开上千个文件时不需要每次遍历所有窗口。
+// 窗口关闭或者另存为其他文件之后索引中的记录不再有效，查找时顺便删除
 QMdiSubWindow* MainWindow::findMdiChild(const QString& fileName)
 {
     QString canonicalFilePath = QFileInfo(fileName).canonicalFilePath();
-    // 利用foreach语句遍历子窗口列表，如果其文件路径和要查找的路径相同，则返回该窗口
-    foreach (QMdiSubWindow* window, ui->mdiArea->subWindowList())
+    QHash<QString, QPointer<QMdiSubWindow> >::iterator it = openWindows.find(canonicalFilePath);
+    if (it == openWindows.end())
+        return 0;
+    QMdiSubWindow* window = it.value();
+    if (window && window->widget())
     {
+        // 大文件查看窗口和文档句柄的文件路径记录在 windowFilePath 中，
+        // 编辑器在第一次加载完成之前还没有路径
         MdiChild* mdiChild = qobject_cast<MdiChild*>(window->widget());
-        if (mdiChild->currentFile() == canonicalFilePath)
+        QString path = mdiChild ? mdiChild->currentFile() : window->widget()->windowFilePath();
+        if (path == canonicalFilePath || (mdiChild && mdiChild->isNewFile() && mdiChild->isBusy()))
             return window;
     }
+    openWindows.erase(it);
     return 0;
 }
 
+// 记录子窗口打开的文件
+void MainWindow::indexWindow(QMdiSubWindow* window, const QString& fileName)
+{
+    QString canonicalFilePath = QFileInfo(fileName).canonicalFilePath();
+    if (window && !canonicalFilePath.isEmpty())
+        openWindows.insert(canonicalFilePath, window);
+}
+
+// 为标签页创建只记录路径的文档句柄，不读取文件，也不创建编辑器
+QMdiSubWindow* MainWindow::openDocumentHandle(const QString& fileName)
+{
+    DocumentHandle* handle = new DocumentHandle(fileName);
+    QMdiSubWindow* window = ui->mdiArea->addSubWindow(handle);
+    indexWindow(window, fileName);
+    handle->show();
+    return window;
+}
+
+// 子窗口中是文档句柄时换成编辑器并开始加载，返回窗口中的编辑器。
+// 文件已经无法读取时关闭窗口，在当前的信号处理完之后再关闭
+MdiChild* MainWindow::loadDocument(QMdiSubWindow* window, int priority, bool wait)
+{
+    DocumentHandle* handle = qobject_cast<DocumentHandle*>(window->widget());
+    if (!handle)
+        return qobject_cast<MdiChild*>(window->widget());
+    MdiChild* child = createMdiChild(0, window);
+    handle->deleteLater();
+    child->setCursorAfterLoad(handle->cursorPosition());
+    child->show();
+    if (!child->loadFile(handle->fileName(), wait))
+    {
+        QMetaObject::invokeMethod(window, "close", Qt::QueuedConnection);
+        return 0;
+    }
+    child->setIoPriority(priority);
+    return child;
+}
+
+// 把编辑器换回文档句柄，编辑器连同文档、撤销记录和布局一起销毁，自动保存和编辑日志也随文档一起结束。
+// 有更改、撤销记录或者其他视图的编辑器不能换回
+bool MainWindow::unloadMdiChild(MdiChild* child)
+{
+    QMdiSubWindow* window = qobject_cast<QMdiSubWindow*>(child->parentWidget());
+    if (!window || !child->canUnload())
+        return false;
+    DocumentHandle* handle = new DocumentHandle(child->currentFile(), child->textCursor().position());
+    window->setWidget(handle);
+    handle->show();
+    child->deleteLater();
+    return true;
+}
+
+// 以只读方式查看大文件，失败时返回 0
+QMdiSubWindow* MainWindow::openLargeFile(const QString& fileName)
+{
+    LargeFileView* view = new LargeFileView;
+    if (!view->openFile(fileName))
+    {
+        QMessageBox::warning(this, tr("多文档编辑器"), tr("无法读取文件 %1。").arg(fileName));
+        delete view;
+        return 0;
+    }
+    QMdiSubWindow* window = ui->mdiArea->addSubWindow(view);
+    indexWindow(window, fileName);
+    connect(view, SIGNAL(searchFinished(bool)), this, SLOT(largeFileSearchFinished(bool)));
+    view->show();
+    return window;
+}
+
+// 询问是否用只读的查看器打开大文件，默认用编辑器打开
+bool MainWindow::confirmLargeFileView(const QString& fileName)
+{
+    QMessageBox box(QMessageBox::Question, tr("多文档编辑器"),
+                    tr("文件 %1 有 %2 MB，在编辑器中打开会占用大量内存，编辑也可能很慢。\n"
+                       "是否改用只读的大文件查看器？")
+                        .arg(QFileInfo(fileName).fileName())
+                        .arg(QFileInfo(fileName).size() >> 20),
+                    QMessageBox::NoButton, this);
+    QPushButton* editButton = box.addButton(tr("编辑(&E)"), QMessageBox::AcceptRole);
+    QPushButton* viewButton = box.addButton(tr("只读查看(&V)"), QMessageBox::ActionRole);
+    box.setDefaultButton(editButton);
+    box.exec();
+    return box.clickedButton() == viewButton;
+}
+
+// 以十六进制查看二进制文件，失败时返回 0
+QMdiSubWindow* MainWindow::openHexFile(const QString& fileName)
+{
+    HexView* view = new HexView;
+    if (!view->openFile(fileName))
+    {
+        QMessageBox::warning(this, tr("多文档编辑器"), tr("无法读取文件 %1。").arg(fileName));
+        delete view;
+        return 0;
+    }
+    QMdiSubWindow* window = ui->mdiArea->addSubWindow(view);
+    indexWindow(window, fileName);
+    connect(view, SIGNAL(searchFinished(bool)), this, SLOT(largeFileSearchFinished(bool)));
+    connect(view, SIGNAL(saveFinished(bool)), this, SLOT(hexViewSaved(bool)));
+    connect(view, SIGNAL(cursorOffsetChanged(qint64)), this, SLOT(showHexOffset(qint64)));
+    view->show();
+    return window;
+}
+
 // 读取窗口设置
 void MainWindow::readSettings()
 {
@@ -43,6 +215,10 @@ void MainWindow::readSettings()
     QSize size = settings.value("size", QSize(400, 400)).toSize();
     move(pos);
     resize(size);
+    // 恢复视图模式
+    bool tabbed = settings.value("tabbed", false).toBool();
+    ui->actionTabbed->setChecked(tabbed);
+    ui->mdiArea->setViewMode(tabbed ? QMdiArea::TabbedView : QMdiArea::SubWindowView);
 }
 
 // 写入窗口设置
@@ -53,6 +229,8 @@ void MainWindow::writeSettings()
     settings.setValue("pos", pos());
     // 写入大小信息
     settings.setValue("size", size());
+    // 写入视图模式
+    settings.setValue("tabbed", ui->mdiArea->viewMode() == QMdiArea::TabbedView);
 }
 
 // 初始化窗口
@@ -64,6 +242,9 @@ void MainWindow::initWindow()
     // 当多文档区域的内容超出可视区域后，出现滚动条
     ui->mdiArea->setHorizontalScrollBarPolicy(Qt::ScrollBarAsNeeded);
     ui->mdiArea->setVerticalScrollBarPolicy(Qt::ScrollBarAsNeeded);
+    // 标签页模式下的标签可以关闭和拖动
+    ui->mdiArea->setTabsClosable(true);
+    ui->mdiArea->setTabsMovable(true);
     ui->statusBar->showMessage(tr("欢迎使用多文档编辑器"));
     QLabel* label = new QLabel(this);
     label->setFrameStyle(QFrame::Box | QFrame::Sunken);
@@ -72,24 +253,57 @@ void MainWindow::initWindow()
     label->setTextFormat(Qt::RichText);
     // 可以打开外部链接
     label->setOpenExternalLinks(true);
+    // 活动文档的换行符显示在链接的左边
+    ui->statusBar->addPermanentWidget(lineEndingLabel);
     ui->statusBar->addPermanentWidget(label);
+    // 三种换行符只能选择一种
+    QActionGroup* lineEndingGroup = new QActionGroup(this);
+    lineEndingGroup->addAction(ui->actionLf);
+    lineEndingGroup->addAction(ui->actionCrLf);
+    lineEndingGroup->addAction(ui->actionCr);
     ui->actionNew->setStatusTip(tr("创建一个文件"));
     // 设置其他动作的状态提示
     ui->actionOpen->setStatusTip(tr("打开一个已经存在的文件"));
     ui->actionSave->setStatusTip(tr("保存文档到硬盘"));
     ui->actionSaveAs->setStatusTip(tr("以新的名称保存文档"));
+    ui->actionSaveAll->setStatusTip(tr("保存所有被更改的文档"));
     ui->actionExit->setStatusTip(tr("退出应用程序"));
     ui->actionUndo->setStatusTip(tr("撤销先前的操作"));
     ui->actionRedo->setStatusTip(tr("恢复先前的操作"));
+    // 撤销历史滑块放在撤销和恢复按钮之后，拖动可以回到任意一个历史状态，包括撤销后又编辑时保留的分支
+    historySlider->setMaximumWidth(160);
+    historySlider->setToolTip(tr("撤销历史"));
+    historySlider->setStatusTip(tr("拖动回到任意一个历史状态"));
+    ui->mainToolBar->addWidget(historySlider);
+    connect(historySlider, SIGNAL(valueChanged(int)), this, SLOT(travelHistory(int)));
     ui->actionCut->setStatusTip(tr("剪切选中的内容到剪贴板"));
     ui->actionCopy->setStatusTip(tr("复制选中的内容到剪贴板"));
     ui->actionPaste->setStatusTip(tr("粘贴剪贴板的内容到当前位置"));
+    ui->actionLf->setStatusTip(tr("保存时使用 Unix 换行符"));
+    ui->actionCrLf->setStatusTip(tr("保存时使用 Windows 换行符"));
+    ui->actionCr->setStatusTip(tr("保存时使用旧的 Mac 换行符"));
+    ui->actionViewLarge->setStatusTip(tr("以只读方式查看任意大小的文件，不把整个文件读入内存"));
+    ui->actionViewHex->setStatusTip(tr("按字节查看和修改任意大小的文件"));
+    ui->actionFollow->setStatusTip(tr("把文件新增的内容追加到文档末尾，适合查看不断增长的日志"));
+    ui->actionHistory->setStatusTip(tr("打开活动文档以前保存过的一个版本"));
+    ui->actionFind->setStatusTip(tr("从当前位置向后查找文本"));
+    ui->actionGoto->setStatusTip(tr("转到指定的行号或百分比位置"));
+    ui->actionCompare->setStatusTip(tr("逐行比较活动文档和另一个打开的文档，并排显示差异"));
+    ui->actionNextDiff->setStatusTip(tr("定位到比较窗口中的下一处差异"));
+    ui->actionPreviousDiff->setStatusTip(tr("定位到比较窗口中的上一处差异"));
     ui->actionClose->setStatusTip(tr("关闭活动窗口"));
     ui->actionCloseAll->setStatusTip(tr("关闭所有窗口"));
+    ui->actionNewView->setStatusTip(tr("为活动文档再打开一个窗口，编辑同时显示在所有窗口中"));
     ui->actionTile->setStatusTip(tr("平铺所有窗口"));
     ui->actionCascade->setStatusTip(tr("层叠所有窗口"));
+    ui->actionTabbed->setStatusTip(tr("以标签页显示窗口，只加载当前标签页的内容"));
     ui->actionNext->setStatusTip(tr("将焦点移动到下一个窗口"));
     ui->actionPrevious->setStatusTip(tr("将焦点移动到前一个窗口"));
+    ui->actionLatency->setStatusTip(tr("查看各文档从按键到完成绘制的延迟分布"));
+    ui->actionMemory->setStatusTip(tr("查看各文档估计占用的内存和进程占用的物理内存"));
+    ui->actionTrace->setStatusTip(tr("记录加载、保存、布局和搜索等操作的耗时"));
+    ui->actionTrace->setChecked(Tracer::isEnabled());
+    ui->actionExportTrace->setStatusTip(tr("把记录的操作耗时导出为 Chrome 跟踪文件，可以用 chrome://tracing 或 Perfetto 打开"));
     ui->actionAbout->setStatusTip(tr("显示本软件的介绍"));
     ui->actionAboutQt->setStatusTip(tr("显示Qt的介绍"));
 }
@@ -116,6 +330,15 @@ void MainWindow::closeEvent(QCloseEvent* event)
 MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent), ui(new Ui::MainWindow)
 {
     ui->setupUi(this);
+    // 停顿监视最先启动，之后创建窗口和恢复文档时的停顿也会被记录
+    QSettings settings("uestc_xiye", "myMdi");
+    watchdog = new StallWatchdog(settings.value("stallThreshold", DefaultStallThreshold).toInt(), this);
+    LocalHistory::setRecording(settings.value("localHistory", true).toBool());
+    isBatchOpening = false;
+    savedCount = 0;
+    // 状态栏中显示换行符的标签和工具栏中的撤销历史滑块，更新菜单时会用到
+    lineEndingLabel = new QLabel(this);
+    historySlider = new QSlider(Qt::Horizontal, this);
 
     // 创建间隔器动作并在其中设置间隔器
     actionSeparator = new QAction(this);
@@ -124,6 +347,9 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent), ui(new Ui::MainWi
     updateMenus();
     // 当有活动窗口时更新菜单
     connect(ui->mdiArea, SIGNAL(subWindowActivated(QMdiSubWindow*)), this, SLOT(updateMenus()));
+    // 子窗口被激活时加载延迟的文件内容
+    connect(ui->mdiArea, SIGNAL(subWindowActivated(QMdiSubWindow*)), this,
+            SLOT(activateMdiChild(QMdiSubWindow*)));
 
     // 创建信号映射器
     windowMapper = new QSignalMapper(this);
@@ -136,6 +362,10 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent), ui(new Ui::MainWi
     readSettings();
     // 初始化窗口
     initWindow();
+    // 创建自动保存和编辑日志，窗口显示之后再检查是否有需要恢复的文档
+    autoSaver = new AutoSaver(this);
+    editJournal = new EditJournal(this);
+    QTimer::singleShot(0, this, SLOT(recoverDocuments()));
 }
 
 // 析构函数
@@ -155,44 +385,270 @@ void MainWindow::on_actionNew_triggered()
 // 打开文件菜单
 void MainWindow::on_actionOpen_triggered()
 {
-    // 获取文件路径
-    QString fileName = QFileDialog::getOpenFileName(this);
-    // 如果路径不为空，则查看该文件是否已经打开
-    if (!fileName.isEmpty())
+    // 获取文件路径，可以一次选择多个文件
+    QStringList fileNames = QFileDialog::getOpenFileNames(this);
+    if (fileNames.isEmpty())
+        return;
+    // 标签页模式下只有当前标签页需要文件内容，其余文件延迟到被激活时再读取
+    bool deferred = (ui->mdiArea->viewMode() == QMdiArea::TabbedView);
+    QMdiSubWindow* last = 0;
+    // 批量打开期间每个新窗口都会被激活，这时不加载内容
+    isBatchOpening = true;
+    foreach (const QString& fileName, fileNames)
     {
         QMdiSubWindow* existing = findMdiChild(fileName);
-        // 如果已经存在，则将对应的子窗口设置为活动窗口
+        // 如果已经存在，则之后将对应的子窗口设置为活动窗口
         if (existing)
         {
-            ui->mdiArea->setActiveSubWindow(existing);
-            return;
+            last = existing;
+            continue;
         }
-        // 如果没有打开，则新建子窗口
-        MdiChild* child = createMdiChild();
-        if (child->loadFile(fileName))
+        // 二进制文件在 I/O 线程中读取时识别，之后改用十六进制查看器打开，这里不读取文件。
+        // 较大的文件默认仍然用编辑器打开，用户可以改用只读的查看器；超过编辑器上限的文件直接用查看器打开。
+        // 查看器不能解压，只有这样的文件才在这里检查文件头
+        qint64 size = QFileInfo(fileName).size();
+        if (size >= LargeFileThreshold && !isGzipFile(fileName)
+            && (size > DocumentIo::MaxEditorFileSize || confirmLargeFileView(fileName)))
         {
-            ui->statusBar->showMessage(tr("打开文件成功"), 2000);
-            child->show();
+            if (QMdiSubWindow* window = openLargeFile(fileName))
+                last = window;
+            continue;
         }
-        else
+        // 如果没有打开，则新建子窗口，标签页模式下只创建文档句柄
+        if (deferred)
+        {
+            last = openDocumentHandle(fileName);
+            continue;
+        }
+        MdiChild* child = createMdiChild();
+        if (!child->loadFile(fileName))
         {
             child->close();
+            continue;
         }
+        child->show();
+        last = qobject_cast<QMdiSubWindow*>(child->parentWidget());
+        indexWindow(last, fileName);
     }
+    isBatchOpening = false;
+    if (last)
+    {
+        ui->mdiArea->setActiveSubWindow(last);
+        // 窗口已经是活动窗口时不会再发射激活信号，这里直接加载其内容
+        activateMdiChild(last);
+    }
+}
+
+// 只读查看大文件菜单：任意大小的文件都可以用查看器打开
+void MainWindow::on_actionViewLarge_triggered()
+{
+    QString fileName = QFileDialog::getOpenFileName(this);
+    if (fileName.isEmpty())
+        return;
+    QMdiSubWindow* window = findMdiChild(fileName);
+    if (!window)
+        window = openLargeFile(fileName);
+    if (window)
+        ui->mdiArea->setActiveSubWindow(window);
+}
+
+// 以十六进制打开菜单：任意文件都可以按字节查看和修改
+void MainWindow::on_actionViewHex_triggered()
+{
+    QString fileName = QFileDialog::getOpenFileName(this);
+    if (fileName.isEmpty())
+        return;
+    QMdiSubWindow* window = findMdiChild(fileName);
+    if (!window)
+        window = openHexFile(fileName);
+    if (window)
+        ui->mdiArea->setActiveSubWindow(window);
+}
+
+// 跟踪文件末尾菜单：跟踪期间文档只读
+void MainWindow::on_actionFollow_triggered(bool checked)
+{
+    MdiChild* child = activeMdiChild();
+    if (child && !child->setFollowing(checked))
+    {
+        QMessageBox::information(this, tr("跟踪文件末尾"), tr("只能跟踪已经保存、没有更改的未压缩文件。"));
+        checked = !checked;
+    }
+    ui->actionFollow->setChecked(checked && child);
+    updateMenus();
+}
+
+// 与其他文档比较菜单：选择另一个打开的文档，在后台逐行比较两个文档的快照，结果在新窗口中并排显示
+void MainWindow::on_actionCompare_triggered()
+{
+    MdiChild* child = activeMdiChild();
+    if (!child)
+        return;
+    // 同一个文档的多个视图只列出一次，标签页模式下还没有编辑器的文档也列出
+    QList<QMdiSubWindow*> others;
+    QList<QTextDocument*> documents;
+    QStringList items;
+    documents << child->document();
+    foreach (QMdiSubWindow* window, ui->mdiArea->subWindowList())
+    {
+        if (DocumentHandle* handle = qobject_cast<DocumentHandle*>(window->widget()))
+        {
+            others << window;
+            items << handle->fileName();
+            continue;
+        }
+        MdiChild* other = qobject_cast<MdiChild*>(window->widget());
+        if (!other || documents.contains(other->document()))
+            continue;
+        others << window;
+        documents << other->document();
+        items << (other->isNewFile() ? other->userFriendlyCurrentFile() : other->currentFile());
+    }
+    if (others.isEmpty())
+    {
+        QMessageBox::information(this, tr("比较"), tr("没有其他打开的文档可以比较。"));
+        return;
+    }
+    bool ok;
+    QString item = QInputDialog::getItem(this, tr("比较"), tr("与哪个文档比较:"), items, 0, false, &ok);
+    if (!ok)
+        return;
+    // 还没有编辑器的文档先等待读入，新换上的编辑器也计入标签页模式下的数量上限。
+    // 正在读写的文档没有完整的内容
+    QMdiSubWindow* otherWindow = others.at(items.indexOf(item));
+    bool hadEditor = qobject_cast<MdiChild*>(otherWindow->widget()) != 0;
+    MdiChild* other = loadDocument(otherWindow, DocumentIo::Active, true);
+    if (!other)
+        return;
+    if (!hadEditor && ui->mdiArea->viewMode() == QMdiArea::TabbedView)
+        loadedChildren.append(other);
+    if (child->isBusy() || other->isBusy())
+    {
+        QMessageBox::information(this, tr("比较"), tr("文档正在加载或保存，请稍后再比较。"));
+        return;
+    }
+    DiffView* view = new DiffView;
+    ui->mdiArea->addSubWindow(view);
+    connect(view, SIGNAL(compareFinished(bool)), this, SLOT(diffCompared(bool)));
+    view->compare(child->userFriendlyCurrentFile(), child->snapshot(), other->userFriendlyCurrentFile(),
+                  other->snapshot());
+    view->show();
+    ui->statusBar->showMessage(tr("正在比较..."));
+}
+
+// 历史版本菜单：选择活动文档保存过的一个版本，取出到临时目录后在新窗口中打开，
+// 打开后可以和当前文档比较
+void MainWindow::on_actionHistory_triggered()
+{
+    MdiChild* child = activeMdiChild();
+    if (!child || child->isNewFile())
+        return;
+    QList<LocalHistory::Version> versions = LocalHistory::versions(child->currentFile());
+    if (versions.isEmpty())
+    {
+        QMessageBox::information(this, tr("历史版本"), tr("“%1”还没有保存过的历史版本。").arg(child->userFriendlyCurrentFile()));
+        return;
+    }
+    // 最近的版本排在最前面
+    QStringList items;
+    for (int i = versions.size() - 1; i >= 0; i--)
+    {
+        const LocalHistory::Version& version = versions.at(i);
+        items << tr("#%1  %2  %3 字节（新增 %4 字节）")
+                     .arg(i + 1)
+                     .arg(version.time.toString("yyyy-MM-dd hh:mm:ss"))
+                     .arg(version.size)
+                     .arg(version.newBytes);
+    }
+    bool ok;
+    QString item = QInputDialog::getItem(this, tr("历史版本"), tr("选择要打开的版本:"), items, 0, false, &ok);
+    if (!ok)
+        return;
+    int index = versions.size() - 1 - items.indexOf(item);
+    const LocalHistory::Version& version = versions.at(index);
+    // 取出的文件保留原来的扩展名，压缩文件仍然可以边解压边显示
+    QFileInfo info(child->currentFile());
+    QString dir = QDir::temp().filePath("myMdi-history");
+    QDir().mkpath(dir);
+    QString name = QString("%1 (%2)").arg(info.completeBaseName()).arg(version.time.toString("yyyyMMdd-hhmmss"));
+    if (!info.suffix().isEmpty())
+        name += "." + info.suffix();
+    QString fileName = QDir(dir).filePath(name);
+    if (QMdiSubWindow* existing = findMdiChild(fileName))
+    {
+        ui->mdiArea->setActiveSubWindow(existing);
+        return;
+    }
+    HistoryRestoreRequest* request = new HistoryRestoreRequest(version, fileName);
+    connect(request, SIGNAL(finished()), this, SLOT(historyVersionRestored()));
+    DocumentIo::instance()->submit(request);
+    ui->statusBar->showMessage(tr("正在取出历史版本..."));
 }
 
 // 保存菜单
 void MainWindow::on_actionSave_triggered()
 {
+    // 文件在后台写入，写入完成后在 mdiChildSaved() 中显示结果
+    if (HexView* view = activeHexView())
+    {
+        if (view->save())
+            ui->statusBar->showMessage(tr("正在保存..."));
+        return;
+    }
     if (activeMdiChild() && activeMdiChild()->save())
-        ui->statusBar->showMessage(tr("文件保存成功"), 2000);
+        ui->statusBar->showMessage(tr("正在保存..."));
 }
 
 // 另存为菜单
 void MainWindow::on_actionSaveAs_triggered()
 {
     if (activeMdiChild() && activeMdiChild()->saveAs())
-        ui->statusBar->showMessage(tr("文件保存成功"), 2000);
+        ui->statusBar->showMessage(tr("正在保存..."));
+}
+
+// 全部保存菜单：所有被更改的文档同时提交给 I/O 线程写入，
+// 写入的并发数由 I/O 线程的数量限制，全部结束后统一报告失败的文件
+void MainWindow::on_actionSaveAll_triggered()
+{
+    // 上一次全部保存还没有结束
+    if (!pendingSaves.isEmpty())
+        return;
+    saveFailures.clear();
+    savedCount = 0;
+    foreach (QMdiSubWindow* window, ui->mdiArea->subWindowList())
+    {
+        MdiChild* child = qobject_cast<MdiChild*>(window->widget());
+        // 视图的文档由它所属的窗口保存
+        if (!child || child->isView() || !child->document()->isModified())
+            continue;
+        // 每个文档在提交时取得文本快照，之后的写入不再占用界面线程
+        if (child->saveQuietly(child == activeMdiChild() ? DocumentIo::Active : DocumentIo::Visible))
+            pendingSaves << child;
+        else if (child->isBusy())
+            saveFailures << tr("%1: 正在加载或保存").arg(child->userFriendlyCurrentFile());
+        else if (child->isChangedOnDisk())
+            saveFailures << tr("%1: 文件已被其他程序修改").arg(child->userFriendlyCurrentFile());
+    }
+    if (pendingSaves.isEmpty())
+        reportSaveAll();
+    else
+        ui->statusBar->showMessage(tr("正在保存 %1 个文件...").arg(pendingSaves.size()));
+}
+
+// 全部保存结束，在一个对话框中列出所有失败的文件
+void MainWindow::reportSaveAll()
+{
+    if (saveFailures.isEmpty())
+    {
+        ui->statusBar->showMessage(tr("已保存 %1 个文件").arg(savedCount), 2000);
+        return;
+    }
+    ui->statusBar->clearMessage();
+    QMessageBox::warning(this, tr("多文档编辑器"),
+                         tr("已保存 %1 个文件，以下 %2 个文件无法保存：\n%3")
+                             .arg(savedCount)
+                             .arg(saveFailures.size())
+                             .arg(saveFailures.join("\n")));
 }
 
 // 退出菜单
@@ -206,17 +662,36 @@ void MainWindow::on_actionExit_triggered()
 // 撤销菜单
 void MainWindow::on_actionUndo_triggered()
 {
-    if (activeMdiChild())
+    // 正在加载或保存的文档是只读的，不能撤销
+    if (activeMdiChild() && !activeMdiChild()->isReadOnly())
         activeMdiChild()->undo();
 }
 
 // 恢复菜单
 void MainWindow::on_actionRedo_triggered()
 {
-    if (activeMdiChild())
+    if (activeMdiChild() && !activeMdiChild()->isReadOnly())
         activeMdiChild()->redo();
 }
 
+// 拖动撤销历史滑块，活动文档回到对应的历史状态
+void MainWindow::travelHistory(int index)
+{
+    if (activeMdiChild() && !activeMdiChild()->isReadOnly())
+        activeMdiChild()->gotoHistory(index);
+}
+
+// 根据活动文档的撤销历史设置滑块的范围和位置，不触发 travelHistory()
+void MainWindow::updateHistorySlider()
+{
+    MdiChild* child = activeMdiChild();
+    historySlider->blockSignals(true);
+    historySlider->setRange(0, child ? child->historyCount() - 1 : 0);
+    historySlider->setValue(child ? child->historyIndex() : 0);
+    historySlider->setEnabled(child && !child->isReadOnly() && child->historyCount() > 1);
+    historySlider->blockSignals(false);
+}
+
 // 剪切菜单
 void MainWindow::on_actionCut_triggered()
 {
@@ -238,18 +713,176 @@ void MainWindow::on_actionPaste_triggered()
         activeMdiChild()->paste();
 }
 
+// 查找菜单：大文件在后台流式搜索，普通文档在编辑器中查找，到末尾后从头继续
+void MainWindow::on_actionFind_triggered()
+{
+    bool ok;
+    QString text = QInputDialog::getText(this, tr("查找"), tr("查找内容："), QLineEdit::Normal, lastFindText, &ok);
+    if (!ok || text.isEmpty())
+        return;
+    lastFindText = text;
+    if (LargeFileView* view = activeLargeFileView())
+    {
+        view->find(text);
+        ui->statusBar->showMessage(tr("正在搜索..."));
+        return;
+    }
+    if (HexView* view = activeHexView())
+    {
+        view->find(HexView::patternFromText(text));
+        ui->statusBar->showMessage(tr("正在搜索..."));
+        return;
+    }
+    // 只记录在文档中查找的时间，不包括输入查找内容的时间
+    TraceScope trace("MdiChild::find");
+    MdiChild* child = activeMdiChild();
+    if (!child || child->find(text))
+        return;
+    QTextCursor cursor = child->textCursor();
+    cursor.movePosition(QTextCursor::Start);
+    child->setTextCursor(cursor);
+    if (!child->find(text))
+        ui->statusBar->showMessage(tr("找不到 %1").arg(text), 2000);
+}
+
+// 转到菜单：输入行号，或者以 % 结尾的百分比。十六进制查看窗口输入偏移
+void MainWindow::on_actionGoto_triggered()
+{
+    bool ok;
+    if (HexView* view = activeHexView())
+    {
+        QString text = QInputDialog::getText(this, tr("转到"), tr("偏移或百分比（例如 0x1F00、4096 或 50%）："),
+                                             QLineEdit::Normal, QString(), &ok).trimmed();
+        if (!ok || text.isEmpty())
+            return;
+        qint64 offset;
+        if (text.endsWith('%'))
+            offset = qint64(text.left(text.size() - 1).toDouble(&ok) / 100 * view->size());
+        else if (text.startsWith("0x", Qt::CaseInsensitive))
+            offset = text.mid(2).toLongLong(&ok, 16);
+        else
+            offset = text.toLongLong(&ok);
+        if (ok && offset >= 0)
+            view->gotoOffset(offset);
+        return;
+    }
+    QString text = QInputDialog::getText(this, tr("转到"), tr("行号或百分比（例如 1200 或 50%）："),
+                                         QLineEdit::Normal, QString(), &ok).trimmed();
+    if (!ok || text.isEmpty())
+        return;
+    bool isPercent = text.endsWith('%');
+    if (isPercent)
+        text.chop(1);
+    double value = text.toDouble(&ok);
+    if (!ok || value < 0)
+        return;
+    if (LargeFileView* view = activeLargeFileView())
+    {
+        if (isPercent)
+            view->gotoPercent(value);
+        else if (!view->gotoLine(qint64(value)))
+            QMessageBox::information(this, tr("多文档编辑器"),
+                                     tr("行索引还没有建立到第 %1 行，请稍后再试，或者按百分比跳转。").arg(qint64(value)));
+        return;
+    }
+    MdiChild* child = activeMdiChild();
+    if (!child)
+        return;
+    int blocks = child->document()->blockCount();
+    int number = isPercent ? int(value / 100 * (blocks - 1)) : int(value) - 1;
+    QTextBlock block = child->document()->findBlockByNumber(qBound(0, number, blocks - 1));
+    child->setTextCursor(QTextCursor(block));
+    child->ensureCursorVisible();
+}
+
+// 下一处差异菜单
+void MainWindow::on_actionNextDiff_triggered()
+{
+    if (DiffView* view = activeDiffView())
+        view->nextHunk();
+}
+
+// 上一处差异菜单
+void MainWindow::on_actionPreviousDiff_triggered()
+{
+    if (DiffView* view = activeDiffView())
+        view->previousHunk();
+}
+
+// 换行符转换为 LF 菜单
+void MainWindow::on_actionLf_triggered()
+{
+    if (activeMdiChild())
+        activeMdiChild()->setLineEnding(LineEnding::Lf);
+    updateMenus();
+}
+
+// 换行符转换为 CRLF 菜单
+void MainWindow::on_actionCrLf_triggered()
+{
+    if (activeMdiChild())
+        activeMdiChild()->setLineEnding(LineEnding::CrLf);
+    updateMenus();
+}
+
+// 换行符转换为 CR 菜单
+void MainWindow::on_actionCr_triggered()
+{
+    if (activeMdiChild())
+        activeMdiChild()->setLineEnding(LineEnding::Cr);
+    updateMenus();
+}
+
 // 关闭菜单
 void MainWindow::on_actionClose_triggered() { ui->mdiArea->closeActiveSubWindow(); }
 
 // 关闭所有窗口菜单
 void MainWindow::on_actionCloseAll_triggered() { ui->mdiArea->closeAllSubWindows(); }
 
+// 新建视图菜单：为活动文档再打开一个窗口，两个窗口共享同一个文档，光标和滚动位置各自独立
+void MainWindow::on_actionNewView_triggered()
+{
+    MdiChild* child = activeMdiChild();
+    if (!child)
+        return;
+    MdiChild* view = createMdiChild(child);
+    view->show();
+    ui->mdiArea->setActiveSubWindow(qobject_cast<QMdiSubWindow*>(view->parentWidget()));
+}
+
 // 平铺菜单
 void MainWindow::on_actionTile_triggered() { ui->mdiArea->tileSubWindows(); }
 
 // 层叠菜单
 void MainWindow::on_actionCascade_triggered() { ui->mdiArea->cascadeSubWindows(); }
 
+// 标签页模式菜单
+void MainWindow::on_actionTabbed_triggered(bool checked)
+{
+    ui->mdiArea->setViewMode(checked ? QMdiArea::TabbedView : QMdiArea::SubWindowView);
+    if (checked)
+    {
+        // 子窗口模式下已加载的窗口也计入数量上限，按激活的先后排列，较久未使用的先卸载
+        loadedChildren.clear();
+        foreach (QMdiSubWindow* window, ui->mdiArea->subWindowList(QMdiArea::ActivationHistoryOrder))
+        {
+            MdiChild* child = qobject_cast<MdiChild*>(window->widget());
+            if (child && !child->isView() && !child->document()->isModified())
+                loadedChildren.prepend(child);
+        }
+        activateMdiChild(ui->mdiArea->activeSubWindow());
+        return;
+    }
+    // 子窗口模式下所有窗口同时可见，所有文档句柄都换成编辑器
+    loadedChildren.clear();
+    foreach (QMdiSubWindow* window, ui->mdiArea->subWindowList())
+    {
+        MdiChild* child = loadDocument(window, DocumentIo::Visible);
+        if (child && child != activeMdiChild())
+            child->setIoPriority(DocumentIo::Visible);
+    }
+}
+
 // 下一个菜单
 void MainWindow::on_actionNext_triggered() { ui->mdiArea->activateNextSubWindow(); }
 
@@ -259,6 +892,48 @@ void MainWindow::on_actionPrevious_triggered() { ui->mdiArea->activatePreviousSu
 // 关于菜单
 void MainWindow::on_actionAbout_triggered() { QMessageBox::about(this, tr("关于本软件"), tr("开发者：UestcXiye")); }
 
+// 按键延迟菜单：对话框不是模态的，打开期间可以继续编辑并观察延迟的变化
+void MainWindow::on_actionLatency_triggered()
+{
+    if (!latencyDialog)
+    {
+        latencyDialog = new LatencyDialog(ui->mdiArea, this);
+        latencyDialog->setAttribute(Qt::WA_DeleteOnClose);
+    }
+    latencyDialog->show();
+    latencyDialog->raise();
+    latencyDialog->activateWindow();
+}
+
+// 内存占用菜单：统计在后台进行，对话框打开期间定期刷新
+void MainWindow::on_actionMemory_triggered()
+{
+    if (!memoryDialog)
+    {
+        memoryDialog = new MemoryDialog(ui->mdiArea, this);
+        memoryDialog->setAttribute(Qt::WA_DeleteOnClose);
+    }
+    memoryDialog->show();
+    memoryDialog->raise();
+    memoryDialog->activateWindow();
+}
+
+// 记录性能跟踪菜单
+void MainWindow::on_actionTrace_triggered(bool checked) { Tracer::setEnabled(checked); }
+
+// 导出性能跟踪菜单：每个线程只保留最近的事件，导出的是最近一段时间的记录
+void MainWindow::on_actionExportTrace_triggered()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, tr("导出性能跟踪"), "trace.json", tr("JSON 文件 (*.json)"));
+    if (fileName.isEmpty())
+        return;
+    QString error;
+    if (Tracer::exportTrace(fileName, &error))
+        ui->statusBar->showMessage(tr("性能跟踪已导出到 %1").arg(fileName), 2000);
+    else
+        QMessageBox::warning(this, tr("多文档编辑器"), tr("无法写入文件 %1：\n%2").arg(fileName).arg(error));
+}
+
 // 关于 Qt 菜单
 void MainWindow::on_actionAboutQt_triggered()
 {
@@ -270,13 +945,28 @@ void MainWindow::on_actionAboutQt_triggered()
 // 更新菜单
 void MainWindow::updateMenus()
 {
+    TraceScope trace("MainWindow::updateMenus");
     // 根据是否有活动窗口来设置各个动作是否可用
     bool hasMdiChild = (activeMdiChild() != 0);
-    ui->actionSave->setEnabled(hasMdiChild);
+    // 十六进制查看窗口的修改也可以保存
+    ui->actionSave->setEnabled(hasMdiChild || activeHexView());
     ui->actionSaveAs->setEnabled(hasMdiChild);
-    ui->actionPaste->setEnabled(hasMdiChild);
+    ui->actionSaveAll->setEnabled(hasMdiChild);
+    ui->actionFollow->setEnabled(hasMdiChild);
+    ui->actionFollow->setChecked(hasMdiChild && activeMdiChild()->isFollowing());
+    ui->actionHistory->setEnabled(hasMdiChild && !activeMdiChild()->isNewFile());
+    // 查找和转到对大文件查看窗口也可用
+    bool hasWindow = (ui->mdiArea->activeSubWindow() != 0);
+    ui->actionFind->setEnabled(hasWindow);
+    ui->actionGoto->setEnabled(hasWindow);
+    ui->actionCompare->setEnabled(hasMdiChild);
+    bool hasHunks = activeDiffView() && activeDiffView()->hunkCount() > 0;
+    ui->actionNextDiff->setEnabled(hasHunks);
+    ui->actionPreviousDiff->setEnabled(hasHunks);
+    ui->actionPaste->setEnabled(hasMdiChild && !activeMdiChild()->isReadOnly());
     ui->actionClose->setEnabled(hasMdiChild);
     ui->actionCloseAll->setEnabled(hasMdiChild);
+    ui->actionNewView->setEnabled(hasMdiChild);
     ui->actionTile->setEnabled(hasMdiChild);
     ui->actionCascade->setEnabled(hasMdiChild);
     ui->actionNext->setEnabled(hasMdiChild);
@@ -288,26 +978,61 @@ void MainWindow::updateMenus()
     ui->actionCut->setEnabled(hasSelection);
     ui->actionCopy->setEnabled(hasSelection);
     // 有活动窗口且文档有撤销操作时，撤销动作可用
-    ui->actionUndo->setEnabled(activeMdiChild() && activeMdiChild()->document()->isUndoAvailable());
+    ui->actionUndo->setEnabled(activeMdiChild() && activeMdiChild()->isUndoAvailable());
     // 有活动窗口且文档有恢复操作时，恢复动作可用
-    ui->actionRedo->setEnabled(activeMdiChild() && activeMdiChild()->document()->isRedoAvailable());
+    ui->actionRedo->setEnabled(activeMdiChild() && activeMdiChild()->isRedoAvailable());
+    updateHistorySlider();
+    // 显示活动文档的换行符，混用多种换行符时不选中任何一种
+    ui->menuLineEnding->setEnabled(hasMdiChild);
+    lineEndingLabel->setVisible(hasMdiChild);
+    // 停顿日志中记录活动文档的路径和大小
+    if (hasMdiChild)
+    {
+        MdiChild* child = activeMdiChild();
+        watchdog->setContext(tr("%1（%2 个字符）").arg(child->currentFile()).arg(child->document()->characterCount() - 1));
+        lineEndingLabel->setText(LineEnding::name(child->lineEnding(), child->hasMixedLineEndings()));
+        ui->actionLf->setChecked(child->lineEnding() == LineEnding::Lf);
+        ui->actionCrLf->setChecked(child->lineEnding() == LineEnding::CrLf);
+        ui->actionCr->setChecked(child->lineEnding() == LineEnding::Cr);
+    }
+    else
+        watchdog->setContext(QString());
 }
 
-// 创建子窗口部件
-MdiChild* MainWindow::createMdiChild()
+// 创建子窗口部件，source 不为 0 时新窗口是它的另一个视图，
+// window 不为 0 时放入这个已有的子窗口，代替其中的文档句柄
+MdiChild* MainWindow::createMdiChild(MdiChild* source, QMdiSubWindow* window)
 {
     // 创建 MdiChild 部件
     MdiChild* child = new MdiChild;
+    if (source)
+        child->shareDocument(source);
     //向多文档区域添加子窗口，child 为中心部件
-    ui->mdiArea->addSubWindow(child);
+    if (window)
+        window->setWidget(child);
+    else
+        ui->mdiArea->addSubWindow(child);
     // 根据 QTextEdit 类的是否可以复制信号设置剪切复制动作是否可用
     connect(child, SIGNAL(copyAvailable(bool)), ui->actionCut, SLOT(setEnabled(bool)));
     connect(child, SIGNAL(copyAvailable(bool)), ui->actionCopy, SLOT(setEnabled(bool)));
-    // 根据 QTextDocument 类的是否可以撤销恢复信号设置撤销恢复动作是否可用
-    connect(child->document(), SIGNAL(undoAvailable(bool)), ui->actionUndo, SLOT(setEnabled(bool)));
-    connect(child->document(), SIGNAL(redoAvailable(bool)), ui->actionRedo, SLOT(setEnabled(bool)));
+    // 根据子窗口的是否可以撤销恢复信号设置撤销恢复动作是否可用
+    connect(child, SIGNAL(undoAvailable(bool)), ui->actionUndo, SLOT(setEnabled(bool)));
+    connect(child, SIGNAL(redoAvailable(bool)), ui->actionRedo, SLOT(setEnabled(bool)));
+    connect(child, SIGNAL(historyChanged()), this, SLOT(updateHistorySlider()));
     // 每当编辑器中的光标位置改变，就重新显示行号和列号
     connect(child, SIGNAL(cursorPositionChanged()), this, SLOT(showTextRowAndCol()));
+    // 文件在后台读写，完成后显示结果
+    connect(child, SIGNAL(loadFinished(bool)), this, SLOT(mdiChildLoaded(bool)));
+    connect(child, SIGNAL(saveFinished(bool)), this, SLOT(mdiChildSaved(bool)));
+    connect(child, SIGNAL(reloadFinished()), this, SLOT(mdiChildReloaded()));
+    connect(child, SIGNAL(binaryFileDetected(QString)), this, SLOT(mdiChildBinary(QString)));
+    // 视图共享的文档已经由它所属的窗口记录
+    if (source)
+        return child;
+    // 空闲时自动保存被更改的内容
+    autoSaver->addDocument(child);
+    // 每次编辑都追加到编辑日志中
+    editJournal->addDocument(child);
     return child;
 }
 
@@ -320,9 +1045,47 @@ void MainWindow::setActiveSubWindow(QWidget* window)
     ui->mdiArea->setActiveSubWindow(qobject_cast<QMdiSubWindow*>(window));
 }
 
+// 子窗口被激活时把文档句柄换成编辑器，标签页模式下较久未使用的编辑器换回文档句柄
+void MainWindow::activateMdiChild(QMdiSubWindow* window)
+{
+    if (isBatchOpening || !window)
+        return;
+    MdiChild* child = loadDocument(window, DocumentIo::Active);
+    if (!child)
+        return;
+    bool tabbed = (ui->mdiArea->viewMode() == QMdiArea::TabbedView);
+    // 活动窗口的 I/O 请求最先执行，之前的活动窗口在子窗口模式下仍然可见
+    if (lastActiveChild && lastActiveChild != child)
+        lastActiveChild->setIoPriority(tabbed ? DocumentIo::Prefetch : DocumentIo::Visible);
+    child->setIoPriority(DocumentIo::Active);
+    lastActiveChild = child;
+    if (!tabbed)
+        return;
+    // 按最近使用的顺序记录有编辑器的窗口
+    loadedChildren.removeAll(QPointer<MdiChild>());
+    loadedChildren.removeAll(child);
+    loadedChildren.prepend(child);
+    // 以较低的优先级预读下一个标签页，它排在最近使用的窗口之后
+    QList<QMdiSubWindow*> windows = ui->mdiArea->subWindowList();
+    int index = windows.indexOf(window);
+    if (index + 1 < windows.size() && qobject_cast<DocumentHandle*>(windows.at(index + 1)->widget()))
+    {
+        if (MdiChild* next = loadDocument(windows.at(index + 1), DocumentIo::Prefetch))
+            loadedChildren.insert(1, next);
+    }
+    // 超出数量的编辑器换回文档句柄，有更改的编辑器保留，只是不再计数
+    while (loadedChildren.size() > MaxLoadedChildren)
+    {
+        QPointer<MdiChild> old = loadedChildren.takeLast();
+        if (old)
+            unloadMdiChild(old);
+    }
+}
+
 // 更新窗口菜单
 void MainWindow::updateWindowMenu()
 {
+    TraceScope trace("MainWindow::updateWindowMenu");
     // 先清空菜单，然后再添加各个菜单动作
     ui->menuW->clear();
     ui->menuW->addAction(ui->actionClose);     // 关闭
@@ -330,6 +1093,7 @@ void MainWindow::updateWindowMenu()
     ui->menuW->addSeparator();                 // 分隔符
     ui->menuW->addAction(ui->actionTile);      // 平铺
     ui->menuW->addAction(ui->actionCascade);   // 层叠
+    ui->menuW->addAction(ui->actionTabbed);    // 标签页模式
     ui->menuW->addSeparator();                 // 分隔符
     ui->menuW->addAction(ui->actionNext);      // 下一个
     ui->menuW->addAction(ui->actionPrevious);  // 前一个
@@ -341,22 +1105,24 @@ void MainWindow::updateWindowMenu()
     for (int i = 0; i < windows.size(); i++)
     {
         MdiChild* child = qobject_cast<MdiChild*>(windows.at(i)->widget());
+        QString name = child ? child->userFriendlyCurrentFile()
+                             : QFileInfo(windows.at(i)->widget()->windowFilePath()).fileName();
         QString text;
         // 如果窗口数小于 9，则设置编号为快捷键
         if (i < 9)
         {
-            text = tr("&%1 %2").arg(i + 1).arg(child->userFriendlyCurrentFile());
+            text = tr("&%1 %2").arg(i + 1).arg(name);
         }
         else
         {
-            text = tr("%1 %2").arg(i + 1).arg(child->userFriendlyCurrentFile());
+            text = tr("%1 %2").arg(i + 1).arg(name);
         }
         // 添加动作到菜单
         QAction* action = ui->menuW->addAction(text);
         // 设置动作可以选择
         action->setCheckable(true);
         // 设置当前活动窗口动作为选中状态
-        action->setChecked(child == activeMdiChild());
+        action->setChecked(windows.at(i) == ui->mdiArea->activeSubWindow());
         // 关联动作的触发信号到信号映射器的 map() 槽函数上，这个函数会发射 mapped() 信号
         connect(action, SIGNAL(triggered()), windowMapper, SLOT(map()));
         // 将动作与相应的窗口部件进行映射，在发射 mapped() 信号时就会以这个窗口部件为参数
@@ -373,6 +1139,181 @@ void MainWindow::showTextRowAndCol()
         // 因为获取的行号和列号都是从 0 开始的，所以我们这里进行了加 1
         int rowNum = activeMdiChild()->textCursor().blockNumber() + 1;
         int colNum = activeMdiChild()->textCursor().columnNumber() + 1;
-        ui->statusBar->showMessage(tr("%1行 %2列").arg(rowNum).arg(colNum), 2000);
+        QString encoding = QString::fromLatin1(activeMdiChild()->encoding());
+        if (activeMdiChild()->isCompressed())
+            encoding += " gzip";
+        ui->statusBar->showMessage(tr("%1行 %2列  %3").arg(rowNum).arg(colNum).arg(encoding), 2000);
+    }
+}
+
+// 恢复上次异常退出时未保存的文档
+void MainWindow::recoverDocuments()
+{
+    // 按文档归并恢复文件：编辑日志比自动保存更及时，优先重放日志，失败时再使用自动保存
+    QMap<QString, QStringList> documents;
+    QStringList files = RecoveryStore::orphanedFiles(".journal") + RecoveryStore::orphanedFiles(".autosave");
+    foreach (const QString& file, files)
+        documents[QFileInfo(file).completeBaseName()] << file;
+    if (documents.isEmpty())
+        return;
+    QMessageBox::StandardButton ret =
+        QMessageBox::question(this, tr("多文档编辑器"),
+                              tr("上次异常退出时有 %1 个文档没有保存，是否恢复？").arg(documents.size()),
+                              QMessageBox::Yes | QMessageBox::No);
+    QStringList errors;
+    foreach (const QStringList& candidates, documents)
+    {
+        if (ret == QMessageBox::Yes)
+        {
+            MdiChild* child = createMdiChild();
+            QString error;
+            bool restored = false;
+            foreach (const QString& file, candidates)
+            {
+                if ((restored = RecoveryStore::restore(file, child, &error)))
+                    break;
+            }
+            if (restored)
+            {
+                child->show();
+            }
+            else
+            {
+                errors << error;
+                child->close();
+            }
+        }
+        // 恢复的文档会重新开始记录，旧的恢复文件不再需要
+        foreach (const QString& file, candidates)
+            QFile::remove(file);
+    }
+    if (!errors.isEmpty())
+        QMessageBox::warning(this, tr("多文档编辑器"), tr("以下文档无法恢复：\n%1").arg(errors.join("\n")));
+}
+
+// 子窗口加载结束，无法读取的文件关闭其窗口
+void MainWindow::mdiChildLoaded(bool ok)
+{
+    MdiChild* child = qobject_cast<MdiChild*>(sender());
+    if (ok)
+    {
+        if (child)
+            indexWindow(qobject_cast<QMdiSubWindow*>(child->parentWidget()), child->currentFile());
+        ui->statusBar->showMessage(tr("打开文件成功"), 2000);
+        // 显示检测到的换行符
+        updateMenus();
+    }
+    else if (child && child->parentWidget())
+    {
+        QMetaObject::invokeMethod(child->parentWidget(), "close", Qt::QueuedConnection);
+    }
+}
+
+// 子窗口读取的是二进制文件，关闭编辑器，改用十六进制查看器打开
+void MainWindow::mdiChildBinary(const QString& fileName)
+{
+    MdiChild* child = qobject_cast<MdiChild*>(sender());
+    bool active = child && child == activeMdiChild();
+    if (child && child->parentWidget())
+        QMetaObject::invokeMethod(child->parentWidget(), "close", Qt::QueuedConnection);
+    QMdiSubWindow* window = openHexFile(fileName);
+    if (window && active)
+        ui->mdiArea->setActiveSubWindow(window);
+}
+
+// 子窗口保存结束
+void MainWindow::mdiChildSaved(bool ok)
+{
+    MdiChild* child = qobject_cast<MdiChild*>(sender());
+    // 另存为之后按新的路径查找
+    if (ok && child)
+        indexWindow(qobject_cast<QMdiSubWindow*>(child->parentWidget()), child->currentFile());
+    // 全部保存的一部分，所有文件都结束后再统一报告
+    if (pendingSaves.removeAll(child) > 0)
+    {
+        if (ok)
+            savedCount++;
+        else
+            saveFailures << QString("%1: %2").arg(child->currentFile()).arg(child->errorString());
+        pendingSaves.removeAll(QPointer<MdiChild>());
+        if (pendingSaves.isEmpty())
+            reportSaveAll();
+        return;
+    }
+    if (ok)
+        ui->statusBar->showMessage(tr("文件保存成功"), 2000);
+    else
+        ui->statusBar->clearMessage();
+}
+
+// 子窗口重新加载了被其他程序修改的文件
+void MainWindow::mdiChildReloaded()
+{
+    MdiChild* child = qobject_cast<MdiChild*>(sender());
+    if (child)
+        ui->statusBar->showMessage(tr("%1 已被其他程序修改，已重新加载（可以撤销）").arg(child->userFriendlyCurrentFile()),
+                                   3000);
+}
+
+// 大文件和十六进制查看窗口搜索结束
+void MainWindow::largeFileSearchFinished(bool found)
+{
+    if (found)
+        ui->statusBar->clearMessage();
+    else
+        ui->statusBar->showMessage(tr("找不到 %1").arg(lastFindText), 2000);
+}
+
+// 十六进制查看窗口保存结束，失败时查看窗口已经提示过
+void MainWindow::hexViewSaved(bool ok)
+{
+    if (ok)
+        ui->statusBar->showMessage(tr("文件保存成功"), 2000);
+    else
+        ui->statusBar->clearMessage();
+}
+
+// 比较结束，显示差异的数量
+void MainWindow::diffCompared(bool ok)
+{
+    DiffView* view = qobject_cast<DiffView*>(sender());
+    if (!ok || !view)
+    {
+        ui->statusBar->clearMessage();
+        return;
+    }
+    if (view->hunkCount() == 0)
+        ui->statusBar->showMessage(tr("两个文档的内容相同"), 2000);
+    else
+        ui->statusBar->showMessage(tr("共有 %1 处差异，按 F8 定位到下一处").arg(view->hunkCount()), 2000);
+    updateMenus();
+}
+
+// 历史版本取出结束，在编辑器中打开取出的文件。大文件也不改用只读的查看器，
+// 取出的版本通常要与当前文档比较，比较只支持编辑器窗口
+void MainWindow::historyVersionRestored()
+{
+    HistoryRestoreRequest* request = qobject_cast<HistoryRestoreRequest*>(sender());
+    if (!request || request->wasCancelled())
+        return;
+    ui->statusBar->clearMessage();
+    if (!request->errorString().isEmpty())
+    {
+        QMessageBox::warning(this, tr("历史版本"), tr("无法取出历史版本:\n%1").arg(request->errorString()));
+        return;
+    }
+    MdiChild* child = createMdiChild();
+    if (!child->loadFile(request->fileName()))
+    {
+        child->close();
+        return;
     }
+    child->show();
+    ui->mdiArea->setActiveSubWindow(qobject_cast<QMdiSubWindow*>(child->parentWidget()));
+}
+
+// 显示十六进制查看窗口的光标位置
+void MainWindow::showHexOffset(qint64 offset)
+{
+    ui->statusBar->showMessage(tr("偏移 0x%1 (%2)").arg(offset, 0, 16).arg(offset), 2000);
 }
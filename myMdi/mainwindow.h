@@ -1,11 +1,23 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+class AutoSaver;
+class DiffView;
+class EditJournal;
+class HexView;
+class LargeFileView;
+class LatencyDialog;
 class MdiChild;
+class MemoryDialog;
+class QLabel;
 class QMdiSubWindow;
 class QSignalMapper;
+class QSlider;
+class StallWatchdog;
 
+#include <QHash>
 #include <QMainWindow>
+#include <QPointer>
 
 namespace Ui
 {
@@ -19,12 +31,38 @@ private:
     Ui::MainWindow* ui;
     QAction* actionSeparator;     // 间隔器
     QSignalMapper* windowMapper;  // 信号映射器
+    QLabel* lineEndingLabel;      // 状态栏中显示活动文档的换行符
+    QSlider* historySlider;       // 工具栏中的撤销历史滑块
+    QList<QPointer<MdiChild> > loadedChildren;  // 标签页模式下最近使用、有编辑器的窗口
+    bool isBatchOpening;                        // 正在批量打开文件，暂不加载窗口内容
+    QHash<QString, QPointer<QMdiSubWindow> > openWindows;  // 打开的文件路径到子窗口的索引
+    QPointer<MdiChild> lastActiveChild;         // 上一个活动窗口，用于调整 I/O 优先级
+    AutoSaver* autoSaver;                       // 自动保存
+    EditJournal* editJournal;                   // 编辑日志
+    QList<QPointer<MdiChild> > pendingSaves;    // 全部保存时还没有写完的文档
+    QStringList saveFailures;                   // 全部保存时失败的文件及原因
+    int savedCount;                             // 全部保存时已经成功保存的文件数
+    QString lastFindText;                       // 上次查找的内容
+    QPointer<LatencyDialog> latencyDialog;      // 按键延迟诊断对话框
+    QPointer<MemoryDialog> memoryDialog;        // 内存占用诊断对话框
+    StallWatchdog* watchdog;                    // 界面线程停顿监视
 
     MdiChild* activeMdiChild();                            // 活动窗口
+    LargeFileView* activeLargeFileView();                  // 活动的大文件查看窗口
+    HexView* activeHexView();                              // 活动的十六进制查看窗口
+    DiffView* activeDiffView();                            // 活动的比较窗口
     QMdiSubWindow* findMdiChild(const QString& fileName);  // 查找子窗口
+    void indexWindow(QMdiSubWindow* window, const QString& fileName);  // 记录子窗口打开的文件
+    QMdiSubWindow* openDocumentHandle(const QString& fileName);  // 为标签页创建只记录路径的文档句柄
+    MdiChild* loadDocument(QMdiSubWindow* window, int priority, bool wait = false);  // 需要时把文档句柄换成编辑器
+    bool unloadMdiChild(MdiChild* child);                  // 把编辑器换回文档句柄
+    QMdiSubWindow* openLargeFile(const QString& fileName);  // 以只读方式查看大文件
+    bool confirmLargeFileView(const QString& fileName);     // 询问是否用只读的查看器打开大文件
+    QMdiSubWindow* openHexFile(const QString& fileName);    // 以十六进制查看二进制文件
     void readSettings();                                   // 读取窗口设置
     void writeSettings();                                  // 写入窗口设置
     void initWindow();                                     // 初始化窗口
+    void reportSaveAll();                                  // 报告全部保存的结果
 
 protected:
     void closeEvent(QCloseEvent* event);  // 关闭事件
@@ -36,28 +74,60 @@ public:
 private slots:
     void on_actionNew_triggered();       // 新建文件菜单
     void on_actionOpen_triggered();      // 打开文件菜单
+    void on_actionViewLarge_triggered(); // 只读查看大文件菜单
+    void on_actionViewHex_triggered();   // 以十六进制打开菜单
+    void on_actionFollow_triggered(bool checked);  // 跟踪文件末尾菜单
+    void on_actionHistory_triggered();   // 历史版本菜单
+    void on_actionCompare_triggered();   // 与其他文档比较菜单
     void on_actionSave_triggered();      // 保存菜单
     void on_actionSaveAs_triggered();    // 另存为菜单
+    void on_actionSaveAll_triggered();   // 全部保存菜单
     void on_actionExit_triggered();      // 退出菜单
     void on_actionUndo_triggered();      // 撤销菜单
     void on_actionRedo_triggered();      // 恢复菜单
     void on_actionCut_triggered();       // 剪切菜单
     void on_actionCopy_triggered();      // 复制菜单
     void on_actionPaste_triggered();     // 粘贴菜单
+    void on_actionFind_triggered();      // 查找菜单
+    void on_actionGoto_triggered();      // 转到菜单
+    void on_actionNextDiff_triggered();  // 下一处差异菜单
+    void on_actionPreviousDiff_triggered();  // 上一处差异菜单
+    void on_actionLf_triggered();        // 换行符转换为 LF 菜单
+    void on_actionCrLf_triggered();      // 换行符转换为 CRLF 菜单
+    void on_actionCr_triggered();        // 换行符转换为 CR 菜单
     void on_actionClose_triggered();     // 关闭菜单
     void on_actionCloseAll_triggered();  // 关闭所有窗口菜单
+    void on_actionNewView_triggered();   // 新建视图菜单
     void on_actionTile_triggered();      // 平铺菜单
     void on_actionCascade_triggered();   // 层叠菜单
+    void on_actionTabbed_triggered(bool checked);  // 标签页模式菜单
     void on_actionNext_triggered();      // 下一个菜单
     void on_actionPrevious_triggered();  // 前一个菜单
+    void on_actionLatency_triggered();   // 按键延迟菜单
+    void on_actionMemory_triggered();    // 内存占用菜单
+    void on_actionTrace_triggered(bool checked);  // 记录性能跟踪菜单
+    void on_actionExportTrace_triggered();  // 导出性能跟踪菜单
     void on_actionAbout_triggered();     // 关于菜单
     void on_actionAboutQt_triggered();   // 关于 Qt 菜单
 
     void updateMenus();                        // 更新菜单
-    MdiChild *createMdiChild();                // 创建子窗口
+    MdiChild *createMdiChild(MdiChild* source = 0, QMdiSubWindow* window = 0);  // 创建子窗口，source 不为 0 时作为它的另一个视图
     void setActiveSubWindow(QWidget* window);  // 设置活动子窗口
+    void activateMdiChild(QMdiSubWindow* window);  // 子窗口被激活时加载其内容
     void updateWindowMenu();                   // 更新窗口菜单
     void showTextRowAndCol();                  // 显示文本的行号和列号
+    void recoverDocuments();                   // 恢复上次异常退出时未保存的文档
+    void mdiChildLoaded(bool ok);              // 子窗口加载结束
+    void mdiChildBinary(const QString& fileName);  // 子窗口读取的是二进制文件
+    void mdiChildSaved(bool ok);               // 子窗口保存结束
+    void mdiChildReloaded();                   // 子窗口重新加载了被其他程序修改的文件
+    void largeFileSearchFinished(bool found);  // 大文件搜索结束
+    void hexViewSaved(bool ok);                // 十六进制查看窗口保存结束
+    void historyVersionRestored();             // 历史版本取出结束
+    void diffCompared(bool ok);                // 比较结束
+    void showHexOffset(qint64 offset);         // 显示十六进制查看窗口的光标位置
+    void travelHistory(int index);             // 拖动撤销历史滑块
+    void updateHistorySlider();                // 更新撤销历史滑块
 };
 
 #endif  // MAINWINDOW_H
@@ -5,9 +5,23 @@
 #include <QFile>
 #include <QFileDialog>
 #include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QKeyEvent>
 #include <QMessageBox>
 #include <QPushButton>
-#include <QTextStream>
+#include <QScrollBar>
+#include <QTextBlock>
+#include <QTextDecoder>
+
+#include "localhistory.h"
+#include "recoverystore.h"
+#include "tracer.h"
+#include "undomanager.h"
+
+static const qint64 FollowBatchBytes = 8 << 20;  // 跟踪时每次最多读取 8MB，作为一次编辑追加
+static const int FollowPollInterval = 1000;      // 跟踪时每秒检查一次文件
+static const int MaxFollowChars = 32 << 20;      // 跟踪时文档最多保留的字符数，超出时丢弃开头的行
+static const int DiskCheckDelay = 300;           // 文件变化后 300 毫秒再检查
 
 // 是否需要保存
 bool MdiChild::maybeSave()
@@ -27,8 +41,8 @@ bool MdiChild::maybeSave()
         box.exec();
         if (box.clickedButton() == yesBtn)
         {
-            // 如果用户选择是，则返回保存操作的结果
-            return save();
+            // 如果用户选择是，则等待保存完成，返回保存操作的结果
+            return save(true);
         }
         else if (box.clickedButton() == cancelBtn)
         {
@@ -46,19 +60,42 @@ void MdiChild::setCurrentFile(const QString& fileName)
     curFile = QFileInfo(fileName).canonicalFilePath();
     // 文件已经被保存过了
     isUntitled = false;
-    // 文档没有被更改过
+    // 文档没有被更改过，记录现在的内容，之后改回这个内容时也不算更改
     document()->setModified(false);
+    markSaved();
     // 窗口不显示被更改标志
     setWindowModified(false);
     // 设置窗口标题，userFriendlyCurrentFile() 函数返回文件名
     setWindowTitle(userFriendlyCurrentFile() + "[*]");
+    emit documentSynced();
 }
 
 // 关闭操作，在关闭事件中执行
 void MdiChild::closeEvent(QCloseEvent* event)
 {
+    // 视图不持有文档，直接关闭
+    if (primary)
+    {
+        event->accept();
+        return;
+    }
+    // 正在保存时先等待保存完成
+    if (FileWriteRequest* request = saveRequest)
+    {
+        request->waitForFinished();
+        finishSave(request);
+    }
     if (maybeSave())
     {
+        // 取消还没有完成的加载
+        if (loadRequest)
+            loadRequest->cancel();
+        // 共享这个文档的视图一起关闭
+        foreach (const QPointer<MdiChild>& view, views)
+        {
+            if (view)
+                view->close();
+        }
         // 如果 maybeSave() 函数返回 true，则关闭窗口
         event->accept();
     }
@@ -75,9 +112,9 @@ void MdiChild::contextMenuEvent(QContextMenuEvent* e)
     // 创建菜单，并向其中添加动作
     QMenu* menu = new QMenu;
     QAction* undo = menu->addAction(tr("撤销(&U)"), this, SLOT(undo()), QKeySequence::Undo);
-    undo->setEnabled(document()->isUndoAvailable());
+    undo->setEnabled(!isReadOnly() && isUndoAvailable());
     QAction* redo = menu->addAction(tr("恢复(&R)"), this, SLOT(redo()), QKeySequence::Redo);
-    redo->setEnabled(document()->isRedoAvailable());
+    redo->setEnabled(!isReadOnly() && isRedoAvailable());
     menu->addSeparator();
     QAction* cut = menu->addAction(tr("剪切(&T)"), this, SLOT(cut()), QKeySequence::Cut);
     cut->setEnabled(textCursor().hasSelection());
@@ -101,6 +138,113 @@ MdiChild::MdiChild(QWidget* parent) : QTextEdit(parent)
     setAttribute(Qt::WA_DeleteOnClose);
     // 初始 isUntitled 为 true
     isUntitled = true;
+    savedCursorPos = 0;
+    quietSave = false;
+    // 新建的文档使用不带 BOM 的 UTF-8 和本平台的换行符
+    format.encoding = "UTF-8";
+    format.bom = false;
+    format.lineEnding = LineEnding::platformDefault();
+    format.mixedLineEndings = false;
+    format.compressed = false;
+    isStreaming = false;
+    diskSize = 0;
+    following = false;
+    followWatcher = 0;
+    followDecoder = 0;
+    followPending = false;
+    isPartial = false;
+    ropeLength = 0;
+    formatChanged = false;
+    isResetting = false;
+    isApplyingUndo = false;
+    lastEdit = NoEdit;
+    lastTypedSpace = false;
+    isChanging = false;
+    viewNumber = 0;
+    diskWatcher = 0;
+    contentChanges = 0;
+    followTimer.setInterval(FollowPollInterval);
+    connect(&followTimer, SIGNAL(timeout()), this, SLOT(followFileChanged()));
+    diskTimer.setSingleShot(true);
+    diskTimer.setInterval(DiskCheckDelay);
+    connect(&diskTimer, SIGNAL(timeout()), this, SLOT(checkDiskFile()));
+    // 编辑时只记录更改区域，文本绳在一步撤销结束或者需要快照时才更新
+    connect(document(), SIGNAL(contentsChange(int, int, int)), this, SLOT(recordRopeChange(int, int, int)));
+    connect(document(), SIGNAL(contentsChanged()), this, SLOT(documentChangeFinished()));
+    connect(this, SIGNAL(cursorPositionChanged()), this, SLOT(cursorMoved()));
+    // 撤销由 UndoManager 管理，关闭 QTextDocument 自己的撤销栈
+    setUndoRedoEnabled(false);
+    undoManager = new UndoManager(this);
+}
+
+MdiChild::~MdiChild()
+{
+    // 窗口没有经过关闭事件就被销毁时，也要取消还没有完成的加载
+    if (loadRequest)
+        loadRequest->cancel();
+    // 正在进行的读取持有解码器，随请求一起删除
+    if (followRequest)
+        followRequest->cancel();
+    if (reloadRequest)
+        reloadRequest->cancel();
+    delete followDecoder;
+    // 还没有销毁的视图不能继续使用即将随这个窗口销毁的文档
+    foreach (const QPointer<MdiChild>& view, views)
+    {
+        if (view)
+        {
+            view->primary = 0;
+            view->setDocument(new QTextDocument(view));
+        }
+    }
+}
+
+// 作为 source 的另一个视图：共享同一个 QTextDocument，编辑立即出现在所有视图中，
+// 文本和布局只有一份，光标、选择和滚动位置各自独立。文件、撤销和读写的状态都保存在
+// 文档所属的窗口中，视图的这些操作都交给它
+void MdiChild::shareDocument(MdiChild* source)
+{
+    MdiChild* doc = source->owner();
+    primary = doc;
+    doc->views.removeAll(QPointer<MdiChild>());
+    doc->views.append(this);
+    viewNumber = doc->views.size() + 1;
+    // 替换自己的空文档，原来的文档随之销毁，它的信号连接也一起断开
+    setDocument(doc->document());
+    setReadOnly(doc->isReadOnly());
+    setWindowModified(document()->isModified());
+    connect(document(), SIGNAL(modificationChanged(bool)), this, SLOT(setWindowModified(bool)));
+    connect(doc, SIGNAL(windowTitleChanged(QString)), this, SLOT(updateViewTitle()));
+    updateViewTitle();
+}
+
+// 视图的标题跟随文档所属的窗口，后面加上视图的编号
+void MdiChild::updateViewTitle()
+{
+    if (primary)
+        setWindowTitle(QString("%1:%2").arg(primary->windowTitle()).arg(viewNumber));
+}
+
+// 是否有其他视图共享这个文档
+bool MdiChild::hasViews() const
+{
+    foreach (const QPointer<MdiChild>& view, views)
+    {
+        if (view)
+            return true;
+    }
+    return false;
+}
+
+// 设置文档在所有视图中是否只读，加载、保存和跟踪期间所有视图都不能编辑
+void MdiChild::setDocumentReadOnly(bool readOnly)
+{
+    setReadOnly(readOnly);
+    foreach (const QPointer<MdiChild>& view, views)
+    {
+        if (view)
+            view->setReadOnly(readOnly);
+    }
 }
 
 // 新建文件操作
@@ -118,51 +262,174 @@ void MdiChild::newFile()
     connect(document(), SIGNAL(contentsChanged()), this, SLOT(documentWasModified()));
 }
 
-// 加载文件
-bool MdiChild::loadFile(const QString& fileName)
+// 加载文件：文件在 I/O 线程中读取和解码，完成后发射 loadFinished()，
+// wait 为 true 时阻塞等待读取完成
+bool MdiChild::loadFile(const QString& fileName, bool wait)
 {
+    TraceScope trace("MdiChild::loadFile");
     // 新建 QFile 对象
     QFile file(fileName);
 
-    // 只读方式打开文件，出错则提示，并返回 false
-    if (!file.open(QFile::ReadOnly | QFile::Text))
+    // 先检查能否以只读方式打开文件，出错则提示，并返回 false
+    if (!file.open(QFile::ReadOnly))
     {
         QMessageBox::warning(this, tr("多文档编辑器"),
                              tr("无法读取文件 %1:\n%2.").arg(fileName).arg(file.errorString()));
         return false;
     }
-    // 新建文本流对象
-    QTextStream in(&file);
+    file.close();
+    // 取消之前还没有完成的加载
+    if (loadRequest)
+        loadRequest->cancel();
+    FileReadRequest* request = new FileReadRequest(fileName, DocumentIo::Active, !wait);
+    loadRequest = request;
+    // 加载完成之前不能编辑
+    setDocumentReadOnly(true);
+    setWindowTitle(tr("%1[*] (加载中)").arg(QFileInfo(fileName).fileName()));
+    if (wait)
+    {
+        DocumentIo::instance()->submit(request);
+        request->waitForFinished();
+        return finishLoad(request);
+    }
+    connect(request, SIGNAL(progress(qint64, qint64)), this, SLOT(showIoProgress(qint64, qint64)));
+    connect(request, SIGNAL(textAvailable()), this, SLOT(loadTextAvailable()));
+    connect(request, SIGNAL(finished()), this, SLOT(loadRequestFinished()));
+    DocumentIo::instance()->submit(request);
+    return true;
+}
+
+// 读取完成，把文本放入编辑器
+bool MdiChild::finishLoad(FileReadRequest* request)
+{
+    TraceScope trace("MdiChild::finishLoad");
+    loadRequest = 0;
+    setDocumentReadOnly(false);
+    bool streamed = isStreaming;
+    isStreaming = false;
+    if (request->wasCancelled())
+        return false;
+    // 二进制文件没有读入，由主窗口改用十六进制查看器打开
+    if (request->isBinary())
+    {
+        emit binaryFileDetected(request->fileName());
+        return false;
+    }
+    ioError = request->errorString();
+    if (!ioError.isEmpty())
+    {
+        updateTitle();
+        QMessageBox::warning(this, tr("多文档编辑器"),
+                             tr("无法读取文件 %1:\n%2.").arg(request->fileName()).arg(request->errorString()));
+        emit loadFinished(false);
+        return false;
+    }
     // 设置鼠标状态为等待状态
     QApplication::setOverrideCursor(Qt::WaitCursor);
-    // 读取文件的全部文本内容，并添加到编辑器中
-    setPlainText(in.readAll());
+    // 把读取到的全部文本内容添加到编辑器中，记住文件的编码以便保存时写回。
+    // 已经显示了部分内容时只追加剩余的部分，否则直接使用 I/O 线程建立的文本绳。
+    // 边加载边显示的压缩文件只要有文本就会先发出 textAvailable()，走到这里时文本和文本绳都是空的
+    if (streamed)
+    {
+        appendLoadedText(request->takeText());
+        undoManager->clear();
+        updateUndoActions();
+    }
+    else
+    {
+        resetDocument(request->takeText(), request->takeRope());
+    }
+    format = request->format();
+    diskSize = request->size();
+    diskSignature = request->signature();
+    declinedChange = QDateTime();
+    isPartial = false;
     // 恢复鼠标状态
     QApplication::restoreOverrideCursor();
     // 设置当前文件
-    setCurrentFile(fileName);
-    connect(document(), SIGNAL(contentsChanged()), this, SLOT(documentWasModified()));
+    setCurrentFile(request->fileName());
+    watchFile();
+    // 恢复换成文档句柄之前的光标位置
+    if (savedCursorPos > 0)
+    {
+        QTextCursor cursor = textCursor();
+        cursor.setPosition(qBound(0, savedCursorPos, document()->characterCount() - 1));
+        setTextCursor(cursor);
+        savedCursorPos = 0;
+    }
+    // 重新加载时不能重复关联信号
+    connect(document(), SIGNAL(contentsChanged()), this, SLOT(documentWasModified()), Qt::UniqueConnection);
+    emit loadFinished(true);
     return true;
 }
 
+// 压缩文件边解压边显示：第一块替换原来的内容，之后的追加到末尾。
+// 加载完成之前文档只读，也不记录撤销
+void MdiChild::loadTextAvailable()
+{
+    FileReadRequest* request = qobject_cast<FileReadRequest*>(sender());
+    if (!request || request != loadRequest)
+        return;
+    QString text = request->takeText();
+    if (!isStreaming)
+    {
+        isStreaming = true;
+        resetDocument(text, TextRope(text));
+    }
+    else
+    {
+        appendLoadedText(text);
+    }
+    // 已经显示的内容都来自硬盘，自动保存和编辑日志不需要记录
+    emit documentSynced();
+}
+
+// 追加边加载边显示的内容，不移动光标和滚动位置
+void MdiChild::appendLoadedText(const QString& text)
+{
+    if (text.isEmpty())
+        return;
+    TraceScope trace("MdiChild::appendLoadedText");
+    QTextCursor cursor(document());
+    cursor.movePosition(QTextCursor::End);
+    cursor.insertText(text);
+    syncRope(false);
+    // 追加的内容来自硬盘，不算作更改
+    document()->setModified(false);
+    markSaved();
+}
+
+// 编辑器是否可以换回只记录路径的文档句柄，之后再次激活时重新从硬盘读取。
+// 未保存过、被更改过或者有撤销记录的文档不能换回，否则会丢失用户的编辑。
+// 视图不持有文档，还有视图显示着的文档也不能换回
+bool MdiChild::canUnload() const
+{
+    return !primary && !hasViews() && !isUntitled && !following && !isBusy() && !document()->isModified()
+           && !isUndoAvailable() && !isRedoAvailable();
+}
+
 // 保存操作
-bool MdiChild::save()
+bool MdiChild::save(bool wait)
 {
+    if (primary)
+        return primary->save(wait);
     if (isUntitled)
     {
         // 如果文件未被保存过，则执行另存为操作
-        return saveAs();
+        return saveAs(wait);
     }
     else
     {
         // 否则直接保存文件
-        return saveFile(curFile);
+        return saveFile(curFile, wait);
     }
 }
 
 // 另存为操作
-bool MdiChild::saveAs()
+bool MdiChild::saveAs(bool wait)
 {
+    if (primary)
+        return primary->saveAs(wait);
     // 使用文件对话框获取文件路径
     QString fileName = QFileDialog::getSaveFileName(this, tr("另存为"), curFile);
     if (fileName.isEmpty())
@@ -171,35 +438,651 @@ bool MdiChild::saveAs()
         return false;
     }
     // 否则保存文件
-    return saveFile(fileName);
+    return saveFile(fileName, wait);
 }
 
-// 保存文件
-bool MdiChild::saveFile(const QString& fileName)
+// 在后台保存，用于一次保存多个文档：出错时不弹出提示，结束后由调用者通过
+// errorString() 汇总报告。新文件仍然需要先选择文件路径
+bool MdiChild::saveQuietly(int priority)
 {
-    QFile file(fileName);
-    if (!file.open(QFile::WriteOnly | QFile::Text))
+    if (primary)
+        return primary->saveQuietly(priority);
+    QString fileName = curFile;
+    if (isUntitled)
     {
-        QMessageBox::warning(this, tr("多文档编辑器"),
-                             tr("无法写入文件 %1:\n%2.").arg(fileName).arg(file.errorString()));
+        fileName = QFileDialog::getSaveFileName(this, tr("另存为"), curFile);
+        if (fileName.isEmpty())
+            return false;
+    }
+    // 不询问就覆盖其他程序的修改，由调用者报告
+    else if (isChangedOnDisk())
+    {
+        ioError = tr("文件已被其他程序修改");
         return false;
     }
-    QTextStream out(&file);
-    // 设置应用程序强制光标为等待旋转光标（设置鼠标状态为等待状态）
-    QApplication::setOverrideCursor(Qt::WaitCursor);
-    // 以纯文本文件写入
-    out << toPlainText();
-    // 恢复光标（恢复鼠标状态）
-    QApplication::restoreOverrideCursor();
-    setCurrentFile(fileName);
+    if (!saveFile(fileName))
+        return false;
+    quietSave = true;
+    setIoPriority(priority);
     return true;
 }
 
+// 保存文件：当前文本在 I/O 线程中编码和写入，完成后发射 saveFinished()，
+// wait 为 true 时阻塞等待写入完成
+bool MdiChild::saveFile(const QString& fileName, bool wait)
+{
+    TraceScope trace("MdiChild::saveFile");
+    if (primary)
+        return primary->saveFile(fileName, wait);
+    // 正在加载或者保存时不能保存，跟踪文件时文档随文件变化，也不需要保存
+    if (isBusy() || following)
+        return false;
+    // 文件在上次读写之后被其他程序修改过，保存会覆盖这些修改，先询问用户
+    if (QFileInfo(fileName).canonicalFilePath() == curFile && isChangedOnDisk()
+        && QMessageBox::warning(this, tr("多文档编辑器"),
+                                tr("文件 %1 已被其他程序修改，保存会覆盖这些修改。\n是否仍然保存？")
+                                    .arg(userFriendlyCurrentFile()),
+                                QMessageBox::Yes | QMessageBox::No, QMessageBox::No)
+               != QMessageBox::Yes)
+        return false;
+    FileWriteRequest* request = new FileWriteRequest(fileName, snapshot(), format, DocumentIo::Active);
+    saveRequest = request;
+    // 写入完成之前不能编辑，保证硬盘上的文件和文档一致
+    setDocumentReadOnly(true);
+    if (wait)
+    {
+        DocumentIo::instance()->submit(request);
+        request->waitForFinished();
+        return finishSave(request);
+    }
+    connect(request, SIGNAL(progress(qint64, qint64)), this, SLOT(showIoProgress(qint64, qint64)));
+    connect(request, SIGNAL(finished()), this, SLOT(saveRequestFinished()));
+    DocumentIo::instance()->submit(request);
+    return true;
+}
+
+// 写入完成
+bool MdiChild::finishSave(FileWriteRequest* request)
+{
+    saveRequest = 0;
+    setDocumentReadOnly(false);
+    bool quiet = quietSave;
+    quietSave = false;
+    ioError = request->wasCancelled() ? tr("保存被取消") : request->errorString();
+    if (request->wasCancelled() || !request->errorString().isEmpty())
+    {
+        updateTitle();
+        if (!request->wasCancelled() && !quiet)
+            QMessageBox::warning(this, tr("多文档编辑器"), tr("无法写入文件 %1:\n%2.")
+                                                               .arg(request->fileName())
+                                                               .arg(request->errorString()));
+        emit saveFinished(false);
+        return false;
+    }
+    diskSize = request->size();
+    diskSignature = request->signature();
+    declinedChange = QDateTime();
+    setCurrentFile(request->fileName());
+    watchFile();
+    // 在后台把保存的文件记录为本地历史的一个新版本
+    if (LocalHistory::isRecording())
+        DocumentIo::instance()->submit(new HistoryRecordRequest(curFile));
+    emit saveFinished(true);
+    return true;
+}
+
+// 当前文本的快照：把累积的更改区域应用到文本绳，只复制更改过的部分，
+// 之后的编辑不影响已经取出的快照
+TextRope MdiChild::snapshot()
+{
+    if (primary)
+        return primary->snapshot();
+    syncRope(true);
+    return rope;
+}
+
+// 把更改区域应用到文本绳，只复制更改过的部分。文本绳此时还是更改之前的内容，
+// 从中取出被删除的文本，与插入的文本一起成为一步撤销。
+// 跟踪文件和边加载边显示时追加的内容来自硬盘，不记录撤销
+void MdiChild::syncRope(bool record)
+{
+    if (!ropeRegion.dirty)
+        return;
+    int position, removed;
+    QString text = RecoveryStore::regionText(document(), ropeRegion, ropeLength, &position, &removed);
+    if (record && !following && !isStreaming && (removed > 0 || !text.isEmpty()))
+    {
+        UndoStep step;
+        step.position = position;
+        step.removed = rope.mid(position, removed);
+        step.added = text;
+        undoManager->push(step);
+    }
+    rope.replace(position, removed, text);
+    ropeRegion.clear();
+    ropeLength = document()->characterCount() - 1;
+    lastEdit = NoEdit;
+    updateUndoActions();
+}
+
+// 记录与硬盘一致时文本绳的快照，调用时文本绳已经与文档一致。快照与之后的文本绳共享没有修改的节点
+void MdiChild::markSaved()
+{
+    savedRope = rope;
+    formatChanged = false;
+}
+
+// 根据内容设置更改标志：长度或哈希值与保存时不同一定被更改过，都相同时再与保存时的快照逐字节确认，
+// 哈希值碰撞时不会误认为没有更改而在关闭时丢掉编辑。两边共享的叶子只比较指针。
+// 还没有结束的一步应用到文本绳的副本上，只复制被修改的路径，也不影响撤销的划分。
+// 这样输入一个字符再删除、或者撤销到保存时的内容之后，文档不再显示更改标志，关闭时也不再询问
+void MdiChild::updateModified()
+{
+    bool modified = formatChanged || document()->characterCount() - 1 != savedRope.length();
+    if (!modified)
+    {
+        TextRope text = rope;
+        if (ropeRegion.dirty)
+        {
+            int position, removed;
+            QString added = RecoveryStore::regionText(document(), ropeRegion, ropeLength, &position, &removed);
+            text.replace(position, removed, added);
+        }
+        modified = !text.sameText(savedRope);
+    }
+    document()->setModified(modified);
+}
+
+// 替换整个文档，文本绳直接使用调用者提供的、与 text 对应的 textRope，不再从文档复制。
+// 与 setPlainText() 一样清空撤销记录
+void MdiChild::resetDocument(const QString& text, const TextRope& textRope)
+{
+    isResetting = true;
+    {
+        TraceScope trace("MdiChild::setPlainText");
+        setPlainText(text);
+    }
+    isResetting = false;
+    rope = textRope;
+    ropeRegion.clear();
+    ropeLength = document()->characterCount() - 1;
+    undoManager->clear();
+    updateUndoActions();
+}
+
+// 是否可以撤销：还没有结束的一步也可以撤销
+bool MdiChild::isUndoAvailable() const { return owner()->ropeRegion.dirty || owner()->undoManager->canUndo(); }
+
+// 撤销记录占用的内存，所有视图共用文档所属窗口的撤销记录
+qint64 MdiChild::undoMemory() const { return owner()->undoManager->memoryUsage(); }
+
+// 是否可以恢复：新的编辑会丢弃恢复步骤
+bool MdiChild::isRedoAvailable() const { return !owner()->ropeRegion.dirty && owner()->undoManager->canRedo(); }
+
+// 通知撤销和恢复是否可用，以及撤销历史的变化
+void MdiChild::updateUndoActions()
+{
+    emit undoAvailable(isUndoAvailable());
+    emit redoAvailable(isRedoAvailable());
+    emit historyChanged();
+}
+
+// 撤销历史中的状态数，还没有结束的一步也算作一个状态
+int MdiChild::historyCount() const
+{
+    const MdiChild* doc = owner();
+    return doc->undoManager->count() + (doc->ropeRegion.dirty ? 1 : 0);
+}
+
+// 当前状态在撤销历史中的序号
+int MdiChild::historyIndex() const
+{
+    const MdiChild* doc = owner();
+    return doc->ropeRegion.dirty ? doc->undoManager->count() : doc->undoManager->currentNode();
+}
+
+// 撤销：先结束正在进行的一步，再回到撤销树中的父节点
+void MdiChild::undo()
+{
+    MdiChild* doc = owner();
+    doc->syncRope(true);
+    doc->applySteps(doc->undoManager->undo(), this);
+}
+
+// 恢复：进入上次离开的子节点，撤销之后又编辑过时原来的分支仍然保留
+void MdiChild::redo()
+{
+    MdiChild* doc = owner();
+    doc->syncRope(true);
+    doc->applySteps(doc->undoManager->redo(), this);
+}
+
+// 回到撤销历史中的任意一个状态，序号按状态产生的先后排列
+void MdiChild::gotoHistory(int index)
+{
+    MdiChild* doc = owner();
+    doc->syncRope(true);
+    doc->applySteps(doc->undoManager->travel(index), this);
+}
+
+// 依次应用撤销树给出的编辑，同时更新文本绳，不作为新的编辑记录。
+// 所有编辑作为一个编辑块，只重新布局一次，光标移到发出撤销的视图中。回到保存时的状态后文档不再显示更改标志
+void MdiChild::applySteps(const QVector<UndoStep>& steps, MdiChild* view)
+{
+    if (steps.isEmpty())
+        return;
+    isApplyingUndo = true;
+    QTextCursor cursor(document());
+    cursor.beginEditBlock();
+    foreach (const UndoStep& step, steps)
+    {
+        cursor.setPosition(step.position);
+        cursor.setPosition(step.position + step.removed.size(), QTextCursor::KeepAnchor);
+        cursor.insertText(step.added);
+        rope.replace(step.position, step.removed.size(), step.added);
+    }
+    cursor.endEditBlock();
+    view->setTextCursor(cursor);
+    isApplyingUndo = false;
+    ropeLength = document()->characterCount() - 1;
+    updateModified();
+    setWindowModified(document()->isModified());
+    updateUndoActions();
+}
+
+// 按键事件：计算按键到绘制完成的延迟，按键的处理在 editKey() 中
+void MdiChild::keyPressEvent(QKeyEvent* e)
+{
+    TraceScope trace("MdiChild::keyPressEvent");
+    // 按键进入时开始计时，还没有绘制又按了键时从最早的一次算起
+    bool timing = !keyTimer.isValid();
+    if (timing)
+        keyTimer.start();
+    int changes = contentChanges;
+    QTextCursor cursor = textCursor();
+    editKey(e);
+    // 没有改变内容和光标的按键（修饰键、只读文档中的输入等）不会引起重绘，不计入延迟
+    if (timing && contentChanges == changes && textCursor() == cursor)
+        keyTimer.invalidate();
+}
+
+// 绘制完成时记录按键到绘制的延迟，每次按键只记录之后的第一次绘制
+void MdiChild::paintEvent(QPaintEvent* e)
+{
+    {
+        TraceScope trace("MdiChild::paintEvent");
+        QTextEdit::paintEvent(e);
+    }
+    if (!keyTimer.isValid())
+        return;
+    owner()->latency.add(keyTimer.nsecsElapsed() / 1000);
+    keyTimer.invalidate();
+}
+
+// 宽度改变时 QTextEdit 重新布局整个文档，大文档的布局时间主要花在这里
+void MdiChild::resizeEvent(QResizeEvent* e)
+{
+    TraceScope trace("MdiChild::resizeEvent");
+    QTextEdit::resizeEvent(e);
+}
+
+// 撤销快捷键交给 UndoManager。连续的输入按单词合并为一步：
+// 在空白之后开始输入新的单词，或者在输入和删除之间切换时，之前的编辑成为完整的一步
+void MdiChild::editKey(QKeyEvent* e)
+{
+    if (e->matches(QKeySequence::Undo))
+    {
+        if (!isReadOnly())
+            undo();
+        return;
+    }
+    if (e->matches(QKeySequence::Redo))
+    {
+        if (!isReadOnly())
+            redo();
+        return;
+    }
+    // 所有视图的编辑都记录在文档所属的窗口中
+    MdiChild* doc = owner();
+    QString text = e->text();
+    if (e->key() == Qt::Key_Backspace || e->key() == Qt::Key_Delete)
+    {
+        if (doc->lastEdit == TypeEdit)
+            doc->syncRope(true);
+        doc->lastEdit = DeleteEdit;
+    }
+    else if (!text.isEmpty() && (text.at(0).isPrint() || text.at(0).isSpace()))
+    {
+        bool space = text.at(0).isSpace();
+        if (doc->lastEdit == DeleteEdit || (doc->lastEdit == TypeEdit && doc->lastTypedSpace && !space))
+            doc->syncRope(true);
+        doc->lastEdit = TypeEdit;
+        doc->lastTypedSpace = space;
+    }
+    QTextEdit::keyPressEvent(e);
+}
+
+// 粘贴和拖放的内容单独作为一步撤销
+void MdiChild::insertFromMimeData(const QMimeData* source)
+{
+    owner()->syncRope(true);
+    QTextEdit::insertFromMimeData(source);
+    owner()->syncRope(true);
+}
+
+// 调整正在进行的加载和保存的优先级
+void MdiChild::setIoPriority(int priority)
+{
+    if (primary)
+    {
+        primary->setIoPriority(priority);
+        return;
+    }
+    if (loadRequest)
+        loadRequest->setPriority(priority);
+    if (saveRequest)
+        saveRequest->setPriority(priority);
+    if (followRequest)
+        followRequest->setPriority(priority);
+}
+
+// 转换换行符：文档中统一使用 \n，只需要改变保存时写入的换行符，文档标记为已更改
+void MdiChild::setLineEnding(LineEnding::Style style)
+{
+    if (primary)
+    {
+        primary->setLineEnding(style);
+        return;
+    }
+    if (style == format.lineEnding && !format.mixedLineEndings)
+        return;
+    format.lineEnding = style;
+    format.mixedLineEndings = false;
+    formatChanged = true;
+    document()->setModified(true);
+    setWindowModified(true);
+}
+
+// 开始或停止跟踪文件末尾。跟踪期间文档只读，从上次读取到的位置读取文件新增的内容追加到末尾，
+// 不会重新读取整个文件。只有与硬盘一致的文档才能开始跟踪
+bool MdiChild::setFollowing(bool enable)
+{
+    if (primary)
+        return primary->setFollowing(enable);
+    if (enable == following)
+        return true;
+    if (enable)
+    {
+        if (isUntitled || isBusy() || format.compressed || document()->isModified())
+            return false;
+        QFile file(curFile);
+        if (!file.open(QIODevice::ReadOnly))
+            return false;
+        followHead = file.read(64);
+        following = true;
+        // 跟踪期间文档随文件变化，停止跟踪后与整个文件比较才能知道是否一致
+        diskSignature = FileSignature();
+        followPending = false;
+        followDecoder = 0;
+        // 追加的内容与硬盘一致，不需要撤销，与 QTextDocument 关闭撤销时一样清空之前的记录
+        setDocumentReadOnly(true);
+        syncRope(false);
+        undoManager->clear();
+        updateUndoActions();
+        followWatcher = new QFileSystemWatcher(this);
+        followWatcher->addPath(curFile);
+        connect(followWatcher, SIGNAL(fileChanged(QString)), this, SLOT(followFileChanged()));
+        followTimer.start();
+        followFileChanged();
+    }
+    else
+    {
+        following = false;
+        followTimer.stop();
+        delete followWatcher;
+        followWatcher = 0;
+        if (followRequest)
+            followRequest->cancel();
+        followRequest = 0;
+        delete followDecoder;
+        followDecoder = 0;
+        setDocumentReadOnly(false);
+        // 丢弃过开头的内容时重新加载完整的文件
+        if (isPartial)
+            loadFile(curFile);
+    }
+    updateTitle();
+    return true;
+}
+
+// 被跟踪的文件有变化。同一时间只有一个读取请求，读取期间的变化在读取结束后处理
+void MdiChild::followFileChanged()
+{
+    if (!following)
+        return;
+    // 日志轮转时原文件被改名或删除，文件监视不再有效，需要重新监视新文件
+    if (!followWatcher->files().contains(curFile) && QFile::exists(curFile))
+        followWatcher->addPath(curFile);
+    if (followRequest)
+    {
+        followPending = true;
+        return;
+    }
+    followPending = false;
+    FileTailRequest* request = new FileTailRequest(curFile, diskSize, followHead, format, followDecoder,
+                                                   FollowBatchBytes, DocumentIo::Visible);
+    followDecoder = 0;
+    followRequest = request;
+    connect(request, SIGNAL(finished()), this, SLOT(followRequestFinished()));
+    DocumentIo::instance()->submit(request);
+}
+
+// 读取新增内容结束，追加到文档末尾。还有没读取的内容时立即继续读取
+void MdiChild::followRequestFinished()
+{
+    FileTailRequest* request = qobject_cast<FileTailRequest*>(sender());
+    if (!request || request != followRequest)
+        return;
+    followRequest = 0;
+    followDecoder = request->takeDecoder();
+    if (request->wasCancelled() || !request->errorString().isEmpty())
+        return;
+    appendFollowedText(request->takeText(), request->wasRestarted());
+    diskSize = request->position();
+    followHead = request->fileHead();
+    if (request->hasMore() || followPending)
+        followFileChanged();
+}
+
+// 追加跟踪读取到的内容：作为一次编辑插入，只更新一次布局；原来显示在末尾时继续显示末尾。
+// 文档超过 MaxFollowChars 时丢弃开头的行，内存和布局的开销不会随日志无限增长
+void MdiChild::appendFollowedText(const QString& text, bool restarted)
+{
+    if (text.isEmpty() && !restarted)
+        return;
+    QScrollBar* bar = verticalScrollBar();
+    bool atEnd = bar->value() == bar->maximum();
+    // 每次修改后立即更新文本绳，不把开头和末尾的修改合并成覆盖整个文档的更改区域
+    QTextCursor cursor(document());
+    // 文件被截断或轮转，从头显示新文件的内容
+    if (restarted)
+    {
+        cursor.select(QTextCursor::Document);
+        cursor.removeSelectedText();
+        syncRope(false);
+        isPartial = false;
+    }
+    cursor.movePosition(QTextCursor::End);
+    cursor.insertText(text);
+    syncRope(false);
+    int excess = document()->characterCount() - 1 - MaxFollowChars;
+    if (excess > 0)
+    {
+        QTextBlock block = document()->findBlock(excess);
+        cursor.setPosition(0);
+        cursor.setPosition(block.next().isValid() ? block.next().position() : excess, QTextCursor::KeepAnchor);
+        cursor.removeSelectedText();
+        syncRope(false);
+        isPartial = true;
+    }
+    document()->setModified(false);
+    markSaved();
+    setWindowModified(false);
+    if (atEnd)
+        bar->setValue(bar->maximum());
+    // 文档与硬盘一致，自动保存和编辑日志以新的内容为基准
+    emit documentSynced();
+}
+
+// 监视文件是否被其他程序修改，另存为之后改为监视新的文件
+void MdiChild::watchFile()
+{
+    if (!diskWatcher)
+    {
+        diskWatcher = new QFileSystemWatcher(this);
+        connect(diskWatcher, SIGNAL(fileChanged(QString)), &diskTimer, SLOT(start()));
+    }
+    if (!diskWatcher->files().isEmpty())
+        diskWatcher->removePaths(diskWatcher->files());
+    diskWatcher->addPath(curFile);
+}
+
+// 是否正在加载、保存或重新加载
+bool MdiChild::isBusy() const
+{
+    const MdiChild* doc = owner();
+    return !doc->loadRequest.isNull() || !doc->saveRequest.isNull() || !doc->reloadRequest.isNull();
+}
+
+// 文件在上次读写之后是否被其他程序修改过：大小或修改时间与上次读写时不同。
+// 文件被删除时保存会重新创建，不算修改
+bool MdiChild::isChangedOnDisk() const
+{
+    const MdiChild* doc = owner();
+    if (doc->isUntitled || !doc->diskSignature.isValid())
+        return false;
+    QFileInfo info(doc->curFile);
+    return info.exists() && !doc->diskSignature.matches(info);
+}
+
+// 检查文件是否被其他程序修改：大小和修改时间与上次读写时相同就不再检查，不同时在后台比较内容。
+// 文档没有更改时直接重新加载，有更改时先询问用户
+void MdiChild::checkDiskFile()
+{
+    if (isUntitled || following)
+        return;
+    // 其他程序先删除再重新创建文件，或者保存时替换了文件，文件监视不再有效，需要重新监视
+    if (!diskWatcher->files().contains(curFile) && QFile::exists(curFile))
+        diskWatcher->addPath(curFile);
+    // 正在读写时稍后再检查，自己保存引起的变化在保存结束后与新的签名相同
+    if (isBusy())
+    {
+        diskTimer.start();
+        return;
+    }
+    QFileInfo info(curFile);
+    if (!info.exists() || diskSignature.matches(info) || info.lastModified() == declinedChange)
+        return;
+    if (document()->isModified())
+    {
+        // 对话框显示期间文件监视可能再次触发检查，同一次修改不重复询问
+        declinedChange = info.lastModified();
+        if (QMessageBox::question(this, tr("多文档编辑器"),
+                                  tr("文件 %1 已被其他程序修改。\n是否重新加载？文档中没有保存的更改可以通过撤销找回。")
+                                      .arg(userFriendlyCurrentFile()))
+            != QMessageBox::Yes)
+            return;
+    }
+    reloadFile();
+}
+
+// 在后台重新读取文件，只把变化的部分替换到文档中。读取期间文档只读
+void MdiChild::reloadFile()
+{
+    syncRope(true);
+    // 文档与上次读写的文件一致时只需要解码变化的几行
+    bool clean = !document()->isModified() && !isPartial;
+    FileReloadRequest* request =
+        new FileReloadRequest(curFile, rope, format, diskSignature, clean, DocumentIo::Visible);
+    reloadRequest = request;
+    setDocumentReadOnly(true);
+    connect(request, SIGNAL(finished()), this, SLOT(reloadRequestFinished()));
+    DocumentIo::instance()->submit(request);
+}
+
+// 重新加载请求结束：变化的部分作为一步编辑替换到文档中，只重新布局这几行，撤销可以回到重新加载之前。
+// 之后文档与硬盘上的文件一致
+void MdiChild::reloadRequestFinished()
+{
+    FileReloadRequest* request = qobject_cast<FileReloadRequest*>(sender());
+    if (!request || request != reloadRequest)
+        return;
+    reloadRequest = 0;
+    setDocumentReadOnly(false);
+    // 读取失败时保留原来的签名，文件再有变化时重新检查
+    if (request->wasCancelled() || !request->errorString().isEmpty())
+        return;
+    diskSignature = request->signature();
+    diskSize = diskSignature.size;
+    declinedChange = QDateTime();
+    if (!request->wasUnchanged())
+    {
+        QTextCursor cursor(document());
+        cursor.setPosition(int(request->position()));
+        cursor.setPosition(int(request->position() + request->removedLength()), QTextCursor::KeepAnchor);
+        cursor.insertText(request->takeText());
+        syncRope(true);
+    }
+    format = request->format();
+    document()->setModified(false);
+    markSaved();
+    setWindowModified(false);
+    updateUndoActions();
+    emit documentSynced();
+    if (!request->wasUnchanged())
+        emit reloadFinished();
+}
+
+// 根据文件是否保存过设置窗口标题
+void MdiChild::updateTitle()
+{
+    if (isUntitled)
+        setWindowTitle(curFile + "[*]" + tr(" - 多文档编辑器"));
+    else
+        setWindowTitle(userFriendlyCurrentFile() + "[*]" + (following ? tr(" [跟踪]") : QString()));
+}
+
 // 提取文件名
 QString MdiChild::userFriendlyCurrentFile()
 {
     // 从文件路径中提取文件名
-    return QFileInfo(curFile).fileName();
+    return QFileInfo(currentFile()).fileName();
+}
+
+// 在窗口标题中显示加载或保存的进度
+void MdiChild::showIoProgress(qint64 processed, qint64 total)
+{
+    int percent = total > 0 ? int(processed * 100 / total) : 100;
+    if (loadRequest && sender() == loadRequest.data())
+        setWindowTitle(tr("%1[*] (加载中 %2%)").arg(QFileInfo(loadRequest->fileName()).fileName()).arg(percent));
+    else
+        setWindowTitle(tr("%1[*] (保存中 %2%)").arg(userFriendlyCurrentFile()).arg(percent));
+}
+
+// 加载请求结束，忽略已经被新的加载取代的请求
+void MdiChild::loadRequestFinished()
+{
+    FileReadRequest* request = qobject_cast<FileReadRequest*>(sender());
+    if (request && request == loadRequest)
+        finishLoad(request);
+}
+
+// 保存请求结束，忽略已经在关闭窗口时处理过的请求
+void MdiChild::saveRequestFinished()
+{
+    FileWriteRequest* request = qobject_cast<FileWriteRequest*>(sender());
+    if (request && request == saveRequest)
+        finishSave(request);
 }
 
 // 文档被更改时，窗口显示更改状态标志
@@ -209,3 +1092,38 @@ void MdiChild::documentWasModified()
     // 如果被更改了，就要在设置了[*]号的地方显示“*”号，这里会在窗口标题中显示
     setWindowModified(document()->isModified());
 }
+
+// 记录文本绳的更改区域，只做整数运算，不影响输入的速度。
+// 替换整个文档和应用撤销时文本绳由调用者直接更新
+void MdiChild::recordRopeChange(int position, int charsRemoved, int charsAdded)
+{
+    isChanging = true;
+    contentChanges++;
+    if (isResetting || isApplyingUndo)
+        return;
+    bool wasDirty = ropeRegion.dirty;
+    ropeRegion.merge(position, charsRemoved, charsAdded);
+    if (!wasDirty)
+        updateUndoActions();
+}
+
+// 光标离开了正在编辑的位置（鼠标点击、方向键、跳转等），之前的编辑成为完整的一步。
+// 输入和删除时光标总是停在更改区域的末尾。在一个视图中编辑时其他视图的光标也会随着移动，
+// 这发生在文档发出更改信号的过程中，不算离开编辑位置
+void MdiChild::cursorMoved()
+{
+    MdiChild* doc = owner();
+    if (!doc->ropeRegion.dirty || doc->isResetting || doc->isApplyingUndo || doc->isChanging)
+        return;
+    if (textCursor().position() != qMin(doc->ropeRegion.newEnd, document()->characterCount() - 1))
+        doc->syncRope(true);
+}
+
+// 文档的更改信号发送完毕，之后光标的移动都来自用户或者程序的操作。
+// QTextDocument 的撤销已经关闭，更改标志由这里根据内容设置
+void MdiChild::documentChangeFinished()
+{
+    isChanging = false;
+    if (!isResetting && !isApplyingUndo)
+        updateModified();
+}
@@ -1,35 +1,162 @@
 #ifndef MDICHILD_H
 #define MDICHILD_H
 
+#include <QElapsedTimer>
 #include <QMenu>
+#include <QPointer>
+#include <QTimer>
 #include <QTextEdit>
 #include <QWidget>
 
+#include "documentio.h"
+#include "editregion.h"
+#include "latencyhistogram.h"
+#include "textrope.h"
+
+class QFileSystemWatcher;
+class UndoManager;
+struct UndoStep;
+
 class MdiChild : public QTextEdit
 {
     Q_OBJECT
 private:
     QString curFile;  //当前文件路径
     bool isUntitled;  //作为当前文件是否被保存到硬盘的标志
+    int savedCursorPos;  //加载完成后恢复的光标位置
+    QPointer<FileReadRequest> loadRequest;   //正在进行的加载
+    bool isStreaming;                        //加载完成之前已经显示了部分内容
+    QPointer<FileWriteRequest> saveRequest;  //正在进行的保存
+    bool quietSave;                          //保存失败时不弹出提示，由调用者汇总报告
+    QString ioError;                         //最近一次加载或保存的出错信息
+    TextFormat format;                       //文件的编码和换行符，加载时检测，保存时写回
+    qint64 diskSize;                         //文档内容对应的文件字节数
+    bool following;                          //是否正在跟踪文件末尾
+    QFileSystemWatcher* followWatcher;       //跟踪时监视文件的变化
+    QTimer followTimer;                      //跟踪时定期检查文件，文件监视漏掉变化时也能继续
+    QPointer<FileTailRequest> followRequest; //正在进行的读取新增内容
+    QTextDecoder* followDecoder;             //跟踪时在多次读取之间传递的解码器
+    QByteArray followHead;                   //文件开头的字节，用于发现日志轮转
+    bool followPending;                      //读取期间文件又有变化
+    bool isPartial;                          //跟踪时丢弃了开头的内容，文档与文件不再一致
+    TextRope rope;                           //文档内容的文本绳，需要时才根据更改区域更新
+    EditRegion ropeRegion;                   //还没有应用到文本绳的更改区域
+    int ropeLength;                          //文本绳对应的文档长度
+    TextRope savedRope;                      //与硬盘一致时文本绳的快照，内容改回原样后不再显示更改标志
+    bool formatChanged;                      //换行符被转换过，内容不变也需要保存
+    bool isResetting;                        //正在替换整个文档，文本绳由调用者直接设置
+    UndoManager* undoManager;                //撤销记录，代替 QTextDocument 没有上限的撤销栈
+    bool isApplyingUndo;                     //正在应用撤销或恢复，不作为新的编辑记录
+    enum EditKind { NoEdit, TypeEdit, DeleteEdit };
+    EditKind lastEdit;                       //上一次按键的编辑类型，用于按单词合并输入
+    bool lastTypedSpace;                     //上一次输入的是否为空白
+    bool isChanging;                         //文档正在发出更改信号，其他视图的光标随之移动，不算离开编辑位置
+    QPointer<MdiChild> primary;              //作为其他窗口的视图时文档所属的窗口，文档状态都保存在那里
+    QList<QPointer<MdiChild> > views;        //共享这个文档的其他视图
+    int viewNumber;                          //视图的编号，显示在窗口标题中
+    FileSignature diskSignature;             //上次读写时文件的签名，用于发现其他程序的修改
+    QFileSystemWatcher* diskWatcher;         //监视文件是否被其他程序修改
+    QTimer diskTimer;                        //文件变化后稍等片刻再检查，其他程序分几次写入时只检查一次
+    QPointer<FileReloadRequest> reloadRequest;  //正在进行的重新加载
+    QDateTime declinedChange;                //用户选择不重新加载时文件的修改时间，同一次修改不再询问
+    LatencyHistogram latency;                //按键到绘制完成的延迟，所有视图记录在文档所属的窗口中
+    QElapsedTimer keyTimer;                  //还没有绘制的第一次按键的时间
+    int contentChanges;                      //文档内容更改的次数，用于判断按键是否改变了内容
+
+    MdiChild* owner() { return primary ? primary.data() : this; }              //文档所属的窗口
+    const MdiChild* owner() const { return primary ? primary.data() : this; }  //文档所属的窗口
 
     bool maybeSave();                              //是否需要保存
     void setCurrentFile(const QString& fileName);  //设置当前文件
+    bool finishLoad(FileReadRequest* request);     //读取完成，把文本放入编辑器
+    bool finishSave(FileWriteRequest* request);    //写入完成
+    void updateTitle();                            //根据文件是否保存过设置窗口标题
+    void appendFollowedText(const QString& text, bool restarted);  //追加跟踪读取到的内容
+    void appendLoadedText(const QString& text);                    //追加边加载边显示的内容
+    void resetDocument(const QString& text, const TextRope& textRope);  //替换整个文档并清空撤销记录
+    void syncRope(bool record);                                    //把更改区域应用到文本绳，需要时记录为一步撤销
+    void markSaved();                                              //记录与硬盘一致时文本绳的快照
+    void updateModified();                                         //根据内容是否与硬盘一致设置更改标志
+    void applySteps(const QVector<UndoStep>& steps, MdiChild* view);  //应用撤销、恢复或者回到历史状态的编辑，光标移到 view 中
+    void setDocumentReadOnly(bool readOnly);                       //设置文档在所有视图中是否只读
+    bool hasViews() const;                                         //是否有其他视图共享这个文档
+    void updateUndoActions();                                      //通知撤销和恢复是否可用
+    void watchFile();                                              //监视文件是否被其他程序修改
+    void reloadFile();                                             //在后台重新读取被其他程序修改的文件
+    void editKey(QKeyEvent* e);                                    //处理撤销快捷键并按单词划分撤销步骤
 
 protected:
     void closeEvent(QCloseEvent* event);          //关闭事件
     void contextMenuEvent(QContextMenuEvent* e);  // 右键菜单事件
+    void keyPressEvent(QKeyEvent* e);             //按键事件，开始计算按键到绘制的延迟
+    void paintEvent(QPaintEvent* e);              //绘制事件，记录按键到绘制完成的延迟
+    void resizeEvent(QResizeEvent* e);            //大小改变事件，记录重新布局的时间
+    void insertFromMimeData(const QMimeData* source);  //粘贴和拖放的内容单独作为一步撤销
 
 public:
     explicit MdiChild(QWidget* parent = 0);
-    void newFile();                            //新建文件
-    bool loadFile(const QString& fileName);    //加载文件
-    bool save();                               //保存操作
-    bool saveAs();                             //另存为操作
-    bool saveFile(const QString& fileName);    //保存文件
+    ~MdiChild();
+    void newFile();                                              //新建文件
+    bool loadFile(const QString& fileName, bool wait = false);  //加载文件，wait 为 true 时等待读取完成
+    bool save(bool wait = false);                                //保存操作
+    bool saveAs(bool wait = false);                              //另存为操作
+    bool saveFile(const QString& fileName, bool wait = false);  //保存文件，wait 为 true 时等待写入完成
+    bool saveQuietly(int priority);              //在后台保存，失败时不弹出提示
+    QString errorString() const { return owner()->ioError; }  //最近一次加载或保存的出错信息
+    QByteArray encoding() const { return owner()->format.encoding; }  //文件的编码
+    LineEnding::Style lineEnding() const { return owner()->format.lineEnding; }  //文件的换行符
+    bool hasMixedLineEndings() const { return owner()->format.mixedLineEndings; }  //文件是否混用了多种换行符
+    bool isCompressed() const { return owner()->format.compressed; }               //文件是否用 gzip 压缩
+    void setLineEnding(LineEnding::Style style);                          //转换换行符，保存时生效
+    bool setFollowing(bool enable);                  //开始或停止跟踪文件末尾
+    bool isFollowing() const { return owner()->following; }  //是否正在跟踪文件末尾
     QString userFriendlyCurrentFile();         //提取文件名
-    QString currentFile() { return curFile; }  //返回当前文件路径
+    QString currentFile() { return owner()->curFile; }  //返回当前文件路径
+    void setCursorAfterLoad(int position) { savedCursorPos = position; }  //加载完成后把光标移到 position
+    bool canUnload() const;                         //编辑器是否可以换回只记录路径的文档句柄
+    bool isNewFile() const { return owner()->isUntitled; }   //是否为还没有保存到硬盘的新文件
+    bool isBusy() const;                             //是否正在加载、保存或重新加载
+    bool isChangedOnDisk() const;                    //文件在上次读写之后是否被其他程序修改过
+    void setIoPriority(int priority);                //调整正在进行的加载和保存的优先级
+    TextRope snapshot();                             //当前文本的不可变快照，可以交给后台线程读取
+    bool isUndoAvailable() const;                    //是否可以撤销
+    bool isRedoAvailable() const;                    //是否可以恢复
+    int historyCount() const;                        //撤销历史中的状态数
+    int historyIndex() const;                        //当前状态在撤销历史中的序号
+    void shareDocument(MdiChild* source);            //作为 source 的另一个视图，共享同一个文档
+    bool isView() const { return !primary.isNull(); }          //是否为共享其他窗口文档的视图
+    const LatencyHistogram& keyLatency() const { return owner()->latency; }  //按键到绘制完成的延迟
+    TextRope lastSnapshot() const { return owner()->rope; }  //最近一次同步的文本绳，不结束当前的一步撤销，可能缺少最近的编辑
+    qint64 undoMemory() const;                               //撤销记录占用的内存
+    void resetKeyLatency() { owner()->latency.reset(); }                     //清空延迟记录
+
+public slots:
+    void undo();  //撤销最近的一步
+    void redo();  //恢复最近撤销的一步
+    void gotoHistory(int index);  //回到撤销历史中的任意一个状态
+
+signals:
+    void documentSynced();       //文档内容与硬盘上的文件一致（加载或保存之后）
+    void loadFinished(bool ok);  //加载结束
+    void saveFinished(bool ok);  //保存结束
+    void historyChanged();       //撤销历史或者当前状态改变
+    void reloadFinished();       //重新加载了被其他程序修改的文件
+    void binaryFileDetected(const QString& fileName);  //要加载的是二进制文件，没有读入
+
 private slots:
-    void documentWasModified();  //文档被更改时，窗口显示更改状态标志
+    void documentWasModified();                           //文档被更改时，窗口显示更改状态标志
+    void recordRopeChange(int position, int charsRemoved, int charsAdded);  //记录文本绳的更改区域
+    void cursorMoved();                                   //光标离开正在编辑的位置时结束当前的一步撤销
+    void documentChangeFinished();                        //文档的更改信号发送完毕
+    void updateViewTitle();                               //视图的标题跟随文档所属的窗口
+    void showIoProgress(qint64 processed, qint64 total);  //显示加载或保存的进度
+    void loadTextAvailable();                             //加载请求解码出了新的文本
+    void loadRequestFinished();                           //加载请求结束
+    void saveRequestFinished();                           //保存请求结束
+    void followFileChanged();                             //被跟踪的文件有变化
+    void followRequestFinished();                         //读取新增内容结束
+    void checkDiskFile();                                 //检查文件是否被其他程序修改
+    void reloadRequestFinished();                         //重新加载请求结束
 };
 
 #endif  // MDICHILD_H
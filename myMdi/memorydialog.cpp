@@ -0,0 +1,219 @@
+#include "memorydialog.h"
+
+#include <QDialogButtonBox>
+#include <QFile>
+#include <QHeaderView>
+#include <QLabel>
+#include <QMdiArea>
+#include <QMdiSubWindow>
+#include <QPushButton>
+#include <QTextDocument>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+
+#include "mdichild.h"
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_MAC)
+#include <mach/mach.h>
+#endif
+
+static const int RefreshInterval = 2000;    // 刷新间隔（毫秒）
+static const int BlockIndexBytes = 96;      // 段落表中的一个段落：片段映射中段落和文本的两个节点
+static const int BlockLayoutBytes = 480;    // 一个段落的 QTextLayout、QTextEngine 和行表
+static const int GlyphBytes = 24;           // 每个字符的字形编号、宽度、偏移、属性和字符到字形的映射
+
+// 表格的列
+enum Column
+{
+    NameColumn,
+    TextColumn,
+    LayoutColumn,
+    UndoColumn,
+    HighlightColumn,
+    IndexColumn,
+    TotalColumn
+};
+
+// 字节数显示为 KB、MB 或 GB
+static QString sizeText(qint64 bytes)
+{
+    if (bytes < 0)
+        return QString("-");
+    if (bytes < (1 << 10))
+        return QString("%1 B").arg(bytes);
+    if (bytes < (1 << 20))
+        return QString("%1 KB").arg(bytes / 1024.0, 0, 'f', 1);
+    if (bytes < (qint64(1) << 30))
+        return QString("%1 MB").arg(bytes / 1048576.0, 0, 'f', 1);
+    return QString("%1 GB").arg(bytes / 1073741824.0, 0, 'f', 2);
+}
+
+// 进程实际占用的物理内存，无法取得时返回 -1
+static qint64 processResidentMemory()
+{
+#if defined(Q_OS_LINUX)
+    QFile file("/proc/self/status");
+    if (!file.open(QIODevice::ReadOnly))
+        return -1;
+    foreach (const QByteArray& line, file.readAll().split('\n'))
+    {
+        // 格式为 "VmRSS:     12345 kB"
+        if (line.startsWith("VmRSS:"))
+            return line.mid(6).trimmed().split(' ').first().toLongLong() * 1024;
+    }
+#elif defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return qint64(counters.WorkingSetSize);
+#elif defined(Q_OS_MAC)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS)
+        return qint64(info.resident_size);
+#endif
+    return -1;
+}
+
+// 文件名一列按文字排序，其他列按 UserRole 中的字节数排序
+class MemoryItem : public QTreeWidgetItem
+{
+public:
+    bool operator<(const QTreeWidgetItem& other) const
+    {
+        int column = treeWidget() ? treeWidget()->sortColumn() : NameColumn;
+        if (column == NameColumn)
+            return text(column).localeAwareCompare(other.text(column)) < 0;
+        return data(column, Qt::UserRole).toLongLong() < other.data(column, Qt::UserRole).toLongLong();
+    }
+};
+
+MemoryReportRequest::MemoryReportRequest(const QVector<DocumentMemory>& documents, int priority)
+    : IoRequest(priority), items(documents), resident(-1)
+{
+}
+
+// 文本绳按实际的节点计算，QTextDocument 的内部结构无法访问，按字符数和段落数估计。
+// 编辑器还没有语法高亮，高亮一项为 0，以后的高亮状态计入这里
+void MemoryReportRequest::run()
+{
+    for (int i = 0; i < items.size(); i++)
+    {
+        if (isCancelled())
+            return;
+        DocumentMemory& item = items[i];
+        qint64 ropeText, ropeNodes;
+        item.rope.memoryUsage(&ropeText, &ropeNodes);
+        item.rope = TextRope();
+        item.text = item.characters * qint64(sizeof(QChar)) + ropeText;
+        item.layout = qint64(item.blocks) * BlockLayoutBytes + item.characters * GlyphBytes;
+        item.highlight = 0;
+        item.index = qint64(item.blocks) * BlockIndexBytes + ropeNodes;
+    }
+    resident = processResidentMemory();
+}
+
+MemoryDialog::MemoryDialog(QMdiArea* mdiArea, QWidget* parent) : QDialog(parent), area(mdiArea)
+{
+    setWindowTitle(tr("内存占用"));
+    summary = new QLabel(this);
+    table = new QTreeWidget(this);
+    table->setRootIsDecorated(false);
+    table->setHeaderLabels(QStringList() << tr("文档") << tr("文本") << tr("布局") << tr("撤销记录") << tr("高亮")
+                                         << tr("索引") << tr("合计"));
+    table->header()->setSectionResizeMode(NameColumn, QHeaderView::Stretch);
+    table->header()->setStretchLastSection(false);
+    // 默认按合计从大到小排列，最占内存的文档在最上面
+    table->setSortingEnabled(true);
+    table->sortByColumn(TotalColumn, Qt::DescendingOrder);
+    QDialogButtonBox* buttons = new QDialogButtonBox(QDialogButtonBox::Close, this);
+    QPushButton* refreshButton = buttons->addButton(tr("刷新(&R)"), QDialogButtonBox::ActionRole);
+    connect(buttons, SIGNAL(rejected()), this, SLOT(reject()));
+    connect(refreshButton, SIGNAL(clicked()), this, SLOT(refresh()));
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->addWidget(summary);
+    layout->addWidget(table);
+    layout->addWidget(buttons);
+    resize(760, 400);
+    refreshTimer.setInterval(RefreshInterval);
+    connect(&refreshTimer, SIGNAL(timeout()), this, SLOT(refresh()));
+    refreshTimer.start();
+    refresh();
+}
+
+MemoryDialog::~MemoryDialog()
+{
+    if (request)
+        request->cancel();
+}
+
+// 同一个文档的多个视图共用文档和撤销记录，只取文档所属的窗口。
+// 这里只取字符数、段落数等 O(1) 的度量，文本绳的快照不结束当前的一步撤销
+void MemoryDialog::refresh()
+{
+    if (request)
+        return;
+    QVector<DocumentMemory> documents;
+    foreach (QMdiSubWindow* window, area->subWindowList())
+    {
+        MdiChild* child = qobject_cast<MdiChild*>(window->widget());
+        if (!child || child->isView())
+            continue;
+        DocumentMemory item;
+        item.name = child->userFriendlyCurrentFile();
+        item.path = child->currentFile();
+        item.characters = child->document()->characterCount();
+        item.blocks = child->document()->blockCount();
+        item.rope = child->lastSnapshot();
+        item.undo = child->undoMemory();
+        item.text = item.layout = item.highlight = item.index = 0;
+        documents.append(item);
+    }
+    request = new MemoryReportRequest(documents, DocumentIo::Background);
+    connect(request, SIGNAL(finished()), this, SLOT(reportFinished()));
+    DocumentIo::instance()->submit(request);
+}
+
+void MemoryDialog::reportFinished()
+{
+    MemoryReportRequest* finished = qobject_cast<MemoryReportRequest*>(sender());
+    if (!finished || finished != request)
+        return;
+    request = 0;
+    if (finished->wasCancelled())
+        return;
+    // 重建所有条目，按当前的排序列重新排列，保留选中的文档
+    QString selected = table->currentItem() ? table->currentItem()->data(NameColumn, Qt::UserRole).toString() : QString();
+    table->clear();
+    QList<QTreeWidgetItem*> items;
+    qint64 total = 0;
+    foreach (const DocumentMemory& document, finished->documents())
+    {
+        MemoryItem* item = new MemoryItem;
+        item->setText(NameColumn, document.name);
+        item->setToolTip(NameColumn, document.path);
+        item->setData(NameColumn, Qt::UserRole, document.path);
+        qint64 sizes[] = { document.text, document.layout, document.undo, document.highlight, document.index,
+                           document.total() };
+        for (int column = TextColumn; column <= TotalColumn; column++)
+        {
+            item->setText(column, sizeText(sizes[column - TextColumn]));
+            item->setData(column, Qt::UserRole, sizes[column - TextColumn]);
+            item->setTextAlignment(column, Qt::AlignRight | Qt::AlignVCenter);
+        }
+        items.append(item);
+        total += document.total();
+    }
+    table->addTopLevelItems(items);
+    foreach (QTreeWidgetItem* item, items)
+    {
+        if (!selected.isEmpty() && item->data(NameColumn, Qt::UserRole).toString() == selected)
+            table->setCurrentItem(item);
+    }
+    summary->setText(tr("进程占用物理内存 %1，%2 个文档估计共占用 %3")
+                         .arg(sizeText(finished->residentMemory()))
+                         .arg(items.size())
+                         .arg(sizeText(total)));
+}
@@ -0,0 +1,70 @@
+#ifndef MEMORYDIALOG_H
+#define MEMORYDIALOG_H
+
+class QLabel;
+class QMdiArea;
+class QTreeWidget;
+
+#include <QDialog>
+#include <QPointer>
+#include <QTimer>
+#include <QVector>
+
+#include "documentio.h"
+#include "textrope.h"
+
+// 一个文档的内存占用，单位为字节。界面线程只取 O(1) 的度量和文本绳的快照，各项的估计在 I/O 线程中计算
+struct DocumentMemory
+{
+    QString name;       // 显示的文件名
+    QString path;       // 文件路径
+    qint64 characters;  // 文档的字符数
+    int blocks;         // 文档的段落数
+    TextRope rope;      // 文本绳的快照，计算之后释放
+    qint64 undo;        // 撤销记录
+    qint64 text;        // 文本：QTextDocument 的 UTF-16 文本和文本绳的叶子
+    qint64 layout;      // 布局：每个段落的 QTextLayout 和字形
+    qint64 highlight;   // 高亮状态
+    qint64 index;       // 索引：QTextDocument 的段落表和文本绳的内部节点
+    qint64 total() const { return text + layout + undo + highlight + index; }  // 合计
+};
+
+// 在 I/O 线程中估计各文档的内存占用，并读取进程实际占用的物理内存
+class MemoryReportRequest : public IoRequest
+{
+    Q_OBJECT
+private:
+    QVector<DocumentMemory> items;  // 各文档的度量和估计
+    qint64 resident;                // 进程占用的物理内存，无法取得时为 -1
+
+protected:
+    void run();
+
+public:
+    MemoryReportRequest(const QVector<DocumentMemory>& documents, int priority);
+    QVector<DocumentMemory> documents() const { return items; }  // 各文档的内存占用
+    qint64 residentMemory() const { return resident; }            // 进程占用的物理内存
+};
+
+// 内存占用诊断：列出每个文档估计的文本、布局、撤销记录、高亮和索引的内存，以及进程占用的物理内存。
+// 可以按任意一列排序，打开期间定期在后台刷新，打开了几百个文档时也不会卡住界面
+class MemoryDialog : public QDialog
+{
+    Q_OBJECT
+private:
+    QMdiArea* area;                         // 文档所在的多文档区域
+    QLabel* summary;                        // 进程和合计的内存
+    QTreeWidget* table;                     // 各文档的内存
+    QTimer refreshTimer;                    // 定时刷新
+    QPointer<MemoryReportRequest> request;  // 正在进行的统计
+
+public:
+    explicit MemoryDialog(QMdiArea* mdiArea, QWidget* parent = 0);
+    ~MemoryDialog();
+
+private slots:
+    void refresh();          // 取得各文档的度量，交给 I/O 线程估计
+    void reportFinished();   // 估计完成，更新表格
+};
+
+#endif  // MEMORYDIALOG_H
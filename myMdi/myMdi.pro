@@ -26,11 +26,61 @@ DEFINES += QT_DEPRECATED_WARNINGS
 SOURCES += \
         main.cpp \
         mainwindow.cpp \
-    mdichild.cpp
+    mdichild.cpp \
+    autosaver.cpp \
+    diffview.cpp \
+    documenthandle.cpp \
+    documentio.cpp \
+    editjournal.cpp \
+    encodingdetector.cpp \
+    filewindow.cpp \
+    gzipstream.cpp \
+    hexview.cpp \
+    largefileview.cpp \
+    latencydialog.cpp \
+    latencyhistogram.cpp \
+    lineending.cpp \
+    localhistory.cpp \
+    memorydialog.cpp \
+    recoverystore.cpp \
+    stallwatchdog.cpp \
+    textrope.cpp \
+    tracer.cpp \
+    undomanager.cpp
 
 HEADERS += \
         mainwindow.h \
-    mdichild.h
+    mdichild.h \
+    autosaver.h \
+    diffview.h \
+    documenthandle.h \
+    documentio.h \
+    editjournal.h \
+    editregion.h \
+    encodingdetector.h \
+    filewindow.h \
+    gzipstream.h \
+    hexview.h \
+    largefileview.h \
+    latencydialog.h \
+    latencyhistogram.h \
+    lineending.h \
+    localhistory.h \
+    memorydialog.h \
+    recoverystore.h \
+    stallwatchdog.h \
+    textrope.h \
+    tracer.h \
+    undomanager.h
+
+# gzip 压缩的文件使用 zlib 边读边解压
+include(zlib.pri)
+
+# 内存占用诊断在 Windows 上用 psapi 读取进程的物理内存
+win32: LIBS += -lpsapi
+
+# 导出符号，停顿日志中的调用栈才能显示函数名
+unix:!macx: QMAKE_LFLAGS += -rdynamic
 
 FORMS += \
         mainwindow.ui
@@ -0,0 +1,189 @@
+#include "recoverystore.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QStandardPaths>
+#include <QTextCursor>
+#include <QTextDocument>
+
+#include "mdichild.h"
+
+static const quint32 RecoveryMagic = 0x4d444153;  // "MDAS"
+static const quint16 RecoveryVersion = 1;
+
+// 恢复文件目录
+QString RecoveryStore::path()
+{
+    static QString dir;
+    if (dir.isEmpty())
+    {
+        dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/recovery";
+        QDir().mkpath(dir);
+    }
+    return dir;
+}
+
+// 锁定本进程的恢复文件，锁文件以进程号命名，进程退出时自动删除
+void RecoveryStore::lock()
+{
+    static QLockFile lockFile(path() + QString("/%1.lock").arg(QCoreApplication::applicationPid()));
+    if (lockFile.isLocked())
+        return;
+    // 锁文件一直持有到进程退出，不能因为时间长而被当作失效
+    lockFile.setStaleLockTime(0);
+    lockFile.tryLock(0);
+}
+
+// 文档的恢复文件名，同一文档的自动保存和编辑日志使用相同的名称
+QString RecoveryStore::fileStem(QTextDocument* document)
+{
+    static int counter = 0;
+    QString stem = document->property("recoveryStem").toString();
+    if (stem.isEmpty())
+    {
+        stem = QString("%1-%2").arg(QCoreApplication::applicationPid()).arg(++counter);
+        document->setProperty("recoveryStem", stem);
+    }
+    return stem;
+}
+
+// 已经退出的进程留下的恢复文件
+QStringList RecoveryStore::orphanedFiles(const QString& suffix)
+{
+    QStringList result;
+    QDir dir(path());
+    QString ownPid = QString::number(QCoreApplication::applicationPid());
+    QStringList names = dir.entryList(QStringList() << "*" + suffix, QDir::Files, QDir::Name);
+    foreach (const QString& name, names)
+    {
+        QString pid = name.section('-', 0, 0);
+        if (pid == ownPid)
+            continue;
+        // 还在运行的进程持有自己的锁文件，它的恢复文件不能动
+        QLockFile lock(dir.filePath(pid + ".lock"));
+        lock.setStaleLockTime(0);
+        if (!lock.tryLock(0))
+            continue;
+        lock.unlock();
+        result << dir.filePath(name);
+    }
+    return result;
+}
+
+// 以原文件当前的大小和修改时间生成文件头，恢复时用来确认原文件没有变化
+QByteArray RecoveryStore::header(const QString& basePath)
+{
+    QFileInfo info(basePath);
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_6);
+    out << RecoveryMagic << RecoveryVersion << basePath << qint64(basePath.isEmpty() ? 0 : info.size())
+        << qint64(basePath.isEmpty() ? 0 : info.lastModified().toMSecsSinceEpoch());
+    return data;
+}
+
+// 取出更改区域在当前文档中的文本。contentsChange() 报告的范围可能包含文档末尾的段落分隔符，
+// 这里把区域限制在上一个版本和当前文档的文本范围内。
+// 段落分隔符和 Shift+Enter 插入的行分隔符都换成 \n，与 toPlainText() 一致，保存时才会写成换行
+QString RecoveryStore::regionText(QTextDocument* document, const EditRegion& region, int previousLength,
+                                  int* position, int* removed)
+{
+    int length = document->characterCount() - 1;
+    int start = qBound(0, region.start, qMin(length, previousLength));
+    int newEnd = qBound(start, region.newEnd, length);
+    int oldEnd = qBound(start, region.oldEnd, previousLength);
+    *position = start;
+    *removed = oldEnd - start;
+    if (newEnd == start)
+        return QString();
+    QTextCursor cursor(document);
+    cursor.setPosition(start);
+    cursor.setPosition(newEnd, QTextCursor::KeepAnchor);
+    QString text = cursor.selectedText();
+    text.replace(QChar::ParagraphSeparator, QLatin1Char('\n'));
+    text.replace(QChar::LineSeparator, QLatin1Char('\n'));
+    return text;
+}
+
+// 在窗口中恢复文档：先加载作为基准的原文件，再依次应用恢复文件中的记录
+bool RecoveryStore::restore(const QString& fileName, MdiChild* child, QString* errorString)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        *errorString = tr("无法读取恢复文件 %1").arg(fileName);
+        return false;
+    }
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_6);
+    quint32 magic;
+    quint16 version;
+    QString basePath;
+    qint64 baseSize, baseModified;
+    in >> magic >> version >> basePath >> baseSize >> baseModified;
+    if (in.status() != QDataStream::Ok || magic != RecoveryMagic || version != RecoveryVersion)
+    {
+        *errorString = tr("恢复文件 %1 已损坏").arg(fileName);
+        return false;
+    }
+
+    // 读出全部记录，异常退出时最后一条记录可能只写了一部分，忽略它
+    QList<quint8> types;
+    QList<int> positions, removals;
+    QStringList texts;
+    while (!in.atEnd())
+    {
+        quint8 type;
+        qint32 position = 0, removed = 0;
+        QString text;
+        in >> type;
+        if (type == DeltaRecord)
+            in >> position >> removed;
+        in >> text;
+        if (in.status() != QDataStream::Ok || (type != DeltaRecord && type != FullRecord))
+            break;
+        types << type;
+        positions << position;
+        removals << removed;
+        texts << text;
+    }
+
+    // 以完整快照开头的恢复文件不需要原文件，否则原文件必须和异常退出前一致
+    bool startsWithFull = !types.isEmpty() && types.first() == FullRecord;
+    QFileInfo info(basePath);
+    if (basePath.isEmpty() || (startsWithFull && !info.exists()))
+    {
+        child->newFile();
+    }
+    else if (!startsWithFull
+             && (!info.exists() || info.size() != baseSize
+                 || info.lastModified().toMSecsSinceEpoch() != baseModified))
+    {
+        *errorString = tr("%1 在上次退出后已被修改").arg(basePath);
+        return false;
+    }
+    else if (!child->loadFile(basePath, true))
+    {
+        *errorString = tr("无法读取文件 %1").arg(basePath);
+        return false;
+    }
+
+    // 所有记录作为一次编辑应用，可以一次撤销
+    QTextCursor cursor(child->document());
+    cursor.beginEditBlock();
+    for (int i = 0; i < types.size(); i++)
+    {
+        int length = child->document()->characterCount() - 1;
+        int position = types.at(i) == FullRecord ? 0 : qBound(0, positions.at(i), length);
+        int end = types.at(i) == FullRecord ? length : qBound(position, position + removals.at(i), length);
+        cursor.setPosition(position);
+        cursor.setPosition(end, QTextCursor::KeepAnchor);
+        cursor.insertText(texts.at(i));
+    }
+    cursor.endEditBlock();
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef RECOVERYSTORE_H
+#define RECOVERYSTORE_H
+
+class MdiChild;
+class QTextDocument;
+
+#include <QCoreApplication>
+#include <QStringList>
+
+#include "editregion.h"
+
+// 恢复文件的存放目录和文件格式，自动保存和编辑日志共用
+//
+// 恢复文件由文件头和若干条记录组成。文件头记录作为基准的原文件（新建文档为空），
+// 增量记录表示把 [position, position + removed) 替换为 text，完整快照只会出现在第一条
+class RecoveryStore
+{
+    Q_DECLARE_TR_FUNCTIONS(RecoveryStore)
+
+public:
+    static const quint8 DeltaRecord = 1;  // 增量记录
+    static const quint8 FullRecord = 2;   // 完整快照
+
+    static QString path();                             // 恢复文件目录
+    static void lock();                                // 锁定本进程的恢复文件，直到进程退出
+    static QString fileStem(QTextDocument* document);  // 文档的恢复文件名，不含扩展名
+    static QStringList orphanedFiles(const QString& suffix);  // 已经退出的进程留下的恢复文件
+    static QByteArray header(const QString& basePath);        // 以原文件当前状态生成文件头
+    static QString regionText(QTextDocument* document, const EditRegion& region, int previousLength,
+                              int* position, int* removed);  // 取出更改区域的文本
+    static bool restore(const QString& fileName, MdiChild* child, QString* errorString);  // 在窗口中恢复文档
+};
+
+#endif  // RECOVERYSTORE_H
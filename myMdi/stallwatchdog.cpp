@@ -0,0 +1,168 @@
+#include "stallwatchdog.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+#include <QTextStream>
+
+#if defined(Q_OS_LINUX) || defined(Q_OS_MAC)
+#define STALL_BACKTRACE
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#endif
+
+static const int HeartbeatInterval = 100;  // 心跳间隔（毫秒）
+static const int CheckInterval = 50;       // 监视线程检查心跳的间隔（毫秒）
+static const int CaptureTimeout = 500;     // 等待界面线程捕获调用栈的最长时间（毫秒）
+
+#ifdef STALL_BACKTRACE
+static const int StackSignal = SIGUSR2;  // 让界面线程捕获调用栈的信号
+static const int MaxFrames = 64;         // 最多捕获的栈帧数
+static pthread_t guiThread;              // 界面线程
+static void* frames[MaxFrames];          // 捕获的栈帧
+static int frameCount;                   // 捕获的栈帧数
+static QAtomicInt captured;              // 信号处理函数已经捕获完毕
+
+// 在界面线程中执行的信号处理函数，只捕获地址，符号在监视线程中解析
+static void captureHandler(int)
+{
+    frameCount = backtrace(frames, MaxFrames);
+    captured.storeRelease(1);
+}
+#endif
+
+StallWatchdog::StallWatchdog(int thresholdMs, QObject* parent) : QThread(parent)
+{
+    threshold = thresholdMs;
+    stopping = false;
+    clock.start();
+    lastBeat.store(0);
+#ifdef STALL_BACKTRACE
+    guiThread = pthread_self();
+    struct sigaction action;
+    sigemptyset(&action.sa_mask);
+    action.sa_handler = captureHandler;
+    // 被信号打断的系统调用自动重新开始，不影响界面线程正在进行的读写
+    action.sa_flags = SA_RESTART;
+    sigaction(StackSignal, &action, 0);
+    // backtrace() 第一次调用时才加载展开栈帧的库，先在这里调用一次，信号处理函数中不会再分配内存
+    void* warmup[1];
+    backtrace(warmup, 1);
+#endif
+    heartbeat.setInterval(HeartbeatInterval);
+    connect(&heartbeat, SIGNAL(timeout()), this, SLOT(beat()));
+    heartbeat.start();
+    start(QThread::LowPriority);
+}
+
+StallWatchdog::~StallWatchdog()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        wakeup.wakeAll();
+    }
+    wait();
+}
+
+void StallWatchdog::beat() { lastBeat.storeRelease(clock.elapsed()); }
+
+void StallWatchdog::setContext(const QString& description)
+{
+    QMutexLocker locker(&mutex);
+    context = description;
+}
+
+QString StallWatchdog::logFile()
+{
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dir);
+    return dir + "/stalls.log";
+}
+
+// 向界面线程发送信号，由信号处理函数在界面线程的栈上调用 backtrace()，
+// 监视线程等待捕获完毕后解析符号。跳过信号处理函数和信号跳板两帧
+QStringList StallWatchdog::captureStack()
+{
+    QStringList stack;
+#ifdef STALL_BACKTRACE
+    captured.store(0);
+    if (pthread_kill(guiThread, StackSignal) != 0)
+        return stack;
+    QElapsedTimer timer;
+    timer.start();
+    while (!captured.loadAcquire())
+    {
+        if (timer.elapsed() > CaptureTimeout)
+            return stack;
+        QThread::msleep(1);
+    }
+    char** symbols = backtrace_symbols(frames, frameCount);
+    if (!symbols)
+        return stack;
+    for (int i = 2; i < frameCount; i++)
+        stack << QString::fromLocal8Bit(symbols[i]);
+    free(symbols);
+#endif
+    return stack;
+}
+
+void StallWatchdog::writeLog(const QString& entry)
+{
+    qWarning().noquote() << entry;
+    QFile file(logFile());
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+        return;
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+    out << entry << "\n";
+}
+
+// 每次停顿只在超过阈值时捕获一次调用栈并写入日志，即使界面再也没有恢复也留下了记录；
+// 恢复后再写入总的停顿时间，时间按两次心跳之间计算，最多多出一个心跳间隔
+void StallWatchdog::run()
+{
+    qint64 stalledSince = -1;  // 正在记录的停顿之前最后一次心跳的时间，没有停顿时为 -1
+    QMutexLocker locker(&mutex);
+    while (!stopping)
+    {
+        wakeup.wait(&mutex, CheckInterval);
+        if (stopping)
+            break;
+        qint64 beatTime = lastBeat.loadAcquire();
+        qint64 now = clock.elapsed();
+        if (now - beatTime > threshold + HeartbeatInterval)
+        {
+            if (stalledSince == beatTime)
+                continue;
+            stalledSince = beatTime;
+            QString description = context;
+            locker.unlock();
+            QStringList stack = captureStack();
+            QString entry = QString("%1 界面线程已经停顿 %2 ms\n活动文档：%3\n")
+                                .arg(QDateTime::currentDateTime().toString(Qt::ISODate))
+                                .arg(now - beatTime - HeartbeatInterval)
+                                .arg(description.isEmpty() ? QString("无") : description);
+            if (stack.isEmpty())
+                entry += "调用栈：无法捕获\n";
+            else
+                entry += "调用栈：\n    " + stack.join("\n    ") + "\n";
+            writeLog(entry);
+            locker.relock();
+        }
+        else if (stalledSince >= 0 && beatTime != stalledSince)
+        {
+            qint64 duration = beatTime - stalledSince - HeartbeatInterval;
+            stalledSince = -1;
+            locker.unlock();
+            writeLog(QString("%1 界面线程恢复，共停顿 %2 ms\n")
+                         .arg(QDateTime::currentDateTime().toString(Qt::ISODate))
+                         .arg(duration));
+            locker.relock();
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef STALLWATCHDOG_H
+#define STALLWATCHDOG_H
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QStringList>
+#include <QThread>
+#include <QTimer>
+#include <QWaitCondition>
+
+// 界面线程停顿监视：界面线程的定时器定期记录心跳，监视线程发现心跳停止超过阈值时，
+// 捕获界面线程的调用栈，连同停顿时间和活动文档写入日志；停顿结束后再记录总的停顿时间。
+// 调用栈在停顿期间捕获，指向的就是阻塞界面的那次调用（加载、保存、取出全文等）。
+// 捕获调用栈需要向界面线程发送信号，目前只支持 Linux 和 macOS，其他平台只记录时间和文档
+class StallWatchdog : public QThread
+{
+    Q_OBJECT
+private:
+    QTimer heartbeat;                 // 界面线程中的心跳定时器
+    QElapsedTimer clock;              // 两个线程共用的时钟
+    QAtomicInteger<qint64> lastBeat;  // 最近一次心跳的时间（毫秒）
+    int threshold;                    // 停顿超过这个时间（毫秒）才记录
+    QMutex mutex;                     // 保护 stopping 和 context
+    QWaitCondition wakeup;            // 等待下一次检查或者停止
+    bool stopping;                    // 监视线程将要停止
+    QString context;                  // 活动文档的描述，由界面线程更新
+
+    static QStringList captureStack();                // 捕获界面线程的调用栈
+    static void writeLog(const QString& entry);        // 写入日志文件和调试输出
+
+protected:
+    void run();
+
+public:
+    explicit StallWatchdog(int thresholdMs, QObject* parent = 0);
+    ~StallWatchdog();
+    void setContext(const QString& description);  // 设置活动文档的描述，停顿时写入日志
+    static QString logFile();                     // 日志文件的路径
+
+private slots:
+    void beat();  // 在界面线程中记录心跳
+};
+
+#endif  // STALLWATCHDOG_H
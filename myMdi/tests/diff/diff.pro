@@ -0,0 +1,29 @@
+include(../tests.pri)
+
+QT += gui widgets
+
+TARGET = tst_diff
+
+SOURCES += \
+        tst_diff.cpp \
+    ../../diffview.cpp \
+    ../../documentio.cpp \
+    ../../encodingdetector.cpp \
+    ../../gzipstream.cpp \
+    ../../lineending.cpp \
+    ../../localhistory.cpp \
+    ../../textrope.cpp \
+    ../../tracer.cpp
+
+HEADERS += \
+    ../../diffview.h \
+    ../../documentio.h \
+    ../../encodingdetector.h \
+    ../../gzipstream.h \
+    ../../lineending.h \
+    ../../localhistory.h \
+    ../../textrope.h \
+    ../../tracer.h
+
+# gzip 压缩的文件使用 zlib 边读边解压
+include(../../zlib.pri)
@@ -0,0 +1,133 @@
+#include <QApplication>
+#include <QStringList>
+#include <QtTest>
+
+#include "diffview.h"
+
+// 逐行比较：固定的小段文本比较出的差异与预期完全相同，按差异改写左边得到的正是右边，编辑的行数也是最少的。
+// 大部分例子中没有两边都只出现一次的行，没有锚点，整段由 Myers 算法比较
+class DiffTest : public QObject
+{
+    Q_OBJECT
+private:
+    static QVector<DiffHunk> compare(const QString& left, const QString& right);  // 在 I/O 线程中比较两段文本
+    static QString format(const QVector<DiffHunk>& hunks);                         // 差异写成 "左起点,行数,右起点,行数;..."
+    static int minimumEdits(const QStringList& left, const QStringList& right);    // 最长公共子序列求出的最少编辑行数
+
+private slots:
+    void hunks_data();
+    void hunks();
+    void tooManyEdits();
+};
+
+QVector<DiffHunk> DiffTest::compare(const QString& left, const QString& right)
+{
+    DiffRequest* request = new DiffRequest(TextRope(left), TextRope(right), DocumentIo::Active);
+    DocumentIo::instance()->submit(request);
+    request->waitForFinished();
+    // 请求在回到事件循环之后才删除自己，这里还可以取出结果
+    return request->hunks();
+}
+
+QString DiffTest::format(const QVector<DiffHunk>& hunks)
+{
+    QStringList parts;
+    foreach (const DiffHunk& hunk, hunks)
+        parts << QString("%1,%2,%3,%4").arg(hunk.leftStart).arg(hunk.leftCount).arg(hunk.rightStart).arg(hunk.rightCount);
+    return parts.join(';');
+}
+
+int DiffTest::minimumEdits(const QStringList& left, const QStringList& right)
+{
+    QVector<int> row(right.size() + 1, 0);
+    for (int i = 0; i < left.size(); i++)
+    {
+        int diagonal = 0;
+        for (int j = 0; j < right.size(); j++)
+        {
+            int above = row.at(j + 1);
+            row[j + 1] = left.at(i) == right.at(j) ? diagonal + 1 : qMax(above, row.at(j));
+            diagonal = above;
+        }
+    }
+    return left.size() + right.size() - 2 * row.last();
+}
+
+void DiffTest::hunks_data()
+{
+    QTest::addColumn<QString>("left");
+    QTest::addColumn<QString>("right");
+    QTest::addColumn<QString>("expected");
+
+    QTest::newRow("identical") << "a\nb\nc" << "a\nb\nc" << "";
+    // 有锚点：删除一行、末尾添加一行
+    QTest::newRow("anchored") << "a\nb\nc\nd" << "a\nc\nd\ne" << "1,1,1,0;4,0,3,1";
+    QTest::newRow("repeated line removed") << "x\nx\nx" << "x\nx" << "2,1,2,0";
+    // 空文本也有一行空行
+    QTest::newRow("from empty") << "" << "a\nb" << "0,1,0,2";
+    QTest::newRow("trailing newline") << "a\nb\n" << "a\nb" << "2,1,2,0";
+    // Myers 论文中的例子，最少 5 步
+    QTest::newRow("myers paper") << "a\nb\nc\na\nb\nb\na" << "c\nb\na\nb\na\nc" << "0,2,0,0;3,0,1,1;5,1,4,0;7,0,5,1";
+    QTest::newRow("swapped halves") << "a\na\nb\nb" << "b\nb\na\na" << "0,2,0,0;4,0,2,2";
+    QTest::newRow("shifted") << "x\ny\nx\ny\nx" << "y\nx\ny\nx\ny" << "0,1,0,0;5,0,4,1";
+    // 替换的行在两边行数相同，合并为一处
+    QTest::newRow("replaced") << "a\nb\na\nb" << "a\nc\na\nc" << "1,1,1,1;3,1,3,1";
+}
+
+void DiffTest::hunks()
+{
+    QFETCH(QString, left);
+    QFETCH(QString, right);
+    QFETCH(QString, expected);
+    QVector<DiffHunk> hunks = compare(left, right);
+    QCOMPARE(format(hunks), expected);
+
+    // 按差异改写左边：差异之间的行原样保留，差异处换成右边的行
+    QStringList leftLines = left.split('\n');
+    QStringList rightLines = right.split('\n');
+    QStringList rebuilt;
+    int line = 0;
+    int edits = 0;
+    for (int i = 0; i < hunks.size(); i++)
+    {
+        const DiffHunk& hunk = hunks.at(i);
+        QVERIFY(hunk.leftStart >= line);
+        QVERIFY(hunk.leftCount > 0 || hunk.rightCount > 0);
+        rebuilt += leftLines.mid(line, hunk.leftStart - line);
+        QCOMPARE(hunk.rightStart, rebuilt.size());
+        rebuilt += rightLines.mid(hunk.rightStart, hunk.rightCount);
+        line = hunk.leftStart + hunk.leftCount;
+        edits += hunk.leftCount + hunk.rightCount;
+        // 首尾相连的差异已经合并
+        if (i > 0)
+            QVERIFY(hunks.at(i - 1).leftStart + hunks.at(i - 1).leftCount < hunk.leftStart
+                    || hunks.at(i - 1).rightStart + hunks.at(i - 1).rightCount < hunk.rightStart);
+    }
+    rebuilt += leftLines.mid(line);
+    QCOMPARE(rebuilt, rightLines);
+    QCOMPARE(edits, minimumEdits(leftLines, rightLines));
+}
+
+// 编辑步数超过上限时不再查找，整段作为一处差异
+void DiffTest::tooManyEdits()
+{
+    QString left = QString("a\n").repeated(1100) + QString("b\n").repeated(1100);
+    QString right = QString("b\n").repeated(1100) + QString("a\n").repeated(1100);
+    QCOMPARE(format(compare(left, right)), QString("0,2200,0,2200"));
+    // 上限以内时仍然求出最少的编辑
+    left = QString("a\n").repeated(1000) + QString("b\n").repeated(1000);
+    right = QString("b\n").repeated(1000) + QString("a\n").repeated(1000);
+    QCOMPARE(format(compare(left, right)), QString("0,1000,0,0;2000,0,1000,1000"));
+}
+
+int main(int argc, char* argv[])
+{
+    // 没有显示器的构建机上也能运行
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+    DiffTest test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_diff.moc"
@@ -0,0 +1,10 @@
+include(../tests.pri)
+
+TARGET = tst_encodingdetector
+
+SOURCES += \
+        tst_encodingdetector.cpp \
+    ../../encodingdetector.cpp
+
+HEADERS += \
+    ../../encodingdetector.h
@@ -0,0 +1,138 @@
+#include <QCoreApplication>
+#include <QtTest>
+
+#include "encodingdetector.h"
+
+static const int MaxOffset = 140;   // 序列放在 0 到这个位置，跨过 16 字节一组和 64 字节一块的每个边界
+static const int PaddedSize = 256;  // 序列之后补 ASCII 到这个长度，不走末尾不足一块的路径
+
+// UTF-8 校验：SSE2 按 16 字节一组、64 字节一块处理，错误的序列放在每个可能的位置，
+// 跨越组和块的边界、落在最后不足一块的部分时都应该被拒绝，合法的序列在同样的位置都应该通过
+class EncodingDetectorTest : public QObject
+{
+    Q_OBJECT
+private:
+    static QByteArray place(const QByteArray& sequence, int offset, bool padded);  // 把序列放在 offset 处，前后是 ASCII
+
+private slots:
+    void isUtf8_data();
+    void isUtf8();
+    void truncatedAtEnd_data();
+    void truncatedAtEnd();
+    void longCjkRun();
+};
+
+QByteArray EncodingDetectorTest::place(const QByteArray& sequence, int offset, bool padded)
+{
+    QByteArray data(offset, 'a');
+    data += sequence;
+    if (padded && data.size() < PaddedSize)
+        data += QByteArray(PaddedSize - data.size(), 'b');
+    return data;
+}
+
+void EncodingDetectorTest::isUtf8_data()
+{
+    QTest::addColumn<QByteArray>("sequence");
+    QTest::addColumn<bool>("valid");
+
+    // 0xE0 之后的第二个字节不小于 0xA0，否则是过长编码
+    QTest::newRow("E0 80 80 overlong") << QByteArray("\xE0\x80\x80") << false;
+    QTest::newRow("E0 9F BF overlong") << QByteArray("\xE0\x9F\xBF") << false;
+    QTest::newRow("E0 A0 80 U+0800") << QByteArray("\xE0\xA0\x80") << true;
+    // 0xED 之后的第二个字节不大于 0x9F，否则是代理项
+    QTest::newRow("ED A0 80 surrogate") << QByteArray("\xED\xA0\x80") << false;
+    QTest::newRow("ED BF BF surrogate") << QByteArray("\xED\xBF\xBF") << false;
+    QTest::newRow("ED 9F BF U+D7FF") << QByteArray("\xED\x9F\xBF") << true;
+    // 0xF0 之后的第二个字节不小于 0x90，否则是过长编码
+    QTest::newRow("F0 80 80 80 overlong") << QByteArray("\xF0\x80\x80\x80") << false;
+    QTest::newRow("F0 8F BF BF overlong") << QByteArray("\xF0\x8F\xBF\xBF") << false;
+    QTest::newRow("F0 90 80 80 U+10000") << QByteArray("\xF0\x90\x80\x80") << true;
+    // 0xF4 之后的第二个字节不大于 0x8F，否则超出 U+10FFFF
+    QTest::newRow("F4 90 80 80 too large") << QByteArray("\xF4\x90\x80\x80") << false;
+    QTest::newRow("F4 BF BF BF too large") << QByteArray("\xF4\xBF\xBF\xBF") << false;
+    QTest::newRow("F4 8F BF BF U+10FFFF") << QByteArray("\xF4\x8F\xBF\xBF") << true;
+    // 不会出现的首字节
+    QTest::newRow("C0 80 overlong") << QByteArray("\xC0\x80") << false;
+    QTest::newRow("C1 BF overlong") << QByteArray("\xC1\xBF") << false;
+    QTest::newRow("F5 80 80 80") << QByteArray("\xF5\x80\x80\x80") << false;
+    QTest::newRow("FF") << QByteArray("\xFF") << false;
+    // 结构错误：多余的后续字节、缺少后续字节
+    QTest::newRow("lone continuation") << QByteArray("\x80") << false;
+    QTest::newRow("extra continuation") << QByteArray("\xC2\x80\x80") << false;
+    QTest::newRow("E4 B8 then ASCII") << QByteArray("\xE4\xB8" "A") << false;
+    QTest::newRow("F0 9F 98 then ASCII") << QByteArray("\xF0\x9F\x98" "A") << false;
+    // 合法的多字节字符
+    QTest::newRow("C2 80 U+0080") << QByteArray("\xC2\x80") << true;
+    QTest::newRow("E4 B8 AD CJK") << QByteArray("\xE4\xB8\xAD") << true;
+    QTest::newRow("EF BF BF U+FFFF") << QByteArray("\xEF\xBF\xBF") << true;
+    QTest::newRow("F0 9F 98 80 emoji") << QByteArray("\xF0\x9F\x98\x80") << true;
+}
+
+// 序列前面的 ASCII 从 0 个到 MaxOffset 个，每个字节都会落在组和块的开头、中间和末尾
+void EncodingDetectorTest::isUtf8()
+{
+    QFETCH(QByteArray, sequence);
+    QFETCH(bool, valid);
+    for (int offset = 0; offset <= MaxOffset; offset++)
+    {
+        QByteArray padded = place(sequence, offset, true);
+        QVERIFY2(EncodingDetector::isUtf8(padded.constData(), padded.size()) == valid,
+                 qPrintable(QString("offset %1, padded").arg(offset)));
+        QByteArray atEnd = place(sequence, offset, false);
+        QVERIFY2(EncodingDetector::isUtf8(atEnd.constData(), atEnd.size()) == valid,
+                 qPrintable(QString("offset %1, at end").arg(offset)));
+    }
+}
+
+void EncodingDetectorTest::truncatedAtEnd_data()
+{
+    QTest::addColumn<QByteArray>("sequence");
+
+    QTest::newRow("C2") << QByteArray("\xC2");
+    QTest::newRow("E4 B8") << QByteArray("\xE4\xB8");
+    QTest::newRow("E0 A0") << QByteArray("\xE0\xA0");
+    QTest::newRow("ED 9F") << QByteArray("\xED\x9F");
+    QTest::newRow("F0 90 80") << QByteArray("\xF0\x90\x80");
+    QTest::newRow("F4 8F BF") << QByteArray("\xF4\x8F\xBF");
+}
+
+// 文件在多字节字符的中间结束：缺少的后续字节可能正好落在下一块，或者落在补 0 的缓冲区中
+void EncodingDetectorTest::truncatedAtEnd()
+{
+    QFETCH(QByteArray, sequence);
+    for (int offset = 0; offset <= MaxOffset; offset++)
+    {
+        QByteArray data = place(sequence, offset, false);
+        QVERIFY2(!EncodingDetector::isUtf8(data.constData(), data.size()),
+                 qPrintable(QString("offset %1").arg(offset)));
+    }
+}
+
+// 连续的汉字跨越所有的边界，每个字符的起点相对于块的位置各不相同
+void EncodingDetectorTest::longCjkRun()
+{
+    QByteArray run;
+    for (int i = 0; i < 100; i++)
+        run += QString(QChar(0x4E00 + i * 37)).toUtf8();
+    for (int offset = 0; offset < 3; offset++)
+    {
+        QByteArray data = QByteArray(offset, 'a') + run;
+        QVERIFY(EncodingDetector::isUtf8(data.constData(), data.size()));
+        // 去掉最后一个字节后被截断
+        QVERIFY(!EncodingDetector::isUtf8(data.constData(), data.size() - 1));
+        // 把一个后续字节换成 ASCII 后结构错误
+        QByteArray broken = data;
+        broken[offset + 151] = 'x';
+        QVERIFY(!EncodingDetector::isUtf8(broken.constData(), broken.size()));
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    EncodingDetectorTest test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_encodingdetector.moc"
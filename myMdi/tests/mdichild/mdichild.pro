@@ -0,0 +1,36 @@
+include(../tests.pri)
+
+QT += gui widgets
+
+TARGET = tst_mdichild
+
+SOURCES += \
+        tst_mdichild.cpp \
+    ../../mdichild.cpp \
+    ../../documentio.cpp \
+    ../../encodingdetector.cpp \
+    ../../gzipstream.cpp \
+    ../../latencyhistogram.cpp \
+    ../../lineending.cpp \
+    ../../localhistory.cpp \
+    ../../recoverystore.cpp \
+    ../../textrope.cpp \
+    ../../tracer.cpp \
+    ../../undomanager.cpp
+
+HEADERS += \
+    ../../mdichild.h \
+    ../../documentio.h \
+    ../../editregion.h \
+    ../../encodingdetector.h \
+    ../../gzipstream.h \
+    ../../latencyhistogram.h \
+    ../../lineending.h \
+    ../../localhistory.h \
+    ../../recoverystore.h \
+    ../../textrope.h \
+    ../../tracer.h \
+    ../../undomanager.h
+
+# gzip 压缩的文件使用 zlib 边读边解压
+include(../../zlib.pri)
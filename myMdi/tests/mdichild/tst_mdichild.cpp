@@ -0,0 +1,142 @@
+#include <QApplication>
+#include <QFile>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTextCursor>
+#include <QtTest>
+
+#include "gzipstream.h"
+#include "mdichild.h"
+
+// 编辑器窗口的加载和保存：重点是等待读取完成（wait 为 true）时的路径，
+// 比较窗口、恢复文档和基准测试都走这条路径，不经过边加载边显示
+class MdiChildTest : public QObject
+{
+    Q_OBJECT
+private:
+    QTemporaryDir dir;  // 测试文件所在的临时目录
+
+    static QByteArray sampleText();                                     // 跨越多个解压块的 UTF-8 文本
+    static bool writeGzip(const QString& fileName, const QByteArray& data);  // 写入 gzip 文件
+    static QByteArray readGzip(const QString& fileName);                     // 读出 gzip 文件解压后的内容
+
+private slots:
+    void initTestCase();
+    void loadGzipAndWait();
+    void saveGzipAfterWaitedLoad();
+    void saveGzipAfterEdit();
+    void saveLineSeparator();
+};
+
+// 中英文混合的行，总长度超过一次解压的 4MB，文件分多块解码
+QByteArray MdiChildTest::sampleText()
+{
+    QByteArray text;
+    for (int i = 0; text.size() < (5 << 20); i++)
+        text += QString("第 %1 行 line %1 的内容\n").arg(i).toUtf8();
+    return text;
+}
+
+bool MdiChildTest::writeGzip(const QString& fileName, const QByteArray& data)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    GzipWriter writer(&file);
+    return writer.write(data) && writer.finish();
+}
+
+QByteArray MdiChildTest::readGzip(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    GzipReader reader(&file);
+    QByteArray data;
+    forever
+    {
+        QByteArray block = reader.read(1 << 20);
+        if (block.isEmpty())
+            break;
+        data += block;
+    }
+    return data;
+}
+
+void MdiChildTest::initTestCase() { QVERIFY(dir.isValid()); }
+
+// 等待读取完成时文本绳也要与显示的文本一致，否则比较、更改标志和保存都以空文本为准
+void MdiChildTest::loadGzipAndWait()
+{
+    QString fileName = dir.filePath("load.txt.gz");
+    QByteArray data = sampleText();
+    QVERIFY(writeGzip(fileName, data));
+    MdiChild child;
+    QVERIFY(child.loadFile(fileName, true));
+    QVERIFY(child.isCompressed());
+    QCOMPARE(child.toPlainText(), QString::fromUtf8(data));
+    QCOMPARE(child.snapshot().toString(), QString::fromUtf8(data));
+    QVERIFY(!child.document()->isModified());
+}
+
+// 没有编辑就保存，写回的内容与原文件相同
+void MdiChildTest::saveGzipAfterWaitedLoad()
+{
+    QString fileName = dir.filePath("save.txt.gz");
+    QByteArray data = sampleText();
+    QVERIFY(writeGzip(fileName, data));
+    MdiChild child;
+    QVERIFY(child.loadFile(fileName, true));
+    QVERIFY(child.saveFile(fileName, true));
+    QCOMPARE(readGzip(fileName), data);
+}
+
+// 编辑之后保存，写回的是编辑后的全部内容
+void MdiChildTest::saveGzipAfterEdit()
+{
+    QString fileName = dir.filePath("edit.txt.gz");
+    QByteArray data = sampleText();
+    QVERIFY(writeGzip(fileName, data));
+    MdiChild child;
+    QVERIFY(child.loadFile(fileName, true));
+    QTextCursor cursor(child.document());
+    cursor.insertText("开头\n");
+    QVERIFY(child.document()->isModified());
+    QVERIFY(child.saveFile(fileName, true));
+    QCOMPARE(readGzip(fileName), QByteArray("开头\n") + data);
+}
+
+// Shift+Enter 在 QTextEdit 中插入 U+2028 行分隔符，文本绳和保存的文件中应该是普通的换行
+void MdiChildTest::saveLineSeparator()
+{
+    QString fileName = dir.filePath("separator.txt");
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("first\nsecond\n");
+    file.close();
+    MdiChild child;
+    QVERIFY(child.loadFile(fileName, true));
+    QTextCursor cursor(child.document());
+    cursor.setPosition(5);
+    child.setTextCursor(cursor);
+    QTest::keyClick(&child, Qt::Key_Return, Qt::ShiftModifier);
+    QVERIFY(child.document()->toRawText().contains(QChar(QChar::LineSeparator)));
+    QCOMPARE(child.snapshot().toString(), QString("first\n\nsecond\n"));
+    QVERIFY(child.saveFile(fileName, true));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readAll(), QByteArray("first\n\nsecond\n"));
+}
+
+int main(int argc, char* argv[])
+{
+    // 没有显示器的构建机上也能运行
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+    // 本地历史和恢复文件写到测试专用的目录，不影响用户的数据
+    QStandardPaths::setTestModeEnabled(true);
+    MdiChildTest test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_mdichild.moc"
@@ -0,0 +1,10 @@
+# 各测试程序共用的设置
+
+QT       += core testlib
+CONFIG += console testcase
+CONFIG -= app_bundle
+TEMPLATE = app
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += $$PWD/..
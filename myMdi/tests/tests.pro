@@ -0,0 +1,15 @@
+#-------------------------------------------------
+#
+# 单元测试，与编辑器分开构建：
+#   qmake && make && make check
+# 每个子目录是一个独立的测试程序
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    diff \
+    encodingdetector \
+    mdichild \
+    textrope
@@ -0,0 +1,10 @@
+include(../tests.pri)
+
+TARGET = tst_textrope
+
+SOURCES += \
+        tst_textrope.cpp \
+    ../../textrope.cpp
+
+HEADERS += \
+    ../../textrope.h
@@ -0,0 +1,212 @@
+#include <QCoreApplication>
+#include <QtTest>
+
+#include "textrope.h"
+
+static const int EditCount = 2000;  // 随机编辑的次数，文本会增长到几十个叶子
+
+// 文本绳与 QString 对照：同样的插入和删除之后两者的内容、长度和行的位置都应相同
+class TextRopeTest : public QObject
+{
+    Q_OBJECT
+private:
+    static quint32 nextRandom(quint32* seed);                   // 种子固定的随机数
+    static QString randomText(quint32* seed);                   // 混合英文、中文、换行和代理对的一段文本
+    static int snap(const QString& model, int position);        // 不落在代理对的中间
+    static void compareLines(const TextRope& rope, const QString& model);  // 逐行比较行首位置和行号
+
+private slots:
+    void empty();
+    void insertAndRemove();
+    void randomEdits();
+    void copyIsSnapshot();
+    void hashCollision();
+};
+
+// 线性同余随机数，每次运行的编辑序列都相同，失败时可以重现
+quint32 TextRopeTest::nextRandom(quint32* seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 16;
+}
+
+QString TextRopeTest::randomText(quint32* seed)
+{
+    QString text;
+    int length = 1 + int(nextRandom(seed) % 600);
+    while (text.size() < length)
+    {
+        switch (nextRandom(seed) % 8)
+        {
+        case 0:
+            text += QChar('\n');
+            break;
+        case 1:
+            text += QChar(0x4E00 + nextRandom(seed) % 0x51A6);
+            break;
+        case 2:
+            text += QString::fromUtf8("\xF0\x9F\x98\x80");
+            break;
+        default:
+            text += QChar('a' + nextRandom(seed) % 26);
+            break;
+        }
+    }
+    return text;
+}
+
+int TextRopeTest::snap(const QString& model, int position)
+{
+    if (position > 0 && position < model.size() && model.at(position).isLowSurrogate())
+        position--;
+    return position;
+}
+
+void TextRopeTest::compareLines(const TextRope& rope, const QString& model)
+{
+    QCOMPARE(rope.lineCount(), qint64(model.count(QChar('\n')) + 1));
+    qint64 line = 0;
+    qint64 start = 0;
+    for (int i = 0; i <= model.size(); i++)
+    {
+        QCOMPARE(rope.lineAt(i), line);
+        QCOMPARE(rope.columnAt(i), i - start);
+        if (i < model.size() && model.at(i) == QChar('\n'))
+        {
+            line++;
+            start = i + 1;
+            QCOMPARE(rope.lineStart(line), start);
+        }
+    }
+    QCOMPARE(rope.lineStart(0), qint64(0));
+    QCOMPARE(rope.lineStart(line + 1), qint64(model.size()));
+}
+
+void TextRopeTest::empty()
+{
+    TextRope rope;
+    QVERIFY(rope.isEmpty());
+    QCOMPARE(rope.length(), qint64(0));
+    QCOMPARE(rope.lineCount(), qint64(1));
+    QCOMPARE(rope.lineStart(0), qint64(0));
+    QCOMPARE(rope.lineAt(0), qint64(0));
+    QCOMPARE(rope.toString(), QString());
+    QCOMPARE(rope.hash(), TextRope(QString()).hash());
+}
+
+// 固定的几步编辑，覆盖开头、中间、末尾和跨行的删除
+void TextRopeTest::insertAndRemove()
+{
+    TextRope rope(QString("第一行\nsecond\n"));
+    rope.insert(0, QString("开头"));
+    rope.insert(rope.length(), QString("末尾"));
+    rope.insert(5, QString("\n中间\n"));
+    QString model = QString("开头第一行\n中间\n\nsecond\n末尾");
+    QCOMPARE(rope.toString(), model);
+    compareLines(rope, model);
+
+    rope.remove(3, 6);
+    model.remove(3, 6);
+    QCOMPARE(rope.toString(), model);
+    compareLines(rope, model);
+
+    rope.replace(0, rope.length(), QString("x"));
+    QCOMPARE(rope.toString(), QString("x"));
+    rope.remove(0, 1);
+    QVERIFY(rope.isEmpty());
+}
+
+// 随机插入、删除和替换，文本跨越多个叶子和多层内部节点，每一步之后与 QString 比较
+void TextRopeTest::randomEdits()
+{
+    quint32 seed = 20240601u;
+    TextRope rope;
+    QString model;
+    for (int step = 0; step < EditCount; step++)
+    {
+        int position = snap(model, int(nextRandom(&seed) % quint32(model.size() + 1)));
+        int kind = int(nextRandom(&seed) % 4);
+        if (kind < 2 || model.isEmpty())
+        {
+            QString text = randomText(&seed);
+            rope.insert(position, text);
+            model.insert(position, text);
+        }
+        else
+        {
+            int end = snap(model, position + int(nextRandom(&seed) % quint32(qMin(model.size() - position, 2000) + 1)));
+            if (kind == 2)
+            {
+                rope.remove(position, end - position);
+                model.remove(position, end - position);
+            }
+            else
+            {
+                QString text = randomText(&seed);
+                rope.replace(position, end - position, text);
+                model.replace(position, end - position, text);
+            }
+        }
+        QCOMPARE(rope.length(), qint64(model.size()));
+        QCOMPARE(rope.byteCount(), qint64(model.toUtf8().size()));
+        if (step % 50 == 0 || step == EditCount - 1)
+        {
+            QCOMPARE(rope.toString(), model);
+            compareLines(rope, model);
+            int from = snap(model, int(nextRandom(&seed) % quint32(model.size() + 1)));
+            int to = snap(model, from + int(nextRandom(&seed) % quint32(model.size() - from + 1)));
+            QCOMPARE(rope.mid(from, to - from), model.mid(from, to - from));
+            QCOMPARE(rope.byteOffset(from), qint64(model.left(from).toUtf8().size()));
+        }
+    }
+    // 内容相同时哈希值与树的形状无关
+    QCOMPARE(rope.hash(), TextRope(model).hash());
+}
+
+// 复制的文本绳是不可变的快照，之后的编辑不影响它
+void TextRopeTest::copyIsSnapshot()
+{
+    QString text;
+    for (int i = 0; i < 1000; i++)
+        text += QString("第 %1 行\n").arg(i);
+    TextRope rope(text);
+    TextRope snapshot = rope;
+    rope.remove(0, 100);
+    rope.insert(500, QString("插入\n"));
+    QCOMPARE(snapshot.toString(), text);
+    compareLines(snapshot, text);
+    QVERIFY(snapshot.hash() != rope.hash());
+}
+
+// 哈希值按 2^64 取模，Thue-Morse 串与它的反串对任何奇数基数都碰撞，sameText() 仍然能区分
+void TextRopeTest::hashCollision()
+{
+    QString thueMorse, complement;
+    for (int i = 0; i < 4096; i++)
+    {
+        bool odd = qPopulationCount(quint32(i)) & 1;
+        thueMorse += QChar(odd ? 'b' : 'a');
+        complement += QChar(odd ? 'a' : 'b');
+    }
+    TextRope rope(thueMorse);
+    TextRope other(complement);
+    QCOMPARE(rope.hash(), other.hash());
+    QVERIFY(!rope.sameText(other));
+    QVERIFY(rope.sameText(TextRope(thueMorse)));
+
+    // 编辑后改回原样，与原来的快照共享大部分叶子
+    TextRope edited = rope;
+    edited.remove(100, 1);
+    QVERIFY(!edited.sameText(rope));
+    edited.insert(100, thueMorse.mid(100, 1));
+    QVERIFY(edited.sameText(rope));
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    TextRopeTest test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_textrope.moc"
@@ -0,0 +1,528 @@
+#include "textrope.h"
+
+#include <string.h>
+
+static const int MaxLeaf = 4096;     // 叶子最多的 UTF-8 字节数
+static const int MinLeaf = 1024;     // 叶子最少的字节数，更小时与相邻的叶子合并
+static const int MaxChildren = 16;   // 内部节点最多的子节点数
+static const int MinChildren = 4;    // 内部节点最少的子节点数，更少时与相邻的节点合并
+static const int NodeOverhead = 32;  // 每个节点的共享指针控制块和堆分配的大致开销
+
+// 多项式哈希的基数，按 2^64 取模。文本 s 的哈希值为 s[0]*B^(n-1) + ... + s[n-1]，
+// 连接 a 和 b 的哈希值为 hash(a) * B^|b| + hash(b)
+static const quint64 HashBase = Q_UINT64_C(0x9e3779b97f4a7c15);
+static const quint64 HashBase2 = HashBase * HashBase;
+static const quint64 HashBase3 = HashBase2 * HashBase;
+static const quint64 HashBase4 = HashBase3 * HashBase;
+
+// B 树的节点：叶子保存文本，内部节点保存子节点，所有叶子的深度相同
+struct TextRope::Node
+{
+    Metrics metrics;            // 子树中文本的度量
+    quint64 hash;               // 子树中文本的哈希值
+    quint64 power;              // 哈希的基数的 metrics.bytes 次方，连接时用
+    int height;                 // 高度，叶子为 0
+    QByteArray text;            // 叶子的 UTF-8 文本
+    QVector<NodePtr> children;  // 内部节点的子节点
+};
+
+TextRope::TextRope() {}
+
+TextRope::TextRope(const QString& text) { insert(0, text); }
+
+// 度量一段 UTF-8 文本。每个字符的首字节计一个 UTF-16 编码单元，4 字节的字符是代理对，计两个
+TextRope::Metrics TextRope::measure(const char* text, int size)
+{
+    Metrics m = {0, size, 0};
+    for (int i = 0; i < size; i++)
+    {
+        uchar c = uchar(text[i]);
+        if (c == '\n')
+            m.lines++;
+        if ((c & 0xC0) != 0x80)
+            m.chars += c >= 0xF0 ? 2 : 1;
+    }
+    return m;
+}
+
+// 一段 UTF-8 文本的哈希值，每次处理 4 个字节，乘法之间没有依赖，比逐字节的霍纳法则快
+quint64 TextRope::hashText(const char* text, int size)
+{
+    const uchar* bytes = reinterpret_cast<const uchar*>(text);
+    quint64 hash = 0;
+    int i = 0;
+    for (; i + 4 <= size; i += 4)
+        hash = hash * HashBase4 + bytes[i] * HashBase3 + bytes[i + 1] * HashBase2 + bytes[i + 2] * HashBase
+               + bytes[i + 3];
+    for (; i < size; i++)
+        hash = hash * HashBase + bytes[i];
+    return hash;
+}
+
+// 哈希的基数的 size 次方，用平方求幂
+quint64 TextRope::hashPower(qint64 size)
+{
+    quint64 result = 1;
+    quint64 base = HashBase;
+    while (size > 0)
+    {
+        if (size & 1)
+            result *= base;
+        base *= base;
+        size >>= 1;
+    }
+    return result;
+}
+
+// 叶子中前 position 个 UTF-16 编码单元的字节数。位置落在代理对中间时移到代理对之后
+int TextRope::byteIndex(const QByteArray& text, qint64 position)
+{
+    const char* p = text.constData();
+    int size = text.size();
+    int i = 0;
+    while (i < size && position > 0)
+    {
+        uchar c = uchar(p[i]);
+        position -= c >= 0xF0 ? 2 : 1;
+        i += c < 0x80 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+    }
+    return qMin(i, size);
+}
+
+// 创建叶子
+TextRope::NodePtr TextRope::makeLeaf(const QByteArray& text)
+{
+    Node* node = new Node;
+    node->metrics = measure(text.constData(), text.size());
+    node->hash = hashText(text.constData(), text.size());
+    node->power = hashPower(text.size());
+    node->height = 0;
+    node->text = text;
+    return NodePtr(node);
+}
+
+// 创建内部节点，度量为子节点之和，哈希值由子节点的哈希值依次连接算出
+TextRope::NodePtr TextRope::makeBranch(const QVector<NodePtr>& children)
+{
+    Node* node = new Node;
+    Metrics m = {0, 0, 0};
+    quint64 hash = 0;
+    quint64 power = 1;
+    foreach (const NodePtr& child, children)
+    {
+        m.chars += child->metrics.chars;
+        m.bytes += child->metrics.bytes;
+        m.lines += child->metrics.lines;
+        hash = hash * child->power + child->hash;
+        power *= child->power;
+    }
+    node->metrics = m;
+    node->hash = hash;
+    node->power = power;
+    node->height = children.first()->height + 1;
+    node->children = children;
+    return NodePtr(node);
+}
+
+// 把文本分成大小相近、都不超过 MaxLeaf 的叶子，不把一个字符的字节拆到两个叶子中
+QVector<TextRope::NodePtr> TextRope::splitLeaves(const QByteArray& text)
+{
+    QVector<NodePtr> leaves;
+    int size = text.size();
+    int count = (size + MaxLeaf - 1) / MaxLeaf;
+    int start = 0;
+    for (int i = 1; i <= count; i++)
+    {
+        int end = int(qint64(size) * i / count);
+        while (end < size && end > start && (uchar(text.at(end)) & 0xC0) == 0x80)
+            end++;
+        if (end > start)
+            leaves << makeLeaf(text.mid(start, end - start));
+        start = end;
+    }
+    return leaves;
+}
+
+// 把同一层的节点平均分组，每组不超过 MaxChildren 个，作为上一层的节点
+QVector<TextRope::NodePtr> TextRope::group(const QVector<NodePtr>& nodes)
+{
+    QVector<NodePtr> parents;
+    int count = (nodes.size() + MaxChildren - 1) / MaxChildren;
+    int start = 0;
+    for (int i = 1; i <= count; i++)
+    {
+        int end = nodes.size() * i / count;
+        parents << makeBranch(nodes.mid(start, end - start));
+        start = end;
+    }
+    return parents;
+}
+
+// 把同一层的节点逐层分组，直到只剩下根节点
+TextRope::NodePtr TextRope::build(QVector<NodePtr> nodes)
+{
+    if (nodes.isEmpty())
+        return NodePtr();
+    while (nodes.size() > 1)
+        nodes = group(nodes);
+    return nodes.first();
+}
+
+// 节点是否过小，需要与相邻的节点合并
+bool TextRope::isUnderfull(const NodePtr& node)
+{
+    return node->height == 0 ? node->text.size() < MinLeaf : node->children.size() < MinChildren;
+}
+
+// 合并两个同一层的相邻节点，合并后太大时重新平均分成两个
+QVector<TextRope::NodePtr> TextRope::merge(const NodePtr& left, const NodePtr& right)
+{
+    if (left->height == 0)
+    {
+        QByteArray text = left->text + right->text;
+        return text.size() <= MaxLeaf ? QVector<NodePtr>() << makeLeaf(text) : splitLeaves(text);
+    }
+    QVector<NodePtr> children = left->children + right->children;
+    return children.size() <= MaxChildren ? QVector<NodePtr>() << makeBranch(children) : group(children);
+}
+
+// 删除之后，把过小的子节点与前一个节点合并
+QVector<TextRope::NodePtr> TextRope::normalize(const QVector<NodePtr>& children)
+{
+    QVector<NodePtr> result;
+    foreach (const NodePtr& child, children)
+    {
+        if (!result.isEmpty() && (isUnderfull(result.last()) || isUnderfull(child)))
+        {
+            NodePtr previous = result.last();
+            result.removeLast();
+            result += merge(previous, child);
+        }
+        else
+        {
+            result << child;
+        }
+    }
+    return result;
+}
+
+// 在子树中插入文本，返回替换这个子树的一个或多个同一高度的节点
+QVector<TextRope::NodePtr> TextRope::insertAt(const NodePtr& node, qint64 position, const QByteArray& text)
+{
+    if (node->height == 0)
+    {
+        QByteArray result = node->text;
+        result.insert(byteIndex(result, position), text);
+        return result.size() <= MaxLeaf ? QVector<NodePtr>() << makeLeaf(result) : splitLeaves(result);
+    }
+    // 插入位置在两个子节点之间时插入到前一个的末尾
+    int i = 0;
+    int last = node->children.size() - 1;
+    while (i < last && position > node->children.at(i)->metrics.chars)
+        position -= node->children.at(i++)->metrics.chars;
+    QVector<NodePtr> children = node->children.mid(0, i);
+    children += insertAt(node->children.at(i), position, text);
+    children += node->children.mid(i + 1);
+    return children.size() <= MaxChildren ? QVector<NodePtr>() << makeBranch(children) : group(children);
+}
+
+// 删除子树中从 position 开始的 count 个编码单元，子树被删空时返回空
+TextRope::NodePtr TextRope::removeRange(const NodePtr& node, qint64 position, qint64 count)
+{
+    if (node->height == 0)
+    {
+        QByteArray result = node->text;
+        int start = byteIndex(result, position);
+        result.remove(start, byteIndex(result, position + count) - start);
+        return result.isEmpty() ? NodePtr() : makeLeaf(result);
+    }
+    QVector<NodePtr> children;
+    qint64 offset = 0;
+    foreach (const NodePtr& child, node->children)
+    {
+        qint64 chars = child->metrics.chars;
+        qint64 begin = qMax(position, offset);
+        qint64 end = qMin(position + count, offset + chars);
+        if (begin < end)
+        {
+            NodePtr rest = removeRange(child, begin - offset, end - begin);
+            if (rest)
+                children << rest;
+        }
+        else
+        {
+            children << child;
+        }
+        offset += chars;
+    }
+    children = normalize(children);
+    return children.isEmpty() ? NodePtr() : makeBranch(children);
+}
+
+// 把子树中从 position 开始的 count 个编码单元追加到 out
+void TextRope::collect(const NodePtr& node, qint64 position, qint64 count, QByteArray* out)
+{
+    if (node->height == 0)
+    {
+        int start = byteIndex(node->text, position);
+        out->append(node->text.mid(start, byteIndex(node->text, position + count) - start));
+        return;
+    }
+    foreach (const NodePtr& child, node->children)
+    {
+        if (count <= 0)
+            break;
+        qint64 chars = child->metrics.chars;
+        if (position < chars)
+        {
+            qint64 length = qMin(count, chars - position);
+            collect(child, position, length, out);
+            count -= length;
+            position = 0;
+        }
+        else
+        {
+            position -= chars;
+        }
+    }
+}
+
+// 整个文本的度量
+TextRope::Metrics TextRope::metrics() const
+{
+    if (!root)
+    {
+        Metrics empty = {0, 0, 0};
+        return empty;
+    }
+    return root->metrics;
+}
+
+// 文本内容的哈希值，空文本为 0。内容相同时哈希值一定相同，不同时几乎不可能相同，比较时还应比较长度
+quint64 TextRope::hash() const { return root ? root->hash : 0; }
+
+// 内容是否相同：先比较字节数和哈希值，再按顺序比较两边的 UTF-8 叶子。
+// 编辑之后改回原样的文本绳与原来的快照共享大部分叶子，同一个叶子只比较指针
+bool TextRope::sameText(const TextRope& other) const
+{
+    if (root == other.root)
+        return true;
+    if (byteCount() != other.byteCount() || hash() != other.hash())
+        return false;
+    QVector<QByteArray> left = chunks();
+    QVector<QByteArray> right = other.chunks();
+    int i = 0, j = 0;  // 两边当前的叶子
+    int x = 0, y = 0;  // 在当前叶子中已经比较过的字节数
+    while (i < left.size() && j < right.size())
+    {
+        const QByteArray& a = left.at(i);
+        const QByteArray& b = right.at(j);
+        if (x == 0 && y == 0 && a.constData() == b.constData() && a.size() == b.size())
+        {
+            i++;
+            j++;
+            continue;
+        }
+        int count = qMin(a.size() - x, b.size() - y);
+        if (memcmp(a.constData() + x, b.constData() + y, size_t(count)) != 0)
+            return false;
+        x += count;
+        y += count;
+        if (x == a.size())
+        {
+            i++;
+            x = 0;
+        }
+        if (y == b.size())
+        {
+            j++;
+            y = 0;
+        }
+    }
+    return true;
+}
+
+// 在 position 处插入文本，只创建从根到插入位置的路径上的新节点
+void TextRope::insert(qint64 position, const QString& text)
+{
+    if (text.isEmpty())
+        return;
+    position = qBound(qint64(0), position, length());
+    QByteArray utf8 = text.toUtf8();
+    if (!root)
+        root = build(splitLeaves(utf8));
+    else
+        root = build(insertAt(root, position, utf8));
+}
+
+// 删除一段文本，根节点只剩一个子节点时降低树的高度
+void TextRope::remove(qint64 position, qint64 count)
+{
+    position = qBound(qint64(0), position, length());
+    count = qBound(qint64(0), count, length() - position);
+    if (count == 0)
+        return;
+    root = removeRange(root, position, count);
+    while (root && root->height > 0 && root->children.size() == 1)
+        root = root->children.first();
+}
+
+// 替换一段文本
+void TextRope::replace(qint64 position, qint64 count, const QString& text)
+{
+    remove(position, count);
+    insert(position, text);
+}
+
+// 取出一段文本，先拼接 UTF-8 再一次转换为 UTF-16
+QString TextRope::mid(qint64 position, qint64 count) const
+{
+    QByteArray text;
+    position = qBound(qint64(0), position, length());
+    count = qBound(qint64(0), count, length() - position);
+    if (count > 0)
+        collect(root, position, count, &text);
+    return QString::fromUtf8(text);
+}
+
+// 取出全部文本
+QString TextRope::toString() const { return mid(0, length()); }
+
+// 按顺序取出所有叶子的 UTF-8 文本。QByteArray 是隐式共享的，不会复制字符
+QVector<QByteArray> TextRope::chunks() const
+{
+    QVector<QByteArray> result;
+    if (!root)
+        return result;
+    QVector<NodePtr> stack;
+    stack << root;
+    while (!stack.isEmpty())
+    {
+        NodePtr node = stack.last();
+        stack.removeLast();
+        if (node->height == 0)
+        {
+            result << node->text;
+            continue;
+        }
+        for (int i = node->children.size() - 1; i >= 0; i--)
+            stack << node->children.at(i);
+    }
+    return result;
+}
+
+// 叶子文本按 QByteArray 的容量计算；节点按结构体、共享指针的控制块和子节点数组计算。
+// 与其他快照共享的节点也计算在内
+void TextRope::memoryUsage(qint64* textBytes, qint64* nodeBytes) const
+{
+    *textBytes = 0;
+    *nodeBytes = 0;
+    if (!root)
+        return;
+    QVector<NodePtr> stack;
+    stack << root;
+    while (!stack.isEmpty())
+    {
+        NodePtr node = stack.last();
+        stack.removeLast();
+        *nodeBytes += sizeof(Node) + NodeOverhead;
+        if (node->height == 0)
+        {
+            *textBytes += node->text.capacity();
+            continue;
+        }
+        *nodeBytes += node->children.capacity() * sizeof(NodePtr);
+        foreach (const NodePtr& child, node->children)
+            stack << child;
+    }
+}
+
+// 第 line 行的行首位置：找到第 line 个换行符，行号超出时返回文本末尾
+qint64 TextRope::lineStart(qint64 line) const
+{
+    if (line <= 0 || !root)
+        return 0;
+    if (line > root->metrics.lines)
+        return root->metrics.chars;
+    NodePtr node = root;
+    qint64 offset = 0;
+    while (node->height > 0)
+    {
+        foreach (const NodePtr& child, node->children)
+        {
+            if (line <= child->metrics.lines)
+            {
+                node = child;
+                break;
+            }
+            line -= child->metrics.lines;
+            offset += child->metrics.chars;
+        }
+    }
+    const char* p = node->text.constData();
+    for (int i = 0; i < node->text.size(); i++)
+    {
+        if (p[i] == '\n' && --line == 0)
+            return offset + measure(p, i + 1).chars;
+    }
+    return offset + node->metrics.chars;
+}
+
+// position 所在的行：统计 position 之前的换行符
+qint64 TextRope::lineAt(qint64 position) const
+{
+    if (!root)
+        return 0;
+    position = qBound(qint64(0), position, root->metrics.chars);
+    NodePtr node = root;
+    qint64 lines = 0;
+    while (node->height > 0)
+    {
+        int last = node->children.size() - 1;
+        for (int i = 0; i <= last; i++)
+        {
+            const NodePtr& child = node->children.at(i);
+            if (position < child->metrics.chars || i == last)
+            {
+                node = child;
+                break;
+            }
+            position -= child->metrics.chars;
+            lines += child->metrics.lines;
+        }
+    }
+    return lines + measure(node->text.constData(), byteIndex(node->text, position)).lines;
+}
+
+// position 所在的列
+qint64 TextRope::columnAt(qint64 position) const
+{
+    position = qBound(qint64(0), position, length());
+    return position - lineStart(lineAt(position));
+}
+
+// position 之前的文本的 UTF-8 字节数，用于在文件中定位
+qint64 TextRope::byteOffset(qint64 position) const
+{
+    if (!root)
+        return 0;
+    position = qBound(qint64(0), position, root->metrics.chars);
+    NodePtr node = root;
+    qint64 bytes = 0;
+    while (node->height > 0)
+    {
+        int last = node->children.size() - 1;
+        for (int i = 0; i <= last; i++)
+        {
+            const NodePtr& child = node->children.at(i);
+            if (position < child->metrics.chars || i == last)
+            {
+                node = child;
+                break;
+            }
+            position -= child->metrics.chars;
+            bytes += child->metrics.bytes;
+        }
+    }
+    return bytes + byteIndex(node->text, position);
+}
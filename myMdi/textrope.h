@@ -0,0 +1,73 @@
+#ifndef TEXTROPE_H
+#define TEXTROPE_H
+
+#include <QByteArray>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+// 文本绳：用 B 树保存分块的文本，每个节点缓存子树的 UTF-16 长度、UTF-8 字节数和换行符个数，
+// 插入、删除、取子串以及位置和行号之间的转换都是 O(log n)。
+// 叶子按 UTF-8 保存，以 ASCII 为主的文本只占 QString 的一半内存，位置仍然按 UTF-16 编码单元计算。
+// 节点创建后不再修改，修改时只复制从根到被修改的叶子的路径，所以复制 TextRope 只是复制根节点的指针，
+// 可以作为不可变的快照交给保存、搜索等后台线程读取，之后的编辑不会影响快照。
+// 每个节点还缓存子树文本的多项式哈希值，由子节点的哈希值算出，与树的形状无关，
+// 内容相同的两个文本绳不管经过怎样的编辑，哈希值都相同，哈希值不同时可以 O(1) 断定内容不同。
+// 哈希值按 2^64 取模，存在构造出的碰撞，哈希值相同时需要用 sameText() 确认
+class TextRope
+{
+public:
+    // 一段文本的度量
+    struct Metrics
+    {
+        qint64 chars;  // UTF-16 编码单元数
+        qint64 bytes;  // UTF-8 字节数
+        qint64 lines;  // 换行符个数
+    };
+
+private:
+    struct Node;
+    typedef QSharedPointer<const Node> NodePtr;
+
+    NodePtr root;  // 根节点，空文本时为空
+
+    static Metrics measure(const char* text, int size);                           // 度量一段 UTF-8 文本
+    static quint64 hashText(const char* text, int size);                          // 一段 UTF-8 文本的哈希值
+    static quint64 hashPower(qint64 size);                                        // 哈希的基数的 size 次方
+    static int byteIndex(const QByteArray& text, qint64 position);               // UTF-16 位置在叶子中的字节位置
+    static NodePtr makeLeaf(const QByteArray& text);                              // 创建叶子
+    static NodePtr makeBranch(const QVector<NodePtr>& children);                  // 创建内部节点
+    static QVector<NodePtr> splitLeaves(const QByteArray& text);                  // 把文本分成大小相近的叶子
+    static QVector<NodePtr> group(const QVector<NodePtr>& nodes);                 // 把同一层的节点分组为上一层
+    static NodePtr build(QVector<NodePtr> nodes);                                 // 把同一层的节点逐层合并为一棵树
+    static bool isUnderfull(const NodePtr& node);                                 // 节点是否过小
+    static QVector<NodePtr> merge(const NodePtr& left, const NodePtr& right);     // 合并两个同一层的相邻节点
+    static QVector<NodePtr> normalize(const QVector<NodePtr>& children);          // 合并过小的子节点
+    static QVector<NodePtr> insertAt(const NodePtr& node, qint64 position, const QByteArray& text);  // 插入
+    static NodePtr removeRange(const NodePtr& node, qint64 position, qint64 count);                 // 删除
+    static void collect(const NodePtr& node, qint64 position, qint64 count, QByteArray* out);       // 取出文本
+
+public:
+    TextRope();
+    explicit TextRope(const QString& text);
+    Metrics metrics() const;                                      // 整个文本的度量
+    qint64 length() const { return metrics().chars; }             // UTF-16 编码单元数
+    qint64 byteCount() const { return metrics().bytes; }          // UTF-8 字节数
+    quint64 hash() const;                                         // 文本内容的哈希值，只取决于内容
+    bool sameText(const TextRope& other) const;                   // 内容是否相同，两边共享的叶子不逐字节比较
+    qint64 lineCount() const { return metrics().lines + 1; }      // 行数
+    bool isEmpty() const { return root.isNull(); }                // 是否为空
+    void insert(qint64 position, const QString& text);            // 在 position 处插入文本
+    void remove(qint64 position, qint64 count);                   // 删除从 position 开始的 count 个编码单元
+    void replace(qint64 position, qint64 count, const QString& text);  // 替换一段文本
+    QString mid(qint64 position, qint64 count) const;             // 取出一段文本
+    QString toString() const;                                     // 取出全部文本
+    QVector<QByteArray> chunks() const;                           // 按顺序取出所有叶子的 UTF-8 文本，不复制字符
+    void memoryUsage(qint64* textBytes, qint64* nodeBytes) const; // 叶子文本和节点本身占用的内存，需要遍历所有节点
+    qint64 lineStart(qint64 line) const;                          // 第 line 行（从 0 开始）的行首位置
+    qint64 lineAt(qint64 position) const;                         // position 所在的行（从 0 开始）
+    qint64 columnAt(qint64 position) const;                       // position 所在的列（从 0 开始）
+    qint64 byteOffset(qint64 position) const;                     // position 之前的文本的 UTF-8 字节数
+};
+
+#endif  // TEXTROPE_H
@@ -0,0 +1,152 @@
+#include "tracer.h"
+
+#include <QAtomicInteger>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QMutex>
+#include <QSaveFile>
+#include <QSharedPointer>
+#include <QThread>
+#include <QThreadStorage>
+#include <QVector>
+
+// 一个计时事件
+struct TraceEvent
+{
+    const char* name;  // 事件名称
+    qint64 start;      // 开始时间（微秒）
+    qint64 duration;   // 持续时间（微秒）
+};
+
+// 一个线程的环形缓冲区。只有所属的线程写入，先写事件再发布 head；
+// 导出时读取前后各取一次 head，读取期间可能被覆盖的事件丢弃
+struct TraceBuffer
+{
+    int thread;                     // 线程编号，导出为 tid
+    QString threadName;             // 线程名称
+    QAtomicInteger<qint64> head;    // 已经写入的事件总数
+    TraceEvent events[Tracer::Capacity];  // 事件，第 i 个事件在 i % Capacity
+};
+
+typedef QSharedPointer<TraceBuffer> TraceBufferPtr;
+
+static QAtomicInt enabled;                           // 是否正在记录
+static QMutex registryMutex;                         // 保护 registry
+static QList<TraceBufferPtr> registry;               // 所有线程的缓冲区，线程结束后仍然保留到导出
+static QThreadStorage<TraceBufferPtr> localBuffer;   // 当前线程的缓冲区
+
+// 当前线程的缓冲区，第一次记录时创建并登记，之后只是一次线程局部存储的查找
+static TraceBuffer* currentBuffer()
+{
+    if (localBuffer.hasLocalData())
+        return localBuffer.localData().data();
+    TraceBufferPtr buffer(new TraceBuffer);
+    QThread* thread = QThread::currentThread();
+    buffer->threadName = thread->objectName();
+    if (buffer->threadName.isEmpty())
+        buffer->threadName = QCoreApplication::instance() && thread == QCoreApplication::instance()->thread()
+                                 ? QString("GUI")
+                                 : QString("Thread %1").arg(quintptr(QThread::currentThreadId()));
+    QMutexLocker locker(&registryMutex);
+    buffer->thread = registry.size() + 1;
+    registry.append(buffer);
+    localBuffer.setLocalData(buffer);
+    return buffer.data();
+}
+
+static QElapsedTimer startClock()
+{
+    QElapsedTimer timer;
+    timer.start();
+    return timer;
+}
+
+bool Tracer::isEnabled() { return enabled.load() != 0; }
+
+void Tracer::setEnabled(bool enable) { enabled.store(enable ? 1 : 0); }
+
+qint64 Tracer::now()
+{
+    static const QElapsedTimer clock = startClock();
+    return clock.nsecsElapsed() / 1000;
+}
+
+void Tracer::record(const char* name, qint64 start, qint64 duration)
+{
+    TraceBuffer* buffer = currentBuffer();
+    qint64 index = buffer->head.load();
+    TraceEvent& event = buffer->events[index % Capacity];
+    event.name = name;
+    event.start = start;
+    event.duration = duration;
+    buffer->head.storeRelease(index + 1);
+}
+
+// 写成 Chrome 跟踪事件格式：每个事件是一个完整事件（ph 为 X），时间单位为微秒，
+// 另外用元数据事件（ph 为 M）给进程和线程命名
+bool Tracer::exportTrace(const QString& fileName, QString* error)
+{
+    QList<TraceBufferPtr> buffers;
+    {
+        QMutexLocker locker(&registryMutex);
+        buffers = registry;
+    }
+    qint64 pid = QCoreApplication::applicationPid();
+    QJsonArray events;
+    QJsonObject process;
+    process.insert("name", "process_name");
+    process.insert("ph", "M");
+    process.insert("pid", double(pid));
+    QJsonObject processArgs;
+    processArgs.insert("name", QCoreApplication::applicationName());
+    process.insert("args", processArgs);
+    events.append(process);
+    QVector<TraceEvent> copy;
+    foreach (const TraceBufferPtr& buffer, buffers)
+    {
+        QJsonObject thread;
+        thread.insert("name", "thread_name");
+        thread.insert("ph", "M");
+        thread.insert("pid", double(pid));
+        thread.insert("tid", buffer->thread);
+        QJsonObject threadArgs;
+        threadArgs.insert("name", buffer->threadName);
+        thread.insert("args", threadArgs);
+        events.append(thread);
+        // 先复制再检查，复制期间被所属线程覆盖的事件不导出
+        qint64 end = buffer->head.loadAcquire();
+        qint64 begin = qMax<qint64>(0, end - Capacity);
+        copy.resize(int(end - begin));
+        for (qint64 i = begin; i < end; i++)
+            copy[int(i - begin)] = buffer->events[i % Capacity];
+        qint64 overwritten = buffer->head.loadAcquire() - Capacity + 1;
+        for (qint64 i = qMax(begin, overwritten); i < end; i++)
+        {
+            const TraceEvent& event = copy.at(int(i - begin));
+            QJsonObject item;
+            item.insert("name", QString::fromLatin1(event.name));
+            item.insert("cat", "myMdi");
+            item.insert("ph", "X");
+            item.insert("ts", double(event.start));
+            item.insert("dur", double(event.duration));
+            item.insert("pid", double(pid));
+            item.insert("tid", buffer->thread);
+            events.append(item);
+        }
+    }
+    QJsonObject root;
+    root.insert("traceEvents", events);
+    root.insert("displayTimeUnit", "ms");
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(root).toJson(QJsonDocument::Compact)) < 0 ||
+        !file.commit())
+    {
+        *error = file.errorString();
+        return false;
+    }
+    return true;
+}
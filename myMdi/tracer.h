@@ -0,0 +1,39 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QString>
+
+// 性能跟踪：在加载、保存、布局、菜单更新和后台请求等操作前后计时，按需导出为 Chrome 跟踪事件格式的 JSON，
+// 可以用 chrome://tracing 或 Perfetto 打开。每个线程只写自己的环形缓冲区，记录时不加锁，
+// 缓冲区满后覆盖最早的事件。跟踪默认关闭，关闭时每个计时点只多一次原子读取
+class Tracer
+{
+public:
+    static const int Capacity = 1 << 14;  // 每个线程保留的事件数
+
+    static bool isEnabled();              // 是否正在记录
+    static void setEnabled(bool enable);  // 开始或停止记录，已经记录的事件保留
+    static qint64 now();                  // 从程序启动开始的微秒数
+    static void record(const char* name, qint64 start, qint64 duration);  // 在当前线程的缓冲区中记录一个事件
+    static bool exportTrace(const QString& fileName, QString* error);     // 把所有线程的事件写入文件
+};
+
+// 在作用域内计时，离开作用域时记录一个事件。name 必须一直有效，例如字符串常量
+class TraceScope
+{
+    Q_DISABLE_COPY(TraceScope)
+
+private:
+    const char* name;  // 事件名称
+    qint64 start;      // 开始时间，没有记录时为 -1
+
+public:
+    explicit TraceScope(const char* eventName) : name(eventName), start(Tracer::isEnabled() ? Tracer::now() : -1) {}
+    ~TraceScope()
+    {
+        if (start >= 0)
+            Tracer::record(name, start, Tracer::now() - start);
+    }
+};
+
+#endif  // TRACER_H
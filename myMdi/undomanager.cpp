@@ -0,0 +1,306 @@
+#include "undomanager.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+
+static const qint64 DocumentLimit = 32 << 20;   // 每个文档的撤销文本在内存中最多占用 32MB
+static const qint64 GlobalLimit = 128 << 20;    // 所有文档合计最多占用 128MB
+
+qint64 UndoManager::totalMemory = 0;
+
+UndoSpillRequest::UndoSpillRequest(const QString& fileName, const QByteArray& bytes)
+    : IoRequest(DocumentIo::Background), path(fileName), data(bytes)
+{
+    length = bytes.size();
+    offset = 0;
+    written = 0;
+}
+
+// 被取消的请求写入的文件已经没有人使用，在它结束之后删除
+UndoSpillRequest::~UndoSpillRequest()
+{
+    if (wasCancelled())
+        QFile::remove(path);
+}
+
+// 压缩后追加到文件末尾
+void UndoSpillRequest::run()
+{
+    if (isCancelled())
+        return;
+    QByteArray compressed = qCompress(data);
+    data.clear();
+    QFile file(path);
+    if (!file.open(QIODevice::ReadWrite))
+    {
+        error = file.errorString();
+        return;
+    }
+    offset = file.size();
+    if (!file.seek(offset) || file.write(compressed) != compressed.size())
+    {
+        error = file.errorString();
+        file.resize(offset);
+        return;
+    }
+    written = compressed.size();
+}
+
+UndoManager::UndoManager(QObject* parent) : QObject(parent)
+{
+    arenaBase = 0;
+    spillFailed = false;
+    spillGeneration = 0;
+    clear();
+}
+
+UndoManager::~UndoManager()
+{
+    abandonSpill();
+    addMemory(-arena.size() - spilling.size());
+}
+
+// 记录存储区大小的变化
+void UndoManager::addMemory(qint64 size) { totalMemory += size; }
+
+// 在当前节点下添加一个子节点。两段文本按 UTF-8 追加到存储区，节点只记录它们的范围
+void UndoManager::push(const UndoStep& step)
+{
+    QByteArray removed = step.removed.toUtf8();
+    QByteArray added = step.added.toUtf8();
+    Node node;
+    node.parent = current;
+    node.redoChild = -1;
+    node.depth = nodes.at(current).depth + 1;
+    node.position = step.position;
+    node.payload = arenaBase + arena.size();
+    node.removedBytes = removed.size();
+    node.addedBytes = added.size();
+    arena += removed;
+    arena += added;
+    addMemory(removed.size() + added.size());
+    nodes[current].redoChild = nodes.size();
+    nodes.append(node);
+    current = nodes.size() - 1;
+    trim();
+}
+
+// 取出存储区中从 start 开始的 size 个字节，已经溢出的部分从文件读回并解压，最近的一块留在缓存中
+bool UndoManager::readPayload(qint64 start, int size, QByteArray* out)
+{
+    out->clear();
+    while (size > 0)
+    {
+        if (start >= arenaBase)
+        {
+            out->append(arena.constData() + (start - arenaBase), size);
+            return true;
+        }
+        qint64 spillingBase = arenaBase - spilling.size();
+        if (start >= spillingBase)
+        {
+            int count = int(qMin(qint64(size), arenaBase - start));
+            out->append(spilling.constData() + (start - spillingBase), count);
+            start += count;
+            size -= count;
+            continue;
+        }
+        // 二分查找包含 start 的块
+        int low = 0;
+        int high = chunks.size() - 1;
+        while (low < high)
+        {
+            int middle = (low + high + 1) / 2;
+            if (chunks.at(middle).start <= start)
+                low = middle;
+            else
+                high = middle - 1;
+        }
+        const Chunk& chunk = chunks.at(low);
+        if (low != cachedChunk)
+        {
+            QFile file(spillPath);
+            if (!file.open(QIODevice::ReadOnly) || !file.seek(chunk.fileOffset))
+                return false;
+            cache = qUncompress(file.read(chunk.fileSize));
+            cachedChunk = low;
+            if (cache.size() != chunk.end - chunk.start)
+            {
+                cachedChunk = -1;
+                return false;
+            }
+        }
+        int count = int(qMin(qint64(size), chunk.end - start));
+        out->append(cache.constData() + (start - chunk.start), count);
+        start += count;
+        size -= count;
+    }
+    return true;
+}
+
+// 节点的编辑。forward 为 false 时取反向的编辑，用于从这个节点回到父节点
+bool UndoManager::nodeStep(int node, bool forward, UndoStep* step)
+{
+    const Node& n = nodes.at(node);
+    QByteArray removed, added;
+    if (!readPayload(n.payload, n.removedBytes, &removed) || !readPayload(n.payload + n.removedBytes, n.addedBytes, &added))
+        return false;
+    step->position = n.position;
+    step->removed = QString::fromUtf8(forward ? removed : added);
+    step->added = QString::fromUtf8(forward ? added : removed);
+    return true;
+}
+
+// 回到父节点
+QVector<UndoStep> UndoManager::undo() { return canUndo() ? travel(nodes.at(current).parent) : QVector<UndoStep>(); }
+
+// 进入上次离开的子节点
+QVector<UndoStep> UndoManager::redo() { return canRedo() ? travel(nodes.at(current).redoChild) : QVector<UndoStep>(); }
+
+// 回到任意一个节点：先从当前节点反向走到两者共同的祖先，再从祖先走到目标节点。
+// 经过的每个节点都记为父节点的恢复方向，之后恢复时沿着来的路回去。
+// 所有编辑先全部取出，读取溢出文件失败时不改变当前节点
+QVector<UndoStep> UndoManager::travel(int node)
+{
+    QVector<UndoStep> steps;
+    if (node < 0 || node >= nodes.size() || node == current)
+        return steps;
+    QVector<int> up, down;
+    int a = current;
+    int b = node;
+    while (nodes.at(a).depth > nodes.at(b).depth)
+    {
+        up.append(a);
+        a = nodes.at(a).parent;
+    }
+    while (nodes.at(b).depth > nodes.at(a).depth)
+    {
+        down.append(b);
+        b = nodes.at(b).parent;
+    }
+    while (a != b)
+    {
+        up.append(a);
+        a = nodes.at(a).parent;
+        down.append(b);
+        b = nodes.at(b).parent;
+    }
+    UndoStep step;
+    foreach (int n, up)
+    {
+        if (!nodeStep(n, false, &step))
+            return QVector<UndoStep>();
+        steps.append(step);
+    }
+    for (int i = down.size() - 1; i >= 0; i--)
+    {
+        if (!nodeStep(down.at(i), true, &step))
+            return QVector<UndoStep>();
+        steps.append(step);
+    }
+    foreach (int n, up)
+        nodes[nodes.at(n).parent].redoChild = n;
+    foreach (int n, down)
+        nodes[nodes.at(n).parent].redoChild = n;
+    current = node;
+    return steps;
+}
+
+// 超出这个文档或者所有文档的内存上限时，在 I/O 线程中把存储区开头的一段写入溢出文件，
+// 这个文档降到上限的一半，超出全部文档的上限时全部写入。同一时间只写入一块，保证文件中的顺序
+void UndoManager::trim()
+{
+    if (spillRequest || spillFailed || (arena.size() <= DocumentLimit && totalMemory <= GlobalLimit))
+        return;
+    int keep = totalMemory > GlobalLimit ? 0 : int(DocumentLimit / 2);
+    int size = arena.size() - keep;
+    if (size <= 0)
+        return;
+    // 整个存储区换到 spilling 中交给溢出请求，不复制要写入的部分，只复制留在内存中的末尾。
+    // 截断时还没有共享，不会重新分配；之后请求和 spilling 共享同一块数据，两边都只读，新的编辑追加到新的 arena
+    QByteArray tail = arena.mid(size);
+    qSwap(arena, tail);
+    qSwap(spilling, tail);
+    spilling.truncate(size);
+    arenaBase += size;
+    UndoSpillRequest* request = new UndoSpillRequest(spillPath, spilling);
+    spillRequest = request;
+    connect(request, SIGNAL(finished()), this, SLOT(spillRequestFinished()));
+    DocumentIo::instance()->submit(request);
+}
+
+// 一块写入结束，释放内存中的这一段。写入失败时文本留在 spilling 中，不再尝试溢出
+void UndoManager::finishSpill(UndoSpillRequest* request)
+{
+    spillRequest = 0;
+    if (request->wasCancelled() || !request->errorString().isEmpty())
+    {
+        spillFailed = true;
+        return;
+    }
+    Chunk chunk;
+    chunk.start = arenaBase - spilling.size();
+    chunk.end = arenaBase;
+    chunk.fileOffset = request->fileOffset();
+    chunk.fileSize = request->fileSize();
+    chunks.append(chunk);
+    addMemory(-spilling.size());
+    spilling.clear();
+    trim();
+}
+
+// 放弃正在写入的一块，不在界面线程中等待后台优先级的请求：还在队列中的请求直接移除，
+// 正在写入的请求结束后由它自己删除文件。之前写入的块在这里删除
+void UndoManager::abandonSpill()
+{
+    if (UndoSpillRequest* request = spillRequest)
+    {
+        spillRequest = 0;
+        request->cancel();
+    }
+    QFile::remove(spillPath);
+}
+
+// 溢出请求结束
+void UndoManager::spillRequestFinished()
+{
+    UndoSpillRequest* request = qobject_cast<UndoSpillRequest*>(sender());
+    if (request && request == spillRequest)
+        finishSpill(request);
+}
+
+qint64 UndoManager::memoryUsage() const
+{
+    return qint64(nodes.capacity()) * sizeof(Node) + arena.capacity() + spilling.capacity() + cache.capacity() +
+           qint64(chunks.capacity()) * sizeof(Chunk);
+}
+
+// 只保留根节点，用于加载文件之后。之后的溢出写入新的文件，不会与被放弃的写入冲突
+void UndoManager::clear()
+{
+    abandonSpill();
+    spillPath = QDir::temp().filePath(QString("myMdi-undo-%1-%2-%3.tmp")
+                                          .arg(QCoreApplication::applicationPid())
+                                          .arg(quintptr(this), 0, 16)
+                                          .arg(spillGeneration++));
+    Node root;
+    root.parent = -1;
+    root.redoChild = -1;
+    root.depth = 0;
+    root.position = 0;
+    root.payload = 0;
+    root.removedBytes = 0;
+    root.addedBytes = 0;
+    nodes.clear();
+    nodes.append(root);
+    current = 0;
+    addMemory(-arena.size() - spilling.size());
+    arena.clear();
+    spilling.clear();
+    arenaBase = 0;
+    chunks.clear();
+    cachedChunk = -1;
+    cache.clear();
+    spillFailed = false;
+}
@@ -0,0 +1,107 @@
+#ifndef UNDOMANAGER_H
+#define UNDOMANAGER_H
+
+#include <QObject>
+#include <QPointer>
+#include <QVector>
+
+#include "documentio.h"
+
+// 一步编辑：在 position 处把 removed 替换成 added。撤销时返回的是反向的编辑
+struct UndoStep
+{
+    int position;     // 编辑的位置
+    QString removed;  // 被替换的文本
+    QString added;    // 替换成的文本
+};
+
+// 把撤销文本存储区开头的一段压缩后追加到溢出文件的末尾
+class UndoSpillRequest : public IoRequest
+{
+    Q_OBJECT
+private:
+    QString path;      // 溢出文件
+    QByteArray data;   // 要写入的文本
+    int length;        // 压缩前的字节数
+    qint64 offset;     // 压缩后的数据在文件中的起点
+    int written;       // 压缩后的字节数
+
+protected:
+    void run();
+
+public:
+    UndoSpillRequest(const QString& fileName, const QByteArray& bytes);
+    ~UndoSpillRequest();
+    int size() const { return length; }              // 压缩前的字节数
+    qint64 fileOffset() const { return offset; }     // 压缩后的数据在文件中的起点
+    int fileSize() const { return written; }         // 压缩后的字节数
+};
+
+// 撤销树：每次编辑是当前节点的一个子节点，撤销之后再编辑产生新的分支，原来的分支不会丢失。
+// 节点只记录位置和文本在存储区中的范围，每个节点 32 字节；文本按 UTF-8 连续追加到存储区，
+// 每个文档和所有文档合计都有内存上限，超出时把存储区开头的一段压缩后写入临时的溢出文件，
+// 回到那些状态时再从文件读回。回到任意一个历史状态只需要沿着树走到共同的祖先再走下去，是 O(深度)
+class UndoManager : public QObject
+{
+    Q_OBJECT
+private:
+    // 树的节点，节点 0 是根节点，表示加载或者清空时的状态
+    struct Node
+    {
+        qint32 parent;        // 父节点，根节点为 -1
+        qint32 redoChild;     // 恢复时进入的子节点，没有时为 -1
+        qint32 depth;         // 深度，根节点为 0
+        qint32 position;      // 编辑的位置
+        qint64 payload;       // 被替换的文本和替换成的文本在存储区中的起点
+        qint32 removedBytes;  // 被替换的文本的字节数
+        qint32 addedBytes;    // 替换成的文本的字节数
+    };
+    // 溢出文件中的一块
+    struct Chunk
+    {
+        qint64 start;       // 在存储区中的起点
+        qint64 end;         // 在存储区中的终点
+        qint64 fileOffset;  // 压缩后的数据在文件中的起点
+        int fileSize;       // 压缩后的字节数
+    };
+
+    QVector<Node> nodes;           // 所有节点，按创建的先后排列
+    int current;                   // 当前状态所在的节点
+    QByteArray arena;              // 内存中的文本存储区
+    qint64 arenaBase;              // arena 的第一个字节在整个存储区中的位置，之前的在 spilling 或溢出文件中
+    QByteArray spilling;           // 交给溢出请求的一段，紧接在 arena 之前，写入结束前从这里读取，写入失败时一直留在内存中
+    static qint64 totalMemory;     // 所有文档的存储区占用的内存
+    QString spillPath;             // 溢出文件
+    int spillGeneration;           // 清空的次数，每次清空换一个溢出文件
+    QVector<Chunk> chunks;         // 溢出文件中的块，按在存储区中的位置排列
+    QPointer<UndoSpillRequest> spillRequest;  // 正在写入的一块
+    bool spillFailed;              // 写入溢出文件失败过，不再尝试
+    int cachedChunk;               // 最近读回的块，没有时为 -1
+    QByteArray cache;              // 最近读回的块解压后的内容
+
+    void addMemory(qint64 size);                          // 记录存储区大小的变化
+    bool readPayload(qint64 start, int size, QByteArray* out);  // 取出存储区中的一段文本
+    bool nodeStep(int node, bool forward, UndoStep* step);  // 节点的编辑，forward 为 false 时取反向的编辑
+    void trim();                                          // 超出内存上限时把存储区开头的一段写入溢出文件
+    void finishSpill(UndoSpillRequest* request);          // 一块写入结束
+    void abandonSpill();                                  // 放弃正在写入的一块，删除溢出文件
+
+public:
+    explicit UndoManager(QObject* parent = 0);
+    ~UndoManager();
+    void push(const UndoStep& step);           // 在当前节点下添加一个子节点，并成为当前节点
+    bool canUndo() const { return current > 0; }                             // 是否可以撤销
+    bool canRedo() const { return nodes.at(current).redoChild >= 0; }        // 是否可以恢复
+    QVector<UndoStep> undo();                  // 回到父节点，返回需要依次应用的编辑
+    QVector<UndoStep> redo();                  // 进入上次离开的子节点
+    QVector<UndoStep> travel(int node);        // 回到任意一个节点，读取溢出文件失败时返回空
+    int count() const { return nodes.size(); }   // 节点数，也就是历史状态数
+    int currentNode() const { return current; }  // 当前节点
+    void clear();                              // 只保留根节点，清空所有撤销记录
+    qint64 memoryUsage() const;                // 节点、存储区和读回缓存占用的内存，不包括溢出文件
+
+private slots:
+    void spillRequestFinished();  // 溢出请求结束
+};
+
+#endif  // UNDOMANAGER_H
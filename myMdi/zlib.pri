@@ -0,0 +1,10 @@
+# gzip 压缩的文件使用 zlib 边读边解压。
+# Windows 上的 Qt 套件（例如 Qt 5.9 MinGW）不带 libz，使用 QtCore 自带并导出的 zlib；
+# 其他平台的 Qt 通常链接系统的 zlib，这里也使用系统的 zlib，需要安装它的开发包（例如 zlib1g-dev）
+
+win32 {
+    QT += core-private
+    DEFINES += MYMDI_QT_ZLIB
+} else {
+    LIBS += -lz
+}